@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include "capture.h"
+
+/* pcapng block types and option codes. */
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_SNAPLEN 65535
+
+/*
+ * Blocks are the type and size, the fixed fields, options ending with an
+ * empty one, and the size again.
+ */
+#define BLOCK_SIZE( fixed, options ) ( 8 + ( fixed ) + ( options ) + 4 + 4 )
+
+#define CAPTURE_RING_MASK ( CAPTURE_RING_SIZE - 1 )
+/* How long the writer sleeps when every ring is empty. */
+#define CAPTURE_IDLE_NSEC 1000000
+#define CAPTURE_BUFFER_SIZE ( 1 << 20 )
+#define CAPTURE_COMMENT_SIZE 128
+
+/*
+ * A frame in a ring, followed by its bytes, padded to 8. A size of 0 marks
+ * the rest of the ring as unused: the next record starts back at 0.
+ */
+struct capture_record {
+    unsigned int size;
+    unsigned short len;
+    unsigned char direction;
+    unsigned char test_type;
+    unsigned char reply_type;
+    unsigned char result;
+    unsigned long id;
+    struct timeval ts;
+};
+
+#define RECORD_SIZE( len ) ( ( sizeof( struct capture_record ) + ( len ) + 7 ) & ~7UL )
+
+int capture_frame( struct capture_ring *ring, int direction, const struct timeval *ts, const void *data, unsigned int len, const struct capture_note *note )
+{
+    struct capture_record *record;
+    unsigned long head = ring->head;
+    unsigned long need = RECORD_SIZE( len );
+    unsigned long pos = head & CAPTURE_RING_MASK;
+    unsigned long to_end = CAPTURE_RING_SIZE - pos;
+    unsigned long total = need + ( to_end < need ? to_end : 0 );
+
+    if ( CAPTURE_RING_SIZE - ( head - ring->tail_seen ) < total ) {
+        ring->tail_seen = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+        if ( CAPTURE_RING_SIZE - ( head - ring->tail_seen ) < total ) return -1;
+    }
+    if ( to_end < need ) {
+        ( (struct capture_record *) ( ring->buf + pos ) )->size = 0;
+        head += to_end;
+        pos = 0;
+    }
+    record = (struct capture_record *) ( ring->buf + pos );
+    record->size = need;
+    record->len = len;
+    record->direction = direction;
+    record->test_type = note ? note->test_type : TEST_INVALID;
+    record->reply_type = note ? note->reply_type : REPLY_TYPE_NONE;
+    record->result = note ? note->result : 0;
+    record->id = note ? note->id : 0;
+    record->ts = *ts;
+    memcpy( record + 1, data, len );
+    __atomic_store_n( &ring->head, head + need, __ATOMIC_RELEASE );
+    return 0;
+}
+
+/* Writer side. */
+
+/* Write len bytes, padded to 4 as everything in pcapng is. */
+static void write_bytes( struct synfrag_capture *capture, const void *data, size_t len )
+{
+    static const char zero[4];
+    size_t pad = ( 4 - ( len & 3 ) ) & 3;
+
+    if ( ( fwrite( data, 1, len, capture->out ) != len || fwrite( zero, 1, pad, capture->out ) != pad ) && !capture->error )
+        capture->error = errno ? errno : EIO;
+}
+
+/* The length an option takes in a block, padding included. */
+static unsigned int option_size( unsigned int len )
+{
+    return 4 + ( ( len + 3 ) & ~3U );
+}
+
+static void write_option( struct synfrag_capture *capture, uint16_t code, const void *data, uint16_t len )
+{
+    uint16_t header[2] = { code, len };
+
+    write_bytes( capture, header, sizeof( header ) );
+    if ( len ) write_bytes( capture, data, len );
+}
+
+static void write_block_header( struct synfrag_capture *capture, uint32_t type, uint32_t size )
+{
+    uint32_t header[2] = { type, size };
+
+    write_bytes( capture, header, sizeof( header ) );
+}
+
+static void write_section_header( struct synfrag_capture *capture )
+{
+    static const char application[] = "synfrag";
+    uint32_t size = BLOCK_SIZE( 16, option_size( strlen( application ) ) );
+    uint32_t magic = PCAPNG_BYTE_ORDER_MAGIC;
+    uint16_t version[2] = { 1, 0 };
+    int64_t section_length = -1;
+
+    write_block_header( capture, PCAPNG_SECTION_HEADER, size );
+    write_bytes( capture, &magic, sizeof( magic ) );
+    write_bytes( capture, version, sizeof( version ) );
+    write_bytes( capture, &section_length, sizeof( section_length ) );
+    write_option( capture, PCAPNG_OPT_SHB_USERAPPL, application, strlen( application ) );
+    write_option( capture, PCAPNG_OPT_END, NULL, 0 );
+    write_bytes( capture, &size, sizeof( size ) );
+}
+
+static void write_interface( struct synfrag_capture *capture, const char *name )
+{
+    uint32_t size = BLOCK_SIZE( 8, option_size( strlen( name ) ) );
+    uint16_t linktype[2] = { PCAPNG_LINKTYPE_ETHERNET, 0 };
+    uint32_t snaplen = PCAPNG_SNAPLEN;
+
+    write_block_header( capture, PCAPNG_INTERFACE_DESCRIPTION, size );
+    write_bytes( capture, linktype, sizeof( linktype ) );
+    write_bytes( capture, &snaplen, sizeof( snaplen ) );
+    write_option( capture, PCAPNG_OPT_IF_NAME, name, strlen( name ) );
+    write_option( capture, PCAPNG_OPT_END, NULL, 0 );
+    write_bytes( capture, &size, sizeof( size ) );
+}
+
+/* "probe 17 v4-frag-tcp", and on a reply what it said and made of the probe. */
+static int format_comment( const struct capture_record *record, char *comment )
+{
+    int len;
+
+    if ( !record->id ) return 0;
+    len = snprintf( comment, CAPTURE_COMMENT_SIZE, "probe %lu %s", record->id, synfrag_test_name( record->test_type ) );
+    if ( record->direction == CAPTURE_INBOUND ) {
+        len += snprintf( comment + len, CAPTURE_COMMENT_SIZE - len, " reply %s, %s",
+            synfrag_reply_type_name( record->reply_type ), synfrag_result_name( record->result ) );
+    }
+    return len < CAPTURE_COMMENT_SIZE ? len : CAPTURE_COMMENT_SIZE - 1;
+}
+
+static void write_packet( struct synfrag_capture *capture, uint32_t interface, const struct capture_record *record )
+{
+    char comment[CAPTURE_COMMENT_SIZE];
+    int comment_len = format_comment( record, comment );
+    uint64_t usec = (uint64_t) record->ts.tv_sec * 1000000 + record->ts.tv_usec;
+    uint32_t fields[5] = { interface, usec >> 32, usec & 0xffffffff, record->len, record->len };
+    uint32_t flags = record->direction;
+    uint32_t size = BLOCK_SIZE( 20 + ( ( record->len + 3 ) & ~3U ), option_size( sizeof( flags ) ) + ( comment_len ? option_size( comment_len ) : 0 ) );
+
+    write_block_header( capture, PCAPNG_ENHANCED_PACKET, size );
+    write_bytes( capture, fields, sizeof( fields ) );
+    write_bytes( capture, record + 1, record->len );
+    if ( comment_len ) write_option( capture, PCAPNG_OPT_COMMENT, comment, comment_len );
+    write_option( capture, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof( flags ) );
+    write_option( capture, PCAPNG_OPT_END, NULL, 0 );
+    write_bytes( capture, &size, sizeof( size ) );
+}
+
+/* Write out everything in the ring now; returns how many frames that was. */
+static unsigned long drain( struct synfrag_capture *capture, uint32_t interface, struct capture_ring *ring )
+{
+    const struct capture_record *record;
+    unsigned long tail = ring->tail;
+    unsigned long head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+    unsigned long pos, count = 0;
+
+    while ( tail != head ) {
+        pos = tail & CAPTURE_RING_MASK;
+        record = (const struct capture_record *) ( ring->buf + pos );
+        if ( !record->size ) {
+            tail += CAPTURE_RING_SIZE - pos;
+            continue;
+        }
+        write_packet( capture, interface, record );
+        tail += record->size;
+        count++;
+    }
+    __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+    return count;
+}
+
+static void *run_writer( void *arg )
+{
+    struct synfrag_capture *capture = arg;
+    struct timespec idle = { 0, CAPTURE_IDLE_NSEC };
+    unsigned long written;
+    unsigned int count, x;
+    int stop;
+
+    while ( 1 ) {
+        /* Whatever was queued before stop was set is in this last pass. */
+        stop = __atomic_load_n( &capture->stop, __ATOMIC_ACQUIRE );
+        count = __atomic_load_n( &capture->ring_count, __ATOMIC_ACQUIRE );
+        for ( ; capture->described < count; capture->described++ )
+            write_interface( capture, capture->rings[capture->described]->name );
+        written = 0;
+        for ( x = 0; x < count; x++ ) written += drain( capture, x, capture->rings[x] );
+        if ( written ) continue;
+        if ( stop ) break;
+        if ( fflush( capture->out ) != 0 && !capture->error ) capture->error = errno;
+        nanosleep( &idle, NULL );
+    }
+    return NULL;
+}
+
+int capture_open( struct synfrag_capture **capturep, const char *path )
+{
+    struct synfrag_capture *capture;
+    int r;
+
+    if ( ( capture = calloc( 1, sizeof( struct synfrag_capture ) ) ) == NULL ) return -1;
+    if ( ( capture->out = fopen( path, "wb" ) ) == NULL ) {
+        free( capture );
+        return -1;
+    }
+    setvbuf( capture->out, NULL, _IOFBF, CAPTURE_BUFFER_SIZE );
+    write_section_header( capture );
+    pthread_mutex_init( &capture->lock, NULL );
+    if ( ( r = pthread_create( &capture->writer, NULL, run_writer, capture ) ) != 0 ) {
+        fclose( capture->out );
+        pthread_mutex_destroy( &capture->lock );
+        free( capture );
+        errno = r;
+        return -1;
+    }
+    *capturep = capture;
+    return 0;
+}
+
+struct capture_ring *capture_add_ring( struct synfrag_capture *capture, const char *name )
+{
+    struct capture_ring *ring;
+
+    if ( posix_memalign( (void **) &ring, 64, sizeof( struct capture_ring ) ) != 0 ) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset( ring, 0, sizeof( struct capture_ring ) );
+    if ( ( ring->buf = malloc( CAPTURE_RING_SIZE ) ) == NULL ) {
+        free( ring );
+        return NULL;
+    }
+    snprintf( ring->name, CAPTURE_NAME_SIZE, "%s", name );
+
+    pthread_mutex_lock( &capture->lock );
+    if ( capture->ring_count == CAPTURE_RINGS_MAX ) {
+        pthread_mutex_unlock( &capture->lock );
+        free( ring->buf );
+        free( ring );
+        errno = ENOSPC;
+        return NULL;
+    }
+    capture->rings[capture->ring_count] = ring;
+    __atomic_store_n( &capture->ring_count, capture->ring_count + 1, __ATOMIC_RELEASE );
+    pthread_mutex_unlock( &capture->lock );
+    return ring;
+}
+
+int capture_close( struct synfrag_capture *capture )
+{
+    unsigned int x;
+    int error;
+
+    __atomic_store_n( &capture->stop, 1, __ATOMIC_RELEASE );
+    pthread_join( capture->writer, NULL );
+    if ( fclose( capture->out ) != 0 && !capture->error ) capture->error = errno;
+    error = capture->error;
+    for ( x = 0; x < capture->ring_count; x++ ) {
+        free( capture->rings[x]->buf );
+        free( capture->rings[x] );
+    }
+    pthread_mutex_destroy( &capture->lock );
+    free( capture );
+    if ( error ) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
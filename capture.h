@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include "synfrag.h"
+
+/*
+ * A pcapng record of every frame sent and received, written on a thread of
+ * its own so the engine never waits on the disk. Each context feeding it
+ * gets a ring, with an interface of its own in the file; the engine copies
+ * frames in and moves on, and a frame that doesn't fit is dropped and
+ * counted rather than waited for. Sent frames and the replies matched to a
+ * probe carry a comment naming the probe, its test and, on replies, what it
+ * made of them.
+ */
+
+/* Frames in flight to the writer per context, in bytes, a power of two. */
+#define CAPTURE_RING_SIZE ( 8 << 20 )
+/* Contexts one capture can take. */
+#define CAPTURE_RINGS_MAX 64
+#define CAPTURE_NAME_SIZE 32
+
+/* As pcapng's epb_flags has it. */
+#define CAPTURE_INBOUND 1
+#define CAPTURE_OUTBOUND 2
+
+/* What a frame was to the engine, for its comment. id is 0 for a frame no probe claimed. */
+struct capture_note {
+    unsigned long id;
+    enum TEST_TYPE test_type;
+    /* Replies only; REPLY_TYPE_NONE on frames sent. */
+    enum REPLY_TYPE reply_type;
+    enum TEST_RESULT result;
+};
+
+/*
+ * One producer, the writer the only consumer: head moves on as frames go in
+ * and tail as they are written, each only by its own side.
+ */
+struct capture_ring {
+    char *buf;
+    unsigned long head __attribute__(( aligned( 64 ) ));
+    /* The producer's last look at tail. */
+    unsigned long tail_seen;
+    unsigned long tail __attribute__(( aligned( 64 ) ));
+    char name[CAPTURE_NAME_SIZE];
+};
+
+struct synfrag_capture {
+    FILE *out;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    struct capture_ring *rings[CAPTURE_RINGS_MAX];
+    unsigned int ring_count;
+    /* Rings the writer has written an interface description for. */
+    unsigned int described;
+    int stop;
+    /* errno of the first failed write, 0 if none. */
+    int error;
+};
+
+/* All return 0 (or the ring), or -1 (NULL) with errno set. */
+int capture_open( struct synfrag_capture **, const char *path );
+/* A ring for one more producer, shown in the file as an interface called name. */
+struct capture_ring *capture_add_ring( struct synfrag_capture *, const char *name );
+/* Writes whatever is still queued first; only once every producer is done. */
+int capture_close( struct synfrag_capture * );
+
+/* Queue a frame; -1 if the ring is full and it was dropped. */
+int capture_frame( struct capture_ring *, int direction, const struct timeval *ts, const void *data, unsigned int len, const struct capture_note *note );
+
+#endif
@@ -214,3 +214,41 @@ int do_checksum(char *buf, int protocol, int len)
     return (1);
 }
 
+
+/*
+ * For checksum offload: put the TCP pseudo header sum, folded but not
+ * complemented, in th_sum, for the NIC or kernel to sum the segment on top
+ * of. Only for plain IPv4 or IPv6 headers, i.e. unfragmented packets.
+ */
+int do_pseudo_checksum(char *buf, int protocol, int len)
+{
+    struct tcphdr *tcph_p;
+    int sum;
+    int ip_version = buf[0] >> 4;
+
+    if (protocol != IPPROTO_TCP) return (-1);
+    if (ip_version == 6)
+    {
+        struct ip6_hdr *ip6h_p = (struct ip6_hdr *)buf;
+
+        if (ip6h_p->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_TCP) return (0);
+        tcph_p = (struct tcphdr *)(buf + sizeof( struct ip6_hdr ));
+        sum = in_cksum((unsigned short *)&ip6h_p->ip6_src, 32);
+    }
+    else if (ip_version == 4)
+    {
+        struct ip *iph_p = (struct ip *)buf;
+
+        tcph_p = (struct tcphdr *)(buf + (iph_p->ip_hl << 2));
+        sum = in_cksum((unsigned short *)&iph_p->ip_src, 8);
+    }
+    else
+    {
+        return (0);
+    }
+    sum += ntohs(IPPROTO_TCP + len);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    tcph_p->th_sum = sum & 0xffff;
+    return (1);
+}
@@ -37,3 +37,4 @@
 
 int in_cksum(unsigned short *addr, int len);
 int do_checksum(char *buf, int protocol, int len);
+int do_pseudo_checksum(char *buf, int protocol, int len);
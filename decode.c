@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "synfrag.h"
+#include "decode.h"
+
+#define ETHER_HEADER_LEN 14
+#define VLAN_TAG_LEN 4
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+#define IPV4_HEADER_LEN 20
+#define IPV6_HEADER_LEN 40
+#define TCP_HEADER_LEN 20
+/* ICMP and ICMPv6 headers, and the least of layer 4 worth decoding. */
+#define ICMP_HEADER_LEN 8
+#define L4_MIN_LEN 8
+
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_ACK 0x10
+
+/* Fields are read a byte at a time: no alignment or byte order to get wrong. */
+static inline unsigned short get16( const unsigned char *p )
+{
+    return p[0] << 8 | p[1];
+}
+
+static inline unsigned int get32( const unsigned char *p )
+{
+    return (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void decode_l4( const unsigned char *l4, unsigned int len, struct decoded_packet *p )
+{
+    if ( len < L4_MIN_LEN ) return;
+    p->l4 = (const char *) l4;
+    p->l4_len = len;
+
+    if ( p->protocol == IPPROTO_TCP ) {
+        p->sport = get16( l4 );
+        p->dport = get16( l4 + 2 );
+        p->seq = get32( l4 + 4 );
+        if ( len >= 14 ) {
+            p->ack = get32( l4 + 8 );
+            p->flags = l4[13];
+        }
+    } else if ( p->protocol == IPPROTO_ICMP || p->protocol == IPPROTO_ICMPV6 ) {
+        p->type = l4[0];
+        p->code = l4[1];
+        p->echo_id = get16( l4 + 4 );
+        p->echo_seq = get16( l4 + 6 );
+    }
+}
+
+/* Length of the IPv6 extension header at h, or 0 if protocol isn't one. */
+static unsigned int ipv6_ext_len( const unsigned char *h, int protocol )
+{
+    if ( protocol == IPPROTO_HOPOPTS || protocol == IPPROTO_ROUTING || protocol == IPPROTO_DSTOPTS ) return ( h[1] + 1 ) * 8;
+    if ( protocol == IPPROTO_AH ) return ( h[1] + 2 ) * 4;
+    if ( protocol == IPPROTO_FRAGMENT ) return 8;
+    return 0;
+}
+
+/*
+ * Decode the IP packet at ip. Returns -1 if it isn't one, otherwise 0 with
+ * as much filled in as the packet allows.
+ */
+static int decode_ip( const unsigned char *ip, unsigned int len, struct decoded_packet *p )
+{
+    unsigned int hl, total, ext_len;
+    int later_fragment;
+
+    memset( p, 0, sizeof( struct decoded_packet ) );
+    if ( len < 1 ) return -1;
+    p->l3 = (const char *) ip;
+
+    if ( ip[0] >> 4 == 4 ) {
+        if ( len < IPV4_HEADER_LEN ) return -1;
+        hl = ( ip[0] & 0x0f ) * 4;
+        total = get16( ip + 2 );
+        if ( hl < IPV4_HEADER_LEN || total < hl ) return -1;
+        if ( total < len ) len = total;
+        if ( hl > len ) return -1;
+        p->family = AF_INET;
+        memcpy( &p->src, ip + 12, 4 );
+        memcpy( &p->dst, ip + 16, 4 );
+        p->protocol = ip[9];
+        later_fragment = ( get16( ip + 6 ) & 0x1fff ) != 0;
+    } else if ( ip[0] >> 4 == 6 ) {
+        if ( len < IPV6_HEADER_LEN ) return -1;
+        total = IPV6_HEADER_LEN + get16( ip + 4 );
+        if ( total < len ) len = total;
+        p->family = AF_INET6;
+        memcpy( &p->src, ip + 8, 16 );
+        memcpy( &p->dst, ip + 24, 16 );
+        p->protocol = ip[6];
+        later_fragment = 0;
+        /* Every extension header is at least 8 bytes, so this always ends. */
+        for ( hl = IPV6_HEADER_LEN; hl + 8 <= len; hl += ext_len ) {
+            if ( !( ext_len = ipv6_ext_len( ip + hl, p->protocol ) ) ) break;
+            if ( p->protocol == IPPROTO_FRAGMENT ) later_fragment |= ( get16( ip + hl + 2 ) & 0xfff8 ) != 0;
+            p->protocol = ip[hl];
+        }
+        /* Cut off inside the chain: no layer 4 to read. */
+        if ( hl > len ) return 0;
+    } else {
+        return -1;
+    }
+
+    if ( !later_fragment ) decode_l4( ip + hl, len - hl, p );
+    return 0;
+}
+
+static int is_icmp_error( const struct decoded_packet *p )
+{
+    if ( p->protocol == IPPROTO_ICMP ) {
+        return p->type == 3 || p->type == 4 || p->type == 5 || p->type == 11 || p->type == 12;
+    }
+    /* ICMPv6 errors are the types below 128. */
+    return p->protocol == IPPROTO_ICMPV6 && p->type < 128;
+}
+
+/* What the reply tells us about the probe it answers. */
+static enum REPLY_TYPE classify( const struct decoded_packet *p )
+{
+    if ( p->protocol == IPPROTO_TCP ) {
+        if ( p->l4_len < TCP_HEADER_LEN ) return REPLY_TYPE_NONE;
+        if ( p->flags & TCP_RST ) return REPLY_TYPE_CLOSED;
+        if ( ( p->flags & ( TCP_SYN | TCP_ACK ) ) == ( TCP_SYN | TCP_ACK ) ) return REPLY_TYPE_OPEN;
+        return REPLY_TYPE_OTHER;
+    }
+    if ( p->protocol == IPPROTO_ICMP ) {
+        switch ( p->type ) {
+            case 0:
+                return REPLY_TYPE_OPEN;
+            case 3:
+                /* Protocol or port unreachable come from the target itself. */
+                if ( p->code == 2 || p->code == 3 ) return REPLY_TYPE_CLOSED;
+                /* Fragmentation needed is about our size, not a refusal. */
+                if ( p->code == 4 ) return REPLY_TYPE_OTHER;
+                return REPLY_TYPE_FILTERED;
+            case 11:
+                return p->code == 1 ? REPLY_TYPE_REASSEMBLY_TIMEOUT : REPLY_TYPE_TIME_EXCEEDED;
+            case 4:
+            case 5:
+            case 12:
+                return REPLY_TYPE_OTHER;
+        }
+        return REPLY_TYPE_NONE;
+    }
+    if ( p->protocol == IPPROTO_ICMPV6 ) {
+        switch ( p->type ) {
+            case 129:
+                return REPLY_TYPE_OPEN;
+            case 1:
+                return p->code == 4 ? REPLY_TYPE_CLOSED : REPLY_TYPE_FILTERED;
+            case 3:
+                return p->code == 1 ? REPLY_TYPE_REASSEMBLY_TIMEOUT : REPLY_TYPE_TIME_EXCEEDED;
+            case 4:
+                /* Unrecognized next header, IPv6's protocol unreachable. */
+                return p->code == 1 ? REPLY_TYPE_CLOSED : REPLY_TYPE_OTHER;
+            case 2:
+                return REPLY_TYPE_OTHER;
+        }
+    }
+    return REPLY_TYPE_NONE;
+}
+
+/*
+ * The address family an Ethernet frame (with at most one VLAN tag) carries,
+ * and where its IP header starts. Returns -1 if it isn't IP.
+ */
+static int frame_family( const unsigned char *f, unsigned int len, unsigned int *off )
+{
+    unsigned short ethertype;
+
+    *off = ETHER_HEADER_LEN;
+    if ( len < ETHER_HEADER_LEN ) return -1;
+    ethertype = get16( f + 12 );
+    if ( ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ ) {
+        if ( len < ETHER_HEADER_LEN + VLAN_TAG_LEN ) return -1;
+        ethertype = get16( f + 16 );
+        *off += VLAN_TAG_LEN;
+    }
+    if ( ethertype == ETHERTYPE_IPV4 ) return AF_INET;
+    if ( ethertype == ETHERTYPE_IPV6 ) return AF_INET6;
+    return -1;
+}
+
+int decode_reply( const char *frame, unsigned int len, struct decoded_reply *reply )
+{
+    const unsigned char *f = (const unsigned char *) frame;
+    struct decoded_packet *p = &reply->packet;
+    unsigned int off;
+    int family;
+
+    reply->type = REPLY_TYPE_NONE;
+    reply->quote.family = 0;
+    if ( ( family = frame_family( f, len, &off ) ) == -1 ) return -1;
+    if ( decode_ip( f + off, len - off, p ) == -1 ) return -1;
+    if ( p->family != family || !p->l4 ) return -1;
+    if ( ( reply->type = classify( p ) ) == REPLY_TYPE_NONE ) return -1;
+
+    if ( is_icmp_error( p ) && p->l4_len > ICMP_HEADER_LEN ) {
+        if ( decode_ip( (const unsigned char *) p->l4 + ICMP_HEADER_LEN, p->l4_len - ICMP_HEADER_LEN, &reply->quote ) == -1 )
+            reply->quote.family = 0;
+    }
+    return 0;
+}
+
+int decode_fragment( const char *frame, unsigned int len, struct decoded_fragment *frag )
+{
+    const unsigned char *f = (const unsigned char *) frame, *ip;
+    unsigned int off, hl, total, ext_len, offlg;
+    int protocol;
+
+    memset( frag, 0, sizeof( struct decoded_fragment ) );
+    if ( ( frag->family = frame_family( f, len, &off ) ) == -1 ) return 0;
+    ip = f + off;
+    len -= off;
+    frag->ip_offset = off;
+
+    if ( frag->family == AF_INET ) {
+        if ( len < IPV4_HEADER_LEN || ip[0] >> 4 != 4 ) return 0;
+        hl = ( ip[0] & 0x0f ) * 4;
+        total = get16( ip + 2 );
+        /* A fragment cut short by the capture can't be put back together. */
+        if ( hl < IPV4_HEADER_LEN || total < hl || total > len ) return 0;
+        offlg = get16( ip + 6 );
+        if ( !( offlg & 0x3fff ) ) return 0;
+        memcpy( &frag->src, ip + 12, 4 );
+        memcpy( &frag->dst, ip + 16, 4 );
+        frag->id = get16( ip + 4 );
+        frag->protocol = ip[9];
+        frag->offset = ( offlg & 0x1fff ) * 8;
+        frag->more = ( offlg & 0x2000 ) != 0;
+    } else {
+        if ( len < IPV6_HEADER_LEN || ip[0] >> 4 != 6 ) return 0;
+        total = IPV6_HEADER_LEN + get16( ip + 4 );
+        if ( total > len ) return 0;
+        /* The fragment header ends the part every fragment repeats. */
+        protocol = ip[6];
+        for ( hl = IPV6_HEADER_LEN; protocol != IPPROTO_FRAGMENT; hl += ext_len ) {
+            if ( hl + 8 > total || !( ext_len = ipv6_ext_len( ip + hl, protocol ) ) ) return 0;
+            protocol = ip[hl];
+        }
+        if ( hl + 8 > total ) return 0;
+        offlg = get16( ip + hl + 2 );
+        /* An atomic fragment is a whole packet already. */
+        if ( !( offlg & 0xfff9 ) ) return 0;
+        memcpy( &frag->src, ip + 8, 16 );
+        memcpy( &frag->dst, ip + 24, 16 );
+        frag->id = get32( ip + hl + 4 );
+        frag->protocol = ip[hl];
+        frag->offset = offlg & 0xfff8;
+        frag->more = offlg & 1;
+        hl += 8;
+    }
+    frag->data_offset = off + hl;
+    frag->data_len = total - hl;
+    return 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <netinet/in.h>
+#include "synfrag.h"
+
+/*
+ * Taking received frames apart. Everything is read through bounds checks
+ * against the captured length, so a short, truncated or hostile frame just
+ * decodes to less; nothing is allocated and nothing exits. IPv4 headers are
+ * cut to their total length (Ethernet pads short frames), IPv6 extension
+ * headers are walked to the layer 4 header, and the packet quoted in an ICMP
+ * error is decoded the same way, so the error can be matched to the exact
+ * probe it is about.
+ */
+
+/* One IP packet and what could be read of its layer 4 header. */
+struct decoded_packet {
+    /* 0 if this isn't an IPv4 or IPv6 packet. */
+    int family;
+    /* IPv4 addresses use the first 4 bytes. */
+    struct in6_addr src;
+    struct in6_addr dst;
+    /* After any IPv6 extension headers. */
+    int protocol;
+    const char *l3;
+    /*
+     * NULL when there is no layer 4 header to read: a later fragment, or cut
+     * off before its first 8 bytes. l4_len is how much of it was captured.
+     */
+    const char *l4;
+    unsigned int l4_len;
+    /* In host byte order. TCP ack and flags need 14 bytes, 0 without them. */
+    unsigned short sport;
+    unsigned short dport;
+    unsigned int seq;
+    unsigned int ack;
+    unsigned char flags;
+    /* ICMP or ICMPv6; id and seq only mean something for echo messages. */
+    unsigned char type;
+    unsigned char code;
+    unsigned short echo_id;
+    unsigned short echo_seq;
+};
+
+struct decoded_reply {
+    struct decoded_packet packet;
+    /* For ICMP errors, the start of the packet it is about; family 0 if none. */
+    struct decoded_packet quote;
+    enum REPLY_TYPE type;
+};
+
+/*
+ * Decode an Ethernet frame (with at most one VLAN tag). Returns 0, or -1 if
+ * it can't be a reply to a probe: not IP, truncated, a later fragment, or
+ * not TCP, an echo reply or an ICMP error.
+ */
+int decode_reply( const char *frame, unsigned int len, struct decoded_reply * );
+
+/* One fragment of an IP packet, as needed to put the packet back together. */
+struct decoded_fragment {
+    int family;
+    struct in6_addr src;
+    struct in6_addr dst;
+    /* With the addresses and protocol, which packet this is a piece of. */
+    unsigned int id;
+    int protocol;
+    /*
+     * Offsets into the frame of the IP header and of the fragment's data.
+     * Everything before the data is the header every fragment repeats; for
+     * IPv6 that ends with the fragment header, the 8 bytes before the data.
+     */
+    unsigned int ip_offset;
+    unsigned int data_offset;
+    unsigned int data_len;
+    /* Where the data goes in the reassembled packet's payload, in bytes. */
+    unsigned int offset;
+    int more;
+};
+
+/*
+ * Returns 1 if frame is a fragment and fills in frag, otherwise 0: not IP,
+ * not fragmented, or cut short by the capture.
+ */
+int decode_fragment( const char *frame, unsigned int len, struct decoded_fragment *frag );
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#ifdef __linux
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#endif
+#include "firewall.h"
+
+/* Room for the whole batch: table, chain and rule. */
+#define FIREWALL_BUFFER_SIZE 2048
+/* Offsets of the source port and the flags in a TCP header. */
+#define FIREWALL_TCP_SPORT 0
+#define FIREWALL_TCP_FLAGS 13
+#define FIREWALL_TCP_RST 0x04
+
+#ifdef __linux
+
+struct firewall_batch {
+    char *buf;
+    unsigned int len;
+    unsigned int seq;
+};
+
+static struct nlmsghdr *add_message( struct firewall_batch *batch, unsigned short type, unsigned short flags, unsigned char family, unsigned short res_id )
+{
+    struct nlmsghdr *nh = (struct nlmsghdr *) ( batch->buf + batch->len );
+    struct nfgenmsg *nfg;
+
+    memset( nh, 0, NLMSG_LENGTH( sizeof( struct nfgenmsg ) ) );
+    nh->nlmsg_len = NLMSG_LENGTH( sizeof( struct nfgenmsg ) );
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nh->nlmsg_seq = ++batch->seq;
+    nfg = NLMSG_DATA( nh );
+    nfg->nfgen_family = family;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons( res_id );
+    return nh;
+}
+
+static void end_message( struct firewall_batch *batch, struct nlmsghdr *nh )
+{
+    batch->len += NLMSG_ALIGN( nh->nlmsg_len );
+}
+
+static struct nlattr *add_attr( struct nlmsghdr *nh, unsigned short type, const void *data, unsigned short len )
+{
+    struct nlattr *nla = (struct nlattr *) ( (char *) nh + NLMSG_ALIGN( nh->nlmsg_len ) );
+
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    if ( len ) memcpy( (char *) nla + NLA_HDRLEN, data, len );
+    memset( (char *) nla + nla->nla_len, 0, NLA_ALIGN( nla->nla_len ) - nla->nla_len );
+    nh->nlmsg_len = NLMSG_ALIGN( nh->nlmsg_len ) + NLA_ALIGN( nla->nla_len );
+    return nla;
+}
+
+static void add_u32( struct nlmsghdr *nh, unsigned short type, unsigned int value )
+{
+    value = htonl( value );
+    add_attr( nh, type, &value, sizeof( value ) );
+}
+
+static void add_string( struct nlmsghdr *nh, unsigned short type, const char *value )
+{
+    add_attr( nh, type, value, strlen( value ) + 1 );
+}
+
+/* Attributes added after a nest starts go inside it until it ends. */
+static struct nlattr *start_nest( struct nlmsghdr *nh, unsigned short type )
+{
+    return add_attr( nh, type | NLA_F_NESTED, NULL, 0 );
+}
+
+static void end_nest( struct nlmsghdr *nh, struct nlattr *nest )
+{
+    nest->nla_len = (char *) nh + nh->nlmsg_len - (char *) nest;
+}
+
+static void add_data( struct nlmsghdr *nh, unsigned short type, const void *data, unsigned short len )
+{
+    struct nlattr *nest = start_nest( nh, type );
+
+    add_attr( nh, NFTA_DATA_VALUE, data, len );
+    end_nest( nh, nest );
+}
+
+/* An expression: its name, then its own attributes up to end_nest() on the returned data nest. */
+static struct nlattr *start_expr( struct nlmsghdr *nh, const char *name, struct nlattr **elem )
+{
+    *elem = start_nest( nh, NFTA_LIST_ELEM );
+    add_string( nh, NFTA_EXPR_NAME, name );
+    return start_nest( nh, NFTA_EXPR_DATA );
+}
+
+static void end_expr( struct nlmsghdr *nh, struct nlattr *data, struct nlattr *elem )
+{
+    end_nest( nh, data );
+    end_nest( nh, elem );
+}
+
+static void add_payload( struct nlmsghdr *nh, unsigned int offset, unsigned int len )
+{
+    struct nlattr *elem, *data = start_expr( nh, "payload", &elem );
+
+    add_u32( nh, NFTA_PAYLOAD_DREG, NFT_REG_1 );
+    add_u32( nh, NFTA_PAYLOAD_BASE, NFT_PAYLOAD_TRANSPORT_HEADER );
+    add_u32( nh, NFTA_PAYLOAD_OFFSET, offset );
+    add_u32( nh, NFTA_PAYLOAD_LEN, len );
+    end_expr( nh, data, elem );
+}
+
+/* Compares register 1, big endian, so the order comparisons work on ports. */
+static void add_cmp( struct nlmsghdr *nh, enum nft_cmp_ops op, const void *value, unsigned short len )
+{
+    struct nlattr *elem, *data = start_expr( nh, "cmp", &elem );
+
+    add_u32( nh, NFTA_CMP_SREG, NFT_REG_1 );
+    add_u32( nh, NFTA_CMP_OP, op );
+    add_data( nh, NFTA_CMP_DATA, value, len );
+    end_expr( nh, data, elem );
+}
+
+/*
+ * The rule, as nft would have it:
+ * meta l4proto tcp tcp sport first_port-last_port tcp flags & rst != 0 drop
+ */
+static void add_rule( struct nlmsghdr *nh, unsigned short first_port, unsigned short last_port )
+{
+    struct nlattr *exprs, *elem, *data, *verdict, *nest;
+    unsigned char proto = IPPROTO_TCP, rst = FIREWALL_TCP_RST, zero = 0;
+
+    first_port = htons( first_port );
+    last_port = htons( last_port );
+    exprs = start_nest( nh, NFTA_RULE_EXPRESSIONS );
+
+    data = start_expr( nh, "meta", &elem );
+    add_u32( nh, NFTA_META_KEY, NFT_META_L4PROTO );
+    add_u32( nh, NFTA_META_DREG, NFT_REG_1 );
+    end_expr( nh, data, elem );
+    add_cmp( nh, NFT_CMP_EQ, &proto, 1 );
+
+    add_payload( nh, FIREWALL_TCP_SPORT, 2 );
+    add_cmp( nh, NFT_CMP_GTE, &first_port, 2 );
+    add_cmp( nh, NFT_CMP_LTE, &last_port, 2 );
+
+    add_payload( nh, FIREWALL_TCP_FLAGS, 1 );
+    data = start_expr( nh, "bitwise", &elem );
+    add_u32( nh, NFTA_BITWISE_SREG, NFT_REG_1 );
+    add_u32( nh, NFTA_BITWISE_DREG, NFT_REG_1 );
+    add_u32( nh, NFTA_BITWISE_LEN, 1 );
+    add_data( nh, NFTA_BITWISE_MASK, &rst, 1 );
+    add_data( nh, NFTA_BITWISE_XOR, &zero, 1 );
+    end_expr( nh, data, elem );
+    add_cmp( nh, NFT_CMP_NEQ, &zero, 1 );
+
+    data = start_expr( nh, "immediate", &elem );
+    add_u32( nh, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT );
+    nest = start_nest( nh, NFTA_IMMEDIATE_DATA );
+    verdict = start_nest( nh, NFTA_DATA_VERDICT );
+    add_u32( nh, NFTA_VERDICT_CODE, NF_DROP );
+    end_nest( nh, verdict );
+    end_nest( nh, nest );
+    end_expr( nh, data, elem );
+
+    end_nest( nh, exprs );
+}
+
+/* Wait for the kernel to acknowledge messages first_seq to last_seq. Returns 0, or -1 with errno set from its error. */
+static int read_acks( int fd, unsigned int first_seq, unsigned int last_seq )
+{
+    union {
+        struct nlmsghdr nh;
+        char bytes[FIREWALL_BUFFER_SIZE];
+    } buf;
+    struct nlmsghdr *nh;
+    struct nlmsgerr *error;
+    unsigned int acked = 0, expected = last_seq - first_seq + 1;
+    ssize_t len;
+
+    while ( acked < expected ) {
+        if ( ( len = recv( fd, &buf, sizeof( buf ), 0 ) ) == -1 ) {
+            if ( errno == EINTR ) continue;
+            return -1;
+        }
+        for ( nh = &buf.nh; NLMSG_OK( nh, len ); nh = NLMSG_NEXT( nh, len ) ) {
+            if ( nh->nlmsg_type != NLMSG_ERROR || nh->nlmsg_seq < first_seq || nh->nlmsg_seq > last_seq ) continue;
+            error = NLMSG_DATA( nh );
+            if ( error->error ) {
+                errno = -error->error;
+                return -1;
+            }
+            acked++;
+        }
+    }
+    return 0;
+}
+
+int firewall_open( struct firewall *fw, unsigned short first_port, unsigned short last_port )
+{
+    union {
+        struct nlmsghdr nh;
+        char bytes[FIREWALL_BUFFER_SIZE];
+    } buf;
+    struct firewall_batch batch;
+    struct sockaddr_nl local, kernel;
+    struct nlmsghdr *nh;
+    struct nlattr *hook;
+    char table[32];
+    unsigned int first_seq;
+    int saved;
+
+    if ( ( fw->fd = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER ) ) == -1 ) return -1;
+    memset( &local, 0, sizeof( struct sockaddr_nl ) );
+    local.nl_family = AF_NETLINK;
+    if ( bind( fw->fd, (struct sockaddr *) &local, sizeof( struct sockaddr_nl ) ) == -1 ) goto fail;
+
+    snprintf( table, sizeof( table ), "synfrag-%ld", (long) getpid() );
+    memset( &buf, 0, sizeof( buf ) );
+    batch.buf = buf.bytes;
+    batch.len = 0;
+    batch.seq = 0;
+
+    nh = add_message( &batch, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES );
+    end_message( &batch, nh );
+    first_seq = batch.seq + 1;
+
+    nh = add_message( &batch, NFNL_SUBSYS_NFTABLES << 8 | NFT_MSG_NEWTABLE, NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK, NFPROTO_INET, 0 );
+    add_string( nh, NFTA_TABLE_NAME, table );
+    add_u32( nh, NFTA_TABLE_FLAGS, NFT_TABLE_F_OWNER );
+    end_message( &batch, nh );
+
+    nh = add_message( &batch, NFNL_SUBSYS_NFTABLES << 8 | NFT_MSG_NEWCHAIN, NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK, NFPROTO_INET, 0 );
+    add_string( nh, NFTA_CHAIN_TABLE, table );
+    add_string( nh, NFTA_CHAIN_NAME, "output" );
+    hook = start_nest( nh, NFTA_CHAIN_HOOK );
+    add_u32( nh, NFTA_HOOK_HOOKNUM, NF_INET_LOCAL_OUT );
+    add_u32( nh, NFTA_HOOK_PRIORITY, 0 );
+    end_nest( nh, hook );
+    add_u32( nh, NFTA_CHAIN_POLICY, NF_ACCEPT );
+    add_string( nh, NFTA_CHAIN_TYPE, "filter" );
+    end_message( &batch, nh );
+
+    nh = add_message( &batch, NFNL_SUBSYS_NFTABLES << 8 | NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND | NLM_F_ACK, NFPROTO_INET, 0 );
+    add_string( nh, NFTA_RULE_TABLE, table );
+    add_string( nh, NFTA_RULE_CHAIN, "output" );
+    add_rule( nh, first_port, last_port );
+    end_message( &batch, nh );
+
+    nh = add_message( &batch, NFNL_MSG_BATCH_END, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES );
+    end_message( &batch, nh );
+
+    memset( &kernel, 0, sizeof( struct sockaddr_nl ) );
+    kernel.nl_family = AF_NETLINK;
+    if ( sendto( fw->fd, batch.buf, batch.len, 0, (struct sockaddr *) &kernel, sizeof( struct sockaddr_nl ) ) == -1 ) goto fail;
+    if ( read_acks( fw->fd, first_seq, batch.seq - 1 ) == -1 ) goto fail;
+    return 0;
+
+fail:
+    saved = errno;
+    close( fw->fd );
+    errno = saved;
+    return -1;
+}
+
+void firewall_close( struct firewall *fw )
+{
+    close( fw->fd );
+}
+
+#else
+
+int firewall_open( struct firewall *fw, unsigned short first_port, unsigned short last_port )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void firewall_close( struct firewall *fw )
+{
+}
+
+#endif
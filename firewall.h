@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#ifndef FIREWALL_H
+#define FIREWALL_H
+
+/*
+ * Keeps the host's own stack from answering replies meant for synfrag: the
+ * SYN/ACKs targets send to synfrag's source ports reach a host with no
+ * socket there, which would otherwise send an RST after each. An nftables
+ * table (inet family, named synfrag-<pid>) drops outgoing RSTs from those
+ * ports; frames synfrag sends itself bypass netfilter and aren't affected.
+ * The table is owned by the netlink socket that created it, so the kernel
+ * removes it when that is closed, however synfrag exits. Needs
+ * CAP_NET_ADMIN and Linux 5.12 or later; elsewhere firewall_open() fails
+ * with ENOSYS.
+ */
+
+struct firewall {
+    int fd;
+};
+
+/* Drop RSTs sent from TCP ports first_port to last_port. Returns 0, or -1 with errno set. */
+int firewall_open( struct firewall *, unsigned short first_port, unsigned short last_port );
+/* Removes the table. */
+void firewall_close( struct firewall * );
+
+#endif
@@ -28,19 +28,15 @@
 #include <stdlib.h>
 #include <string.h>
 
-/*
- * The following functions require the user to call free() on the returned
- * pointer.
-*/
+#include "flag_names.h"
 
-/* Room for all of the flags as strings plus * one for the NULL. */
-#define TCP_FLAG_STRING_MAX_LENGTH ( ( 8 * 5 ) + 1 )
-char *tcp_flags_to_names( unsigned char flags )
+/*
+ * The following functions write into a buffer supplied by the caller, which
+ * must be at least the matching *_FLAG_STRING_MAX_LENGTH bytes long. They
+ * return that same buffer.
+ */
+char *tcp_flags_to_names( unsigned char flags, char *str )
 {
-    char *str;
-    str = (char *) malloc( TCP_FLAG_STRING_MAX_LENGTH );
-    if ( str == NULL ) return NULL;
-
     if ( flags == 0 ) {
         strcpy( str, "None" );
         return str;
@@ -59,14 +55,8 @@ char *tcp_flags_to_names( unsigned char flags )
     return str;
 }
 
-/* Room for all of the flags as strings plus * one for the NULL. */
-#define IP_FLAG_STRING_MAX_LENGTH ( ( 3 * 4 ) + 1 )
-char *ip_flags_to_names( unsigned char flags )
+char *ip_flags_to_names( unsigned char flags, char *str )
 {
-    char *str;
-    str = (char *) malloc( IP_FLAG_STRING_MAX_LENGTH );
-    if ( str == NULL ) return NULL;
-
     if ( flags == 0 ) {
         strcpy( str, "None" );
         return str;
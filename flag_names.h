@@ -25,9 +25,13 @@
  * Author: John Eaglesham
  */
 
-/* Require users to free() the returned pointer. */
-char *tcp_flags_to_names( unsigned char );
-char *ip_flags_to_names( unsigned char );
+/* Room for all of the flags as strings plus one for the NULL. */
+#define TCP_FLAG_STRING_MAX_LENGTH ( ( 8 * 5 ) + 1 )
+#define IP_FLAG_STRING_MAX_LENGTH ( ( 3 * 4 ) + 1 )
+
+/* Write into the caller's buffer (see above for sizes) and return it. */
+char *tcp_flags_to_names( unsigned char, char * );
+char *ip_flags_to_names( unsigned char, char * );
 
 /* Returned pointer is to a static buffer, don't call free() */
 char *icmp_type_to_name( unsigned char );
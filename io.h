@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include <sys/time.h>
+#include <netinet/in.h>
+
+/*
+ * Packet I/O backends. The engine only ever talks to a struct io_backend:
+ * it hands over frames to send in batches and takes received frames in
+ * batches, and waits on the backend's descriptor when there is nothing to
+ * do. Each backend embeds struct io_backend as its first member and fills in
+ * ops; the io_open_* functions return 0, or -1 with a description in errbuf.
+ * A backend with a descriptor and no clock of its own must take recv, fd
+ * and stats on one thread while send is called on another, as a pipeline's
+ * receive stage does.
+ */
+
+#define IO_ERRBUF_SIZE 256
+/* Frames passed to or returned from a backend in one call, at most. */
+#define IO_BATCH 32
+/* Largest frame a backend has to carry or capture. */
+#define IO_FRAME_MAX 1536
+
+struct io_frame {
+    char *data;
+    unsigned int len;
+    /* When it was received; unused for sending. */
+    struct timeval ts;
+    /*
+     * For sending through a backend with IO_CAP_CSUM_OFFLOAD: if csum_start
+     * is non-zero, the checksum field csum_offset bytes past it holds the
+     * pseudo header sum, and the checksum over everything from csum_start
+     * on is left to the kernel or NIC.
+     */
+    unsigned short csum_start;
+    unsigned short csum_offset;
+};
+
+struct io_stats {
+    unsigned long received;
+    unsigned long dropped;
+    unsigned long interface_dropped;
+};
+
+struct io_backend;
+
+struct io_ops {
+    const char *name;
+    /* Returns how many frames were sent, or -1 with errbuf set. */
+    int (*send)( struct io_backend *, const struct io_frame *, unsigned int count );
+    /*
+     * Fills in up to max frames, valid until the next recv. Returns how
+     * many, 0 if none are waiting, or -1 with errbuf set.
+     */
+    int (*recv)( struct io_backend *, struct io_frame *, unsigned int max );
+    /*
+     * Readable when frames are waiting. -1 means recv never has anything
+     * later that it doesn't have now, so there is no point waiting on it.
+     */
+    int (*fd)( struct io_backend * );
+    /* Safe to call only from the thread receiving. */
+    void (*stats)( struct io_backend *, struct io_stats * );
+    void (*close)( struct io_backend * );
+    /*
+     * Optional, for backends that keep their own clock (a simulated
+     * network). now reads it; wait moves it on to until, or to when the next
+     * frame can be received if that is sooner. Without them the engine uses
+     * gettimeofday() and select() on fd.
+     */
+    void (*now)( struct io_backend *, struct timeval * );
+    void (*wait)( struct io_backend *, const struct timeval *until );
+};
+
+/* For io_backend.caps. */
+#define IO_CAP_CSUM_OFFLOAD ( 1 << 0 )
+
+struct io_backend {
+    const struct io_ops *ops;
+    /* What this backend, as opened, can do beyond sending frames as is. */
+    unsigned int caps;
+    char errbuf[IO_ERRBUF_SIZE];
+};
+
+static inline int io_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    return io->ops->send( io, frames, count );
+}
+
+static inline int io_recv( struct io_backend *io, struct io_frame *frames, unsigned int max )
+{
+    return io->ops->recv( io, frames, max );
+}
+
+static inline int io_fd( struct io_backend *io )
+{
+    return io->ops->fd( io );
+}
+
+static inline void io_stats( struct io_backend *io, struct io_stats *stats )
+{
+    io->ops->stats( io, stats );
+}
+
+static inline void io_now( struct io_backend *io, struct timeval *now )
+{
+    if ( io->ops->now ) io->ops->now( io, now );
+    else gettimeofday( now, NULL );
+}
+
+/* Returns -1, having done nothing, if the backend runs on real time. */
+static inline int io_wait( struct io_backend *io, const struct timeval *until )
+{
+    if ( !io->ops->wait ) return -1;
+    io->ops->wait( io, until );
+    return 0;
+}
+
+static inline void io_close( struct io_backend *io )
+{
+    if ( io ) io->ops->close( io );
+}
+
+/* libpcap on a live interface, capturing only what matches filter. */
+int io_open_pcap( struct io_backend **, const char *interface, const char *filter, char *errbuf );
+
+/*
+ * Replies are read from a pcap savefile (those matching filter); sent
+ * frames are written to dump_path, or dropped if it is NULL.
+ */
+int io_open_savefile( struct io_backend **, const char *path, const char *filter, const char *dump_path, char *errbuf );
+
+/* Flags for io_open_packet(). */
+/* Hand frames straight to the driver, skipping the qdisc layer. */
+#define IO_PACKET_QDISC_BYPASS ( 1 << 0 )
+/*
+ * Prefix frames with a virtio-net header (PACKET_VNET_HDR) so checksums can
+ * be offloaded, giving the backend IO_CAP_CSUM_OFFLOAD.
+ */
+#define IO_PACKET_CSUM_OFFLOAD ( 1 << 1 )
+
+/* AF_PACKET with mmap'd TX and RX rings (Linux only). */
+int io_open_packet( struct io_backend **, const char *interface, const char *filter, int flags, char *errbuf );
+
+/* Flags for io_open_xdp(). */
+/* Insist on zero-copy (driver support needed) or on copy mode. */
+#define IO_XDP_ZEROCOPY ( 1 << 0 )
+#define IO_XDP_COPY ( 1 << 1 )
+/*
+ * Attach the program in generic (skb) mode, which works on any interface
+ * including veth but gives up most of the speed.
+ */
+#define IO_XDP_GENERIC ( 1 << 2 )
+
+/*
+ * An AF_XDP socket on one queue of the interface (Linux only), with an XDP
+ * program attached that steers frames for src (of the given family) that
+ * look like replies to it and leaves the rest to the kernel: TCP to ports
+ * port up to port + ports - 1, and ICMP echo replies with id port.
+ */
+int io_open_xdp(
+    struct io_backend **,
+    const char *interface,
+    unsigned int queue,
+    int flags,
+    int family,
+    const struct in6_addr *src,
+    unsigned short port,
+    unsigned short ports,
+    char *errbuf
+);
+
+/*
+ * Given a frame that was sent, write the frame to be received in reply to
+ * it into reply and return its length, or return 0 for no reply.
+ */
+typedef unsigned int (*io_responder)( void *arg, const char *frame, unsigned int len, char *reply, unsigned int reply_size );
+
+/*
+ * No network at all: every frame sent is handed to responder, and its
+ * replies are queued to be received.
+ */
+int io_open_loopback( struct io_backend **, io_responder, void *arg, char *errbuf );
+
+/*
+ * A responder standing in for a host that answers every TCP SYN with a
+ * SYN/ACK and every echo request with a reply. arg is NULL or points to an
+ * int: if NULL or non-zero, the first fragment of a fragmented probe is
+ * answered as if it had been reassembled, otherwise with a reassembly time
+ * exceeded error.
+ */
+unsigned int io_loopback_host( void *arg, const char *frame, unsigned int len, char *reply, unsigned int reply_size );
+
+/*
+ * A simulated network in virtual time, for load testing the engine. Hosts
+ * behave as io_loopback_host() does, but fragments are only answered once
+ * both have arrived, and spec (comma separated, NULL or "" for defaults)
+ * adds:
+ *
+ *  loss=P            lose each frame, either way, with probability P (or P%)
+ *  rtt=MS            base round trip time in milliseconds (default 1)
+ *  jitter=MS         add up to this much, uniformly
+ *  tail=P:MS         and for a fraction P of replies, up to this much more
+ *  icmp-rate=N       answer with at most N ICMP messages per second
+ *  host-icmp-rate=N:B
+ *                    and have each target send us at most N a second,
+ *                    after a burst of B, as Linux does per peer
+ *  seed=N            for the random number generator (default 1)
+ *  hops=N            put N routers in front of every target (default 0);
+ *                    router n answers frames whose TTL runs out there with
+ *                    a time exceeded error from 198.18.0.n or 2001:db8::n
+ *  reassembly=N      keep at most N incomplete reassemblies (default no
+ *                    limit), dropping first fragments that find no room;
+ *                    each is given up on after 30 seconds
+ *  PREFIX/LEN=WHAT   for targets in the prefix (longest match wins), one of
+ *                    pass, no-reassembly (answer fragments with reassembly
+ *                    time exceeded), drop-short-frags, drop-frags,
+ *                    drop-optioned or drop-all; drop-short-frags:N drops
+ *                    first fragments shorter than N bytes instead of 68; a
+ *                    dropping rule can be put on router n with WHAT@n,
+ *                    otherwise the target's edge drops
+ *
+ * The clock only moves when the engine waits, straight to the next reply or
+ * timeout, so a long scan replays in however long building and matching
+ * its frames takes.
+ */
+int io_open_sim( struct io_backend **, const char *spec, char *errbuf );
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#define __USE_BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __FreeBSD__
+#include <netinet/in_systm.h>
+#endif
+
+#ifdef __linux
+#define ETHERTYPE_IPV6 ETH_P_IPV6
+#define __FAVOR_BSD
+#endif
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <netinet/tcp.h>
+#include <netinet/if_ether.h>
+#include "io.h"
+#include "checksums.h"
+
+/*
+ * Replies waiting to be received. If the engine sends faster than it
+ * receives, replies past this are counted as dropped, like a full socket
+ * buffer.
+ */
+#define LOOP_SLOTS 4096
+
+struct io_loop {
+    struct io_backend io;
+    io_responder responder;
+    void *arg;
+    char *frames;
+    unsigned int len[LOOP_SLOTS];
+    struct timeval ts[LOOP_SLOTS];
+    /* Free running; slot is the counter modulo LOOP_SLOTS. */
+    unsigned int head;
+    unsigned int tail;
+    /* Handed out by the last recv, so not free until the next one. */
+    unsigned int held;
+    unsigned long received;
+    unsigned long dropped;
+};
+
+static int loop_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    struct io_loop *l = (struct io_loop *) io;
+    struct timeval now;
+    unsigned int x, slot, len;
+
+    /* One clock read per batch; the replies all "arrive" together. */
+    gettimeofday( &now, NULL );
+    for ( x = 0; x < count; x++ ) {
+        if ( l->tail - l->head == LOOP_SLOTS ) {
+            l->dropped++;
+            continue;
+        }
+        slot = l->tail % LOOP_SLOTS;
+        len = l->responder( l->arg, frames[x].data, frames[x].len, l->frames + (size_t) slot * IO_FRAME_MAX, IO_FRAME_MAX );
+        if ( !len ) continue;
+        l->len[slot] = len;
+        l->ts[slot] = now;
+        l->tail++;
+        l->received++;
+    }
+    return count;
+}
+
+static int loop_recv( struct io_backend *io, struct io_frame *frames, unsigned int max )
+{
+    struct io_loop *l = (struct io_loop *) io;
+    unsigned int x, slot;
+
+    l->head += l->held;
+    for ( x = 0; x < max && l->head + x != l->tail; x++ ) {
+        slot = ( l->head + x ) % LOOP_SLOTS;
+        frames[x].data = l->frames + (size_t) slot * IO_FRAME_MAX;
+        frames[x].len = l->len[slot];
+        frames[x].ts = l->ts[slot];
+    }
+    l->held = x;
+    return x;
+}
+
+/* Replies only ever appear during send, so there is nothing to wait for. */
+static int loop_fd( struct io_backend *io )
+{
+    return -1;
+}
+
+static void loop_stats( struct io_backend *io, struct io_stats *stats )
+{
+    struct io_loop *l = (struct io_loop *) io;
+
+    memset( stats, 0, sizeof( struct io_stats ) );
+    stats->received = l->received;
+    stats->dropped = l->dropped;
+}
+
+static void loop_close( struct io_backend *io )
+{
+    struct io_loop *l = (struct io_loop *) io;
+
+    free( l->frames );
+    free( l );
+}
+
+static const struct io_ops loop_ops = {
+    "loopback",
+    loop_send,
+    loop_recv,
+    loop_fd,
+    loop_stats,
+    loop_close
+};
+
+int io_open_loopback( struct io_backend **iop, io_responder responder, void *arg, char *errbuf )
+{
+    struct io_loop *l;
+
+    *iop = NULL;
+    if ( ( l = calloc( 1, sizeof( struct io_loop ) ) ) == NULL ||
+        ( l->frames = malloc( (size_t) LOOP_SLOTS * IO_FRAME_MAX ) ) == NULL ) {
+        free( l );
+        snprintf( errbuf, IO_ERRBUF_SIZE, "Out of memory for loopback frames" );
+        return -1;
+    }
+    l->io.ops = &loop_ops;
+    l->responder = responder ? responder : io_loopback_host;
+    l->arg = arg;
+    *iop = &l->io;
+    return 0;
+}
+
+/*
+ * The simulated host. It only looks at first fragments (offset 0) and
+ * unfragmented packets, and only at the first 8 bytes of the layer 4 header,
+ * which is all a short first fragment carries and all it takes to answer.
+ */
+#define SIZEOF_ETHER sizeof( struct ether_header )
+#define SIZEOF_IPV4 sizeof( struct ip )
+#define SIZEOF_IPV6 sizeof( struct ip6_hdr )
+#define SIZEOF_TCP sizeof( struct tcphdr )
+#define SIZEOF_PING 8
+/* What an ICMP error quotes of the offending packet past its IP header(s). */
+#define QUOTE_LEN 8
+
+static unsigned int reply_ethernet( const char *frame, char *reply )
+{
+    const struct ether_header *ethh = (const struct ether_header *) frame;
+    struct ether_header *reply_ethh = (struct ether_header *) reply;
+
+    memcpy( reply_ethh->ether_dhost, ethh->ether_shost, ETHER_ADDR_LEN );
+    memcpy( reply_ethh->ether_shost, ethh->ether_dhost, ETHER_ADDR_LEN );
+    reply_ethh->ether_type = ethh->ether_type;
+    return SIZEOF_ETHER;
+}
+
+/* The TCP reply to a SYN, written at tcph; the caller checksums it. */
+static void reply_tcp( const struct tcphdr *syn, struct tcphdr *tcph )
+{
+    memset( tcph, 0, SIZEOF_TCP );
+    tcph->th_sport = syn->th_dport;
+    tcph->th_dport = syn->th_sport;
+    tcph->th_seq = htonl( 1 );
+    tcph->th_ack = htonl( ntohl( syn->th_seq ) + 1 );
+    tcph->th_off = SIZEOF_TCP / 4;
+    tcph->th_flags = TH_SYN | TH_ACK;
+    tcph->th_win = htons( 65535 );
+}
+
+static unsigned int reply_ipv4( int reassemble, const char *frame, unsigned int len, char *reply, unsigned int reply_size )
+{
+    const struct ip *iph = (const struct ip *) ( frame + SIZEOF_ETHER );
+    struct ip *reply_iph = (struct ip *) ( reply + SIZEOF_ETHER );
+    const char *l4h;
+    unsigned int hl, l4_len;
+    unsigned short off;
+
+    if ( len < SIZEOF_ETHER + SIZEOF_IPV4 ) return 0;
+    hl = iph->ip_hl * 4;
+    off = ntohs( iph->ip_off );
+    if ( hl < SIZEOF_IPV4 || len < SIZEOF_ETHER + hl + QUOTE_LEN ) return 0;
+    if ( off & IP_OFFMASK ) return 0;
+    l4h = (const char *) iph + hl;
+
+    reply_ethernet( frame, reply );
+    memset( reply_iph, 0, SIZEOF_IPV4 );
+    reply_iph->ip_v = 4;
+    reply_iph->ip_hl = SIZEOF_IPV4 / 4;
+    reply_iph->ip_ttl = 64;
+    reply_iph->ip_src = iph->ip_dst;
+    reply_iph->ip_dst = iph->ip_src;
+
+    if ( ( off & IP_MF ) && !reassemble ) {
+        struct icmp *icmph = (struct icmp *) ( (char *) reply_iph + SIZEOF_IPV4 );
+
+        l4_len = SIZEOF_PING + hl + QUOTE_LEN;
+        if ( SIZEOF_ETHER + SIZEOF_IPV4 + l4_len > reply_size ) return 0;
+        memset( icmph, 0, SIZEOF_PING );
+        icmph->icmp_type = ICMP_TIMXCEED;
+        icmph->icmp_code = ICMP_TIMXCEED_REASS;
+        memcpy( (char *) icmph + SIZEOF_PING, iph, hl + QUOTE_LEN );
+        reply_iph->ip_p = IPPROTO_ICMP;
+    } else if ( iph->ip_p == IPPROTO_TCP ) {
+        reply_tcp( (const struct tcphdr *) l4h, (struct tcphdr *) ( (char *) reply_iph + SIZEOF_IPV4 ) );
+        l4_len = SIZEOF_TCP;
+        reply_iph->ip_p = IPPROTO_TCP;
+    } else if ( iph->ip_p == IPPROTO_ICMP && ( (const struct icmp *) l4h )->icmp_type == ICMP_ECHO ) {
+        struct icmp *icmph = (struct icmp *) ( (char *) reply_iph + SIZEOF_IPV4 );
+
+        memcpy( icmph, l4h, SIZEOF_PING );
+        icmph->icmp_type = ICMP_ECHOREPLY;
+        icmph->icmp_cksum = 0;
+        l4_len = SIZEOF_PING;
+        reply_iph->ip_p = IPPROTO_ICMP;
+    } else {
+        return 0;
+    }
+
+    reply_iph->ip_len = htons( SIZEOF_IPV4 + l4_len );
+    do_checksum( (char *) reply_iph, reply_iph->ip_p, l4_len );
+    do_checksum( (char *) reply_iph, IPPROTO_IP, SIZEOF_IPV4 );
+    return SIZEOF_ETHER + SIZEOF_IPV4 + l4_len;
+}
+
+static unsigned int reply_ipv6( int reassemble, const char *frame, unsigned int len, char *reply, unsigned int reply_size )
+{
+    const struct ip6_hdr *ip6h = (const struct ip6_hdr *) ( frame + SIZEOF_ETHER );
+    struct ip6_hdr *reply_ip6h = (struct ip6_hdr *) ( reply + SIZEOF_ETHER );
+    const char *l4h;
+    unsigned int hl = SIZEOF_IPV6, l4_len;
+    int next_header, fragmented = 0;
+
+    if ( len < SIZEOF_ETHER + SIZEOF_IPV6 ) return 0;
+    next_header = ip6h->ip6_nxt;
+    while ( next_header == IPPROTO_FRAGMENT || next_header == IPPROTO_DSTOPTS ) {
+        const char *ext = (const char *) ip6h + hl;
+
+        if ( len < SIZEOF_ETHER + hl + 8 ) return 0;
+        if ( next_header == IPPROTO_FRAGMENT ) {
+            const struct ip6_frag *fragh = (const struct ip6_frag *) ext;
+            if ( fragh->ip6f_offlg & IP6F_OFF_MASK ) return 0;
+            fragmented = ( fragh->ip6f_offlg & IP6F_MORE_FRAG ) != 0;
+            next_header = fragh->ip6f_nxt;
+            hl += sizeof( struct ip6_frag );
+        } else {
+            const struct ip6_dest *desth = (const struct ip6_dest *) ext;
+            next_header = desth->ip6d_nxt;
+            hl += ( desth->ip6d_len + 1 ) * 8;
+        }
+    }
+    if ( len < SIZEOF_ETHER + hl + QUOTE_LEN ) return 0;
+    l4h = (const char *) ip6h + hl;
+
+    reply_ethernet( frame, reply );
+    memset( reply_ip6h, 0, SIZEOF_IPV6 );
+    reply_ip6h->ip6_flow = htonl( 6 << 28 );
+    reply_ip6h->ip6_hlim = 64;
+    reply_ip6h->ip6_src = ip6h->ip6_dst;
+    reply_ip6h->ip6_dst = ip6h->ip6_src;
+
+    if ( fragmented && !reassemble ) {
+        struct icmp6_hdr *icmp6h = (struct icmp6_hdr *) ( (char *) reply_ip6h + SIZEOF_IPV6 );
+
+        l4_len = sizeof( struct icmp6_hdr ) + hl + QUOTE_LEN;
+        if ( SIZEOF_ETHER + SIZEOF_IPV6 + l4_len > reply_size ) return 0;
+        memset( icmp6h, 0, sizeof( struct icmp6_hdr ) );
+        icmp6h->icmp6_type = ICMP6_TIME_EXCEEDED;
+        icmp6h->icmp6_code = ICMP6_TIME_EXCEED_REASSEMBLY;
+        memcpy( (char *) icmp6h + sizeof( struct icmp6_hdr ), ip6h, hl + QUOTE_LEN );
+        reply_ip6h->ip6_nxt = IPPROTO_ICMPV6;
+    } else if ( next_header == IPPROTO_TCP ) {
+        reply_tcp( (const struct tcphdr *) l4h, (struct tcphdr *) ( (char *) reply_ip6h + SIZEOF_IPV6 ) );
+        l4_len = SIZEOF_TCP;
+        reply_ip6h->ip6_nxt = IPPROTO_TCP;
+    } else if ( next_header == IPPROTO_ICMPV6 && ( (const struct icmp6_hdr *) l4h )->icmp6_type == ICMP6_ECHO_REQUEST ) {
+        struct icmp6_hdr *icmp6h = (struct icmp6_hdr *) ( (char *) reply_ip6h + SIZEOF_IPV6 );
+
+        memcpy( icmp6h, l4h, sizeof( struct icmp6_hdr ) );
+        icmp6h->icmp6_type = ICMP6_ECHO_REPLY;
+        icmp6h->icmp6_cksum = 0;
+        l4_len = sizeof( struct icmp6_hdr );
+        reply_ip6h->ip6_nxt = IPPROTO_ICMPV6;
+    } else {
+        return 0;
+    }
+
+    reply_ip6h->ip6_plen = htons( l4_len );
+    do_checksum( (char *) reply_ip6h, reply_ip6h->ip6_nxt, l4_len );
+    return SIZEOF_ETHER + SIZEOF_IPV6 + l4_len;
+}
+
+unsigned int io_loopback_host( void *arg, const char *frame, unsigned int len, char *reply, unsigned int reply_size )
+{
+    const struct ether_header *ethh = (const struct ether_header *) frame;
+    int reassemble = arg ? *(int *) arg : 1;
+
+    if ( len < SIZEOF_ETHER || reply_size < SIZEOF_ETHER + SIZEOF_IPV6 + SIZEOF_TCP ) return 0;
+    if ( ntohs( ethh->ether_type ) == ETHERTYPE_IP ) return reply_ipv4( reassemble, frame, len, reply, reply_size );
+    if ( ntohs( ethh->ether_type ) == ETHERTYPE_IPV6 ) return reply_ipv6( reassemble, frame, len, reply, reply_size );
+    return 0;
+}
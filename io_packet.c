@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "io.h"
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/virtio_net.h>
+#include <pcap.h>
+
+/*
+ * TPACKET_V2 rings, the same size each way. Frames are laid out back to back
+ * since the block size is a multiple of the frame size.
+ */
+#define RING_FRAME_SIZE 2048
+#define RING_FRAMES 1024
+#define RING_BLOCK_SIZE ( 1 << 16 )
+#define RING_SIZE ( RING_FRAMES * RING_FRAME_SIZE )
+/* Where frame data starts in a TX slot. */
+#define TX_DATA_OFFSET ( TPACKET2_HDRLEN - sizeof( struct sockaddr_ll ) )
+
+struct io_packet {
+    struct io_backend io;
+    int fd;
+    char *ring;
+    char *rx_ring;
+    char *tx_ring;
+    unsigned int rx_head;
+    unsigned int tx_head;
+    /* Slots handed out by the last recv, given back to the kernel next call. */
+    unsigned int held_first;
+    unsigned int held_count;
+    /* PACKET_STATISTICS resets on every read, so keep the totals here. */
+    unsigned long received;
+    unsigned long dropped;
+    /* Whether TX frames carry a virtio_net_hdr (IO_PACKET_CSUM_OFFLOAD). */
+    int vnet_hdr;
+};
+
+static struct tpacket2_hdr *slot( char *ring, unsigned int index )
+{
+    return (struct tpacket2_hdr *) ( ring + (size_t) index * RING_FRAME_SIZE );
+}
+
+static int packet_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    struct io_packet *p = (struct io_packet *) io;
+    struct tpacket2_hdr *hdr;
+    struct virtio_net_hdr *vnet;
+    unsigned int headroom = p->vnet_hdr ? sizeof( struct virtio_net_hdr ) : 0;
+    unsigned int x;
+    char *data;
+
+    for ( x = 0; x < count; x++ ) {
+        if ( frames[x].len > RING_FRAME_SIZE - TX_DATA_OFFSET - headroom ) {
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "Frame too big for the TX ring" );
+            break;
+        }
+        hdr = slot( p->tx_ring, p->tx_head );
+        if ( __atomic_load_n( &hdr->tp_status, __ATOMIC_ACQUIRE ) & ( TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING ) ) {
+            /* Ring full: let the kernel drain it, blocking, then try once more. */
+            send( p->fd, NULL, 0, 0 );
+            if ( __atomic_load_n( &hdr->tp_status, __ATOMIC_ACQUIRE ) & ( TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING ) ) {
+                snprintf( io->errbuf, IO_ERRBUF_SIZE, "TX ring full" );
+                break;
+            }
+        }
+        data = (char *) hdr + TX_DATA_OFFSET;
+        if ( p->vnet_hdr ) {
+            vnet = (struct virtio_net_hdr *) data;
+            memset( vnet, 0, sizeof( struct virtio_net_hdr ) );
+            vnet->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+            if ( frames[x].csum_start ) {
+                vnet->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+                vnet->csum_start = frames[x].csum_start;
+                vnet->csum_offset = frames[x].csum_offset;
+            }
+        }
+        /* The kernel reads the virtio-net header off the front of the frame. */
+        memcpy( data + headroom, frames[x].data, frames[x].len );
+        hdr->tp_len = headroom + frames[x].len;
+        __atomic_store_n( &hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE );
+        p->tx_head = ( p->tx_head + 1 ) % RING_FRAMES;
+    }
+    if ( !x ) return -1;
+
+    /* One syscall for the whole batch. */
+    if ( send( p->fd, NULL, 0, MSG_DONTWAIT ) == -1 && errno != EAGAIN && errno != ENOBUFS ) {
+        snprintf( io->errbuf, IO_ERRBUF_SIZE, "send failed: %s", strerror( errno ) );
+        return -1;
+    }
+    return x;
+}
+
+static int packet_recv( struct io_backend *io, struct io_frame *frames, unsigned int max )
+{
+    struct io_packet *p = (struct io_packet *) io;
+    struct tpacket2_hdr *hdr;
+    unsigned int x;
+
+    for ( x = 0; x < p->held_count; x++ ) {
+        hdr = slot( p->rx_ring, ( p->held_first + x ) % RING_FRAMES );
+        __atomic_store_n( &hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE );
+    }
+    p->held_first = p->rx_head;
+
+    for ( x = 0; x < max; x++ ) {
+        hdr = slot( p->rx_ring, p->rx_head );
+        if ( !( __atomic_load_n( &hdr->tp_status, __ATOMIC_ACQUIRE ) & TP_STATUS_USER ) ) break;
+        frames[x].data = (char *) hdr + hdr->tp_mac;
+        frames[x].len = hdr->tp_snaplen;
+        frames[x].ts.tv_sec = hdr->tp_sec;
+        frames[x].ts.tv_usec = hdr->tp_nsec / 1000;
+        p->rx_head = ( p->rx_head + 1 ) % RING_FRAMES;
+    }
+    p->held_count = x;
+    return x;
+}
+
+static int packet_fd( struct io_backend *io )
+{
+    return ( (struct io_packet *) io )->fd;
+}
+
+static void packet_stats( struct io_backend *io, struct io_stats *stats )
+{
+    struct io_packet *p = (struct io_packet *) io;
+    struct tpacket_stats ts;
+    socklen_t len = sizeof( struct tpacket_stats );
+
+    if ( getsockopt( p->fd, SOL_PACKET, PACKET_STATISTICS, &ts, &len ) == 0 ) {
+        p->received += ts.tp_packets;
+        p->dropped += ts.tp_drops;
+    }
+    memset( stats, 0, sizeof( struct io_stats ) );
+    stats->received = p->received;
+    stats->dropped = p->dropped;
+}
+
+static void packet_close( struct io_backend *io )
+{
+    struct io_packet *p = (struct io_packet *) io;
+
+    if ( p->ring ) munmap( p->ring, 2 * RING_SIZE );
+    if ( p->fd != -1 ) close( p->fd );
+    free( p );
+}
+
+static const struct io_ops packet_ops = {
+    "packet",
+    packet_send,
+    packet_recv,
+    packet_fd,
+    packet_stats,
+    packet_close
+};
+
+static int fail( char *errbuf, const char *what )
+{
+    snprintf( errbuf, IO_ERRBUF_SIZE, "%s: %s", what, strerror( errno ) );
+    return -1;
+}
+
+/* pcap compiles the filter; its instructions are laid out as the kernel's. */
+static int attach_filter( int fd, const char *filter, char *errbuf )
+{
+    struct bpf_program program;
+    struct sock_fprog fprog;
+    pcap_t *dead;
+    int r = 0;
+
+    if ( !filter ) return 0;
+    if ( ( dead = pcap_open_dead( DLT_EN10MB, IO_FRAME_MAX ) ) == NULL ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_open_dead failed" );
+        return -1;
+    }
+    if ( pcap_compile( dead, &program, (char *) filter, 1, 0 ) == -1 ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_compile failed: %s", pcap_geterr( dead ) );
+        pcap_close( dead );
+        return -1;
+    }
+    fprog.len = program.bf_len;
+    fprog.filter = (struct sock_filter *) program.bf_insns;
+    if ( setsockopt( fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof( struct sock_fprog ) ) == -1 )
+        r = fail( errbuf, "Unable to attach filter" );
+    pcap_freecode( &program );
+    pcap_close( dead );
+    return r;
+}
+
+int io_open_packet( struct io_backend **iop, const char *interface, const char *filter, int flags, char *errbuf )
+{
+    struct io_packet *p;
+    struct tpacket_req req;
+    struct sockaddr_ll sll;
+    int version = TPACKET_V2;
+    int one = 1;
+    unsigned int ifindex;
+
+    *iop = NULL;
+    if ( ( ifindex = if_nametoindex( interface ) ) == 0 ) return fail( errbuf, "Unknown interface" );
+    if ( ( p = calloc( 1, sizeof( struct io_packet ) ) ) == NULL ) return fail( errbuf, "Out of memory" );
+    p->io.ops = &packet_ops;
+
+    /* No protocol yet, so nothing is queued before the filter is in place. */
+    if ( ( p->fd = socket( AF_PACKET, SOCK_RAW, 0 ) ) == -1 ) {
+        fail( errbuf, "Unable to create packet socket" );
+        goto error;
+    }
+    if ( attach_filter( p->fd, filter, errbuf ) == -1 ) goto error;
+    if ( setsockopt( p->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof( int ) ) == -1 ) {
+        fail( errbuf, "Unable to use TPACKET_V2" );
+        goto error;
+    }
+    /* Best effort, both: skip our own frames, and bad frames rather than stall. */
+    setsockopt( p->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof( int ) );
+    setsockopt( p->fd, SOL_PACKET, PACKET_LOSS, &one, sizeof( int ) );
+    if ( ( flags & IO_PACKET_QDISC_BYPASS ) &&
+        setsockopt( p->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof( int ) ) == -1 ) {
+        fail( errbuf, "Unable to bypass qdisc" );
+        goto error;
+    }
+    /* Has to come before the rings, which it changes the layout of. */
+    if ( flags & IO_PACKET_CSUM_OFFLOAD ) {
+        if ( setsockopt( p->fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof( int ) ) == -1 ) {
+            fail( errbuf, "Unable to use virtio-net headers for checksum offload" );
+            goto error;
+        }
+        p->vnet_hdr = 1;
+        p->io.caps |= IO_CAP_CSUM_OFFLOAD;
+    }
+
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr = RING_SIZE / RING_BLOCK_SIZE;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = RING_FRAMES;
+    if ( setsockopt( p->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof( struct tpacket_req ) ) == -1 ||
+        setsockopt( p->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof( struct tpacket_req ) ) == -1 ) {
+        fail( errbuf, "Unable to set up packet rings" );
+        goto error;
+    }
+    /* RX ring first, then TX, in one mapping. */
+    p->ring = mmap( NULL, 2 * RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p->fd, 0 );
+    if ( p->ring == MAP_FAILED ) {
+        p->ring = NULL;
+        fail( errbuf, "Unable to map packet rings" );
+        goto error;
+    }
+    p->rx_ring = p->ring;
+    p->tx_ring = p->ring + RING_SIZE;
+
+    memset( &sll, 0, sizeof( struct sockaddr_ll ) );
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons( ETH_P_ALL );
+    sll.sll_ifindex = ifindex;
+    if ( bind( p->fd, (struct sockaddr *) &sll, sizeof( struct sockaddr_ll ) ) == -1 ) {
+        fail( errbuf, "Unable to bind packet socket" );
+        goto error;
+    }
+
+    *iop = &p->io;
+    return 0;
+
+error:
+    packet_close( &p->io );
+    return -1;
+}
+
+#else
+
+int io_open_packet( struct io_backend **iop, const char *interface, const char *filter, int flags, char *errbuf )
+{
+    *iop = NULL;
+    snprintf( errbuf, IO_ERRBUF_SIZE, "AF_PACKET is not supported on this system" );
+    return -1;
+}
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pcap.h>
+#include "io.h"
+
+/* Live capture and savefiles share everything but open and stats. */
+struct io_pcap {
+    struct io_backend io;
+    pcap_t *pcap;
+    pcap_t *dead;
+    pcap_dumper_t *dump;
+    unsigned long received;
+};
+
+static int live_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    struct io_pcap *p = (struct io_pcap *) io;
+    unsigned int x;
+
+    for ( x = 0; x < count; x++ ) {
+        if ( pcap_inject( p->pcap, frames[x].data, frames[x].len ) != (int) frames[x].len ) {
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "pcap_inject failed: %s", pcap_geterr( p->pcap ) );
+            return x ? (int) x : -1;
+        }
+    }
+    return count;
+}
+
+static int savefile_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    struct io_pcap *p = (struct io_pcap *) io;
+    struct pcap_pkthdr header;
+    unsigned int x;
+
+    if ( !p->dump ) return count;
+    gettimeofday( &header.ts, NULL );
+    for ( x = 0; x < count; x++ ) {
+        header.caplen = header.len = frames[x].len;
+        pcap_dump( (unsigned char *) p->dump, &header, (unsigned char *) frames[x].data );
+    }
+    return count;
+}
+
+/* pcap only keeps the last frame it returned, so it's one at a time. */
+static int capture_recv( struct io_backend *io, struct io_frame *frames, unsigned int max )
+{
+    struct io_pcap *p = (struct io_pcap *) io;
+    struct pcap_pkthdr *header;
+    const unsigned char *data;
+    int r;
+
+    r = pcap_next_ex( p->pcap, &header, &data );
+    /* -2 is the end of a savefile, which just means no more replies. */
+    if ( r == 0 || r == -2 ) return 0;
+    if ( r < 0 ) {
+        snprintf( io->errbuf, IO_ERRBUF_SIZE, "pcap_next_ex failed: %s", pcap_geterr( p->pcap ) );
+        return -1;
+    }
+    frames[0].data = (char *) data;
+    frames[0].len = header->caplen;
+    frames[0].ts = header->ts;
+    p->received++;
+    return 1;
+}
+
+static int live_fd( struct io_backend *io )
+{
+    return pcap_get_selectable_fd( ( (struct io_pcap *) io )->pcap );
+}
+
+static int savefile_fd( struct io_backend *io )
+{
+    return -1;
+}
+
+static void live_stats( struct io_backend *io, struct io_stats *stats )
+{
+    struct io_pcap *p = (struct io_pcap *) io;
+    struct pcap_stat ps;
+
+    memset( stats, 0, sizeof( struct io_stats ) );
+    if ( pcap_stats( p->pcap, &ps ) == -1 ) return;
+    stats->received = ps.ps_recv;
+    stats->dropped = ps.ps_drop;
+    stats->interface_dropped = ps.ps_ifdrop;
+}
+
+static void savefile_stats( struct io_backend *io, struct io_stats *stats )
+{
+    memset( stats, 0, sizeof( struct io_stats ) );
+    stats->received = ( (struct io_pcap *) io )->received;
+}
+
+static void capture_close( struct io_backend *io )
+{
+    struct io_pcap *p = (struct io_pcap *) io;
+
+    if ( p->dump ) pcap_dump_close( p->dump );
+    if ( p->dead ) pcap_close( p->dead );
+    if ( p->pcap ) pcap_close( p->pcap );
+    free( p );
+}
+
+static const struct io_ops pcap_ops = {
+    "pcap",
+    live_send,
+    capture_recv,
+    live_fd,
+    live_stats,
+    capture_close
+};
+
+static const struct io_ops savefile_ops = {
+    "savefile",
+    savefile_send,
+    capture_recv,
+    savefile_fd,
+    savefile_stats,
+    capture_close
+};
+
+static int set_filter( struct io_pcap *p, const char *filter, char *errbuf )
+{
+    struct bpf_program program;
+
+    if ( !filter ) return 0;
+    if ( pcap_compile( p->pcap, &program, (char *) filter, 1, 0 ) == -1 ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_compile failed: %s", pcap_geterr( p->pcap ) );
+        return -1;
+    }
+    if ( pcap_setfilter( p->pcap, &program ) == -1 ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_setfilter failed: %s", pcap_geterr( p->pcap ) );
+        pcap_freecode( &program );
+        return -1;
+    }
+    pcap_freecode( &program );
+    return 0;
+}
+
+int io_open_pcap( struct io_backend **iop, const char *interface, const char *filter, char *errbuf )
+{
+    char pcaperr[PCAP_ERRBUF_SIZE];
+    struct io_pcap *p;
+
+    *iop = NULL;
+    if ( ( p = calloc( 1, sizeof( struct io_pcap ) ) ) == NULL ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "Out of memory" );
+        return -1;
+    }
+    p->io.ops = &pcap_ops;
+
+    if ( ( p->pcap = pcap_open_live( interface, IO_FRAME_MAX, 0, 1, pcaperr ) ) == NULL ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_open_live failed: %.200s", pcaperr );
+        goto fail;
+    }
+    if ( pcap_datalink( p->pcap ) != DLT_EN10MB ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "non-ethernet interface specified." );
+        goto fail;
+    }
+    pcap_setdirection( p->pcap, PCAP_D_IN );
+    if ( pcap_setnonblock( p->pcap, 1, pcaperr ) == -1 ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_setnonblock failed: %.200s", pcaperr );
+        goto fail;
+    }
+    if ( set_filter( p, filter, errbuf ) == -1 ) goto fail;
+
+    *iop = &p->io;
+    return 0;
+
+fail:
+    capture_close( &p->io );
+    return -1;
+}
+
+int io_open_savefile( struct io_backend **iop, const char *path, const char *filter, const char *dump_path, char *errbuf )
+{
+    char pcaperr[PCAP_ERRBUF_SIZE];
+    struct io_pcap *p;
+
+    *iop = NULL;
+    if ( ( p = calloc( 1, sizeof( struct io_pcap ) ) ) == NULL ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "Out of memory" );
+        return -1;
+    }
+    p->io.ops = &savefile_ops;
+
+    if ( ( p->pcap = pcap_open_offline( path, pcaperr ) ) == NULL ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "pcap_open_offline failed: %.200s", pcaperr );
+        goto fail;
+    }
+    if ( pcap_datalink( p->pcap ) != DLT_EN10MB ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "%s is not an ethernet capture.", path );
+        goto fail;
+    }
+    if ( set_filter( p, filter, errbuf ) == -1 ) goto fail;
+
+    if ( dump_path ) {
+        if ( ( p->dead = pcap_open_dead( DLT_EN10MB, IO_FRAME_MAX ) ) == NULL ||
+            ( p->dump = pcap_dump_open( p->dead, dump_path ) ) == NULL ) {
+            snprintf( errbuf, IO_ERRBUF_SIZE, "Unable to open %s for writing", dump_path );
+            goto fail;
+        }
+    }
+
+    *iop = &p->io;
+    return 0;
+
+fail:
+    capture_close( &p->io );
+    return -1;
+}
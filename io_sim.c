@@ -0,0 +1,919 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#define __USE_BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __FreeBSD__
+#include <netinet/in_systm.h>
+#endif
+
+#ifdef __linux
+#define ETHERTYPE_IPV6 ETH_P_IPV6
+#define __FAVOR_BSD
+#endif
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <netinet/if_ether.h>
+#include "io.h"
+#include "checksums.h"
+
+#define SIZEOF_ETHER sizeof( struct ether_header )
+#define SIZEOF_IPV4 sizeof( struct ip )
+#define SIZEOF_IPV6 sizeof( struct ip6_hdr )
+/*
+ * First fragments smaller than this (IP header on) count as short, as in the
+ * tests; like tiny fragment filters (RFC 1858), later fragments are let be.
+ */
+#define MINIMUM_PACKET_SIZE 68
+#define SIM_RULES_MAX 64
+/* Replies are no bigger. */
+#define SIM_FRAME_MAX 256
+/* Nor are first fragments kept until the rest arrive: IPv6's minimum MTU. */
+#define SIM_FIRST_FRAGMENT_MAX ( SIZEOF_ETHER + 1280 )
+/* First fragments waiting for the rest: hash buckets, and room for as many to start with. */
+#define SIM_FRAGMENTS 4096
+/* How long a first fragment waits for the rest, as Linux's ipfrag_time. */
+#define SIM_REASSEMBLY_TIMEOUT 30
+/* Targets whose own ICMP rate limit is tracked, a direct mapped table. */
+#define SIM_HOSTS 4096
+#define SIM_SPEC_MAX 1024
+
+enum SIM_BEHAVIOUR {
+    SIM_PASS = 0,
+    SIM_NO_REASSEMBLY,
+    SIM_DROP_SHORT_FRAGMENTS,
+    SIM_DROP_FRAGMENTS,
+    SIM_DROP_OPTIONED,
+    SIM_DROP_ALL
+};
+
+/* Indexed by enum SIM_BEHAVIOUR. */
+static const char *behaviour_names[] = {
+    "pass",
+    "no-reassembly",
+    "drop-short-frags",
+    "drop-frags",
+    "drop-optioned",
+    "drop-all",
+    NULL
+};
+
+struct sim_rule {
+    int family;
+    unsigned char prefix[16];
+    unsigned int len;
+    enum SIM_BEHAVIOUR behaviour;
+    /* For drop-short-frags: first fragments shorter than this are short. */
+    unsigned int short_below;
+    /* The router that drops, 0 for the target's own edge. */
+    unsigned int at;
+};
+
+/* A reply on its way back. */
+struct sim_event {
+    struct timeval when;
+    /* Breaks ties in when, so replies due together arrive in send order. */
+    unsigned long seq;
+    unsigned int len;
+    char frame[SIM_FRAME_MAX];
+    struct sim_event *next_free;
+};
+
+/* One target's ICMP token bucket. */
+struct sim_host {
+    int used;
+    unsigned char addr[16];
+    double tokens;
+    struct timeval refilled;
+};
+
+struct sim_fragment {
+    int used;
+    /* The next in its bucket, or on the free list. */
+    int next;
+    unsigned int bucket;
+    struct timeval when;
+    unsigned char dst[16];
+    unsigned int id;
+    unsigned int len;
+    char frame[SIM_FIRST_FRAGMENT_MAX];
+};
+
+/* What the network looks at in a frame sent. */
+struct sim_packet {
+    int family;
+    unsigned char dst[16];
+    /* IP header onwards. */
+    unsigned int ip_len;
+    int optioned;
+    int fragment;
+    int first;
+    int last;
+    unsigned int id;
+    unsigned int ttl;
+};
+
+struct io_sim {
+    struct io_backend io;
+    struct timeval now;
+
+    double loss;
+    long rtt_usec;
+    long jitter_usec;
+    double tail;
+    long tail_usec;
+    double icmp_rate;
+    /* Each target's own limit, 0 for none, and the burst it allows. */
+    double host_icmp_rate;
+    double host_icmp_burst;
+    /* Routers between us and every target. */
+    unsigned int hops;
+    struct sim_rule rules[SIM_RULES_MAX];
+    unsigned int rule_count;
+    uint64_t rng;
+
+    double icmp_tokens;
+    struct timeval icmp_refilled;
+
+    /* Min-heap on when, then seq. */
+    struct sim_event **heap;
+    unsigned int heap_count;
+    unsigned int heap_size;
+    unsigned long seq;
+    struct sim_event *free_events;
+    /* Handed out by the last recv, recycled on the next. */
+    struct sim_event *held[IO_BATCH];
+    unsigned int held_count;
+
+    struct sim_host *hosts;
+    /* Chained from buckets, grown when they run out, so only reassembly_max turns one away. */
+    struct sim_fragment *fragments;
+    unsigned int fragment_count;
+    int *fragment_buckets;
+    int free_fragment;
+    /* Incomplete reassemblies held, and how many fit (0 for no limit). */
+    unsigned int reassembling;
+    unsigned int reassembly_max;
+    struct timeval reassembly_swept;
+    unsigned long received;
+};
+
+/* xorshift64*, so a seed always replays the same network. */
+static double sim_random( struct io_sim *s )
+{
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return ( ( s->rng * 2685821657736338717ULL ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+static void add_usec( struct timeval *tv, long usec )
+{
+    tv->tv_sec += usec / 1000000;
+    tv->tv_usec += usec % 1000000;
+    if ( tv->tv_usec >= 1000000 ) {
+        tv->tv_sec++;
+        tv->tv_usec -= 1000000;
+    }
+}
+
+static int event_before( const struct sim_event *a, const struct sim_event *b )
+{
+    if ( timercmp( &a->when, &b->when, != ) ) return timercmp( &a->when, &b->when, < );
+    return a->seq < b->seq;
+}
+
+static int heap_push( struct io_sim *s, struct sim_event *event )
+{
+    struct sim_event **heap;
+    unsigned int x, parent;
+
+    if ( s->heap_count == s->heap_size ) {
+        if ( ( heap = realloc( s->heap, sizeof( struct sim_event * ) * s->heap_size * 2 ) ) == NULL ) return -1;
+        s->heap = heap;
+        s->heap_size *= 2;
+    }
+    for ( x = s->heap_count++; x; x = parent ) {
+        parent = ( x - 1 ) / 2;
+        if ( !event_before( event, s->heap[parent] ) ) break;
+        s->heap[x] = s->heap[parent];
+    }
+    s->heap[x] = event;
+    return 0;
+}
+
+static struct sim_event *heap_pop( struct io_sim *s )
+{
+    struct sim_event *top = s->heap[0], *last = s->heap[--s->heap_count];
+    unsigned int x = 0, child;
+
+    while ( ( child = 2 * x + 1 ) < s->heap_count ) {
+        if ( child + 1 < s->heap_count && event_before( s->heap[child + 1], s->heap[child] ) ) child++;
+        if ( !event_before( s->heap[child], last ) ) break;
+        s->heap[x] = s->heap[child];
+        x = child;
+    }
+    s->heap[x] = last;
+    return top;
+}
+
+static struct sim_event *get_event( struct io_sim *s )
+{
+    struct sim_event *event = s->free_events;
+
+    if ( event ) {
+        s->free_events = event->next_free;
+        return event;
+    }
+    return malloc( sizeof( struct sim_event ) );
+}
+
+static void put_event( struct io_sim *s, struct sim_event *event )
+{
+    event->next_free = s->free_events;
+    s->free_events = event;
+}
+
+/* Returns -1 if the frame isn't IPv4 or IPv6. */
+static int parse_packet( const char *frame, unsigned int len, struct sim_packet *packet )
+{
+    const struct ether_header *ethh = (const struct ether_header *) frame;
+
+    memset( packet, 0, sizeof( struct sim_packet ) );
+    if ( len < SIZEOF_ETHER ) return -1;
+    packet->ip_len = len - SIZEOF_ETHER;
+
+    if ( ntohs( ethh->ether_type ) == ETHERTYPE_IP ) {
+        const struct ip *iph = (const struct ip *) ( frame + SIZEOF_ETHER );
+        unsigned short off;
+
+        if ( packet->ip_len < SIZEOF_IPV4 ) return -1;
+        off = ntohs( iph->ip_off );
+        packet->family = AF_INET;
+        memcpy( packet->dst, &iph->ip_dst, sizeof( struct in_addr ) );
+        packet->optioned = iph->ip_hl > SIZEOF_IPV4 / 4;
+        packet->fragment = ( off & ( IP_MF | IP_OFFMASK ) ) != 0;
+        packet->first = !( off & IP_OFFMASK );
+        packet->last = !( off & IP_MF );
+        packet->id = ntohs( iph->ip_id );
+        packet->ttl = iph->ip_ttl;
+        return 0;
+    }
+
+    if ( ntohs( ethh->ether_type ) == ETHERTYPE_IPV6 ) {
+        const struct ip6_hdr *ip6h = (const struct ip6_hdr *) ( frame + SIZEOF_ETHER );
+        unsigned int hl = SIZEOF_IPV6;
+        int next_header;
+
+        if ( packet->ip_len < SIZEOF_IPV6 ) return -1;
+        packet->family = AF_INET6;
+        memcpy( packet->dst, &ip6h->ip6_dst, sizeof( struct in6_addr ) );
+        packet->first = packet->last = 1;
+        packet->ttl = ip6h->ip6_hlim;
+        next_header = ip6h->ip6_nxt;
+        while ( next_header == IPPROTO_FRAGMENT || next_header == IPPROTO_DSTOPTS ) {
+            const char *ext = (const char *) ip6h + hl;
+
+            if ( packet->ip_len < hl + 8 ) return 0;
+            if ( next_header == IPPROTO_FRAGMENT ) {
+                const struct ip6_frag *fragh = (const struct ip6_frag *) ext;
+                packet->fragment = 1;
+                packet->first = !( fragh->ip6f_offlg & IP6F_OFF_MASK );
+                packet->last = !( fragh->ip6f_offlg & IP6F_MORE_FRAG );
+                packet->id = ntohl( fragh->ip6f_ident );
+                next_header = fragh->ip6f_nxt;
+                hl += sizeof( struct ip6_frag );
+            } else {
+                const struct ip6_dest *desth = (const struct ip6_dest *) ext;
+                packet->optioned = 1;
+                next_header = desth->ip6d_nxt;
+                hl += ( desth->ip6d_len + 1 ) * 8;
+            }
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/* The longest matching rule, NULL if none. */
+static const struct sim_rule *rule_for( struct io_sim *s, const struct sim_packet *packet )
+{
+    const struct sim_rule *rule, *found = NULL;
+    unsigned int x, bytes, bits;
+
+    for ( x = 0; x < s->rule_count; x++ ) {
+        rule = &s->rules[x];
+        if ( rule->family != packet->family || ( found && rule->len <= found->len ) ) continue;
+        bytes = rule->len / 8;
+        bits = rule->len % 8;
+        if ( memcmp( rule->prefix, packet->dst, bytes ) != 0 ) continue;
+        if ( bits && ( ( rule->prefix[bytes] ^ packet->dst[bytes] ) & ( 0xff << ( 8 - bits ) ) ) ) continue;
+        found = rule;
+    }
+    return found;
+}
+
+static int acl_drops( const struct sim_rule *rule, const struct sim_packet *packet )
+{
+    switch ( rule ? rule->behaviour : SIM_PASS ) {
+        case SIM_DROP_ALL:
+            return 1;
+        case SIM_DROP_FRAGMENTS:
+            return packet->fragment;
+        case SIM_DROP_SHORT_FRAGMENTS:
+            return packet->fragment && packet->first && packet->ip_len < rule->short_below;
+        case SIM_DROP_OPTIONED:
+            return packet->optioned;
+        default:
+            return 0;
+    }
+}
+
+/* Room for another ICMP message, by token bucket with a second's burst. */
+static int icmp_allowed( struct io_sim *s )
+{
+    struct timeval elapsed;
+
+    if ( s->icmp_rate <= 0 ) return 1;
+    timersub( &s->now, &s->icmp_refilled, &elapsed );
+    s->icmp_tokens += ( elapsed.tv_sec + elapsed.tv_usec / 1000000.0 ) * s->icmp_rate;
+    if ( s->icmp_tokens > s->icmp_rate ) s->icmp_tokens = s->icmp_rate;
+    s->icmp_refilled = s->now;
+    if ( s->icmp_tokens < 1 ) return 0;
+    s->icmp_tokens--;
+    return 1;
+}
+
+/* The same for a target of its own, which a colliding target takes over. */
+static int host_icmp_allowed( struct io_sim *s, const struct sim_packet *packet )
+{
+    struct sim_host *host;
+    struct timeval elapsed;
+    unsigned int hash;
+
+    if ( s->host_icmp_rate <= 0 ) return 1;
+    memcpy( &hash, packet->dst + ( packet->family == AF_INET ? 0 : 12 ), sizeof( unsigned int ) );
+    hash = ( hash ^ hash >> 16 ) * 2654435761U;
+    host = &s->hosts[( hash >> 16 ) % SIM_HOSTS];
+    if ( !host->used || memcmp( host->addr, packet->dst, 16 ) != 0 ) {
+        host->used = 1;
+        memcpy( host->addr, packet->dst, 16 );
+        host->tokens = s->host_icmp_burst;
+        host->refilled = s->now;
+    }
+    timersub( &s->now, &host->refilled, &elapsed );
+    host->tokens += ( elapsed.tv_sec + elapsed.tv_usec / 1000000.0 ) * s->host_icmp_rate;
+    if ( host->tokens > s->host_icmp_burst ) host->tokens = s->host_icmp_burst;
+    host->refilled = s->now;
+    if ( host->tokens < 1 ) return 0;
+    host->tokens--;
+    return 1;
+}
+
+static int is_icmp( const char *frame, unsigned int len )
+{
+    const struct ether_header *ethh = (const struct ether_header *) frame;
+
+    if ( ntohs( ethh->ether_type ) == ETHERTYPE_IP )
+        return ( (const struct ip *) ( frame + SIZEOF_ETHER ) )->ip_p == IPPROTO_ICMP;
+    return ( (const struct ip6_hdr *) ( frame + SIZEOF_ETHER ) )->ip6_nxt == IPPROTO_ICMPV6;
+}
+
+/* Stop holding a first fragment. */
+static void drop_fragment( struct io_sim *s, int idx )
+{
+    struct sim_fragment *held = &s->fragments[idx];
+    int *link = &s->fragment_buckets[held->bucket];
+
+    while ( *link != idx ) link = &s->fragments[*link].next;
+    *link = held->next;
+    held->used = 0;
+    held->next = s->free_fragment;
+    s->free_fragment = idx;
+    s->reassembling--;
+}
+
+/* Put fragments from count up on the free list. */
+static void free_fragments( struct io_sim *s, unsigned int count )
+{
+    unsigned int x;
+
+    for ( x = s->fragment_count; x > count; x-- ) {
+        s->fragments[x - 1].used = 0;
+        s->fragments[x - 1].next = s->free_fragment;
+        s->free_fragment = x - 1;
+    }
+}
+
+/* A free entry for a first fragment in bucket, or -1 if there is no memory for one. */
+static int hold_fragment( struct io_sim *s, unsigned int bucket )
+{
+    struct sim_fragment *fragments;
+    unsigned int count = s->fragment_count;
+    int idx;
+
+    if ( s->free_fragment == -1 ) {
+        if ( ( fragments = realloc( s->fragments, sizeof( struct sim_fragment ) * count * 2 ) ) == NULL ) return -1;
+        s->fragments = fragments;
+        s->fragment_count = count * 2;
+        free_fragments( s, count );
+    }
+    idx = s->free_fragment;
+    s->free_fragment = s->fragments[idx].next;
+    s->fragments[idx].used = 1;
+    s->fragments[idx].bucket = bucket;
+    s->fragments[idx].next = s->fragment_buckets[bucket];
+    s->fragment_buckets[bucket] = idx;
+    s->reassembling++;
+    return idx;
+}
+
+/*
+ * Give up on reassemblies that have waited too long, as a full table would,
+ * at most once a (virtual) second. Returns whether there is room now.
+ */
+static int reassembly_room( struct io_sim *s )
+{
+    struct timeval elapsed;
+    unsigned int x;
+
+    if ( !s->reassembly_max || s->reassembling < s->reassembly_max ) return 1;
+    timersub( &s->now, &s->reassembly_swept, &elapsed );
+    if ( elapsed.tv_sec < 1 ) return 0;
+    s->reassembly_swept = s->now;
+    for ( x = 0; x < s->fragment_count; x++ ) {
+        if ( !s->fragments[x].used ) continue;
+        timersub( &s->now, &s->fragments[x].when, &elapsed );
+        if ( elapsed.tv_sec < SIM_REASSEMBLY_TIMEOUT ) continue;
+        drop_fragment( s, x );
+    }
+    return s->reassembling < s->reassembly_max;
+}
+
+/*
+ * The host's answer to one frame, written into event. Fragments are held
+ * until the last one arrives, so a lost second fragment means no reply, as
+ * does a first fragment that finds reassembly full. Returns -1 if there is
+ * no memory to hold a fragment in.
+ */
+static int host_reply( struct io_sim *s, enum SIM_BEHAVIOUR behaviour, const struct sim_packet *packet, const char *frame, unsigned int len, struct sim_event *event )
+{
+    static int reassemble = 1, no_reassembly = 0;
+    struct sim_fragment *held;
+    unsigned int hash, bucket, reply_len;
+    int idx;
+
+    if ( !packet->fragment ) return io_loopback_host( &reassemble, frame, len, event->frame, SIM_FRAME_MAX );
+    if ( behaviour == SIM_NO_REASSEMBLY ) {
+        if ( !packet->first ) return 0;
+        return io_loopback_host( &no_reassembly, frame, len, event->frame, SIM_FRAME_MAX );
+    }
+
+    memcpy( &hash, packet->dst + ( packet->family == AF_INET ? 0 : 12 ), sizeof( unsigned int ) );
+    hash = ( hash ^ packet->id ) * 2654435761U;
+    bucket = ( hash >> 16 ) % SIM_FRAGMENTS;
+    for ( idx = s->fragment_buckets[bucket]; idx != -1; idx = s->fragments[idx].next ) {
+        held = &s->fragments[idx];
+        if ( held->id == packet->id && memcmp( held->dst, packet->dst, 16 ) == 0 ) break;
+    }
+    if ( packet->first ) {
+        if ( len > SIM_FIRST_FRAGMENT_MAX ) return 0;
+        /* A first fragment sent again takes the place of the one held. */
+        if ( idx == -1 ) {
+            if ( !reassembly_room( s ) ) return 0;
+            if ( ( idx = hold_fragment( s, bucket ) ) == -1 ) return -1;
+        }
+        held = &s->fragments[idx];
+        held->when = s->now;
+        memcpy( held->dst, packet->dst, 16 );
+        held->id = packet->id;
+        held->len = len;
+        memcpy( held->frame, frame, len );
+        return 0;
+    }
+    if ( !packet->last || idx == -1 ) return 0;
+    held = &s->fragments[idx];
+    drop_fragment( s, idx );
+    reply_len = io_loopback_host( &reassemble, held->frame, held->len, event->frame, SIM_FRAME_MAX );
+    return reply_len;
+}
+
+/*
+ * Router hop's time exceeded error for a frame whose TTL ran out there. Hop
+ * n is 198.18.0.n or 2001:db8::n. It quotes the IP headers and 8 bytes
+ * past them (IPv4, which only reports first fragments) or as much of the
+ * frame as fits (IPv6).
+ */
+static unsigned int router_reply( unsigned int hop, const struct sim_packet *packet, const char *frame, unsigned int len, struct sim_event *event )
+{
+    char *reply = event->frame;
+    unsigned int quote, l4_len;
+
+    memcpy( reply, frame + ETHER_ADDR_LEN, ETHER_ADDR_LEN );
+    memcpy( reply + ETHER_ADDR_LEN, frame, ETHER_ADDR_LEN );
+    memcpy( reply + 2 * ETHER_ADDR_LEN, frame + 2 * ETHER_ADDR_LEN, 2 );
+
+    if ( packet->family == AF_INET ) {
+        const struct ip *iph = (const struct ip *) ( frame + SIZEOF_ETHER );
+        struct ip *reply_iph = (struct ip *) ( reply + SIZEOF_ETHER );
+        struct icmp *icmph = (struct icmp *) ( (char *) reply_iph + SIZEOF_IPV4 );
+
+        if ( !packet->first ) return 0;
+        quote = iph->ip_hl * 4 + 8;
+        if ( quote > packet->ip_len ) quote = packet->ip_len;
+        l4_len = 8 + quote;
+        if ( SIZEOF_ETHER + SIZEOF_IPV4 + l4_len > SIM_FRAME_MAX ) return 0;
+
+        memset( reply_iph, 0, SIZEOF_IPV4 + 8 );
+        reply_iph->ip_v = 4;
+        reply_iph->ip_hl = SIZEOF_IPV4 / 4;
+        reply_iph->ip_ttl = 64;
+        reply_iph->ip_p = IPPROTO_ICMP;
+        reply_iph->ip_len = htons( SIZEOF_IPV4 + l4_len );
+        reply_iph->ip_src.s_addr = htonl( 0xc6120000 | hop );
+        reply_iph->ip_dst = iph->ip_src;
+        icmph->icmp_type = ICMP_TIMXCEED;
+        icmph->icmp_code = ICMP_TIMXCEED_INTRANS;
+        memcpy( (char *) icmph + 8, iph, quote );
+        do_checksum( (char *) reply_iph, IPPROTO_ICMP, l4_len );
+        do_checksum( (char *) reply_iph, IPPROTO_IP, SIZEOF_IPV4 );
+        return SIZEOF_ETHER + SIZEOF_IPV4 + l4_len;
+    } else {
+        const struct ip6_hdr *ip6h = (const struct ip6_hdr *) ( frame + SIZEOF_ETHER );
+        struct ip6_hdr *reply_ip6h = (struct ip6_hdr *) ( reply + SIZEOF_ETHER );
+        struct icmp6_hdr *icmp6h = (struct icmp6_hdr *) ( (char *) reply_ip6h + SIZEOF_IPV6 );
+
+        quote = packet->ip_len;
+        if ( quote > SIM_FRAME_MAX - SIZEOF_ETHER - SIZEOF_IPV6 - 8 ) quote = SIM_FRAME_MAX - SIZEOF_ETHER - SIZEOF_IPV6 - 8;
+        l4_len = 8 + quote;
+
+        memset( reply_ip6h, 0, SIZEOF_IPV6 + 8 );
+        reply_ip6h->ip6_flow = htonl( 6 << 28 );
+        reply_ip6h->ip6_hlim = 64;
+        reply_ip6h->ip6_nxt = IPPROTO_ICMPV6;
+        reply_ip6h->ip6_plen = htons( l4_len );
+        reply_ip6h->ip6_src.s6_addr[0] = 0x20;
+        reply_ip6h->ip6_src.s6_addr[1] = 0x01;
+        reply_ip6h->ip6_src.s6_addr[2] = 0x0d;
+        reply_ip6h->ip6_src.s6_addr[3] = 0xb8;
+        reply_ip6h->ip6_src.s6_addr[15] = hop;
+        reply_ip6h->ip6_dst = ip6h->ip6_src;
+        icmp6h->icmp6_type = ICMP6_TIME_EXCEEDED;
+        icmp6h->icmp6_code = ICMP6_TIME_EXCEED_TRANSIT;
+        memcpy( (char *) icmp6h + 8, ip6h, quote );
+        do_checksum( (char *) reply_ip6h, IPPROTO_ICMPV6, l4_len );
+        return SIZEOF_ETHER + SIZEOF_IPV6 + l4_len;
+    }
+}
+
+static long latency_usec( struct io_sim *s )
+{
+    long usec = s->rtt_usec;
+
+    if ( s->jitter_usec ) usec += sim_random( s ) * s->jitter_usec;
+    if ( s->tail > 0 && sim_random( s ) < s->tail ) usec += sim_random( s ) * s->tail_usec;
+    return usec;
+}
+
+static int sim_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    struct io_sim *s = (struct io_sim *) io;
+    struct sim_packet packet;
+    struct sim_event *event;
+    const struct sim_rule *rule;
+    enum SIM_BEHAVIOUR behaviour;
+    unsigned int x, hop, at;
+    int len;
+
+    for ( x = 0; x < count; x++ ) {
+        if ( parse_packet( frames[x].data, frames[x].len, &packet ) == -1 ) continue;
+        if ( s->loss > 0 && sim_random( s ) < s->loss ) continue;
+        rule = rule_for( s, &packet );
+        behaviour = rule ? rule->behaviour : SIM_PASS;
+        /* Where the TTL runs out, s->hops + 1 being the target. */
+        hop = packet.ttl <= s->hops ? ( packet.ttl ? packet.ttl : 1 ) : s->hops + 1;
+        /* Routers drop on the way in, before looking at the TTL. */
+        at = rule && rule->at && rule->at <= s->hops ? rule->at : s->hops + 1;
+        if ( at <= hop && acl_drops( rule, &packet ) ) continue;
+
+        if ( ( event = get_event( s ) ) == NULL ) {
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "Out of memory for simulated replies" );
+            return x ? (int) x : -1;
+        }
+        if ( hop <= s->hops ) {
+            event->len = router_reply( hop, &packet, frames[x].data, frames[x].len, event );
+        } else if ( ( len = host_reply( s, behaviour, &packet, frames[x].data, frames[x].len, event ) ) == -1 ) {
+            put_event( s, event );
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "Out of memory for held fragments" );
+            return x ? (int) x : -1;
+        } else {
+            event->len = len;
+        }
+        if ( !event->len ||
+            ( is_icmp( event->frame, event->len ) && ( !icmp_allowed( s ) || ( hop > s->hops && !host_icmp_allowed( s, &packet ) ) ) ) ||
+            ( s->loss > 0 && sim_random( s ) < s->loss ) ) {
+            put_event( s, event );
+            continue;
+        }
+        event->when = s->now;
+        /* Routers are spread evenly along the path. */
+        add_usec( &event->when, latency_usec( s ) * hop / ( s->hops + 1 ) );
+        event->seq = s->seq++;
+        if ( heap_push( s, event ) == -1 ) {
+            put_event( s, event );
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "Out of memory for simulated replies" );
+            return x ? (int) x : -1;
+        }
+    }
+    return count;
+}
+
+static int sim_recv( struct io_backend *io, struct io_frame *frames, unsigned int max )
+{
+    struct io_sim *s = (struct io_sim *) io;
+    unsigned int x;
+
+    for ( x = 0; x < s->held_count; x++ ) {
+        put_event( s, s->held[x] );
+    }
+    for ( x = 0; x < max && x < IO_BATCH && s->heap_count; x++ ) {
+        if ( timercmp( &s->heap[0]->when, &s->now, > ) ) break;
+        s->held[x] = heap_pop( s );
+        frames[x].data = s->held[x]->frame;
+        frames[x].len = s->held[x]->len;
+        frames[x].ts = s->held[x]->when;
+    }
+    s->held_count = x;
+    s->received += x;
+    return x;
+}
+
+static int sim_fd( struct io_backend *io )
+{
+    return -1;
+}
+
+static void sim_stats( struct io_backend *io, struct io_stats *stats )
+{
+    memset( stats, 0, sizeof( struct io_stats ) );
+    stats->received = ( (struct io_sim *) io )->received;
+}
+
+static void sim_close( struct io_backend *io )
+{
+    struct io_sim *s = (struct io_sim *) io;
+    struct sim_event *event;
+    unsigned int x;
+
+    for ( x = 0; x < s->held_count; x++ ) {
+        free( s->held[x] );
+    }
+    for ( x = 0; x < s->heap_count; x++ ) {
+        free( s->heap[x] );
+    }
+    while ( ( event = s->free_events ) ) {
+        s->free_events = event->next_free;
+        free( event );
+    }
+    free( s->heap );
+    free( s->hosts );
+    free( s->fragments );
+    free( s->fragment_buckets );
+    free( s );
+}
+
+static void sim_now( struct io_backend *io, struct timeval *now )
+{
+    *now = ( (struct io_sim *) io )->now;
+}
+
+static void sim_wait( struct io_backend *io, const struct timeval *until )
+{
+    struct io_sim *s = (struct io_sim *) io;
+    struct timeval next = *until;
+
+    if ( s->heap_count && timercmp( &s->heap[0]->when, &next, < ) ) next = s->heap[0]->when;
+    if ( timercmp( &next, &s->now, > ) ) s->now = next;
+}
+
+static const struct io_ops sim_ops = {
+    "sim",
+    sim_send,
+    sim_recv,
+    sim_fd,
+    sim_stats,
+    sim_close,
+    sim_now,
+    sim_wait
+};
+
+/* A probability as 0.3 or 30%. */
+static int parse_probability( const char *value, double *p )
+{
+    char *end;
+
+    *p = strtod( value, &end );
+    if ( end == value ) return -1;
+    if ( *end == '%' ) {
+        *p /= 100;
+        end++;
+    }
+    return ( *end || *p < 0 || *p > 1 ) ? -1 : 0;
+}
+
+/* Milliseconds, possibly fractional, to microseconds. */
+static int parse_ms( const char *value, long *usec )
+{
+    char *end;
+    double ms = strtod( value, &end );
+
+    if ( end == value || *end || ms < 0 || ms > 3600000 ) return -1;
+    *usec = ms * 1000;
+    return 0;
+}
+
+static int parse_rule( struct io_sim *s, char *key, char *value )
+{
+    struct sim_rule *rule;
+    char *len_str = strchr( key, '/' ), *at_str = strchr( value, '@' ), *size_str, *end;
+    long len, at = 0, size = MINIMUM_PACKET_SIZE;
+    int x;
+
+    if ( s->rule_count == SIM_RULES_MAX ) return -1;
+    rule = &s->rules[s->rule_count];
+    *len_str++ = '\0';
+    if ( inet_pton( AF_INET, key, rule->prefix ) == 1 ) {
+        rule->family = AF_INET;
+    } else if ( inet_pton( AF_INET6, key, rule->prefix ) == 1 ) {
+        rule->family = AF_INET6;
+    } else {
+        return -1;
+    }
+    len = strtol( len_str, &end, 10 );
+    if ( end == len_str || *end || len < 0 || len > ( rule->family == AF_INET ? 32 : 128 ) ) return -1;
+    rule->len = len;
+    if ( at_str ) {
+        *at_str++ = '\0';
+        at = strtol( at_str, &end, 10 );
+        if ( end == at_str || *end || at < 1 || at > 255 ) return -1;
+    }
+    rule->at = at;
+    if ( ( size_str = strchr( value, ':' ) ) ) {
+        *size_str++ = '\0';
+        size = strtol( size_str, &end, 10 );
+        if ( end == size_str || *end || size < 1 || size > 65535 || strcmp( value, "drop-short-frags" ) != 0 ) return -1;
+    }
+    rule->short_below = size;
+
+    for ( x = 0; behaviour_names[x]; x++ ) {
+        if ( strcmp( value, behaviour_names[x] ) == 0 ) {
+            rule->behaviour = x;
+            s->rule_count++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int parse_spec( struct io_sim *s, const char *spec, char *errbuf )
+{
+    char buf[SIM_SPEC_MAX];
+    char *item, *value, *saveptr, *colon;
+    unsigned long seed;
+    int bad;
+
+    if ( !spec ) return 0;
+    if ( strlen( spec ) >= SIM_SPEC_MAX ) {
+        snprintf( errbuf, IO_ERRBUF_SIZE, "Simulator settings too long" );
+        return -1;
+    }
+    strcpy( buf, spec );
+
+    for ( item = strtok_r( buf, ",", &saveptr ); item; item = strtok_r( NULL, ",", &saveptr ) ) {
+        if ( ( value = strchr( item, '=' ) ) == NULL ) {
+            bad = 1;
+        } else {
+            *value++ = '\0';
+            if ( strchr( item, '/' ) ) {
+                bad = parse_rule( s, item, value ) == -1;
+            } else if ( strcmp( item, "loss" ) == 0 ) {
+                bad = parse_probability( value, &s->loss ) == -1;
+            } else if ( strcmp( item, "rtt" ) == 0 ) {
+                bad = parse_ms( value, &s->rtt_usec ) == -1;
+            } else if ( strcmp( item, "jitter" ) == 0 ) {
+                bad = parse_ms( value, &s->jitter_usec ) == -1;
+            } else if ( strcmp( item, "tail" ) == 0 ) {
+                bad = ( colon = strchr( value, ':' ) ) == NULL;
+                if ( !bad ) {
+                    *colon++ = '\0';
+                    bad = parse_probability( value, &s->tail ) == -1 || parse_ms( colon, &s->tail_usec ) == -1;
+                }
+            } else if ( strcmp( item, "hops" ) == 0 ) {
+                s->hops = strtoul( value, &colon, 10 );
+                bad = colon == value || *colon || s->hops > 255;
+            } else if ( strcmp( item, "reassembly" ) == 0 ) {
+                s->reassembly_max = strtoul( value, &colon, 10 );
+                bad = colon == value || *colon;
+            } else if ( strcmp( item, "icmp-rate" ) == 0 ) {
+                s->icmp_rate = strtod( value, &colon );
+                bad = colon == value || *colon || s->icmp_rate < 0;
+            } else if ( strcmp( item, "host-icmp-rate" ) == 0 ) {
+                s->host_icmp_rate = strtod( value, &colon );
+                bad = colon == value || *colon != ':' || s->host_icmp_rate < 0;
+                if ( !bad ) {
+                    value = colon + 1;
+                    s->host_icmp_burst = strtod( value, &colon );
+                    bad = colon == value || *colon || s->host_icmp_burst < 1;
+                }
+            } else if ( strcmp( item, "seed" ) == 0 ) {
+                seed = strtoul( value, &colon, 10 );
+                bad = colon == value || *colon;
+                /* xorshift never leaves zero. */
+                s->rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+            } else {
+                bad = 1;
+            }
+        }
+        if ( bad ) {
+            snprintf( errbuf, IO_ERRBUF_SIZE, "Invalid simulator setting: %.200s", item );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int io_open_sim( struct io_backend **iop, const char *spec, char *errbuf )
+{
+    struct io_sim *s;
+    unsigned int x;
+
+    *iop = NULL;
+    if ( ( s = calloc( 1, sizeof( struct io_sim ) ) ) == NULL ) goto nomem;
+    s->io.ops = &sim_ops;
+    s->rtt_usec = 1000;
+    s->rng = 1;
+    s->heap_size = 1024;
+    if ( ( s->heap = malloc( sizeof( struct sim_event * ) * s->heap_size ) ) == NULL ) goto nomem;
+    if ( ( s->fragments = malloc( sizeof( struct sim_fragment ) * SIM_FRAGMENTS ) ) == NULL ) goto nomem;
+    if ( ( s->fragment_buckets = malloc( sizeof( int ) * SIM_FRAGMENTS ) ) == NULL ) goto nomem;
+    for ( x = 0; x < SIM_FRAGMENTS; x++ ) {
+        s->fragment_buckets[x] = -1;
+    }
+    s->fragment_count = SIM_FRAGMENTS;
+    s->free_fragment = -1;
+    free_fragments( s, 0 );
+    if ( ( s->hosts = calloc( SIM_HOSTS, sizeof( struct sim_host ) ) ) == NULL ) goto nomem;
+    if ( parse_spec( s, spec, errbuf ) == -1 ) {
+        sim_close( &s->io );
+        return -1;
+    }
+
+    /* Virtual time starts now, so timestamps still look sensible. */
+    gettimeofday( &s->now, NULL );
+    s->icmp_refilled = s->now;
+    s->icmp_tokens = s->icmp_rate;
+    s->reassembly_swept = s->now;
+    *iop = &s->io;
+    return 0;
+
+nomem:
+    if ( s ) sim_close( &s->io );
+    snprintf( errbuf, IO_ERRBUF_SIZE, "Out of memory for the simulator" );
+    return -1;
+}
@@ -0,0 +1,741 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "io.h"
+
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/if_xdp.h> ) && __has_include( <linux/bpf.h> )
+#define HAVE_AF_XDP 1
+#endif
+#endif
+
+#ifdef HAVE_AF_XDP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include "packet_pool.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* Every ring has XDP_RING_SIZE entries, and so do the RX and TX halves of UMEM. */
+#define XDP_FRAME_SIZE 2048
+#define XDP_RING_SIZE 2048
+#define XDP_FRAMES ( XDP_RING_SIZE * 2 )
+
+/* How long to wait for a queue still held by a closing socket. */
+#define BIND_RETRIES 20
+#define BIND_RETRY_USEC 50000
+
+/* Big enough for the reply steering program below. */
+#define PROG_MAX_INSNS 192
+
+/*
+ * One of the four rings shared with the kernel. Producer and consumer
+ * indexes only ever increase; the cached copies save touching the shared
+ * cache lines more than needed.
+ */
+struct xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *desc;
+    uint32_t mask;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    size_t map_size;
+};
+
+/*
+ * An AF_XDP socket bound to one queue of an interface, with an XDP program
+ * attached that steers our replies (and nothing else) to it. Everything
+ * else the interface receives goes to the kernel stack as usual. TX and RX
+ * share one UMEM, kept in a packet_pool.
+ */
+struct io_xdp {
+    struct io_backend io;
+    int fd;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    int zerocopy;
+    /* Frames not in the fill ring or in flight on RX are free for TX. */
+    struct packet_pool umem;
+    struct xdp_ring fill;
+    struct xdp_ring completion;
+    struct xdp_ring rx;
+    struct xdp_ring tx;
+    /* Frames handed out by the last recv, back to the fill ring next call. */
+    uint64_t held[IO_BATCH];
+    unsigned int held_count;
+    unsigned long received;
+};
+
+/* A tiny assembler for the steering program, with forward jumps to labels. */
+enum PROG_LABEL {
+    LABEL_PASS = 0,
+    LABEL_REDIRECT,
+    LABEL_TCP,
+    LABEL_UNREACH,
+    LABEL_QUOTE,
+    LABEL_QUOTED,
+    LABEL_QUOTED_ICMP,
+    LABEL_QUOTED_FRAG,
+    LABEL_QUOTED_LATER,
+    LABEL_COUNT
+};
+
+struct prog {
+    struct bpf_insn insn[PROG_MAX_INSNS];
+    int len;
+    int label[LABEL_COUNT];
+    int fixup_at[PROG_MAX_INSNS];
+    int fixup_label[PROG_MAX_INSNS];
+    int fixups;
+};
+
+static void emit( struct prog *p, unsigned char code, unsigned char dst, unsigned char src, short off, int imm )
+{
+    struct bpf_insn *insn = &p->insn[p->len++];
+
+    memset( insn, 0, sizeof( struct bpf_insn ) );
+    insn->code = code;
+    insn->dst_reg = dst;
+    insn->src_reg = src;
+    insn->off = off;
+    insn->imm = imm;
+}
+
+static void emit_jump( struct prog *p, unsigned char code, unsigned char dst, unsigned char src, int imm, int label )
+{
+    p->fixup_at[p->fixups] = p->len;
+    p->fixup_label[p->fixups++] = label;
+    emit( p, code, dst, src, 0, imm );
+}
+
+static void set_label( struct prog *p, int label )
+{
+    p->label[label] = p->len;
+}
+
+static void resolve_jumps( struct prog *p )
+{
+    int x;
+
+    for ( x = 0; x < p->fixups; x++ ) {
+        p->insn[p->fixup_at[x]].off = p->label[p->fixup_label[x]] - p->fixup_at[x] - 1;
+    }
+}
+
+/* r4 = packet field of the given size (BPF_B, BPF_H, BPF_W) at offset off from base. */
+static void load_from( struct prog *p, int size, int base, short off )
+{
+    emit( p, BPF_LDX | size | BPF_MEM, BPF_REG_4, base, off, 0 );
+}
+
+/* r4 = packet field of the given size at offset off. */
+static void load_field( struct prog *p, int size, short off )
+{
+    load_from( p, size, BPF_REG_2, off );
+}
+
+/* Pass unless base plus len is within the packet. */
+static void check_length( struct prog *p, int base, int len )
+{
+    emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, base, 0, 0 );
+    emit( p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, len );
+    emit_jump( p, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, LABEL_PASS );
+}
+
+/*
+ * Pass unless the 16 bit field at off from base is in [port, port + ports).
+ * It is loaded in network byte order, so it is swapped to host order first.
+ */
+static void check_port_range( struct prog *p, int base, short off, unsigned short port, unsigned short ports )
+{
+    load_from( p, BPF_H, base, off );
+    emit( p, BPF_ALU | BPF_END | BPF_FROM_BE, BPF_REG_4, 0, 0, 16 );
+    emit_jump( p, BPF_JMP | BPF_JLT | BPF_K, BPF_REG_4, 0, port, LABEL_PASS );
+    emit_jump( p, BPF_JMP | BPF_JGE | BPF_K, BPF_REG_4, 0, port + ports, LABEL_PASS );
+}
+
+/*
+ * Redirect if the quoted layer 4 header, at off from r7 with its protocol in
+ * r5, is one of our SYNs or echo requests, and pass otherwise.
+ */
+static void check_quoted_l4( struct prog *p, short off, int icmp, int echo_request, int be_port, unsigned short port, unsigned short ports )
+{
+    set_label( p, LABEL_QUOTED );
+    check_length( p, BPF_REG_7, off + 8 );
+    emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_TCP, LABEL_QUOTED_ICMP );
+    check_port_range( p, BPF_REG_7, off, port, ports );
+    emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_REDIRECT );
+    set_label( p, LABEL_QUOTED_ICMP );
+    emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, icmp, LABEL_PASS );
+    load_from( p, BPF_B, BPF_REG_7, off );
+    emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, echo_request, LABEL_PASS );
+    load_from( p, BPF_H, BPF_REG_7, off + 4 );
+    emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, be_port, LABEL_PASS );
+    emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_REDIRECT );
+
+    /* A later fragment's quote has no layer 4 header, only the protocol to go on. */
+    set_label( p, LABEL_QUOTED_LATER );
+    emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, IPPROTO_TCP, LABEL_REDIRECT );
+    emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, icmp, LABEL_REDIRECT );
+    emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_PASS );
+}
+
+/*
+ * Send frames addressed to src that are TCP to one of our ports (port and
+ * the ports - 1 after it), ICMP echo replies with our id (port), or the ICMP
+ * errors a fragment test can get back that quote one of our SYNs or echo
+ * requests, from src, to the socket for the queue they arrived on. A quote
+ * of a later fragment carries no layer 4 header, so the quoted protocol has
+ * to do. Everything else, and anything that doesn't fit the simple layouts
+ * checked here (IPv4 options, IPv6 extension headers, fragments, quotes cut
+ * short), is passed to the kernel; the options and headers our own probes
+ * carry are allowed for in quotes. ICMPv4 "fragmentation needed" and ICMPv6
+ * "packet too big" are always left to the kernel, which needs them for path
+ * MTU discovery.
+ *
+ * Registers: r6 context, r2 packet data, r3 packet end, r4 scratch, r5 the
+ * quoted protocol and r7 r2 moved on past the quote's options or extension
+ * headers. Fields are compared in network byte order, as loaded.
+ */
+static void build_steering_program( struct prog *p, int family, const struct in6_addr *src, unsigned short port, unsigned short ports, int map_fd )
+{
+    int be_port = htons( port );
+    uint32_t word;
+    int x;
+
+    memset( p, 0, sizeof( struct prog ) );
+
+    emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0 );
+    emit( p, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof( struct xdp_md, data ), 0 );
+    emit( p, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof( struct xdp_md, data_end ), 0 );
+
+    if ( family == AF_INET ) {
+        /* Ethernet, a bare IPv4 header and the first 8 bytes of layer 4. */
+        check_length( p, BPF_REG_2, 14 + 20 + 8 );
+        load_field( p, BPF_H, 12 );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, htons( 0x0800 ), LABEL_PASS );
+        /* Version 4, no options. */
+        load_field( p, BPF_B, 14 );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 0x45, LABEL_PASS );
+        /* Not a fragment. */
+        load_field( p, BPF_H, 14 + 6 );
+        emit_jump( p, BPF_JMP | BPF_JSET | BPF_K, BPF_REG_4, 0, htons( 0x3fff ), LABEL_PASS );
+        memcpy( &word, src, 4 );
+        load_field( p, BPF_W, 14 + 16 );
+        emit_jump( p, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, word, LABEL_PASS );
+
+        load_field( p, BPF_B, 14 + 9 );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, IPPROTO_TCP, LABEL_TCP );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, IPPROTO_ICMP, LABEL_PASS );
+
+        load_field( p, BPF_B, 34 );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 11, LABEL_QUOTE );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 3, LABEL_UNREACH );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 0, LABEL_PASS );
+        load_field( p, BPF_H, 34 + 4 );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, be_port, LABEL_PASS );
+        emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_REDIRECT );
+
+        set_label( p, LABEL_UNREACH );
+        load_field( p, BPF_B, 34 + 1 );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 4, LABEL_PASS );
+
+        /* The quoted IPv4 header, from src, past the ICMP header at 42. */
+        set_label( p, LABEL_QUOTE );
+        check_length( p, BPF_REG_2, 42 + 20 );
+        load_field( p, BPF_W, 42 + 12 );
+        emit_jump( p, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, word, LABEL_PASS );
+        load_field( p, BPF_B, 42 + 9 );
+        emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_5, BPF_REG_4, 0, 0 );
+        load_field( p, BPF_H, 42 + 6 );
+        emit_jump( p, BPF_JMP | BPF_JSET | BPF_K, BPF_REG_4, 0, htons( 0x1fff ), LABEL_QUOTED_LATER );
+        /* r7 moves on by the quote's options, so its layer 4 header is at 62 from r7. */
+        load_field( p, BPF_B, 42 );
+        emit( p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_4, 0, 0, 0x0f );
+        emit_jump( p, BPF_JMP | BPF_JLT | BPF_K, BPF_REG_4, 0, 5, LABEL_PASS );
+        emit( p, BPF_ALU64 | BPF_SUB | BPF_K, BPF_REG_4, 0, 0, 5 );
+        emit( p, BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_4, 0, 0, 2 );
+        emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_2, 0, 0 );
+        emit( p, BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_7, BPF_REG_4, 0, 0 );
+        check_quoted_l4( p, 62, IPPROTO_ICMP, 8, be_port, port, ports );
+
+        set_label( p, LABEL_TCP );
+        check_port_range( p, BPF_REG_2, 34 + 2, port, ports );
+        emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_REDIRECT );
+    } else {
+        /* Ethernet, an IPv6 header and the first 8 bytes of layer 4. */
+        check_length( p, BPF_REG_2, 14 + 40 + 8 );
+        load_field( p, BPF_H, 12 );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, htons( 0x86dd ), LABEL_PASS );
+        for ( x = 0; x < 4; x++ ) {
+            memcpy( &word, (char *) src + x * 4, 4 );
+            load_field( p, BPF_W, 14 + 24 + x * 4 );
+            emit_jump( p, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, word, LABEL_PASS );
+        }
+
+        load_field( p, BPF_B, 14 + 6 );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, IPPROTO_TCP, LABEL_TCP );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, IPPROTO_ICMPV6, LABEL_PASS );
+
+        /* Destination unreachable, time exceeded, parameter problem. */
+        load_field( p, BPF_B, 54 );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 1, LABEL_QUOTE );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 3, LABEL_QUOTE );
+        emit_jump( p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 4, LABEL_QUOTE );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 129, LABEL_PASS );
+        load_field( p, BPF_H, 54 + 4 );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, be_port, LABEL_PASS );
+        emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_REDIRECT );
+
+        /* The quoted IPv6 header, from src, past the ICMPv6 header at 62. */
+        set_label( p, LABEL_QUOTE );
+        check_length( p, BPF_REG_2, 62 + 40 );
+        for ( x = 0; x < 4; x++ ) {
+            memcpy( &word, (char *) src + x * 4, 4 );
+            load_field( p, BPF_W, 62 + 8 + x * 4 );
+            emit_jump( p, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, word, LABEL_PASS );
+        }
+        load_field( p, BPF_B, 62 + 6 );
+        emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_5, BPF_REG_4, 0, 0 );
+        emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_2, 0, 0 );
+        /* The destination options a probe's first fragment may carry, r7 moving on past them. */
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_DSTOPTS, LABEL_QUOTED_FRAG );
+        check_length( p, BPF_REG_2, 102 + 2 );
+        load_field( p, BPF_B, 102 );
+        emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_5, BPF_REG_4, 0, 0 );
+        load_field( p, BPF_B, 102 + 1 );
+        emit( p, BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_4, 0, 0, 3 );
+        emit( p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 8 );
+        emit( p, BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_7, BPF_REG_4, 0, 0 );
+        /* Then the fragment header, r7 moving on past it too unless this is a later fragment. */
+        set_label( p, LABEL_QUOTED_FRAG );
+        emit_jump( p, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_FRAGMENT, LABEL_QUOTED );
+        check_length( p, BPF_REG_7, 102 + 8 );
+        load_from( p, BPF_B, BPF_REG_7, 102 );
+        emit( p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_5, BPF_REG_4, 0, 0 );
+        load_from( p, BPF_H, BPF_REG_7, 102 + 2 );
+        emit_jump( p, BPF_JMP | BPF_JSET | BPF_K, BPF_REG_4, 0, htons( 0xfff8 ), LABEL_QUOTED_LATER );
+        emit( p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_7, 0, 0, 8 );
+        check_quoted_l4( p, 102, IPPROTO_ICMPV6, 128, be_port, port, ports );
+
+        set_label( p, LABEL_TCP );
+        check_port_range( p, BPF_REG_2, 54 + 2, port, ports );
+        emit_jump( p, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_REDIRECT );
+    }
+
+    /* bpf_redirect_map( xskmap, rx_queue_index, XDP_PASS ), passing if no socket. */
+    set_label( p, LABEL_REDIRECT );
+    emit( p, BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof( struct xdp_md, rx_queue_index ), 0 );
+    emit( p, BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd );
+    emit( p, 0, 0, 0, 0, 0 );
+    emit( p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS );
+    emit( p, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map );
+    emit( p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+
+    set_label( p, LABEL_PASS );
+    emit( p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS );
+    emit( p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+
+    resolve_jumps( p );
+}
+
+static int sys_bpf( int cmd, union bpf_attr *attr )
+{
+    return syscall( __NR_bpf, cmd, attr, sizeof( union bpf_attr ) );
+}
+
+static int fail( char *errbuf, const char *what )
+{
+    snprintf( errbuf, IO_ERRBUF_SIZE, "%s: %s", what, strerror( errno ) );
+    return -1;
+}
+
+static int load_program( struct io_xdp *port, struct prog *p, char *errbuf )
+{
+    static char log[65536];
+    union bpf_attr attr;
+    char *last;
+
+    memset( &attr, 0, sizeof( union bpf_attr ) );
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t) (unsigned long) p->insn;
+    attr.insn_cnt = p->len;
+    attr.license = (uint64_t) (unsigned long) "BSD";
+    if ( ( port->prog_fd = sys_bpf( BPF_PROG_LOAD, &attr ) ) >= 0 ) return 0;
+
+    /* Load it again with the verifier log for something more useful. */
+    log[0] = '\0';
+    attr.log_buf = (uint64_t) (unsigned long) log;
+    attr.log_size = sizeof( log );
+    attr.log_level = 1;
+    if ( ( port->prog_fd = sys_bpf( BPF_PROG_LOAD, &attr ) ) >= 0 ) return 0;
+    if ( !log[0] ) return fail( errbuf, "Unable to load XDP program" );
+
+    log[sizeof( log ) - 1] = '\0';
+    while ( ( last = strrchr( log, '\n' ) ) && last[1] == '\0' ) *last = '\0';
+    last = strrchr( log, '\n' );
+    snprintf( errbuf, IO_ERRBUF_SIZE, "XDP program rejected: %.200s", last ? last + 1 : log );
+    return -1;
+}
+
+static int map_ring( int fd, struct xdp_ring *ring, struct xdp_ring_offset *off, off_t pgoff, size_t entry_size )
+{
+    ring->map_size = off->desc + XDP_RING_SIZE * entry_size;
+    ring->map = mmap( NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff );
+    if ( ring->map == MAP_FAILED ) {
+        ring->map = NULL;
+        return -1;
+    }
+    ring->producer = (uint32_t *) ( (char *) ring->map + off->producer );
+    ring->consumer = (uint32_t *) ( (char *) ring->map + off->consumer );
+    ring->flags = (uint32_t *) ( (char *) ring->map + off->flags );
+    ring->desc = (char *) ring->map + off->desc;
+    ring->mask = XDP_RING_SIZE - 1;
+    return 0;
+}
+
+static void refill( struct io_xdp *port, uint64_t addr )
+{
+    struct xdp_ring *fill = &port->fill;
+
+    /* RX frames never outnumber the fill ring, so it can't be full. */
+    ( (uint64_t *) fill->desc )[fill->cached_prod++ & fill->mask] = addr & ~(uint64_t) ( XDP_FRAME_SIZE - 1 );
+    __atomic_store_n( fill->producer, fill->cached_prod, __ATOMIC_RELEASE );
+}
+
+static void reap_completions( struct io_xdp *port )
+{
+    struct xdp_ring *cr = &port->completion;
+    uint32_t prod = __atomic_load_n( cr->producer, __ATOMIC_ACQUIRE );
+
+    if ( cr->cached_cons == prod ) return;
+    while ( cr->cached_cons != prod ) {
+        packet_pool_put( &port->umem, port->umem.base + ( (uint64_t *) cr->desc )[cr->cached_cons++ & cr->mask] );
+    }
+    __atomic_store_n( cr->consumer, cr->cached_cons, __ATOMIC_RELEASE );
+}
+
+static void xdp_close( struct io_backend *io )
+{
+    struct io_xdp *port = (struct io_xdp *) io;
+
+    if ( port->link_fd != -1 ) close( port->link_fd );
+    if ( port->prog_fd != -1 ) close( port->prog_fd );
+    if ( port->map_fd != -1 ) close( port->map_fd );
+    if ( port->fill.map ) munmap( port->fill.map, port->fill.map_size );
+    if ( port->completion.map ) munmap( port->completion.map, port->completion.map_size );
+    if ( port->rx.map ) munmap( port->rx.map, port->rx.map_size );
+    if ( port->tx.map ) munmap( port->tx.map, port->tx.map_size );
+    if ( port->fd != -1 ) close( port->fd );
+    packet_pool_destroy( &port->umem );
+    free( port );
+}
+
+static int xdp_send( struct io_backend *io, const struct io_frame *frames, unsigned int count )
+{
+    struct io_xdp *port = (struct io_xdp *) io;
+    struct xdp_ring *tx = &port->tx;
+    struct xdp_desc *desc;
+    unsigned int x;
+    char *buf;
+
+    reap_completions( port );
+    for ( x = 0; x < count; x++ ) {
+        if ( frames[x].len > XDP_FRAME_SIZE ) {
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "Frame too big for AF_XDP" );
+            break;
+        }
+        /* TX frames never outnumber the TX ring, so having one means there's room. */
+        if ( ( buf = packet_pool_get( &port->umem ) ) == NULL ) {
+            snprintf( io->errbuf, IO_ERRBUF_SIZE, "AF_XDP TX ring full" );
+            break;
+        }
+        memcpy( buf, frames[x].data, frames[x].len );
+        desc = &( (struct xdp_desc *) tx->desc )[tx->cached_prod++ & tx->mask];
+        desc->addr = buf - port->umem.base;
+        desc->len = frames[x].len;
+        desc->options = 0;
+    }
+    if ( !x ) return -1;
+    __atomic_store_n( tx->producer, tx->cached_prod, __ATOMIC_RELEASE );
+
+    /* Copy mode only transmits from a syscall; zero-copy when the driver asks. */
+    if ( !port->zerocopy || ( __atomic_load_n( tx->flags, __ATOMIC_RELAXED ) & XDP_RING_NEED_WAKEUP ) ) {
+        if ( sendto( port->fd, NULL, 0, MSG_DONTWAIT, NULL, 0 ) == -1 &&
+            errno != EAGAIN && errno != EBUSY && errno != ENOBUFS ) return fail( io->errbuf, "AF_XDP send failed" );
+    }
+    return x;
+}
+
+static int xdp_recv( struct io_backend *io, struct io_frame *frames, unsigned int max )
+{
+    struct io_xdp *port = (struct io_xdp *) io;
+    struct xdp_ring *rx = &port->rx;
+    struct xdp_desc *desc;
+    struct timeval now;
+    unsigned int x;
+
+    for ( x = 0; x < port->held_count; x++ ) {
+        refill( port, port->held[x] );
+    }
+    port->held_count = 0;
+
+    if ( rx->cached_cons == rx->cached_prod ) {
+        rx->cached_prod = __atomic_load_n( rx->producer, __ATOMIC_ACQUIRE );
+        if ( rx->cached_cons == rx->cached_prod ) {
+            if ( __atomic_load_n( port->fill.flags, __ATOMIC_RELAXED ) & XDP_RING_NEED_WAKEUP )
+                recvfrom( port->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL );
+            return 0;
+        }
+    }
+
+    if ( max > IO_BATCH ) max = IO_BATCH;
+    gettimeofday( &now, NULL );
+    for ( x = 0; x < max && rx->cached_cons != rx->cached_prod; x++ ) {
+        desc = &( (struct xdp_desc *) rx->desc )[rx->cached_cons++ & rx->mask];
+        port->held[x] = desc->addr;
+        frames[x].data = port->umem.base + desc->addr;
+        frames[x].len = desc->len;
+        frames[x].ts = now;
+    }
+    port->held_count = x;
+    __atomic_store_n( rx->consumer, rx->cached_cons, __ATOMIC_RELEASE );
+    port->received += x;
+    return x;
+}
+
+static int xdp_fd( struct io_backend *io )
+{
+    return ( (struct io_xdp *) io )->fd;
+}
+
+static void xdp_stats( struct io_backend *io, struct io_stats *stats )
+{
+    struct io_xdp *port = (struct io_xdp *) io;
+    struct xdp_statistics xs;
+    socklen_t optlen = sizeof( struct xdp_statistics );
+
+    memset( stats, 0, sizeof( struct io_stats ) );
+    stats->received = port->received;
+    if ( getsockopt( port->fd, SOL_XDP, XDP_STATISTICS, &xs, &optlen ) == 0 )
+        stats->dropped = xs.rx_dropped + xs.rx_ring_full + xs.rx_fill_ring_empty_descs;
+}
+
+static const struct io_ops xdp_ops = {
+    "xdp",
+    xdp_send,
+    xdp_recv,
+    xdp_fd,
+    xdp_stats,
+    xdp_close
+};
+
+int io_open_xdp(
+    struct io_backend **iop,
+    const char *interface,
+    unsigned int queue,
+    int flags,
+    int family,
+    const struct in6_addr *src,
+    unsigned short port_number,
+    unsigned short ports,
+    char *errbuf
+) {
+    struct io_xdp *port;
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct xdp_options options;
+    struct sockaddr_xdp sxdp;
+    struct rlimit unlimited = { RLIM_INFINITY, RLIM_INFINITY };
+    union bpf_attr attr;
+    struct prog prog;
+    socklen_t optlen;
+    unsigned int ifindex;
+    int ring_size = XDP_RING_SIZE;
+    int x;
+    void *frame;
+
+    *iop = NULL;
+    if ( ( ifindex = if_nametoindex( interface ) ) == 0 ) return fail( errbuf, "Unknown interface" );
+    if ( ( port = calloc( 1, sizeof( struct io_xdp ) ) ) == NULL ) return fail( errbuf, "Out of memory" );
+    port->io.ops = &xdp_ops;
+    port->fd = port->map_fd = port->prog_fd = port->link_fd = -1;
+
+    /* Older kernels charge UMEM and BPF maps against the memlock limit. */
+    setrlimit( RLIMIT_MEMLOCK, &unlimited );
+
+    if ( packet_pool_init( &port->umem, XDP_FRAMES, XDP_FRAME_SIZE, PACKET_POOL_HUGEPAGES ) == -1 ) {
+        fail( errbuf, "Unable to allocate UMEM" );
+        goto error;
+    }
+    if ( ( port->fd = socket( AF_XDP, SOCK_RAW, 0 ) ) == -1 ) {
+        fail( errbuf, "Unable to create AF_XDP socket" );
+        goto error;
+    }
+
+    memset( &reg, 0, sizeof( struct xdp_umem_reg ) );
+    reg.addr = (uint64_t) (unsigned long) port->umem.base;
+    reg.len = (uint64_t) XDP_FRAMES * XDP_FRAME_SIZE;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    if ( setsockopt( port->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof( reg ) ) == -1 ) {
+        fail( errbuf, "Unable to register UMEM" );
+        goto error;
+    }
+    if ( setsockopt( port->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof( int ) ) == -1 ||
+        setsockopt( port->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof( int ) ) == -1 ||
+        setsockopt( port->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof( int ) ) == -1 ||
+        setsockopt( port->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof( int ) ) == -1 ) {
+        fail( errbuf, "Unable to size AF_XDP rings" );
+        goto error;
+    }
+
+    optlen = sizeof( struct xdp_mmap_offsets );
+    if ( getsockopt( port->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen ) == -1 ) {
+        fail( errbuf, "Unable to get AF_XDP ring offsets" );
+        goto error;
+    }
+    if ( map_ring( port->fd, &port->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof( uint64_t ) ) == -1 ||
+        map_ring( port->fd, &port->completion, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof( uint64_t ) ) == -1 ||
+        map_ring( port->fd, &port->rx, &off.rx, XDP_PGOFF_RX_RING, sizeof( struct xdp_desc ) ) == -1 ||
+        map_ring( port->fd, &port->tx, &off.tx, XDP_PGOFF_TX_RING, sizeof( struct xdp_desc ) ) == -1 ) {
+        fail( errbuf, "Unable to map AF_XDP rings" );
+        goto error;
+    }
+
+    /* Half of UMEM waits in the fill ring for replies, the rest is for TX. */
+    for ( x = 0; x < XDP_RING_SIZE; x++ ) {
+        frame = packet_pool_get( &port->umem );
+        refill( port, (char *) frame - port->umem.base );
+    }
+
+    memset( &sxdp, 0, sizeof( struct sockaddr_xdp ) );
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    if ( flags & IO_XDP_ZEROCOPY ) sxdp.sxdp_flags |= XDP_ZEROCOPY;
+    if ( flags & IO_XDP_COPY ) sxdp.sxdp_flags |= XDP_COPY;
+    /*
+     * The kernel lets go of a queue asynchronously after the last socket on
+     * it closes, so a quick restart can find it still busy for a moment.
+     */
+    for ( x = 0; bind( port->fd, (struct sockaddr *) &sxdp, sizeof( struct sockaddr_xdp ) ) == -1; x++ ) {
+        if ( errno != EBUSY || x == BIND_RETRIES ) {
+            fail( errbuf, "Unable to bind AF_XDP socket" );
+            goto error;
+        }
+        usleep( BIND_RETRY_USEC );
+    }
+    optlen = sizeof( struct xdp_options );
+    if ( getsockopt( port->fd, SOL_XDP, XDP_OPTIONS, &options, &optlen ) == 0 )
+        port->zerocopy = options.flags & XDP_OPTIONS_ZEROCOPY;
+
+    memset( &attr, 0, sizeof( union bpf_attr ) );
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof( uint32_t );
+    attr.value_size = sizeof( uint32_t );
+    attr.max_entries = queue + 1;
+    if ( ( port->map_fd = sys_bpf( BPF_MAP_CREATE, &attr ) ) == -1 ) {
+        fail( errbuf, "Unable to create XSKMAP" );
+        goto error;
+    }
+    memset( &attr, 0, sizeof( union bpf_attr ) );
+    attr.map_fd = port->map_fd;
+    attr.key = (uint64_t) (unsigned long) &queue;
+    attr.value = (uint64_t) (unsigned long) &port->fd;
+    attr.flags = BPF_ANY;
+    if ( sys_bpf( BPF_MAP_UPDATE_ELEM, &attr ) == -1 ) {
+        fail( errbuf, "Unable to add socket to XSKMAP" );
+        goto error;
+    }
+
+    build_steering_program( &prog, family, src, port_number, ports, port->map_fd );
+    if ( load_program( port, &prog, errbuf ) == -1 ) goto error;
+
+    /* A link detaches the program by itself when we exit, however we exit. */
+    memset( &attr, 0, sizeof( union bpf_attr ) );
+    attr.link_create.prog_fd = port->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = ( flags & IO_XDP_GENERIC ) ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+    if ( ( port->link_fd = sys_bpf( BPF_LINK_CREATE, &attr ) ) == -1 ) {
+        fail( errbuf, "Unable to attach XDP program" );
+        goto error;
+    }
+
+    *iop = &port->io;
+    return 0;
+
+error:
+    xdp_close( &port->io );
+    return -1;
+}
+
+#else
+
+int io_open_xdp(
+    struct io_backend **iop,
+    const char *interface,
+    unsigned int queue,
+    int flags,
+    int family,
+    const struct in6_addr *src,
+    unsigned short port_number,
+    unsigned short ports,
+    char *errbuf
+) {
+    *iop = NULL;
+    snprintf( errbuf, IO_ERRBUF_SIZE, "AF_XDP is not supported on this system" );
+    return -1;
+}
+
+#endif
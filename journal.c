@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "journal.h"
+
+/* Records the file grows by at a time. */
+#define JOURNAL_GROW 65536
+
+/* (Re)map the file at a size holding capacity records. */
+static int map_journal( struct journal *j, unsigned long capacity )
+{
+    size_t size = sizeof( struct journal_header ) + capacity * sizeof( struct journal_record );
+    void *p;
+
+    if ( size > j->map_size && ftruncate( j->fd, size ) == -1 ) return -1;
+    if ( ( p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0 ) ) == MAP_FAILED ) return -1;
+    if ( j->header ) munmap( j->header, j->map_size );
+    j->header = p;
+    j->records = (struct journal_record *) ( j->header + 1 );
+    j->map_size = size;
+    j->capacity = capacity;
+    return 0;
+}
+
+int journal_create( struct journal *j, const char *path, int test_type, unsigned short dstport )
+{
+    char magic[8];
+    int r;
+
+    memset( j, 0, sizeof( struct journal ) );
+    if ( ( j->fd = open( path, O_RDWR | O_CREAT, 0644 ) ) == -1 ) return -1;
+    /* Replace an old journal, but not some other file named by mistake. */
+    if ( pread( j->fd, magic, sizeof( magic ), 0 ) > 0 && memcmp( magic, JOURNAL_MAGIC, sizeof( magic ) ) != 0 ) {
+        errno = EEXIST;
+        goto fail;
+    }
+    if ( ftruncate( j->fd, 0 ) == -1 || map_journal( j, JOURNAL_GROW ) == -1 ) goto fail;
+    memcpy( j->header->magic, JOURNAL_MAGIC, sizeof( j->header->magic ) );
+    j->header->test_type = test_type;
+    j->header->dstport = dstport;
+    j->header->count = 0;
+    return 0;
+
+fail:
+    r = errno;
+    journal_close( j );
+    errno = r;
+    return -1;
+}
+
+int journal_open( struct journal *j, const char *path )
+{
+    struct stat st;
+    int r;
+
+    memset( j, 0, sizeof( struct journal ) );
+    if ( ( j->fd = open( path, O_RDWR ) ) == -1 ) return -1;
+    if ( fstat( j->fd, &st ) == -1 ) goto fail;
+    if ( st.st_size < (off_t) sizeof( struct journal_header ) ) {
+        errno = EINVAL;
+        goto fail;
+    }
+    j->map_size = st.st_size;
+    if ( map_journal( j, ( st.st_size - sizeof( struct journal_header ) ) / sizeof( struct journal_record ) ) == -1 ) goto fail;
+    if ( memcmp( j->header->magic, JOURNAL_MAGIC, sizeof( j->header->magic ) ) != 0 || j->header->count > j->capacity ) {
+        errno = EINVAL;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    r = errno;
+    journal_close( j );
+    errno = r;
+    return -1;
+}
+
+long journal_append( struct journal *j, uint64_t key )
+{
+    struct journal_record *record;
+
+    if ( j->header->count == j->capacity && map_journal( j, j->capacity + JOURNAL_GROW ) == -1 ) return -1;
+    record = &j->records[j->header->count];
+    record->key = key;
+    record->verified = 0;
+    record->state = 0;
+    return j->header->count++;
+}
+
+/* Keys are already hashes; just spread the top bits in. */
+static unsigned long index_slot( const struct journal *j, uint64_t key )
+{
+    return ( key ^ key >> 32 ) & j->index_mask;
+}
+
+int journal_index( struct journal *j )
+{
+    unsigned long size = 2, x, slot;
+
+    /* At most half full, so probes stay short and always end. */
+    while ( size < j->header->count * 2 ) size <<= 1;
+    free( j->index );
+    if ( ( j->index = malloc( sizeof( long ) * size ) ) == NULL ) return -1;
+    j->index_mask = size - 1;
+    for ( x = 0; x < size; x++ ) {
+        j->index[x] = -1;
+    }
+    for ( x = 0; x < j->header->count; x++ ) {
+        for ( slot = index_slot( j, j->records[x].key ); j->index[slot] != -1; slot = ( slot + 1 ) & j->index_mask ) {
+            if ( j->records[j->index[slot]].key == j->records[x].key ) break;
+        }
+        if ( j->index[slot] == -1 ) j->index[slot] = x;
+    }
+    return 0;
+}
+
+long journal_find( const struct journal *j, uint64_t key )
+{
+    unsigned long slot;
+
+    for ( slot = index_slot( j, key ); j->index[slot] != -1; slot = ( slot + 1 ) & j->index_mask ) {
+        if ( j->records[j->index[slot]].key == key ) return j->index[slot];
+    }
+    return -1;
+}
+
+void journal_sync( struct journal *j )
+{
+    msync( j->header, j->map_size, MS_ASYNC );
+}
+
+void journal_close( struct journal *j )
+{
+    if ( j->header ) {
+        msync( j->header, j->map_size, MS_SYNC );
+        munmap( j->header, j->map_size );
+    }
+    if ( j->fd != -1 ) close( j->fd );
+    free( j->index );
+    memset( j, 0, sizeof( struct journal ) );
+    j->fd = -1;
+}
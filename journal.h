@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The progress and results of a --compare run, so one that dies can be
+ * resumed and the next run can be told what changed. The file is a header
+ * and one record per pair read, in the order they were read, and is mapped
+ * shared: every update is in the page cache as soon as it is made, so a
+ * crash or a kill loses nothing, and journal_sync() now and then gets it to
+ * disk in case of a reboot. A pair is either finished, with its replies and
+ * when they came in, or probed again on resume.
+ */
+
+#define JOURNAL_MAGIC "synfragJ"
+/* Set in a record's state once both replies are in. */
+#define JOURNAL_DONE 0x80
+
+struct journal_header {
+    char magic[8];
+    int test_type;
+    unsigned int dstport;
+    /* Records in use. */
+    unsigned long count;
+};
+
+struct journal_record {
+    /* A hash of the pair: checked on resume, looked up by journal_find(). */
+    uint64_t key;
+    /* When the replies came in, in seconds since the epoch. */
+    uint32_t verified;
+    /* 0 until finished, then JOURNAL_DONE | baseline reply << 3 | test reply. */
+    unsigned char state;
+};
+
+struct journal {
+    int fd;
+    struct journal_header *header;
+    struct journal_record *records;
+    size_t map_size;
+    unsigned long capacity;
+    /* Built by journal_index(): record indexes by key, open addressed. */
+    long *index;
+    unsigned long index_mask;
+};
+
+/*
+ * Start a new journal at path, replacing any journal there (EEXIST if there
+ * is some other file), or open an existing one to resume (EINVAL if it isn't
+ * a journal). Both return 0, or -1 with errno set.
+ */
+int journal_create( struct journal *, const char *path, int test_type, unsigned short dstport );
+int journal_open( struct journal *, const char *path );
+/*
+ * Add a record, growing the file if need be. Records may move when the file
+ * grows, so they are referred to by index. Returns its index, or -1 with
+ * errno set.
+ */
+long journal_append( struct journal *, uint64_t key );
+/*
+ * Index the records by key, for a journal that won't grow any more. Returns
+ * 0, or -1 with errno set.
+ */
+int journal_index( struct journal * );
+/* The record with key, or -1 if there is none; the first if there are several. */
+long journal_find( const struct journal *, uint64_t key );
+/* Start writing everything out without waiting for it. */
+void journal_sync( struct journal * );
+void journal_close( struct journal * );
+
+#endif
@@ -0,0 +1,2680 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#define __USE_BSD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#ifdef __FreeBSD__
+#include <netinet/in_systm.h>
+#endif
+
+#ifdef __linux
+#define ETHERTYPE_IPV6 ETH_P_IPV6
+#define __FAVOR_BSD
+#endif
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <netinet/tcp.h>
+#include <netinet/if_ether.h>
+#include <net/if.h>
+#include "synfrag.h"
+#include "checksums.h"
+#include "flag_names.h"
+#include "packet_pool.h"
+#include "prof.h"
+#include "io.h"
+#include "decode.h"
+#include "reasm.h"
+#include "capture.h"
+#include "ring.h"
+
+#define IP_FLAGS_OFFSET 13
+#define SOURCE_PORT SYNFRAG_SOURCE_PORT
+#define BIG_PACKET_SIZE 1500
+#define TCP_WINDOW 65535
+/*
+ * If this is ever big enough to exceed BIG_PACKET_SIZE when added with the
+ * sizes of the other (IPv4/IPv6+destination options+fragmentation+padding)
+ * headers, a buffer will overflow. So don't do that. 
+ */
+#define FRAGMENT_OFFSET_TO_BYTES 8
+#define MINIMUM_FRAGMENT_SIZE FRAGMENT_OFFSET_TO_BYTES
+#define MINIMUM_PACKET_SIZE 68
+/* Longest a probe's first fragment can be shaped into: IPv6's minimum MTU. */
+#define FIRST_FRAGMENT_MAX 1280
+/* Most a single PadN option pads by. */
+#define PADN_MAX ( 2 + 255 )
+/*
+ * Per RFC 2460, a destination options header must have a payload size that
+ * is: ( multiple of 8 ) - 2. This fixes a length up to that by only ever
+ * increasing it.
+ */
+#define DSTOPTS_LENGTH(x) ( ( x ) + ( 6 - ( x ) % 8 + 8 ) % 8 )
+/*
+ * Frames to build transmitted packets in: one to build in, plus a batch
+ * waiting to be handed to the backend. Replies are inspected in place in the
+ * backend's buffers.
+ */
+#define POOL_FRAMES ( IO_BATCH + 1 )
+/* Source MAC when there is no interface to take one from. */
+#define NO_INTERFACE_MAC { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }
+/*
+ * A timeout of an ICMP probe sent this soon after an answered one to the same
+ * target looks like the target's ICMP rate limit, not a filter: a token
+ * bucket answers the start of a burst and drops the rest, and Linux refills
+ * one token a second per peer.
+ */
+#define RATE_LIMIT_WINDOW_USEC 1000000
+/* Slowest a target's ICMP pacing backs off to once it looks rate limited. */
+#define PACE_INTERVAL_MAX_USEC 4000000
+/*
+ * Probes a pipeline's generator can get ahead by, and results a sink holds.
+ * A sink copies reply frames, which are at most a reassembled packet.
+ */
+#define PIPELINE_PROBES 4096
+#define SINK_RESULTS 2048
+#define SINK_REPLY_MAX ( SIZEOF_ETHER + REASM_HEAD_MAX + REASM_DATA_MAX )
+/* How long a pipeline waits on replies before looking for new probes again. */
+#define PIPELINE_POLL_USEC 1000
+/* Raw frames a pipeline's receive stage can get ahead of matching by. */
+#define PIPELINE_FRAMES 2048
+/* Longest the receive stage sleeps on the backend before trying it again anyway. */
+#define RECEIVER_WAIT_USEC 100000
+#define PIPELINE_MAC_STRLEN 18
+
+/* Save time typing/screen real estate. */
+#define SIZEOF_ICMP6 sizeof( struct icmp6_hdr )
+#define SIZEOF_TCP sizeof( struct tcphdr )
+#define SIZEOF_IPV4 sizeof( struct ip )
+#define SIZEOF_IPV6 sizeof( struct ip6_hdr )
+#define SIZEOF_ETHER sizeof( struct ether_header )
+/* This size is fixed but extends past the standard basic icmp header. */
+#define SIZEOF_PING 8
+
+struct probe_slot;
+struct test_desc;
+
+/*
+ * What a test's layer 4 header is: how to build it into a probe, and how to
+ * tell replies to and ICMP quotes of that probe apart from anything else.
+ */
+struct l4_desc {
+    unsigned char protocol;
+    unsigned short header_len;
+    /* Where the checksum goes if the backend can finish it, 0 if it can't. */
+    unsigned short csum_offset;
+    int (*build)( struct synfrag_ctx *, const struct test_desc *, struct probe_slot *, void *iph, void *l4h, int offload );
+    void (*print)( void *l4h );
+    /* A reply of the probe's own kind answering it: a SYN/ACK or RST, or an echo reply. */
+    int (*answers)( const struct probe_slot *, const struct decoded_packet * );
+    /* The probe, as quoted in an ICMP error. */
+    int (*quoted)( const struct probe_slot *, const struct decoded_packet * );
+};
+
+/*
+ * One test. The emitter builds and sends the frame(s) for the family and
+ * fragment layout: emit_ipv4() and emit_ipv6() send the probe whole, the
+ * *_fragments() emitters split it after the first MINIMUM_FRAGMENT_SIZE
+ * bytes of the layer 4 header, behind options bytes of IPv4 options or IPv6
+ * destination options when options is non-zero, unless the probe shapes its
+ * first fragment otherwise.
+ */
+struct test_desc {
+    enum TEST_TYPE test_type;
+    const char *name;
+    int family;
+    const struct l4_desc *l4;
+    unsigned short options;
+    /* Echo payload past the ICMP header. */
+    unsigned short padding;
+    /* The unfragmented test of the same family and protocol. */
+    enum TEST_TYPE baseline;
+    int (*emit)( struct synfrag_ctx *, const struct test_desc *, struct probe_slot *, struct ether_header *, unsigned int parts );
+};
+
+/* Which frames of a probe an emitter sends; unfragmented probes are all first. */
+#define EMIT_FIRST ( 1 << 0 )
+#define EMIT_REST ( 1 << 1 )
+#define EMIT_ALL ( EMIT_FIRST | EMIT_REST )
+
+static char *test_result_names[] = {
+    "success",
+    "failed",
+    "timeout",
+    "time-exceeded"
+};
+
+static char *reply_type_names[] = {
+    "none",
+    "open",
+    "closed",
+    "filtered",
+    "reassembly-timeout",
+    "time-exceeded",
+    "other"
+};
+
+/*
+ * Counters. Each thread working on a context bumps its own cache line
+ * aligned slot (so far only the engine's, slot 0) and synfrag_get_stats()
+ * sums them, possibly from another thread. Having a single writer per slot
+ * means relaxed loads and stores are enough; no locked instructions on the
+ * hot path.
+ */
+#define STATS_SLOTS 4
+#define ENGINE_STATS_SLOT 0
+/* Refresh the cached backend stats this often. */
+#define KERNEL_STATS_INTERVAL_SECONDS 1
+
+enum STAT_COUNTER {
+    STAT_FRAMES_SENT = 0,
+    STAT_BYTES_SENT,
+    STAT_INJECT_FAILURES,
+    STAT_REPLIES_MATCHED,
+    STAT_REPLIES_UNMATCHED,
+    STAT_REPLIES_REASSEMBLED,
+    STAT_REASSEMBLY_DISCARDED,
+    STAT_PROBES_PACED,
+    STAT_RATE_LIMITED,
+    STAT_CAPTURE_DROPPED,
+    STAT_SINK_STALLS,
+    STAT_RESULTS,
+    STAT_PROBES_SENT = STAT_RESULTS + SYNFRAG_RESULT_MAX,
+    STAT_COUNT = STAT_PROBES_SENT + SYNFRAG_TEST_TYPE_MAX
+};
+
+struct stats_slot {
+    unsigned long counter[STAT_COUNT];
+} __attribute__(( aligned( 64 ) ));
+
+static inline void stat_add( struct stats_slot *slot, int counter, unsigned long n )
+{
+    __atomic_store_n( &slot->counter[counter], __atomic_load_n( &slot->counter[counter], __ATOMIC_RELAXED ) + n, __ATOMIC_RELAXED );
+}
+
+/*
+ * One probe we are waiting on. Slots live in one array sized by
+ * max_in_flight. In-use slots are chained twice: into a hash bucket keyed on
+ * the target address (to match replies) and into a list in send order (to
+ * find timeouts, since every probe in flight shares the same timeout).
+ * Paced slots are in neither until they go out. Unused slots are chained
+ * through hash_next.
+ */
+struct probe_slot {
+    /* Numbered in submission order, from 1. */
+    unsigned long id;
+    enum TEST_TYPE test_type;
+    const struct test_desc *test;
+    /* IPv4 addresses use the first 4 bytes. */
+    struct in6_addr dst;
+    char dstip[SYNFRAG_ADDRSTRLEN];
+    unsigned short dstport;
+    unsigned short srcport;
+    /* 0 for the default. */
+    unsigned char ttl;
+    /* A fragment test's first fragment: layer 4 bytes in it, and options in front. */
+    unsigned short frag_data;
+    unsigned short options;
+    unsigned char dstmac[ETHER_ADDR_LEN];
+    /* What the target echoes back, identifying this probe. */
+    unsigned int syn_seq;
+    unsigned short echo_seq;
+    unsigned short fragid;
+    struct timeval sent;
+    struct timeval deadline;
+    void *user;
+    int hash_next;
+    int fifo_next;
+    int fifo_prev;
+    /*
+     * Whether the last fragment is still held back, until release. Held
+     * probes are also chained in submission order through hold_next.
+     */
+    int held;
+    struct timeval release;
+    int hold_next;
+    int hold_prev;
+    unsigned int hold_msec;
+    /*
+     * An ICMP probe answered by the target itself, so paced and watched for
+     * rate limiting. A paced probe waits in the pacing heap until due.
+     */
+    int icmp;
+    struct timeval due;
+};
+
+/*
+ * What is known of one target's ICMP rate limit, in a direct mapped table as
+ * big as the hash buckets; a collision only forgets a target.
+ */
+struct icmp_peer {
+    struct in6_addr dst;
+    int used;
+    /*
+     * When its budget is next back to full, as in the generic cell rate
+     * algorithm: a probe may go out burst - 1 intervals before this.
+     */
+    struct timeval tat;
+    long interval_usec;
+    unsigned int burst;
+    /* When the latest answered probe to it went out. */
+    struct timeval answered;
+};
+
+struct synfrag_ctx {
+    /* Frames go out and replies come in through this. */
+    struct io_backend *io;
+    /* What a failing backend call is reported as. */
+    int io_error;
+    /* Built frames (from the pool) not yet handed to the backend. */
+    struct io_frame tx[IO_BATCH];
+    unsigned int tx_count;
+    /* The last batch received, and the next frame of it to look at. */
+    struct io_frame rx[IO_BATCH];
+    unsigned int rx_count;
+    unsigned int rx_next;
+    /* Where frames come from instead while a pipeline runs, if it has a receive stage. */
+    struct pipeline_receiver *receiver;
+    /* The default loopback responder's argument. */
+    int loopback_reassemble;
+    /*
+     * Leave TCP checksums of unfragmented probes to the kernel or NIC. A
+     * checksum over fragments has to cover all of them, so those are always
+     * done here.
+     */
+    int csum_offload;
+    struct packet_pool pool;
+    /* Fragmented replies waiting for the rest of their pieces. */
+    struct reasm reasm;
+    /* Looked up once when the interface is opened. */
+    unsigned char interface_mac[ETHER_ADDR_LEN];
+    unsigned char dstmac[ETHER_ADDR_LEN];
+    int family;
+    struct in6_addr src;
+    long timeout;
+    /* Print every header we build or receive. */
+    int verbose;
+    unsigned int rand_seed;
+    unsigned short next_echo_seq;
+    /* Counts up, so fragments of probes in flight together never share an id. */
+    unsigned short next_fragid;
+    /* TTL or hop limit of the probe being built. */
+    unsigned char ttl;
+    unsigned long next_probe_id;
+    /* NULL without a capture; the probe being sent, and when, for its frames' record. */
+    struct capture_ring *capture;
+    struct capture_note sending;
+    struct timeval sending_time;
+
+    struct probe_slot *slots;
+    int *buckets;
+    unsigned int max_in_flight;
+    unsigned int bucket_mask;
+    int free_head;
+    int fifo_head;
+    int fifo_tail;
+    int hold_head;
+    int hold_tail;
+    unsigned int in_flight;
+    /* Min-heap of paced slots on due, and every target's ICMP budget. */
+    int *paced;
+    unsigned int paced_count;
+    struct icmp_peer *peers;
+    /* 0 when ICMP probes aren't paced. */
+    long pace_interval_usec;
+    unsigned int pace_burst;
+
+    struct stats_slot stats[STATS_SLOTS];
+    /* Written by the engine, read by synfrag_get_stats(). */
+    unsigned long kernel_received;
+    unsigned long kernel_dropped;
+    unsigned long interface_dropped;
+    time_t kernel_stats_time;
+
+#ifdef SYNFRAG_PROFILE
+    struct prof prof;
+#endif
+
+    char errbuf[SYNFRAG_ERRBUF_SIZE];
+};
+
+static int set_error( struct synfrag_ctx *ctx, int code, const char *fmt, ... )
+{
+    va_list ap;
+
+    va_start( ap, fmt );
+    vsnprintf( ctx->errbuf, SYNFRAG_ERRBUF_SIZE, fmt, ap );
+    va_end( ap );
+    return code;
+}
+
+/* set_error() plus ": strerror( errno )", like err(3). */
+static int set_errno_error( struct synfrag_ctx *ctx, const char *what )
+{
+    return set_error( ctx, SYNFRAG_ERR_SYSTEM, "%s: %s", what, strerror( errno ) );
+}
+
+#ifdef SIOCGIFHWADDR
+static int fill_interface_mac( struct synfrag_ctx *ctx, char *dest, const char *interface )
+{
+    int fd;
+    struct ifreq ifr;
+
+    fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    if ( fd == -1 )
+        return set_errno_error( ctx, "socket failed" );
+
+    memset( &ifr, 0, sizeof( struct ifreq ) );
+    ifr.ifr_addr.sa_family = AF_INET;
+    strncpy( ifr.ifr_name, interface, IFNAMSIZ - 1 );
+
+    if ( ioctl( fd, SIOCGIFHWADDR, &ifr ) == -1 ) {
+        close( fd );
+        return set_errno_error( ctx, "ioctl failed" );
+    }
+    close( fd );
+
+    memcpy( dest, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN );
+    return SYNFRAG_OK;
+}
+#elif __FreeBSD__
+#include <ifaddrs.h>
+#include <net/if_dl.h>
+static int fill_interface_mac( struct synfrag_ctx *ctx, char *dest, const char *interface )
+{
+    struct ifaddrs *ifap;
+
+    if ( getifaddrs( &ifap ) == 0 ) {
+        struct ifaddrs *p;
+        for ( p = ifap; p; p = p->ifa_next ) {
+            if ( ( p->ifa_addr->sa_family == AF_LINK ) && ( strcmp( p->ifa_name, interface ) == 0 ) ) {
+                struct sockaddr_dl* sdp = (struct sockaddr_dl*) p->ifa_addr;
+                memcpy( dest, sdp->sdl_data + sdp->sdl_nlen, 6 );
+                freeifaddrs( ifap );
+                return SYNFRAG_OK;
+            }
+        }
+        freeifaddrs(ifap);
+    }
+    return set_error( ctx, SYNFRAG_ERR_SYSTEM, "Failed to get MAC for interface %s", interface );
+}
+#else
+#error Do not know how to get MAC address on this platform.
+#endif
+
+static void print_ethh( struct ether_header *ethh )
+{
+    printf( "Ethernet Frame, ethertype 0x%04X (%s)\n",
+        ntohs( ethh->ether_type ),
+        ether_protocol_to_name( ntohs( ethh->ether_type ) )
+    );
+
+    printf( " Src MAC %02X:%02X:%02X:%02X:%02X:%02X\n",
+        ethh->ether_shost[0],
+        ethh->ether_shost[1],
+        ethh->ether_shost[2],
+        ethh->ether_shost[3],
+        ethh->ether_shost[4],
+        ethh->ether_shost[5] );
+
+    printf( " Dest MAC %02X:%02X:%02X:%02X:%02X:%02X\n",
+        ethh->ether_dhost[0],
+        ethh->ether_dhost[1],
+        ethh->ether_dhost[2],
+        ethh->ether_dhost[3],
+        ethh->ether_dhost[4],
+        ethh->ether_dhost[5] );
+
+    printf( "\n" );
+}
+
+static void print_iph( struct ip *iph )
+{
+    char srcbuf[INET_ADDRSTRLEN];
+    char dstbuf[INET_ADDRSTRLEN];
+    char flag_buf[IP_FLAG_STRING_MAX_LENGTH];
+    char *flag_names = ip_flags_to_names( ntohs( iph->ip_off ) >> IP_FLAGS_OFFSET, (char *) &flag_buf );
+
+    /* Can't fail, the buffers are big enough for any IPv4 address. */
+    inet_ntop( AF_INET, &iph->ip_src, (char *) &srcbuf, INET_ADDRSTRLEN );
+    inet_ntop( AF_INET, &iph->ip_dst, (char *) &dstbuf, INET_ADDRSTRLEN );
+
+    printf( "IPv4 Packet:\n\
+ Src IP: %s\n\
+ Dst IP: %s\n\
+ Protocol: %i (%s)\n\
+ Frag Offset: %i (%i bytes)\n\
+ Flags: %i (%s)\n\
+ Iphl: %i (%i bytes)\n\
+\n",
+        (char *) &srcbuf,
+        (char *) &dstbuf,
+        iph->ip_p,
+        ip_protocol_to_name( iph->ip_p ),
+        ntohs( iph->ip_off ) & 0x1FFF,
+        ( ntohs( iph->ip_off ) & 0x1FFF ) * FRAGMENT_OFFSET_TO_BYTES,
+        ntohs( iph->ip_off ) >> IP_FLAGS_OFFSET,
+        flag_names,
+        iph->ip_hl,
+        iph->ip_hl * 4
+    );
+}
+
+static void print_ip6h( struct ip6_hdr *ip6h )
+{
+    char srcbuf[INET6_ADDRSTRLEN];
+    char dstbuf[INET6_ADDRSTRLEN];
+
+    /* Can't fail, the buffers are big enough for any IPv6 address. */
+    inet_ntop( AF_INET6, &ip6h->ip6_src, (char *) &srcbuf, INET6_ADDRSTRLEN );
+    inet_ntop( AF_INET6, &ip6h->ip6_dst, (char *) &dstbuf, INET6_ADDRSTRLEN );
+
+    printf( "IPv6 Packet:\n\
+ Src IP: %s\n\
+ Dst IP: %s\n\
+ Protocol: %i (%s)\n\
+ Payload Len: %i\n\
+\n",
+        (char *) &srcbuf,
+        (char *) &dstbuf,
+        ip6h->ip6_nxt,
+        ip_protocol_to_name( ip6h->ip6_nxt ),
+        ntohs( ip6h->ip6_plen )
+    );
+}
+
+static void print_icmph( struct icmp *icmph )
+{
+    printf( "ICMP Packet:\n\
+ Type: %i (%s)\n\
+ Code: %i (%s)\n",
+        icmph->icmp_type,
+        icmp_type_to_name( icmph->icmp_type ),
+        icmph->icmp_code,
+        icmp_code_to_name( icmph->icmp_type, icmph->icmp_code )
+    );
+    if ( ( icmph->icmp_type == ICMP_ECHO || icmph->icmp_type == ICMP_ECHOREPLY ) && ( icmph->icmp_code == 0 ) ) {
+        printf( " Echo id: %i\n", htons( icmph->icmp_id ) );
+    }
+    printf( "\n" );
+}
+
+static void print_icmp6h( struct icmp6_hdr *icmp6h )
+{
+    printf( "ICMPv6 Packet:\n\
+ Type: %i (%s)\n\
+ Code: %i (%s)\n",
+        icmp6h->icmp6_type,
+        icmp6_type_to_name( icmp6h->icmp6_type ),
+        icmp6h->icmp6_code,
+        icmp6_code_to_name( icmp6h->icmp6_type, icmp6h->icmp6_code )
+    );
+    if ( ( icmp6h->icmp6_type == ICMP6_ECHO_REQUEST || icmp6h->icmp6_type == ICMP6_ECHO_REPLY ) && ( icmp6h->icmp6_code == 0 ) ) {
+        printf( " Echo id: %i\n", htons( icmp6h->icmp6_id ) );
+    }
+    printf( "\n" );
+}
+
+static void print_tcph( struct tcphdr *tcph )
+{
+    char flag_buf[TCP_FLAG_STRING_MAX_LENGTH];
+    char *tcp_flags = tcp_flags_to_names( tcph->th_flags, (char *) &flag_buf );
+
+    printf( "TCP Packet:\n\
+ Src Port: %u\n\
+ Dst Port: %u\n\
+ Seq Num: %u\n\
+ Ack Num: %u\n\
+ Flags: %i (%s)\n\
+\n",
+        ntohs( tcph->th_sport ),
+        ntohs( tcph->th_dport ),
+        ntohl( tcph->th_seq ),
+        ntohl( tcph->th_ack ),
+        tcph->th_flags,
+        tcp_flags
+    );
+}
+
+/*
+ * Packet builders. Addresses have already been validated by
+ * synfrag_open()/synfrag_submit() so the only way these can fail is a bug in
+ * how a test lays out its frame; that is reported rather than sent.
+ */
+/* do_checksum(), timed as its own stage when profiling. */
+static int timed_checksum( struct synfrag_ctx *ctx, char *buf, int protocol, int len )
+{
+    PROF_DECLARE( start );
+    int r;
+
+    PROF_START( start );
+    r = do_checksum( buf, protocol, len );
+    PROF_END_NESTED( &ctx->prof, PROF_CHECKSUM, start );
+    return r;
+}
+
+static void build_ethernet( struct synfrag_ctx *ctx, struct ether_header *ethh, const unsigned char *dstmac, short int ethertype )
+{
+    memcpy( &ethh->ether_shost, ctx->interface_mac, ETHER_ADDR_LEN );
+    memcpy( &ethh->ether_dhost, dstmac, ETHER_ADDR_LEN );
+    ethh->ether_type = htons( ethertype );
+}
+
+/*
+ * With offload set, only the pseudo header sum goes in th_sum and the
+ * kernel or NIC finishes the checksum; see inject_frame_offloaded().
+ */
+static int build_tcp_syn( struct synfrag_ctx *ctx, void *iph, struct tcphdr *tcph, unsigned short srcport, unsigned short dstport, unsigned int seq, int offload )
+{
+    tcph->th_sport = htons( srcport );
+    tcph->th_dport = htons( dstport );
+    tcph->th_seq = htonl( seq );
+    tcph->th_ack = 0;
+    tcph->th_x2 = 0;
+    tcph->th_off = SIZEOF_TCP / 4;
+    tcph->th_flags = TH_SYN;
+    tcph->th_win = TCP_WINDOW;
+    tcph->th_sum = 0;
+    tcph->th_urp = 0;
+    if ( offload ) {
+        if ( do_pseudo_checksum( iph, IPPROTO_TCP, SIZEOF_TCP ) != 1 )
+            return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute pseudo header checksum (build_tcp_syn)." );
+        return SYNFRAG_OK;
+    }
+    if ( timed_checksum( ctx, iph, IPPROTO_TCP, SIZEOF_TCP ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute checksum (build_tcp_syn)." );
+    return SYNFRAG_OK;
+}
+
+static int build_icmp_ping( struct synfrag_ctx *ctx, void *iph, struct icmp *icmph, unsigned short payload_length, unsigned short seq )
+{
+    icmph->icmp_type = ICMP_ECHO;
+    icmph->icmp_code = 0;
+    icmph->icmp_cksum = 0;
+    icmph->icmp_id = htons( SOURCE_PORT );
+    icmph->icmp_seq = htons( seq );
+    memset( (char *) icmph + SIZEOF_PING, 0x01, payload_length );
+    /*
+     * Cancel the sequence number out of the checksum, so every echo request
+     * to a target looks like one flow to load balancers hashing on the
+     * checksum, as Paris traceroute does.
+     */
+    *( (unsigned short *) ( (char *) icmph + SIZEOF_PING ) ) = htons( (unsigned short) ~seq );
+    if ( timed_checksum( ctx, iph, IPPROTO_ICMP, SIZEOF_PING + payload_length ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute checksum (build_icmp_ping)." );
+    return SYNFRAG_OK;
+}
+
+static int build_icmp6_ping( struct synfrag_ctx *ctx, void *iph, struct icmp6_hdr *icmp6h, unsigned short payload_length, unsigned short seq )
+{
+    icmp6h->icmp6_type = ICMP6_ECHO_REQUEST;
+    icmp6h->icmp6_code = 0;
+    icmp6h->icmp6_cksum = 0;
+    icmp6h->icmp6_id = htons( SOURCE_PORT );
+    icmp6h->icmp6_seq = htons( seq );
+    memset( (char *) icmp6h + SIZEOF_ICMP6, 0x01, payload_length );
+    /* As for build_icmp_ping(). */
+    *( (unsigned short *) ( (char *) icmp6h + SIZEOF_ICMP6 ) ) = htons( (unsigned short) ~seq );
+    if ( timed_checksum( ctx, iph, IPPROTO_ICMPV6, SIZEOF_ICMP6 + payload_length ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute checksum (build_icmp6_ping)." );
+    return SYNFRAG_OK;
+}
+
+static void build_bare_ipv4( struct synfrag_ctx *ctx, struct ip *iph, struct in6_addr *dst, unsigned char protocol )
+{
+    iph->ip_v = 4;
+    iph->ip_hl = 5;
+    iph->ip_tos = 0;
+    iph->ip_len = htons( SIZEOF_IPV4 + SIZEOF_TCP );
+    iph->ip_id = 0;
+    iph->ip_off = 0;
+    iph->ip_ttl = ctx->ttl;
+    iph->ip_p = protocol;
+    iph->ip_sum = 0;
+    memcpy( &iph->ip_src, &ctx->src, sizeof( struct in_addr ) );
+    memcpy( &iph->ip_dst, dst, sizeof( struct in_addr ) );
+}
+
+static int build_ipv4( struct synfrag_ctx *ctx, struct ip *iph, struct in6_addr *dst, unsigned char protocol, unsigned short payload_length )
+{
+    build_bare_ipv4( ctx, iph, dst, protocol );
+    iph->ip_len = htons( SIZEOF_IPV4 + payload_length );
+    if ( timed_checksum( ctx, (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute checksum (build_ipv4)." );
+    return SYNFRAG_OK;
+}
+
+/*
+ * The first fragment: optlen bytes of options (a multiple of 4), then the
+ * first data_len bytes of the payload.
+ */
+static int build_ipv4_frag1( struct synfrag_ctx *ctx, struct ip *iph, struct in6_addr *dst, unsigned char protocol, unsigned short fragid, unsigned short optlen, unsigned short data_len )
+{
+    if ( optlen % 4 != 0 || optlen > MAX_IPOPTLEN )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "optlen must be a multiple of 4, at most %d", MAX_IPOPTLEN );
+
+    build_bare_ipv4( ctx, iph, dst, protocol );
+    iph->ip_off = htons( 1 << IP_FLAGS_OFFSET ); /* Set More Fragments (MF) bit */
+    iph->ip_id = htons( fragid );
+    iph->ip_len = htons( SIZEOF_IPV4 + optlen + data_len );
+    /* In 32 bit words. */
+    iph->ip_hl = ( SIZEOF_IPV4 + optlen ) / 4;
+
+    if ( optlen ) {
+        /* Pad with NOP's and then end-of-padding option. */
+        memset( (char *) iph + SIZEOF_IPV4, IPOPT_NOP, optlen - 1 );
+        *( (char *) iph + SIZEOF_IPV4 + optlen - 1 ) = IPOPT_EOL;
+    }
+    if ( timed_checksum( ctx, (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute checksum (build_ipv4_frag1)." );
+    return SYNFRAG_OK;
+}
+
+/* The rest, offset bytes in. */
+static int build_ipv4_frag2( struct synfrag_ctx *ctx, struct ip *iph, struct in6_addr *dst, unsigned char protocol, unsigned short fragid, unsigned short offset, unsigned short payload_length )
+{
+    build_bare_ipv4( ctx, iph, dst, protocol );
+    iph->ip_off = htons( offset / FRAGMENT_OFFSET_TO_BYTES );
+    iph->ip_id = htons( fragid );
+    iph->ip_len = htons( SIZEOF_IPV4 + payload_length );
+    if ( timed_checksum( ctx, (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to compute checksum (build_ipv4_frag2)." );
+    return SYNFRAG_OK;
+}
+
+static void build_ipv6( struct synfrag_ctx *ctx, struct ip6_hdr *ip6h, struct in6_addr *dst, unsigned char protocol, unsigned short payload_length )
+{
+    /* 4 bits version, 8 bits TC, 20 bits flow-ID. We only set the version bits. */
+    ip6h->ip6_flow = htonl( 0x06 << 28 );
+    ip6h->ip6_plen = htons( payload_length );
+    ip6h->ip6_hlim = ctx->ttl;
+    ip6h->ip6_nxt = protocol;
+    memcpy( &ip6h->ip6_src, &ctx->src, sizeof( struct in6_addr ) );
+    memcpy( &ip6h->ip6_dst, dst, sizeof( struct in6_addr ) );
+}
+
+/*
+ * The first fragment, carrying data_len bytes of the payload. With a
+ * non-zero optlen (a multiple of 8, less 2) the fragment header follows a
+ * destination options header padded out to it.
+ */
+static int build_ipv6_frag1( struct synfrag_ctx *ctx, struct ip6_hdr *ip6h, struct in6_addr *dst, unsigned char protocol, unsigned short fragid, unsigned short optlen, unsigned short data_len )
+{
+    unsigned short ext_len = optlen ? sizeof( struct ip6_dest ) + optlen : 0;
+    struct ip6_dest *desth = (struct ip6_dest *) ( (char *)ip6h + SIZEOF_IPV6 );
+    struct ip6_frag *fragh = (struct ip6_frag *) ( (char *)ip6h + SIZEOF_IPV6 + ext_len );
+    char *pad = (char *) desth + sizeof( struct ip6_dest );
+    unsigned short left = optlen, n;
+
+    if ( optlen && optlen % 8 != 6 ) return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "optlen value not supported" );
+    build_ipv6( ctx, ip6h, dst, optlen ? IPPROTO_DSTOPTS : IPPROTO_FRAGMENT, ext_len + sizeof( struct ip6_frag ) + data_len );
+
+    if ( optlen ) {
+        desth->ip6d_nxt = IPPROTO_FRAGMENT;
+        desth->ip6d_len = optlen / 8;
+    }
+    /* PadN options as long as they go, and a Pad1 for an odd byte left over. */
+    while ( left ) {
+        if ( left == 1 ) {
+            *pad = 0;
+            break;
+        }
+        n = left > PADN_MAX ? PADN_MAX : left;
+        pad[0] = 1;
+        pad[1] = n - 2;
+        memset( pad + 2, 0, n - 2 );
+        pad += n;
+        left -= n;
+    }
+
+    fragh->ip6f_reserved = 0;
+    fragh->ip6f_nxt = protocol;
+    fragh->ip6f_ident = htons( fragid );
+    fragh->ip6f_offlg = IP6F_MORE_FRAG;
+    return SYNFRAG_OK;
+}
+
+/* The rest, offset bytes in. */
+static void build_ipv6_frag2( struct synfrag_ctx *ctx, struct ip6_hdr *ip6h, struct in6_addr *dst, unsigned char protocol, unsigned short fragid, unsigned short offset, unsigned short payload_length )
+{
+    struct ip6_frag *fragh = (struct ip6_frag *) ( (char *)ip6h + SIZEOF_IPV6 );
+
+    build_ipv6( ctx, ip6h, dst, IPPROTO_FRAGMENT, payload_length + sizeof( struct ip6_frag ) );
+
+    fragh->ip6f_reserved = 0;
+    fragh->ip6f_nxt = protocol;
+    fragh->ip6f_ident = htons( fragid );
+    /* In units of 8 bytes from bit 3 up, so a multiple of 8 goes in as is. */
+    fragh->ip6f_offlg = htons( offset );
+}
+
+/*
+ * Hand every queued frame to the backend in one batch and give their pool
+ * frames back. Frames the backend didn't take are dropped and counted.
+ */
+static int transmit_pending( struct synfrag_ctx *ctx )
+{
+    struct stats_slot *stats = &ctx->stats[ENGINE_STATS_SLOT];
+    void *frames[IO_BATCH];
+    unsigned long bytes = 0;
+    unsigned int x, count = ctx->tx_count;
+    int sent;
+
+    if ( !count ) return SYNFRAG_OK;
+    sent = io_send( ctx->io, ctx->tx, count );
+    for ( x = 0; x < count; x++ ) {
+        if ( (int) x < sent ) bytes += ctx->tx[x].len;
+        frames[x] = ctx->tx[x].data;
+    }
+    packet_pool_put_bulk( &ctx->pool, frames, count );
+    ctx->tx_count = 0;
+
+    if ( sent > 0 ) {
+        stat_add( stats, STAT_FRAMES_SENT, sent );
+        stat_add( stats, STAT_BYTES_SENT, bytes );
+    }
+    if ( sent < (int) count ) {
+        stat_add( stats, STAT_INJECT_FAILURES, count - ( sent > 0 ? sent : 0 ) );
+        return set_error( ctx, ctx->io_error, "%s send failed: %s", ctx->io->ops->name, ctx->io->errbuf );
+    }
+    return SYNFRAG_OK;
+}
+
+/*
+ * Queue a copy of the frame (tests reuse their buffer for the next
+ * fragment), sending the batch once it is full. A non-zero csum_start asks
+ * the backend to finish the checksum csum_offset bytes past it, over
+ * everything from csum_start on.
+ */
+static int inject_frame_offloaded( struct synfrag_ctx *ctx, struct ether_header *ethh, int packet_size, unsigned short csum_start, unsigned short csum_offset )
+{
+    PROF_DECLARE( start );
+    struct io_frame *tx;
+    char *frame;
+    int r = SYNFRAG_OK;
+
+    PROF_START( start );
+    if ( ( frame = packet_pool_get( &ctx->pool ) ) == NULL )
+        return set_error( ctx, SYNFRAG_ERR_NOMEM, "Packet pool exhausted" );
+    memcpy( frame, ethh, packet_size );
+    if ( ctx->capture && capture_frame( ctx->capture, CAPTURE_OUTBOUND, &ctx->sending_time, frame, packet_size, &ctx->sending ) == -1 )
+        stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_CAPTURE_DROPPED, 1 );
+    tx = &ctx->tx[ctx->tx_count];
+    tx->data = frame;
+    tx->len = packet_size;
+    tx->csum_start = csum_start;
+    tx->csum_offset = csum_offset;
+    if ( ++ctx->tx_count == IO_BATCH ) r = transmit_pending( ctx );
+    PROF_END_NESTED( &ctx->prof, PROF_INJECT, start );
+    return r;
+}
+
+static int inject_frame( struct synfrag_ctx *ctx, struct ether_header *ethh, int packet_size )
+{
+    return inject_frame_offloaded( ctx, ethh, packet_size, 0, 0 );
+}
+
+/*
+ * Layer 4 headers. Each builds its header at l4h, checksummed over the
+ * whole of it (fragments are split afterwards), and matches what comes
+ * back.
+ */
+static int build_l4_tcp( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, void *iph, void *l4h, int offload )
+{
+    return build_tcp_syn( ctx, iph, l4h, probe->srcport, probe->dstport, probe->syn_seq, offload );
+}
+
+static int build_l4_icmp( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, void *iph, void *l4h, int offload )
+{
+    return build_icmp_ping( ctx, iph, l4h, test->padding, probe->echo_seq );
+}
+
+static int build_l4_icmp6( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, void *iph, void *l4h, int offload )
+{
+    return build_icmp6_ping( ctx, iph, l4h, test->padding, probe->echo_seq );
+}
+
+static void print_l4_tcp( void *l4h )
+{
+    print_tcph( l4h );
+}
+
+static void print_l4_icmp( void *l4h )
+{
+    print_icmph( l4h );
+}
+
+static void print_l4_icmp6( void *l4h )
+{
+    print_icmp6h( l4h );
+}
+
+/* TCP replies must acknowledge our sequence number. */
+static int tcp_answers( const struct probe_slot *probe, const struct decoded_packet *packet )
+{
+    return packet->protocol == IPPROTO_TCP &&
+        packet->sport == probe->dstport &&
+        packet->dport == probe->srcport &&
+        packet->ack == probe->syn_seq + 1;
+}
+
+static int tcp_quoted( const struct probe_slot *probe, const struct decoded_packet *quote )
+{
+    return quote->protocol == IPPROTO_TCP &&
+        quote->sport == probe->srcport &&
+        quote->dport == probe->dstport &&
+        quote->seq == probe->syn_seq;
+}
+
+/* Echo replies must carry our id and sequence. */
+static int icmp_answers( const struct probe_slot *probe, const struct decoded_packet *packet )
+{
+    return packet->protocol == IPPROTO_ICMP &&
+        packet->echo_id == SOURCE_PORT &&
+        packet->echo_seq == probe->echo_seq;
+}
+
+static int icmp_quoted( const struct probe_slot *probe, const struct decoded_packet *quote )
+{
+    return quote->protocol == IPPROTO_ICMP &&
+        quote->type == ICMP_ECHO &&
+        quote->echo_id == SOURCE_PORT &&
+        quote->echo_seq == probe->echo_seq;
+}
+
+static int icmp6_answers( const struct probe_slot *probe, const struct decoded_packet *packet )
+{
+    return packet->protocol == IPPROTO_ICMPV6 &&
+        packet->echo_id == SOURCE_PORT &&
+        packet->echo_seq == probe->echo_seq;
+}
+
+static int icmp6_quoted( const struct probe_slot *probe, const struct decoded_packet *quote )
+{
+    return quote->protocol == IPPROTO_ICMPV6 &&
+        quote->type == ICMP6_ECHO_REQUEST &&
+        quote->echo_id == SOURCE_PORT &&
+        quote->echo_seq == probe->echo_seq;
+}
+
+static const struct l4_desc l4_tcp = {
+    IPPROTO_TCP, SIZEOF_TCP, offsetof( struct tcphdr, th_sum ),
+    build_l4_tcp, print_l4_tcp, tcp_answers, tcp_quoted
+};
+
+static const struct l4_desc l4_icmp = {
+    IPPROTO_ICMP, SIZEOF_PING, 0,
+    build_l4_icmp, print_l4_icmp, icmp_answers, icmp_quoted
+};
+
+static const struct l4_desc l4_icmp6 = {
+    IPPROTO_ICMPV6, SIZEOF_ICMP6, 0,
+    build_l4_icmp6, print_l4_icmp6, icmp6_answers, icmp6_quoted
+};
+
+/*
+ * Emitters. Each builds its frame(s) in ethh, a BIG_PACKET_SIZE frame from
+ * the pool, and sends those in parts. A fragmented probe's checksum spans
+ * its fragments, so it is built whole whichever are sent, and only
+ * unfragmented probes can have their checksum offloaded.
+ */
+static int emit_ipv4( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, struct ether_header *ethh, unsigned int parts )
+{
+    struct ip *iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
+    void *l4h = (char *) iph + SIZEOF_IPV4;
+    unsigned short l4_len = test->l4->header_len + test->padding;
+    int packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + l4_len;
+    int offload = ctx->csum_offload && test->l4->csum_offset;
+    int r;
+
+    build_ethernet( ctx, ethh, probe->dstmac, ETHERTYPE_IP );
+    if ( ( r = build_ipv4( ctx, iph, &probe->dst, test->l4->protocol, l4_len ) ) != SYNFRAG_OK ) return r;
+    if ( ( r = test->l4->build( ctx, test, probe, iph, l4h, offload ) ) != SYNFRAG_OK ) return r;
+    if ( ctx->verbose ) {
+        print_ethh( ethh );
+        print_iph( iph );
+        test->l4->print( l4h );
+    }
+
+    if ( offload )
+        return inject_frame_offloaded( ctx, ethh, packet_size, SIZEOF_ETHER + SIZEOF_IPV4, test->l4->csum_offset );
+    return inject_frame( ctx, ethh, packet_size );
+}
+
+static int emit_ipv4_fragments( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, struct ether_header *ethh, unsigned int parts )
+{
+    struct ip *iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
+    char *l4h = (char *) iph + SIZEOF_IPV4 + probe->options;
+    unsigned short l4_len = test->l4->header_len + test->padding;
+    int r;
+
+    build_ethernet( ctx, ethh, probe->dstmac, ETHERTYPE_IP );
+    if ( ( r = build_ipv4_frag1( ctx, iph, &probe->dst, test->l4->protocol, probe->fragid, probe->options, probe->frag_data ) ) != SYNFRAG_OK ) return r;
+    if ( ( r = test->l4->build( ctx, test, probe, iph, l4h, 0 ) ) != SYNFRAG_OK ) return r;
+    if ( parts & EMIT_FIRST ) {
+        if ( ctx->verbose ) {
+            print_ethh( ethh );
+            print_iph( iph );
+            test->l4->print( l4h );
+        }
+        if ( ( r = inject_frame( ctx, ethh, SIZEOF_ETHER + SIZEOF_IPV4 + probe->options + probe->frag_data ) ) != SYNFRAG_OK ) return r;
+    }
+    if ( !( parts & EMIT_REST ) ) return SYNFRAG_OK;
+
+    /* The rest of the layer 4 header and payload, behind a bare header. */
+    if ( ( r = build_ipv4_frag2( ctx, iph, &probe->dst, test->l4->protocol, probe->fragid, probe->frag_data, l4_len - probe->frag_data ) ) != SYNFRAG_OK ) return r;
+    memmove( (char *) iph + SIZEOF_IPV4, l4h + probe->frag_data, l4_len - probe->frag_data );
+    if ( ctx->verbose ) print_iph( iph );
+
+    return inject_frame( ctx, ethh, SIZEOF_ETHER + SIZEOF_IPV4 + l4_len - probe->frag_data );
+}
+
+static int emit_ipv6( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, struct ether_header *ethh, unsigned int parts )
+{
+    struct ip6_hdr *ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
+    void *l4h = (char *) ip6h + SIZEOF_IPV6;
+    unsigned short l4_len = test->l4->header_len + test->padding;
+    int packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + l4_len;
+    int offload = ctx->csum_offload && test->l4->csum_offset;
+    int r;
+
+    build_ethernet( ctx, ethh, probe->dstmac, ETHERTYPE_IPV6 );
+    build_ipv6( ctx, ip6h, &probe->dst, test->l4->protocol, l4_len );
+    if ( ( r = test->l4->build( ctx, test, probe, ip6h, l4h, offload ) ) != SYNFRAG_OK ) return r;
+    if ( ctx->verbose ) {
+        print_ethh( ethh );
+        print_ip6h( ip6h );
+        test->l4->print( l4h );
+    }
+
+    if ( offload )
+        return inject_frame_offloaded( ctx, ethh, packet_size, SIZEOF_ETHER + SIZEOF_IPV6, test->l4->csum_offset );
+    return inject_frame( ctx, ethh, packet_size );
+}
+
+static int emit_ipv6_fragments( struct synfrag_ctx *ctx, const struct test_desc *test, struct probe_slot *probe, struct ether_header *ethh, unsigned int parts )
+{
+    struct ip6_hdr *ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
+    unsigned short ext_len = probe->options ? sizeof( struct ip6_dest ) + probe->options : 0;
+    char *fragment = (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_frag );
+    char *l4h = fragment + ext_len;
+    unsigned short l4_len = test->l4->header_len + test->padding;
+    int r;
+
+    build_ethernet( ctx, ethh, probe->dstmac, ETHERTYPE_IPV6 );
+    if ( ( r = build_ipv6_frag1( ctx, ip6h, &probe->dst, test->l4->protocol, probe->fragid, probe->options, probe->frag_data ) ) != SYNFRAG_OK ) return r;
+    if ( ( r = test->l4->build( ctx, test, probe, ip6h, l4h, 0 ) ) != SYNFRAG_OK ) return r;
+    if ( parts & EMIT_FIRST ) {
+        if ( ctx->verbose ) {
+            print_ethh( ethh );
+            print_ip6h( ip6h );
+            test->l4->print( l4h );
+        }
+        if ( ( r = inject_frame( ctx, ethh, SIZEOF_ETHER + SIZEOF_IPV6 + ext_len + sizeof( struct ip6_frag ) + probe->frag_data ) ) != SYNFRAG_OK ) return r;
+    }
+    if ( !( parts & EMIT_REST ) ) return SYNFRAG_OK;
+
+    /* The rest of the layer 4 header and payload, behind just a fragment header. */
+    build_ipv6_frag2( ctx, ip6h, &probe->dst, test->l4->protocol, probe->fragid, probe->frag_data, l4_len - probe->frag_data );
+    memmove( fragment, l4h + probe->frag_data, l4_len - probe->frag_data );
+    if ( ctx->verbose ) print_ip6h( ip6h );
+
+    return inject_frame( ctx, ethh, SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + l4_len - probe->frag_data );
+}
+
+/* Options to push the first fragment of an optioned test past MINIMUM_PACKET_SIZE. */
+#define IPV4_OPTIONS_LENGTH 40
+#define IPV6_OPTIONS_LENGTH DSTOPTS_LENGTH( MINIMUM_PACKET_SIZE - SIZEOF_IPV6 - sizeof( struct ip6_dest ) - sizeof( struct ip6_frag ) - MINIMUM_FRAGMENT_SIZE )
+/*
+ * Must be > 6 or the first fragment of an optioned IPv6 echo request will be
+ * <= MINIMUM_PACKET_SIZE bytes and the second empty.
+ */
+#define PING_PADDING 40
+
+/* In the order tests are listed by synfrag_test_by_index(). */
+static const struct test_desc tests[] = {
+    { TEST_IPV4_TCP, "v4-tcp", AF_INET, &l4_tcp, 0, 0, TEST_IPV4_TCP, emit_ipv4 },
+    { TEST_IPV4_ICMP, "v4-icmp", AF_INET, &l4_icmp, 0, PING_PADDING, TEST_IPV4_ICMP, emit_ipv4 },
+    { TEST_FRAG_IPV4_TCP, "v4-frag-tcp", AF_INET, &l4_tcp, 0, 0, TEST_IPV4_TCP, emit_ipv4_fragments },
+    { TEST_FRAG_IPV4_ICMP, "v4-frag-icmp", AF_INET, &l4_icmp, 0, PING_PADDING, TEST_IPV4_ICMP, emit_ipv4_fragments },
+    { TEST_FRAG_OPTIONED_IPV4_TCP, "v4-frag-optioned-tcp", AF_INET, &l4_tcp, IPV4_OPTIONS_LENGTH, 0, TEST_IPV4_TCP, emit_ipv4_fragments },
+    { TEST_FRAG_OPTIONED_IPV4_ICMP, "v4-frag-optioned-icmp", AF_INET, &l4_icmp, IPV4_OPTIONS_LENGTH, PING_PADDING, TEST_IPV4_ICMP, emit_ipv4_fragments },
+
+    { TEST_IPV6_TCP, "v6-tcp", AF_INET6, &l4_tcp, 0, 0, TEST_IPV6_TCP, emit_ipv6 },
+    { TEST_IPV6_ICMP6, "v6-icmp6", AF_INET6, &l4_icmp6, 0, PING_PADDING, TEST_IPV6_ICMP6, emit_ipv6 },
+    { TEST_FRAG_IPV6_TCP, "v6-frag-tcp", AF_INET6, &l4_tcp, 0, 0, TEST_IPV6_TCP, emit_ipv6_fragments },
+    { TEST_FRAG_IPV6_ICMP6, "v6-frag-icmp6", AF_INET6, &l4_icmp6, 0, PING_PADDING, TEST_IPV6_ICMP6, emit_ipv6_fragments },
+    { TEST_FRAG_OPTIONED_IPV6_TCP, "v6-frag-optioned-tcp", AF_INET6, &l4_tcp, IPV6_OPTIONS_LENGTH, 0, TEST_IPV6_TCP, emit_ipv6_fragments },
+    { TEST_FRAG_OPTIONED_IPV6_ICMP6, "v6-frag-optioned-icmp6", AF_INET6, &l4_icmp6, IPV6_OPTIONS_LENGTH, PING_PADDING, TEST_IPV6_ICMP6, emit_ipv6_fragments }
+};
+
+#define TEST_COUNT ( sizeof( tests ) / sizeof( tests[0] ) )
+
+/*
+ * How long a fragment test's first fragment is, IP header on, carrying data
+ * bytes of the layer 4 header behind options bytes of options; -1 if the
+ * test can't be split that way.
+ */
+static int first_fragment_size( const struct test_desc *test, unsigned short data, unsigned short options )
+{
+    unsigned short l4_len = test->l4->header_len + test->padding;
+    int size;
+
+    if ( test->baseline == test->test_type ) return -1;
+    if ( !data || data % FRAGMENT_OFFSET_TO_BYTES || data >= l4_len ) return -1;
+    if ( test->family == AF_INET ) {
+        if ( options % 4 || options > MAX_IPOPTLEN ) return -1;
+        size = SIZEOF_IPV4 + options + data;
+    } else {
+        if ( options && options % 8 != 6 ) return -1;
+        size = SIZEOF_IPV6 + ( options ? sizeof( struct ip6_dest ) + options : 0 ) + sizeof( struct ip6_frag ) + data;
+    }
+    return size > FIRST_FRAGMENT_MAX ? -1 : size;
+}
+
+static const struct test_desc *find_test( enum TEST_TYPE test_type )
+{
+    unsigned int x;
+
+    for ( x = 0; x < TEST_COUNT; x++ ) {
+        if ( tests[x].test_type == test_type ) return &tests[x];
+    }
+    return NULL;
+}
+
+static int send_probe( struct synfrag_ctx *ctx, struct probe_slot *probe, unsigned int parts )
+{
+    struct ether_header *ethh;
+    PROF_DECLARE( start );
+    int r;
+
+    if ( ( ethh = packet_pool_get( &ctx->pool ) ) == NULL )
+        return set_error( ctx, SYNFRAG_ERR_NOMEM, "Packet pool exhausted" );
+
+#ifdef SYNFRAG_PROFILE
+    ctx->prof.nested = 0;
+#endif
+    PROF_START( start );
+
+    ctx->ttl = probe->ttl ? probe->ttl : IPDEFTTL;
+    if ( ctx->capture ) {
+        ctx->sending.id = probe->id;
+        ctx->sending.test_type = probe->test_type;
+        io_now( ctx->io, &ctx->sending_time );
+    }
+    r = probe->test->emit( ctx, probe->test, probe, ethh, parts );
+
+#ifdef SYNFRAG_PROFILE
+    /* What's left once checksum and inject are taken out is building. */
+    start += ctx->prof.nested;
+#endif
+    PROF_END( &ctx->prof, PROF_BUILD, start );
+    if ( r == SYNFRAG_OK && ( parts & EMIT_FIRST ) ) USDT_SEND( probe->test_type, probe->dstip, probe->dstport );
+
+    packet_pool_put( &ctx->pool, ethh );
+    return r;
+}
+
+/*
+ * Reply handling. Everything past here only ever reads frames, it never
+ * trusts them: any frame can be short, truncated or not from a target.
+ */
+
+static void print_reply( const struct decoded_reply *reply )
+{
+    const struct decoded_packet *packet = &reply->packet;
+
+    if ( packet->family == AF_INET ) {
+        print_iph( (struct ip *) packet->l3 );
+    } else {
+        print_ip6h( (struct ip6_hdr *) packet->l3 );
+    }
+
+    if ( packet->protocol == IPPROTO_TCP ) {
+        print_tcph( (struct tcphdr *) packet->l4 );
+    } else if ( packet->protocol == IPPROTO_ICMP ) {
+        print_icmph( (struct icmp *) packet->l4 );
+    } else {
+        print_icmp6h( (struct icmp6_hdr *) packet->l4 );
+    }
+}
+
+/*
+ * What a reply to a probe of test_type means. match_reply() has already
+ * checked the reply is of the probe's kind (a TCP reply to a SYN, an echo
+ * reply to an echo request), or an error about it.
+ */
+static enum TEST_RESULT reply_result( struct synfrag_ctx *ctx, const struct decoded_reply *reply )
+{
+    if ( ctx->verbose ) print_reply( reply );
+    if ( reply->type == REPLY_TYPE_OPEN ) return TEST_RESULT_SUCCESS;
+    if ( reply->type == REPLY_TYPE_TIME_EXCEEDED ) return TEST_RESULT_TIME_EXCEEDED;
+    if ( ctx->verbose ) printf( "Received reply but it wasn't what we were hoping for (%s).\n", reply_type_names[reply->type] );
+    return TEST_RESULT_FAILED;
+}
+
+/*
+ * My back-of-the-napkin for the maximum length for the ipv6 filter string
+ * below + 1 byte for the trailing NULL 
+ */
+#define FILTER_STR_LEN 203 
+
+/*
+ * The filter only names our own address, so the same compiled program serves
+ * every probe sent through the backend. The backend installs it once, before
+ * anything is sent, and match_reply() picks out which probe a reply belongs
+ * to.
+ */
+static int build_reply_filter( struct synfrag_ctx *ctx, const char *srcip, char *filter_str )
+{
+    int r;
+
+    if ( ctx->family == AF_INET ) {
+        r = snprintf(
+            filter_str,
+            FILTER_STR_LEN,
+            /* Later fragments carry no ports; reassembly sorts them out. */
+            "dst %s and (icmp or (tcp and (dst portrange %i-%i or ip[6:2] & 0x1fff != 0)))",
+            srcip,
+            SOURCE_PORT,
+            SOURCE_PORT + SYNFRAG_SOURCE_PORTS - 1
+        );
+    } else {
+        r = snprintf(
+            filter_str,
+            FILTER_STR_LEN,
+            /*
+             * Attempt to ignore ICMP6 neighbor solicitation/advertisement. The
+             * protocol of a fragmented reply is behind a fragment header.
+             */
+            "dst %s and ((icmp6 and ip6[40] != 135 and ip6[40] != 136) or (tcp and dst portrange %i-%i) or ip6[6] == 44)",
+            srcip,
+            SOURCE_PORT,
+            SOURCE_PORT + SYNFRAG_SOURCE_PORTS - 1
+        );
+    }
+    if ( r < 0 || r >= FILTER_STR_LEN ) return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "snprintf for pcap filter failed" );
+    return SYNFRAG_OK;
+}
+
+/*
+ * Buckets are picked with the low bits, so every input bit has to reach them:
+ * an IPv4 address's last octet lands in the top byte of h[0] on little endian
+ * machines, and a plain multiply would put a whole sequential scan in one
+ * bucket. This is murmur3's finalizer.
+ */
+static unsigned int addr_hash( const struct in6_addr *addr )
+{
+    unsigned int h[4], x;
+
+    memcpy( h, addr, sizeof( h ) );
+    x = h[0] ^ h[1] ^ h[2] ^ h[3];
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+    return x;
+}
+
+static void add_usec( struct timeval *tv, long usec )
+{
+    tv->tv_sec += usec / 1000000;
+    tv->tv_usec += usec % 1000000;
+    if ( tv->tv_usec >= 1000000 ) {
+        tv->tv_sec++;
+        tv->tv_usec -= 1000000;
+    } else if ( tv->tv_usec < 0 ) {
+        tv->tv_sec--;
+        tv->tv_usec += 1000000;
+    }
+}
+
+/* dst's entry in the ICMP budget table, taking it over if someone else has it. */
+static struct icmp_peer *find_peer( struct synfrag_ctx *ctx, const struct in6_addr *dst )
+{
+    struct icmp_peer *peer = &ctx->peers[addr_hash( dst ) & ctx->bucket_mask];
+
+    if ( !peer->used || memcmp( &peer->dst, dst, sizeof( struct in6_addr ) ) != 0 ) {
+        memset( peer, 0, sizeof( struct icmp_peer ) );
+        peer->used = 1;
+        peer->dst = *dst;
+        peer->interval_usec = ctx->pace_interval_usec;
+        peer->burst = ctx->pace_burst;
+    }
+    return peer;
+}
+
+/*
+ * Whether an ICMP probe has to wait for its target's budget: probes to one
+ * target go out an interval apart, or up to burst at once after a quiet
+ * spell. Either way its turn is taken, and is in probe->due.
+ */
+static int pace_probe( struct synfrag_ctx *ctx, struct probe_slot *probe, const struct timeval *now )
+{
+    struct icmp_peer *peer = find_peer( ctx, &probe->dst );
+    struct timeval earliest = peer->tat;
+
+    add_usec( &earliest, -(long) ( peer->burst - 1 ) * peer->interval_usec );
+    probe->due = timercmp( &earliest, now, > ) ? earliest : *now;
+    if ( timercmp( &peer->tat, &probe->due, < ) ) peer->tat = probe->due;
+    add_usec( &peer->tat, peer->interval_usec );
+    return timercmp( &probe->due, now, > );
+}
+
+static void pace_push( struct synfrag_ctx *ctx, int idx )
+{
+    unsigned int x = ctx->paced_count++, parent;
+
+    while ( x > 0 ) {
+        parent = ( x - 1 ) / 2;
+        if ( !timercmp( &ctx->slots[idx].due, &ctx->slots[ctx->paced[parent]].due, < ) ) break;
+        ctx->paced[x] = ctx->paced[parent];
+        x = parent;
+    }
+    ctx->paced[x] = idx;
+}
+
+/* Take the paced slot that is due first off the heap. */
+static int pace_pop( struct synfrag_ctx *ctx )
+{
+    int top = ctx->paced[0], last = ctx->paced[--ctx->paced_count];
+    unsigned int x = 0, child;
+
+    while ( ( child = 2 * x + 1 ) < ctx->paced_count ) {
+        if ( child + 1 < ctx->paced_count &&
+            timercmp( &ctx->slots[ctx->paced[child + 1]].due, &ctx->slots[ctx->paced[child]].due, < ) ) child++;
+        if ( !timercmp( &ctx->slots[ctx->paced[child]].due, &ctx->slots[last].due, < ) ) break;
+        ctx->paced[x] = ctx->paced[child];
+        x = child;
+    }
+    ctx->paced[x] = last;
+    return top;
+}
+
+static void unlink_held( struct synfrag_ctx *ctx, int idx )
+{
+    struct probe_slot *probe = &ctx->slots[idx];
+
+    if ( probe->hold_prev == -1 ) ctx->hold_head = probe->hold_next;
+    else ctx->slots[probe->hold_prev].hold_next = probe->hold_next;
+    if ( probe->hold_next == -1 ) ctx->hold_tail = probe->hold_prev;
+    else ctx->slots[probe->hold_next].hold_prev = probe->hold_prev;
+    probe->held = 0;
+}
+
+static void unlink_probe( struct synfrag_ctx *ctx, int idx )
+{
+    struct probe_slot *probe = &ctx->slots[idx];
+    int *link = &ctx->buckets[addr_hash( &probe->dst ) & ctx->bucket_mask];
+
+    while ( *link != idx ) link = &ctx->slots[*link].hash_next;
+    *link = probe->hash_next;
+
+    if ( probe->fifo_prev == -1 ) ctx->fifo_head = probe->fifo_next;
+    else ctx->slots[probe->fifo_prev].fifo_next = probe->fifo_next;
+    if ( probe->fifo_next == -1 ) ctx->fifo_tail = probe->fifo_prev;
+    else ctx->slots[probe->fifo_next].fifo_prev = probe->fifo_prev;
+    if ( probe->held ) unlink_held( ctx, idx );
+
+    probe->hash_next = ctx->free_head;
+    ctx->free_head = idx;
+    __atomic_store_n( &ctx->in_flight, ctx->in_flight - 1, __ATOMIC_RELAXED );
+}
+
+/*
+ * An ICMP error quotes the start of the probe it is about: its IP headers
+ * and at least 8 bytes past them, enough for the ports and sequence number
+ * of a SYN or the id and sequence of an echo request. Hosts and routers only
+ * report on first fragments; quotes of later ones carry no layer 4 header
+ * and match nothing. Returns the slot index, or -1.
+ */
+static int match_quoted_probe( struct synfrag_ctx *ctx, const struct decoded_packet *quote )
+{
+    struct probe_slot *probe;
+    int idx;
+
+    if ( !quote->l4 || memcmp( &quote->src, &ctx->src, sizeof( struct in6_addr ) ) != 0 ) return -1;
+
+    for ( idx = ctx->buckets[addr_hash( &quote->dst ) & ctx->bucket_mask]; idx != -1; idx = probe->hash_next ) {
+        probe = &ctx->slots[idx];
+        if ( memcmp( &probe->dst, &quote->dst, sizeof( struct in6_addr ) ) != 0 ) continue;
+        if ( probe->test->l4->quoted( probe, quote ) ) return idx;
+    }
+    return -1;
+}
+
+/*
+ * Work out which probe a reply answers. TCP replies (SYN/ACK or RST) must
+ * acknowledge our sequence number and echo replies must carry our id and
+ * sequence, so late replies to earlier probes can't be mistaken for new ones.
+ * ICMP errors, from the target or a router on the way, go to the probe they
+ * quote. An error from a target whose quote is no help (cut short, or about
+ * a later fragment) goes to the oldest probe still waiting on that target.
+ * Returns the slot index, or -1.
+ */
+static int match_reply( struct synfrag_ctx *ctx, const struct decoded_reply *reply )
+{
+    const struct decoded_packet *packet = &reply->packet;
+    struct probe_slot *probe;
+    int idx, oldest = -1;
+
+    if ( reply->quote.family && ( idx = match_quoted_probe( ctx, &reply->quote ) ) != -1 ) return idx;
+    /* Only a quote can say which probe ran out of TTL, and where. */
+    if ( reply->type == REPLY_TYPE_TIME_EXCEEDED ) return -1;
+
+    for ( idx = ctx->buckets[addr_hash( &packet->src ) & ctx->bucket_mask]; idx != -1; idx = probe->hash_next ) {
+        probe = &ctx->slots[idx];
+        if ( memcmp( &probe->dst, &packet->src, sizeof( struct in6_addr ) ) != 0 ) continue;
+
+        if ( packet->protocol == IPPROTO_TCP || reply->type == REPLY_TYPE_OPEN ) {
+            if ( probe->test->l4->answers( probe, packet ) ) return idx;
+            continue;
+        }
+        if ( oldest == -1 || timercmp( &probe->sent, &ctx->slots[oldest].sent, < ) ) oldest = idx;
+    }
+    return oldest;
+}
+
+/* decoded is the reply, NULL if there was none. */
+static void complete_probe( struct synfrag_ctx *ctx, int idx, enum TEST_RESULT result, const char *reply, int reply_len, const struct decoded_reply *decoded, struct timeval *when, struct synfrag_result *out )
+{
+    struct probe_slot *probe = &ctx->slots[idx];
+    const struct in6_addr *from = decoded ? &decoded->packet.src : NULL;
+    struct icmp_peer *peer;
+    struct timeval rtt, since;
+
+    out->id = probe->id;
+    out->test_type = probe->test_type;
+    out->result = result;
+    out->reply_type = decoded ? decoded->type : REPLY_TYPE_NONE;
+    memcpy( out->dstip, probe->dstip, SYNFRAG_ADDRSTRLEN );
+    out->dstport = probe->dstport;
+    if ( !from ) {
+        out->replier[0] = '\0';
+    } else if ( memcmp( from, &probe->dst, sizeof( struct in6_addr ) ) == 0 ) {
+        memcpy( out->replier, probe->dstip, SYNFRAG_ADDRSTRLEN );
+    } else {
+        inet_ntop( ctx->family, from, out->replier, SYNFRAG_ADDRSTRLEN );
+    }
+    out->reply = reply;
+    out->reply_len = reply_len;
+    out->user = probe->user;
+    out->early = probe->held;
+    out->rate_limited = 0;
+    if ( probe->icmp ) {
+        peer = find_peer( ctx, &probe->dst );
+        if ( from && memcmp( from, &probe->dst, sizeof( struct in6_addr ) ) == 0 ) {
+            if ( timercmp( &peer->answered, &probe->sent, < ) ) peer->answered = probe->sent;
+        } else if ( !reply && peer->answered.tv_sec && !timercmp( &probe->sent, &peer->answered, < ) ) {
+            timersub( &probe->sent, &peer->answered, &since );
+            out->rate_limited = since.tv_sec * 1000000 + since.tv_usec < RATE_LIMIT_WINDOW_USEC;
+        }
+        /* Slow down on a target that looks limited, and give up its burst. */
+        if ( out->rate_limited && ctx->pace_interval_usec ) {
+            peer->burst = 1;
+            if ( peer->interval_usec < PACE_INTERVAL_MAX_USEC ) peer->interval_usec *= 2;
+        }
+        if ( out->rate_limited ) stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_RATE_LIMITED, 1 );
+    }
+    stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_RESULTS + result, 1 );
+    if ( reply ) {
+        timersub( when, &probe->sent, &rtt );
+        out->rtt_usec = rtt.tv_sec * 1000000 + rtt.tv_usec;
+        USDT_MATCH( probe->test_type, probe->dstip, result, out->rtt_usec );
+    } else {
+        out->rtt_usec = -1;
+        USDT_TIMEOUT( probe->test_type, probe->dstip );
+    }
+    unlink_probe( ctx, idx );
+}
+
+static int alloc_probe_table( struct synfrag_ctx *ctx, unsigned int max_in_flight )
+{
+    struct probe_slot *slots;
+    struct icmp_peer *peers;
+    int *buckets, *paced;
+    unsigned int buckets_count = 1, x;
+
+    while ( buckets_count < max_in_flight ) buckets_count <<= 1;
+
+    slots = malloc( sizeof( struct probe_slot ) * max_in_flight );
+    buckets = malloc( sizeof( int ) * buckets_count );
+    paced = malloc( sizeof( int ) * max_in_flight );
+    peers = calloc( buckets_count, sizeof( struct icmp_peer ) );
+    if ( slots == NULL || buckets == NULL || paced == NULL || peers == NULL ) {
+        free( slots );
+        free( buckets );
+        free( paced );
+        free( peers );
+        return set_error( ctx, SYNFRAG_ERR_NOMEM, "Out of memory for %u probes", max_in_flight );
+    }
+
+    for ( x = 0; x < max_in_flight; x++ ) {
+        slots[x].hash_next = x + 1 < max_in_flight ? (int) x + 1 : -1;
+    }
+    for ( x = 0; x < buckets_count; x++ ) {
+        buckets[x] = -1;
+    }
+
+    free( ctx->slots );
+    free( ctx->buckets );
+    free( ctx->paced );
+    free( ctx->peers );
+    ctx->slots = slots;
+    ctx->buckets = buckets;
+    ctx->paced = paced;
+    ctx->paced_count = 0;
+    ctx->peers = peers;
+    ctx->max_in_flight = max_in_flight;
+    ctx->bucket_mask = buckets_count - 1;
+    ctx->free_head = 0;
+    ctx->fifo_head = ctx->fifo_tail = -1;
+    ctx->hold_head = ctx->hold_tail = -1;
+    return SYNFRAG_OK;
+}
+
+/* Returns 0 on success, -1 if mac_str isn't a MAC address. */
+static int parse_mac( const char *mac_str, unsigned char *dest )
+{
+    if ( sscanf( mac_str, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+            &dest[0],
+            &dest[1],
+            &dest[2],
+            &dest[3],
+            &dest[4],
+            &dest[5] ) != 6 ) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Open the backend the config asks for, with the reply filter for srcip. */
+static int open_backend( struct synfrag_ctx *ctx, const struct synfrag_config *config )
+{
+    char filter_str[FILTER_STR_LEN];
+    char ioerr[IO_ERRBUF_SIZE];
+    int flags = 0, r;
+
+    if ( ( r = build_reply_filter( ctx, config->srcip, filter_str ) ) != SYNFRAG_OK ) return r;
+    ctx->io_error = SYNFRAG_ERR_SYSTEM;
+
+    switch ( config->backend ) {
+        case SYNFRAG_BACKEND_PCAP:
+            ctx->io_error = SYNFRAG_ERR_PCAP;
+            r = io_open_pcap( &ctx->io, config->interface, filter_str, ioerr );
+            break;
+        case SYNFRAG_BACKEND_SAVEFILE:
+            if ( !config->savefile ) return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "No savefile given" );
+            ctx->io_error = SYNFRAG_ERR_PCAP;
+            r = io_open_savefile( &ctx->io, config->savefile, filter_str, config->dumpfile, ioerr );
+            break;
+        case SYNFRAG_BACKEND_PACKET:
+            if ( config->backend_flags & SYNFRAG_PACKET_QDISC_BYPASS ) flags |= IO_PACKET_QDISC_BYPASS;
+            if ( config->backend_flags & SYNFRAG_PACKET_CSUM_OFFLOAD ) flags |= IO_PACKET_CSUM_OFFLOAD;
+            r = io_open_packet( &ctx->io, config->interface, filter_str, flags, ioerr );
+            break;
+        case SYNFRAG_BACKEND_XDP:
+            if ( config->backend_flags & SYNFRAG_XDP_ZEROCOPY ) flags |= IO_XDP_ZEROCOPY;
+            if ( config->backend_flags & SYNFRAG_XDP_COPY ) flags |= IO_XDP_COPY;
+            if ( config->backend_flags & SYNFRAG_XDP_GENERIC ) flags |= IO_XDP_GENERIC;
+            /* The XDP program does the filtering itself. */
+            r = io_open_xdp( &ctx->io, config->interface, config->xdp_queue, flags, ctx->family, &ctx->src, SOURCE_PORT, SYNFRAG_SOURCE_PORTS, ioerr );
+            break;
+        case SYNFRAG_BACKEND_SIM:
+            r = io_open_sim( &ctx->io, config->sim, ioerr );
+            break;
+        case SYNFRAG_BACKEND_LOOPBACK:
+            if ( config->responder ) {
+                r = io_open_loopback( &ctx->io, config->responder, config->responder_arg, ioerr );
+            } else {
+                ctx->loopback_reassemble = !( config->backend_flags & SYNFRAG_LOOPBACK_NO_REASSEMBLY );
+                r = io_open_loopback( &ctx->io, io_loopback_host, &ctx->loopback_reassemble, ioerr );
+            }
+            break;
+        default:
+            return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unknown backend" );
+    }
+    if ( r == -1 ) return set_error( ctx, ctx->io_error, "%s", ioerr );
+    ctx->csum_offload = ( ctx->io->caps & IO_CAP_CSUM_OFFLOAD ) != 0;
+    return SYNFRAG_OK;
+}
+
+/* Public interface. */
+int synfrag_open( struct synfrag_ctx **ctxp, const char *interface, const char *srcip, const char *dstmac, char *errbuf )
+{
+    struct synfrag_config config;
+
+    memset( &config, 0, sizeof( struct synfrag_config ) );
+    config.backend = SYNFRAG_BACKEND_PCAP;
+    config.interface = interface;
+    config.srcip = srcip;
+    config.dstmac = dstmac;
+    return synfrag_open_config( ctxp, &config, errbuf );
+}
+
+int synfrag_open_config( struct synfrag_ctx **ctxp, const struct synfrag_config *config, char *errbuf )
+{
+    struct synfrag_ctx *ctx;
+    struct timeval now;
+    unsigned char no_interface_mac[ETHER_ADDR_LEN] = NO_INTERFACE_MAC;
+    int on_interface = config->backend == SYNFRAG_BACKEND_PCAP ||
+        config->backend == SYNFRAG_BACKEND_PACKET ||
+        config->backend == SYNFRAG_BACKEND_XDP;
+    int r;
+
+    *ctxp = NULL;
+    /* Aligned so each stats slot really has a cache line to itself. */
+    if ( posix_memalign( (void **) &ctx, 64, sizeof( struct synfrag_ctx ) ) != 0 ) {
+        snprintf( errbuf, SYNFRAG_ERRBUF_SIZE, "Out of memory" );
+        return SYNFRAG_ERR_NOMEM;
+    }
+    memset( ctx, 0, sizeof( struct synfrag_ctx ) );
+
+    gettimeofday( &now, NULL );
+    ctx->rand_seed = getpid() ^ now.tv_usec;
+    ctx->timeout = SYNFRAG_DEFAULT_TIMEOUT_SECONDS;
+    ctx->next_echo_seq = 1;
+    ctx->next_fragid = rand_r( &ctx->rand_seed );
+#ifdef SYNFRAG_PROFILE
+    prof_calibrate( &ctx->prof );
+#endif
+
+    if ( !config->srcip ) {
+        r = set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Missing source address" );
+        goto fail;
+    } else if ( inet_pton( AF_INET, config->srcip, &ctx->src ) == 1 ) {
+        ctx->family = AF_INET;
+    } else if ( inet_pton( AF_INET6, config->srcip, &ctx->src ) == 1 ) {
+        ctx->family = AF_INET6;
+    } else {
+        r = set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid source address: %s", config->srcip );
+        goto fail;
+    }
+
+    if ( on_interface && !config->interface ) {
+        r = set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Missing interface" );
+        goto fail;
+    }
+    /* Without a real next hop any MAC will do, so the default is our own. */
+    if ( config->dstmac ) {
+        if ( parse_mac( config->dstmac, ctx->dstmac ) == -1 ) {
+            r = set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unable to parse remote MAC address" );
+            goto fail;
+        }
+    } else if ( on_interface ) {
+        r = set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Missing remote MAC address" );
+        goto fail;
+    } else {
+        memcpy( ctx->dstmac, no_interface_mac, ETHER_ADDR_LEN );
+    }
+
+    if ( packet_pool_init( &ctx->pool, POOL_FRAMES, PACKET_POOL_FRAME_SIZE, 0 ) == -1 ) {
+        r = set_errno_error( ctx, "Unable to allocate packet pool" );
+        goto fail;
+    }
+
+    if ( reasm_init( &ctx->reasm, REASM_DEFAULT_SLOTS ) == -1 ) {
+        r = set_errno_error( ctx, "Unable to allocate fragment table" );
+        goto fail;
+    }
+
+    if ( ( r = alloc_probe_table( ctx, SYNFRAG_DEFAULT_MAX_IN_FLIGHT ) ) != SYNFRAG_OK ) goto fail;
+
+    if ( on_interface ) {
+        if ( ( r = fill_interface_mac( ctx, (char *) ctx->interface_mac, config->interface ) ) != SYNFRAG_OK ) goto fail;
+    } else {
+        memcpy( ctx->interface_mac, no_interface_mac, ETHER_ADDR_LEN );
+    }
+    if ( ( r = open_backend( ctx, config ) ) != SYNFRAG_OK ) goto fail;
+
+    *ctxp = ctx;
+    return SYNFRAG_OK;
+
+fail:
+    memcpy( errbuf, ctx->errbuf, SYNFRAG_ERRBUF_SIZE );
+    synfrag_close( ctx );
+    return r;
+}
+
+void synfrag_close( struct synfrag_ctx *ctx )
+{
+    if ( !ctx ) return;
+    /* Frames still queued go out; nothing is waiting on their results. */
+    if ( ctx->io ) transmit_pending( ctx );
+    io_close( ctx->io );
+    packet_pool_destroy( &ctx->pool );
+    reasm_destroy( &ctx->reasm );
+    free( ctx->slots );
+    free( ctx->buckets );
+    free( ctx->paced );
+    free( ctx->peers );
+    free( ctx );
+}
+
+void synfrag_set_verbose( struct synfrag_ctx *ctx, int verbose )
+{
+    ctx->verbose = verbose;
+}
+
+int synfrag_set_timeout( struct synfrag_ctx *ctx, long seconds )
+{
+    if ( seconds < 1 ) return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid value for timeout" );
+    /* Probes time out in the order they went out, so they all share one. */
+    if ( ctx->in_flight ) return set_error( ctx, SYNFRAG_ERR_BUSY, "Probes are still in flight" );
+    ctx->timeout = seconds;
+    return SYNFRAG_OK;
+}
+
+int synfrag_set_max_in_flight( struct synfrag_ctx *ctx, unsigned int max_in_flight )
+{
+    if ( max_in_flight < 1 || max_in_flight > INT_MAX / 2 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid number of probes in flight" );
+    if ( ctx->in_flight ) return set_error( ctx, SYNFRAG_ERR_BUSY, "Probes are still in flight" );
+    return alloc_probe_table( ctx, max_in_flight );
+}
+
+/*
+ * Send a submitted probe, already counted in flight, and start waiting on
+ * it. If it can't be sent its slot is given back.
+ */
+static int start_probe( struct synfrag_ctx *ctx, int idx )
+{
+    struct probe_slot *probe = &ctx->slots[idx];
+    int r, bucket;
+
+    if ( ( r = send_probe( ctx, probe, probe->hold_msec ? EMIT_FIRST : EMIT_ALL ) ) != SYNFRAG_OK ) {
+        probe->hash_next = ctx->free_head;
+        ctx->free_head = idx;
+        __atomic_store_n( &ctx->in_flight, ctx->in_flight - 1, __ATOMIC_RELAXED );
+        return r;
+    }
+
+    io_now( ctx->io, &probe->sent );
+    probe->deadline = probe->sent;
+    probe->deadline.tv_sec += ctx->timeout;
+    stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_PROBES_SENT + probe->test_type, 1 );
+
+    bucket = addr_hash( &probe->dst ) & ctx->bucket_mask;
+    probe->hash_next = ctx->buckets[bucket];
+    ctx->buckets[bucket] = idx;
+
+    probe->fifo_next = -1;
+    probe->fifo_prev = ctx->fifo_tail;
+    if ( ctx->fifo_tail == -1 ) ctx->fifo_head = idx;
+    else ctx->slots[ctx->fifo_tail].fifo_next = idx;
+    ctx->fifo_tail = idx;
+
+    probe->held = probe->hold_msec != 0;
+    if ( probe->held ) {
+        probe->release = probe->sent;
+        add_usec( &probe->release, probe->hold_msec * 1000L );
+        probe->hold_next = -1;
+        probe->hold_prev = ctx->hold_tail;
+        if ( ctx->hold_tail == -1 ) ctx->hold_head = idx;
+        else ctx->slots[ctx->hold_tail].hold_next = idx;
+        ctx->hold_tail = idx;
+    }
+    return SYNFRAG_OK;
+}
+
+int synfrag_set_icmp_pace( struct synfrag_ctx *ctx, double rate, unsigned int burst )
+{
+    if ( rate < 0 || rate > 1000000 || ( rate > 0 && burst < 1 ) )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid ICMP pace" );
+    if ( ctx->in_flight ) return set_error( ctx, SYNFRAG_ERR_BUSY, "Probes are still in flight" );
+    ctx->pace_interval_usec = rate > 0 ? 1000000 / rate : 0;
+    ctx->pace_burst = burst;
+    /* Budgets, and what was learned of rate limits, start over. */
+    memset( ctx->peers, 0, sizeof( struct icmp_peer ) * ( ctx->bucket_mask + 1 ) );
+    return SYNFRAG_OK;
+}
+
+int synfrag_capture_open( struct synfrag_capture **capturep, const char *path, char *errbuf )
+{
+    if ( capture_open( capturep, path ) == -1 ) {
+        snprintf( errbuf, SYNFRAG_ERRBUF_SIZE, "Unable to open %s: %s", path, strerror( errno ) );
+        return SYNFRAG_ERR_SYSTEM;
+    }
+    return SYNFRAG_OK;
+}
+
+int synfrag_set_capture( struct synfrag_ctx *ctx, struct synfrag_capture *capture, const char *name )
+{
+    if ( ctx->capture ) return set_error( ctx, SYNFRAG_ERR_BUSY, "Already capturing" );
+    if ( ( ctx->capture = capture_add_ring( capture, name ? name : ctx->io->ops->name ) ) == NULL )
+        return set_errno_error( ctx, "Unable to add to capture" );
+    return SYNFRAG_OK;
+}
+
+int synfrag_capture_close( struct synfrag_capture *capture, char *errbuf )
+{
+    if ( capture_close( capture ) == -1 ) {
+        snprintf( errbuf, SYNFRAG_ERRBUF_SIZE, "Unable to write capture: %s", strerror( errno ) );
+        return SYNFRAG_ERR_SYSTEM;
+    }
+    return SYNFRAG_OK;
+}
+
+int synfrag_submit( struct synfrag_ctx *ctx, const struct synfrag_probe *p )
+{
+    const struct test_desc *test;
+    struct probe_slot *probe;
+    struct timeval now;
+    int idx;
+
+    if ( ( test = find_test( p->test_type ) ) == NULL )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Unsupported test type!" );
+    if ( test->family != ctx->family )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Test %s doesn't match the source address family", test->name );
+    if ( test->l4 == &l4_tcp && !p->dstport )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Missing dstport" );
+    if ( p->hold_msec && test->baseline == test->test_type )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Only fragment tests can hold back their last fragment" );
+    if ( ( p->frag_data || p->frag_options ) && first_fragment_size( test,
+        p->frag_data ? p->frag_data : MINIMUM_FRAGMENT_SIZE, p->frag_options ? p->frag_options : test->options ) == -1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "%s has no first fragment of %u bytes of data behind %u of options",
+            test->name, p->frag_data, p->frag_options );
+    if ( p->srcport && ( p->srcport < SOURCE_PORT || p->srcport >= SOURCE_PORT + SYNFRAG_SOURCE_PORTS ) )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid srcport %u, replies are only captured for %u-%u",
+            p->srcport, SOURCE_PORT, SOURCE_PORT + SYNFRAG_SOURCE_PORTS - 1 );
+    if ( ctx->free_head == -1 )
+        return set_error( ctx, SYNFRAG_ERR_BUSY, "Too many probes in flight" );
+
+    idx = ctx->free_head;
+    probe = &ctx->slots[idx];
+    memset( &probe->dst, 0, sizeof( struct in6_addr ) );
+    if ( !p->dstip || inet_pton( ctx->family, p->dstip, &probe->dst ) != 1 )
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid IP address: %s", p->dstip ? p->dstip : "(none)" );
+    if ( !p->dstmac ) {
+        memcpy( probe->dstmac, ctx->dstmac, ETHER_ADDR_LEN );
+    } else if ( parse_mac( p->dstmac, probe->dstmac ) == -1 ) {
+        return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Invalid dstmac: %s", p->dstmac );
+    }
+
+    probe->id = ++ctx->next_probe_id;
+    probe->test_type = p->test_type;
+    probe->test = test;
+    /* Normalised, so results always spell an address the same way. */
+    inet_ntop( ctx->family, &probe->dst, probe->dstip, SYNFRAG_ADDRSTRLEN );
+    probe->dstport = test->l4 == &l4_tcp ? p->dstport : 0;
+    probe->srcport = p->srcport ? p->srcport : SOURCE_PORT;
+    probe->ttl = p->ttl;
+    probe->frag_data = p->frag_data ? p->frag_data : MINIMUM_FRAGMENT_SIZE;
+    probe->options = p->frag_options ? p->frag_options : test->options;
+    probe->syn_seq = rand_r( &ctx->rand_seed );
+    probe->echo_seq = ctx->next_echo_seq++;
+    probe->fragid = ctx->next_fragid++;
+    probe->user = p->user;
+    probe->hold_msec = p->hold_msec;
+    /* Replies to probes with a TTL set come from routers, whose limits we can't pace. */
+    probe->icmp = test->l4 != &l4_tcp && !p->ttl;
+
+    ctx->free_head = probe->hash_next;
+    __atomic_store_n( &ctx->in_flight, ctx->in_flight + 1, __ATOMIC_RELAXED );
+
+    if ( probe->icmp && ctx->pace_interval_usec ) {
+        io_now( ctx->io, &now );
+        if ( pace_probe( ctx, probe, &now ) ) {
+            pace_push( ctx, idx );
+            stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_PROBES_PACED, 1 );
+            return SYNFRAG_OK;
+        }
+    }
+    return start_probe( ctx, idx );
+}
+
+/* Send the last fragment of the oldest held probe. */
+static int release_held( struct synfrag_ctx *ctx )
+{
+    int idx = ctx->hold_head;
+
+    unlink_held( ctx, idx );
+    return send_probe( ctx, &ctx->slots[idx], EMIT_REST );
+}
+
+/*
+ * When to stop waiting: at the oldest probe's deadline, when the next held
+ * fragment or paced probe is due, or at until, whichever comes first. NULL
+ * if there is nothing to wait for.
+ */
+static const struct timeval *next_wakeup( struct synfrag_ctx *ctx, const struct timeval *until )
+{
+    const struct timeval *next = until;
+
+    if ( ctx->fifo_head != -1 && ( !next || timercmp( &ctx->slots[ctx->fifo_head].deadline, next, < ) ) )
+        next = &ctx->slots[ctx->fifo_head].deadline;
+    if ( ctx->hold_head != -1 && ( !next || timercmp( &ctx->slots[ctx->hold_head].release, next, < ) ) )
+        next = &ctx->slots[ctx->hold_head].release;
+    if ( ctx->paced_count && ( !next || timercmp( &ctx->slots[ctx->paced[0]].due, next, < ) ) )
+        next = &ctx->slots[ctx->paced[0]].due;
+    return next;
+}
+
+/*
+ * Backend stats aren't safe to read while another thread uses the backend,
+ * so the engine copies them out now and then for synfrag_get_stats().
+ */
+static void refresh_kernel_stats( struct synfrag_ctx *ctx )
+{
+    struct io_stats stats;
+
+    io_stats( ctx->io, &stats );
+    __atomic_store_n( &ctx->kernel_received, stats.received, __ATOMIC_RELAXED );
+    __atomic_store_n( &ctx->kernel_dropped, stats.dropped, __ATOMIC_RELAXED );
+    __atomic_store_n( &ctx->interface_dropped, stats.interface_dropped, __ATOMIC_RELAXED );
+}
+
+/*
+ * A pipeline's receive stage: a thread of its own draining the backend into
+ * a ring of raw frames, which receive_frame() takes them from instead, so
+ * the engine's thread only decodes and matches them. The engine sleeps on a
+ * pipe that the receiver writes to when it finds the engine waiting.
+ */
+struct received_frame {
+    struct timeval ts;
+    unsigned int len;
+    char data[IO_FRAME_MAX];
+};
+
+struct pipeline_receiver {
+    struct synfrag_ctx *ctx;
+    struct ring ring;
+    pthread_t thread;
+    /* Read and write ends. */
+    int wake[2];
+    /* Set by the engine while it sleeps, or is about to. */
+    int waiting;
+    /* Set, and written to halt so the receiver needn't wait out its sleep, to stop it. */
+    int stop;
+    int halt[2];
+    /* Set once the backend fails, with why in errbuf. */
+    int failed;
+    char errbuf[IO_ERRBUF_SIZE];
+    /* The engine still has the oldest frame, until its next receive_frame(). */
+    int held;
+};
+
+static int receive_queued( struct synfrag_ctx *ctx, char **data, int *len, struct timeval *when )
+{
+    struct pipeline_receiver *rx = ctx->receiver;
+    struct received_frame *frame;
+
+    if ( rx->held ) {
+        ring_release( &rx->ring );
+        rx->held = 0;
+    }
+    if ( ( frame = ring_peek( &rx->ring ) ) == NULL ) {
+        if ( __atomic_load_n( &rx->failed, __ATOMIC_ACQUIRE ) )
+            return set_error( ctx, ctx->io_error, "%s receive failed: %s", ctx->io->ops->name, rx->errbuf );
+        return 0;
+    }
+    *data = frame->data;
+    *len = frame->len;
+    *when = frame->ts;
+    rx->held = 1;
+    return 1;
+}
+
+/* What the engine sleeps on for frames, or -1 if some are waiting already. */
+static int receiver_sleep_fd( struct pipeline_receiver *rx )
+{
+    __atomic_store_n( &rx->waiting, 1, __ATOMIC_RELAXED );
+    /* Pairs with wake_engine(): either it sees waiting, or we see its frame. */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( ring_peek( &rx->ring ) || __atomic_load_n( &rx->failed, __ATOMIC_ACQUIRE ) ) {
+        __atomic_store_n( &rx->waiting, 0, __ATOMIC_RELAXED );
+        return -1;
+    }
+    return rx->wake[0];
+}
+
+static void receiver_woken( struct pipeline_receiver *rx )
+{
+    char buf[64];
+
+    __atomic_store_n( &rx->waiting, 0, __ATOMIC_RELAXED );
+    while ( read( rx->wake[0], buf, sizeof( buf ) ) > 0 );
+}
+
+/*
+ * The next received frame, valid until the next call. Frames come from the
+ * backend a batch at a time, or from the receive stage while a pipeline runs.
+ * Returns 1, 0 if nothing is waiting, or an error.
+ */
+static int receive_frame( struct synfrag_ctx *ctx, char **data, int *len, struct timeval *when )
+{
+    int r;
+
+    if ( ctx->receiver ) return receive_queued( ctx, data, len, when );
+    if ( ctx->rx_next == ctx->rx_count ) {
+        if ( ( r = io_recv( ctx->io, ctx->rx, IO_BATCH ) ) < 0 ) {
+            ctx->rx_count = ctx->rx_next = 0;
+            return set_error( ctx, ctx->io_error, "%s receive failed: %s", ctx->io->ops->name, ctx->io->errbuf );
+        }
+        ctx->rx_count = r;
+        ctx->rx_next = 0;
+        if ( !r ) return 0;
+    }
+    *data = ctx->rx[ctx->rx_next].data;
+    *len = ctx->rx[ctx->rx_next].len;
+    *when = ctx->rx[ctx->rx_next].ts;
+    ctx->rx_next++;
+    return 1;
+}
+
+/* Record a received frame, with what it was to the probe it completed if any. */
+static void capture_received( struct synfrag_ctx *ctx, const char *data, int len, const struct timeval *when, int idx, const struct decoded_reply *reply, enum TEST_RESULT result )
+{
+    struct capture_note note;
+
+    memset( &note, 0, sizeof( struct capture_note ) );
+    if ( idx != -1 ) {
+        note.id = ctx->slots[idx].id;
+        note.test_type = ctx->slots[idx].test_type;
+        note.reply_type = reply->type;
+        note.result = result;
+    }
+    if ( capture_frame( ctx->capture, CAPTURE_INBOUND, when, data, len, &note ) == -1 )
+        stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_CAPTURE_DROPPED, 1 );
+}
+
+/* With until set, waits no longer than that, even with nothing in flight. */
+static int next_result( struct synfrag_ctx *ctx, struct synfrag_result *result, int wait, const struct timeval *until )
+{
+    char *received_packet_data;
+    int received_packet_len;
+    const char *reply_data;
+    unsigned int reply_len;
+    struct timeval now, ts, received_time;
+    const struct timeval *wakeup;
+    struct decoded_reply reply;
+    enum TEST_RESULT res;
+    fd_set select_me;
+    PROF_DECLARE( start );
+    int r, fd, idx;
+
+    while ( 1 ) {
+        if ( !ctx->in_flight && !until ) return 0;
+
+        io_now( ctx->io, &now );
+        /* The receive stage keeps these up to date itself, being the backend's reader. */
+        if ( !ctx->receiver && now.tv_sec - ctx->kernel_stats_time >= KERNEL_STATS_INTERVAL_SECONDS ) {
+            refresh_kernel_stats( ctx );
+            ctx->kernel_stats_time = now.tv_sec;
+        }
+        /* Held back fragments go out as they come due, in submission order. */
+        while ( ctx->hold_head != -1 && !timercmp( &now, &ctx->slots[ctx->hold_head].release, < ) ) {
+            if ( ( r = release_held( ctx ) ) != SYNFRAG_OK ) return r;
+        }
+        /* And paced probes as their targets' ICMP budgets allow. */
+        while ( ctx->paced_count && !timercmp( &now, &ctx->slots[ctx->paced[0]].due, < ) ) {
+            if ( ( r = start_probe( ctx, pace_pop( ctx ) ) ) != SYNFRAG_OK ) return r;
+        }
+        /* Probes share one timeout, so the oldest always expires first. */
+        idx = ctx->fifo_head;
+        if ( idx != -1 && !timercmp( &now, &ctx->slots[idx].deadline, < ) ) {
+            complete_probe( ctx, idx, TEST_RESULT_TIMEOUT, NULL, 0, NULL, &now, result );
+            return 1;
+        }
+
+        PROF_START( start );
+        r = receive_frame( ctx, &received_packet_data, &received_packet_len, &received_time );
+        PROF_END( &ctx->prof, PROF_RECEIVE, start );
+        if ( r < 0 ) return r;
+        if ( r == 1 ) {
+            /*
+             * Everything we need is in the headers, so a truncated capture
+             * of a big reply is still good enough.
+             */
+            USDT_RECEIVE( received_packet_len );
+            PROF_START( start );
+            reply_data = received_packet_data;
+            reply_len = received_packet_len;
+            /* A fragment is held until its packet is whole; only that gets matched. */
+            r = reasm_add( &ctx->reasm, received_packet_data, received_packet_len, &received_time, ctx->timeout, &reply_data, &reply_len );
+            if ( ctx->reasm.discarded ) stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_REASSEMBLY_DISCARDED, ctx->reasm.discarded );
+            if ( r == REASM_HELD || r == REASM_DROPPED ) {
+                PROF_END( &ctx->prof, PROF_MATCH, start );
+                if ( ctx->capture ) capture_received( ctx, received_packet_data, received_packet_len, &received_time, -1, NULL, 0 );
+                continue;
+            }
+            if ( r == REASM_COMPLETE ) stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_REPLIES_REASSEMBLED, 1 );
+            idx = -1;
+            if ( decode_reply( reply_data, reply_len, &reply ) == 0 ) idx = match_reply( ctx, &reply );
+            if ( idx == -1 ) {
+                PROF_END( &ctx->prof, PROF_MATCH, start );
+                stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_REPLIES_UNMATCHED, 1 );
+                if ( ctx->capture ) capture_received( ctx, received_packet_data, received_packet_len, &received_time, -1, NULL, 0 );
+                continue;
+            }
+            stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_REPLIES_MATCHED, 1 );
+            res = reply_result( ctx, &reply );
+            PROF_END( &ctx->prof, PROF_MATCH, start );
+            if ( ctx->capture ) capture_received( ctx, received_packet_data, received_packet_len, &received_time, idx, &reply, res );
+
+            complete_probe(
+                ctx,
+                idx,
+                res,
+                reply_data,
+                reply_len,
+                &reply,
+                &received_time,
+                result
+            );
+            return 1;
+        }
+
+        /* The backend is non-blocking, 0 just means nothing was ready yet. */
+        if ( !wait || ( until && !timercmp( &now, until, < ) ) ) return 0;
+
+        /* About to wait, so whatever is queued has to go out first. */
+        if ( ctx->tx_count ) {
+            PROF_START( start );
+            r = transmit_pending( ctx );
+            PROF_END( &ctx->prof, PROF_INJECT, start );
+            if ( r != SYNFRAG_OK ) return r;
+            /* Replies may be waiting already, e.g. from the loopback backend. */
+            continue;
+        }
+
+        /* A simulated network moves its clock on instead of us sleeping. */
+        wakeup = next_wakeup( ctx, until );
+        if ( io_wait( ctx->io, wakeup ) == 0 ) continue;
+
+        /* With no descriptor nothing can arrive, so just sit out the timeout. */
+        fd = io_fd( ctx->io );
+        if ( ctx->receiver && ( fd = receiver_sleep_fd( ctx->receiver ) ) == -1 ) continue;
+        timersub( wakeup, &now, &ts );
+        FD_ZERO( &select_me );
+        if ( fd != -1 ) FD_SET( fd, &select_me );
+        PROF_START( start );
+        r = select( fd + 1, fd != -1 ? &select_me : NULL, NULL, NULL, &ts );
+        PROF_END( &ctx->prof, PROF_WAIT, start );
+        if ( ctx->receiver ) receiver_woken( ctx->receiver );
+        if ( r == -1 && errno != EINTR )
+            return set_errno_error( ctx, "select failed" );
+    }
+}
+
+int synfrag_next_result( struct synfrag_ctx *ctx, struct synfrag_result *result, int wait )
+{
+    return next_result( ctx, result, wait, NULL );
+}
+
+int synfrag_next_result_until( struct synfrag_ctx *ctx, struct synfrag_result *result, const struct timeval *until )
+{
+    return next_result( ctx, result, 1, until );
+}
+
+void synfrag_now( struct synfrag_ctx *ctx, struct timeval *now )
+{
+    io_now( ctx->io, now );
+}
+
+int synfrag_run( struct synfrag_ctx *ctx, const struct synfrag_probe *probes, unsigned int count, synfrag_result_cb cb, void *arg )
+{
+    struct synfrag_result result;
+    unsigned int x = 0;
+    int r;
+
+    while ( x < count ) {
+        r = synfrag_submit( ctx, &probes[x] );
+        if ( r == SYNFRAG_ERR_BUSY ) {
+            /* Table full, wait for something to finish. */
+            if ( ( r = synfrag_next_result( ctx, &result, 1 ) ) < 0 ) return r;
+            if ( r == 1 ) cb( &result, arg );
+            continue;
+        }
+        if ( r != SYNFRAG_OK ) return r;
+        x++;
+
+        /* Hand over anything already done so replies don't pile up. */
+        while ( ( r = synfrag_next_result( ctx, &result, 0 ) ) == 1 ) cb( &result, arg );
+        if ( r < 0 ) return r;
+    }
+
+    while ( ( r = synfrag_next_result( ctx, &result, 1 ) ) == 1 ) cb( &result, arg );
+    return r;
+}
+
+/* Pipeline functions. */
+
+/* A probe on its way from the generator, with copies of what it points to. */
+struct pipeline_probe {
+    struct synfrag_probe probe;
+    char dstip[SYNFRAG_ADDRSTRLEN];
+    char dstmac[PIPELINE_MAC_STRLEN];
+};
+
+struct pipeline_generator {
+    synfrag_probe_gen gen;
+    void *arg;
+    struct ring ring;
+    pthread_t thread;
+    /* Set by the generator once it has made its last probe. */
+    int done;
+    /* Set by the engine to give up early. */
+    int stop;
+};
+
+/* A result on its way to the sink, with its reply frame. */
+struct sink_result {
+    struct synfrag_result result;
+    char reply[SINK_REPLY_MAX];
+};
+
+struct synfrag_sink {
+    synfrag_result_cb cb;
+    void *arg;
+    struct ring ring;
+    pthread_t thread;
+    int stop;
+};
+
+static void *run_generator( void *arg )
+{
+    struct pipeline_generator *g = arg;
+    struct pipeline_probe *entry;
+    struct synfrag_probe probe;
+    unsigned int tries;
+
+    while ( !__atomic_load_n( &g->stop, __ATOMIC_ACQUIRE ) ) {
+        memset( &probe, 0, sizeof( struct synfrag_probe ) );
+        if ( g->gen( &probe, g->arg ) != 1 ) break;
+        /* A full ring is the engine asking for a break. */
+        tries = 0;
+        while ( ( entry = ring_reserve( &g->ring ) ) == NULL ) {
+            if ( __atomic_load_n( &g->stop, __ATOMIC_ACQUIRE ) ) return NULL;
+            ring_backoff( &tries );
+        }
+        entry->probe = probe;
+        snprintf( entry->dstip, SYNFRAG_ADDRSTRLEN, "%s", probe.dstip ? probe.dstip : "" );
+        snprintf( entry->dstmac, PIPELINE_MAC_STRLEN, "%s", probe.dstmac ? probe.dstmac : "" );
+        ring_publish( &g->ring, entry );
+    }
+    __atomic_store_n( &g->done, 1, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+static void *run_sink( void *arg )
+{
+    struct synfrag_sink *sink = arg;
+    struct sink_result *entry;
+    unsigned int tries = 0;
+    int stop;
+
+    while ( 1 ) {
+        /* Whatever went in before stop was set is seen before stopping. */
+        stop = __atomic_load_n( &sink->stop, __ATOMIC_ACQUIRE );
+        if ( ( entry = ring_peek( &sink->ring ) ) ) {
+            sink->cb( &entry->result, sink->arg );
+            ring_release( &sink->ring );
+            tries = 0;
+        } else if ( stop ) {
+            break;
+        } else {
+            ring_backoff( &tries );
+        }
+    }
+    return NULL;
+}
+
+/* Let the engine know there are frames, if it is asleep waiting for them. */
+static void wake_engine( struct pipeline_receiver *rx )
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( !__atomic_exchange_n( &rx->waiting, 0, __ATOMIC_RELAXED ) ) return;
+    /* A full pipe (EAGAIN) has a wakeup in it already. */
+    while ( write( rx->wake[1], "", 1 ) == -1 && errno == EINTR );
+}
+
+/* Copy a frame into the ring, waiting for room. Returns -1 if told to stop meanwhile. */
+static int receiver_push( struct pipeline_receiver *rx, const struct io_frame *frame )
+{
+    struct received_frame *entry;
+    unsigned int tries = 0;
+
+    /* The engine is behind, and the kernel's buffer holds the rest meanwhile. */
+    while ( ( entry = ring_reserve( &rx->ring ) ) == NULL ) {
+        if ( __atomic_load_n( &rx->stop, __ATOMIC_ACQUIRE ) ) return -1;
+        ring_backoff( &tries );
+    }
+    entry->ts = frame->ts;
+    entry->len = frame->len < IO_FRAME_MAX ? frame->len : IO_FRAME_MAX;
+    memcpy( entry->data, frame->data, entry->len );
+    ring_publish( &rx->ring, entry );
+    return 0;
+}
+
+static void receiver_fail( struct pipeline_receiver *rx, const char *why )
+{
+    snprintf( rx->errbuf, IO_ERRBUF_SIZE, "%s", why );
+    __atomic_store_n( &rx->failed, 1, __ATOMIC_RELEASE );
+    wake_engine( rx );
+}
+
+static void *run_receiver( void *arg )
+{
+    struct pipeline_receiver *rx = arg;
+    struct io_backend *io = rx->ctx->io;
+    struct io_frame frames[IO_BATCH];
+    struct timeval now, ts;
+    fd_set select_me;
+    time_t stats_time = 0;
+    int fd = io_fd( io ), r, x;
+    int nfds = ( fd > rx->halt[0] ? fd : rx->halt[0] ) + 1;
+
+    while ( !__atomic_load_n( &rx->stop, __ATOMIC_ACQUIRE ) ) {
+        gettimeofday( &now, NULL );
+        if ( now.tv_sec - stats_time >= KERNEL_STATS_INTERVAL_SECONDS ) {
+            refresh_kernel_stats( rx->ctx );
+            stats_time = now.tv_sec;
+        }
+        if ( ( r = io_recv( io, frames, IO_BATCH ) ) < 0 ) {
+            receiver_fail( rx, io->errbuf );
+            break;
+        }
+        for ( x = 0; x < r; x++ ) {
+            if ( receiver_push( rx, &frames[x] ) == -1 ) return NULL;
+        }
+        if ( r ) {
+            wake_engine( rx );
+            continue;
+        }
+        /* Nothing waiting, so sleep on the backend until there is or we are stopped. */
+        ts.tv_sec = 0;
+        ts.tv_usec = RECEIVER_WAIT_USEC;
+        FD_ZERO( &select_me );
+        FD_SET( fd, &select_me );
+        FD_SET( rx->halt[0], &select_me );
+        if ( select( nfds, &select_me, NULL, NULL, &ts ) == -1 && errno != EINTR ) {
+            receiver_fail( rx, strerror( errno ) );
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* A pipe with both ends non-blocking, for waking a thread sleeping in select(). */
+static int open_wakeup( int fds[2] )
+{
+    int x;
+
+    if ( pipe( fds ) == -1 ) return -1;
+    for ( x = 0; x < 2; x++ ) {
+        fcntl( fds[x], F_SETFL, O_NONBLOCK );
+        fcntl( fds[x], F_SETFD, FD_CLOEXEC );
+    }
+    return 0;
+}
+
+static void free_receiver( struct pipeline_receiver *rx )
+{
+    int x;
+
+    for ( x = 0; x < 2; x++ ) {
+        if ( rx->wake[x] != -1 ) close( rx->wake[x] );
+        if ( rx->halt[x] != -1 ) close( rx->halt[x] );
+    }
+    ring_destroy( &rx->ring );
+    free( rx );
+}
+
+/*
+ * Give ctx a receive stage, unless its backend keeps its own clock or has
+ * nothing to wait on, where frames only turn up when the engine asks.
+ * Frames already taken from the backend go into the ring first.
+ */
+static int start_receiver( struct synfrag_ctx *ctx )
+{
+    struct pipeline_receiver *rx;
+    int r;
+
+    if ( ctx->io->ops->wait || io_fd( ctx->io ) == -1 ) return SYNFRAG_OK;
+    if ( ( rx = calloc( 1, sizeof( struct pipeline_receiver ) ) ) == NULL ) return set_error( ctx, SYNFRAG_ERR_NOMEM, "Unable to allocate the receive stage" );
+    rx->ctx = ctx;
+    rx->wake[0] = rx->wake[1] = rx->halt[0] = rx->halt[1] = -1;
+    if ( ring_init( &rx->ring, PIPELINE_FRAMES, sizeof( struct received_frame ) ) == -1 ) {
+        free( rx );
+        return set_error( ctx, SYNFRAG_ERR_NOMEM, "Unable to allocate the frame ring" );
+    }
+    if ( open_wakeup( rx->wake ) == -1 || open_wakeup( rx->halt ) == -1 ) {
+        r = set_errno_error( ctx, "Unable to make the receive stage's pipes" );
+        free_receiver( rx );
+        return r;
+    }
+    while ( ctx->rx_next < ctx->rx_count ) receiver_push( rx, &ctx->rx[ctx->rx_next++] );
+    if ( ( r = pthread_create( &rx->thread, NULL, run_receiver, rx ) ) != 0 ) {
+        free_receiver( rx );
+        return set_error( ctx, SYNFRAG_ERR_SYSTEM, "Unable to start the receive stage's thread: %s", strerror( r ) );
+    }
+    ctx->receiver = rx;
+    return SYNFRAG_OK;
+}
+
+/* Frames still in the ring are late replies, dropped as synfrag_flush() would. */
+static void stop_receiver( struct synfrag_ctx *ctx )
+{
+    struct pipeline_receiver *rx = ctx->receiver;
+
+    if ( !rx ) return;
+    __atomic_store_n( &rx->stop, 1, __ATOMIC_RELEASE );
+    while ( write( rx->halt[1], "", 1 ) == -1 && errno == EINTR );
+    pthread_join( rx->thread, NULL );
+    free_receiver( rx );
+    ctx->receiver = NULL;
+}
+
+/* Copy a result into the sink, waiting for room if it is full. */
+static void sink_push( struct synfrag_ctx *ctx, struct synfrag_sink *sink, const struct synfrag_result *result )
+{
+    struct sink_result *entry;
+    unsigned int tries = 0;
+
+    if ( ( entry = ring_reserve( &sink->ring ) ) == NULL ) {
+        stat_add( &ctx->stats[ENGINE_STATS_SLOT], STAT_SINK_STALLS, 1 );
+        do {
+            ring_backoff( &tries );
+        } while ( ( entry = ring_reserve( &sink->ring ) ) == NULL );
+    }
+    entry->result = *result;
+    if ( result->reply ) {
+        entry->result.reply_len = result->reply_len < SINK_REPLY_MAX ? result->reply_len : SINK_REPLY_MAX;
+        memcpy( entry->reply, result->reply, entry->result.reply_len );
+        entry->result.reply = entry->reply;
+    }
+    ring_publish( &sink->ring, entry );
+}
+
+int synfrag_sink_open( struct synfrag_sink **sinkp, synfrag_result_cb cb, void *arg, char *errbuf )
+{
+    struct synfrag_sink *sink;
+    int r;
+
+    if ( ( sink = calloc( 1, sizeof( struct synfrag_sink ) ) ) == NULL || ring_init( &sink->ring, SINK_RESULTS, sizeof( struct sink_result ) ) == -1 ) {
+        snprintf( errbuf, SYNFRAG_ERRBUF_SIZE, "Unable to allocate a sink: %s", strerror( errno ) );
+        free( sink );
+        return SYNFRAG_ERR_NOMEM;
+    }
+    sink->cb = cb;
+    sink->arg = arg;
+    if ( ( r = pthread_create( &sink->thread, NULL, run_sink, sink ) ) != 0 ) {
+        snprintf( errbuf, SYNFRAG_ERRBUF_SIZE, "Unable to start the sink's thread: %s", strerror( r ) );
+        ring_destroy( &sink->ring );
+        free( sink );
+        return SYNFRAG_ERR_SYSTEM;
+    }
+    *sinkp = sink;
+    return SYNFRAG_OK;
+}
+
+void synfrag_sink_close( struct synfrag_sink *sink )
+{
+    __atomic_store_n( &sink->stop, 1, __ATOMIC_RELEASE );
+    pthread_join( sink->thread, NULL );
+    ring_destroy( &sink->ring );
+    free( sink );
+}
+
+int synfrag_run_pipelined( struct synfrag_ctx *ctx, synfrag_probe_gen gen, void *arg, struct synfrag_sink *sink )
+{
+    struct pipeline_generator g;
+    struct pipeline_probe *entry = NULL;
+    struct synfrag_probe probe;
+    struct synfrag_result result;
+    struct timeval until;
+    int r;
+
+    memset( &g, 0, sizeof( struct pipeline_generator ) );
+    g.gen = gen;
+    g.arg = arg;
+    if ( ring_init( &g.ring, PIPELINE_PROBES, sizeof( struct pipeline_probe ) ) == -1 )
+        return set_error( ctx, SYNFRAG_ERR_NOMEM, "Unable to allocate the probe ring" );
+    if ( ( r = start_receiver( ctx ) ) != SYNFRAG_OK ) {
+        ring_destroy( &g.ring );
+        return r;
+    }
+    if ( ( r = pthread_create( &g.thread, NULL, run_generator, &g ) ) != 0 ) {
+        stop_receiver( ctx );
+        ring_destroy( &g.ring );
+        return set_error( ctx, SYNFRAG_ERR_SYSTEM, "Unable to start the generator's thread: %s", strerror( r ) );
+    }
+
+    while ( 1 ) {
+        /* Everything the generator has ready goes in, as far as the table takes it. */
+        while ( ( entry = ring_peek( &g.ring ) ) ) {
+            probe = entry->probe;
+            probe.dstip = probe.dstip ? entry->dstip : NULL;
+            probe.dstmac = probe.dstmac ? entry->dstmac : NULL;
+            if ( ( r = synfrag_submit( ctx, &probe ) ) == SYNFRAG_ERR_BUSY ) break;
+            if ( r != SYNFRAG_OK ) goto out;
+            ring_release( &g.ring );
+            while ( ( r = next_result( ctx, &result, 0, NULL ) ) == 1 ) sink_push( ctx, sink, &result );
+            if ( r < 0 ) goto out;
+        }
+        if ( !entry && __atomic_load_n( &g.done, __ATOMIC_ACQUIRE ) && !ring_peek( &g.ring ) && !ctx->in_flight ) break;
+
+        /* A full table waits for a result; otherwise not so long that new probes sit in the ring. */
+        if ( entry ) {
+            r = next_result( ctx, &result, 1, NULL );
+        } else {
+            io_now( ctx->io, &until );
+            add_usec( &until, PIPELINE_POLL_USEC );
+            r = next_result( ctx, &result, 1, &until );
+        }
+        if ( r < 0 ) goto out;
+        if ( r == 1 ) sink_push( ctx, sink, &result );
+    }
+    r = SYNFRAG_OK;
+
+out:
+    __atomic_store_n( &g.stop, 1, __ATOMIC_RELEASE );
+    pthread_join( g.thread, NULL );
+    ring_destroy( &g.ring );
+    stop_receiver( ctx );
+    return r;
+}
+
+int synfrag_transmit( struct synfrag_ctx *ctx )
+{
+    return transmit_pending( ctx );
+}
+
+void synfrag_flush( struct synfrag_ctx *ctx )
+{
+    char *data;
+    int len;
+    struct timeval when;
+
+    while ( receive_frame( ctx, &data, &len, &when ) == 1 );
+}
+
+void synfrag_abandon( struct synfrag_ctx *ctx )
+{
+    int idx;
+
+    while ( ctx->fifo_head != -1 ) unlink_probe( ctx, ctx->fifo_head );
+    /* Paced probes haven't gone out, so they are only on the heap. */
+    while ( ctx->paced_count ) {
+        idx = ctx->paced[--ctx->paced_count];
+        ctx->slots[idx].hash_next = ctx->free_head;
+        ctx->free_head = idx;
+        __atomic_store_n( &ctx->in_flight, ctx->in_flight - 1, __ATOMIC_RELAXED );
+    }
+}
+
+unsigned int synfrag_in_flight( struct synfrag_ctx *ctx )
+{
+    return ctx->in_flight;
+}
+
+void synfrag_get_stats( struct synfrag_ctx *ctx, struct synfrag_stats *out )
+{
+    unsigned long sum[STAT_COUNT];
+    int x, y;
+
+    memset( sum, 0, sizeof( sum ) );
+    for ( x = 0; x < STATS_SLOTS; x++ ) {
+        for ( y = 0; y < STAT_COUNT; y++ ) {
+            sum[y] += __atomic_load_n( &ctx->stats[x].counter[y], __ATOMIC_RELAXED );
+        }
+    }
+
+    memcpy( out->probes_sent, &sum[STAT_PROBES_SENT], sizeof( out->probes_sent ) );
+    out->frames_sent = sum[STAT_FRAMES_SENT];
+    out->bytes_sent = sum[STAT_BYTES_SENT];
+    out->inject_failures = sum[STAT_INJECT_FAILURES];
+    out->replies_matched = sum[STAT_REPLIES_MATCHED];
+    out->replies_unmatched = sum[STAT_REPLIES_UNMATCHED];
+    out->replies_reassembled = sum[STAT_REPLIES_REASSEMBLED];
+    out->reassembly_discarded = sum[STAT_REASSEMBLY_DISCARDED];
+    out->probes_paced = sum[STAT_PROBES_PACED];
+    out->rate_limited = sum[STAT_RATE_LIMITED];
+    out->capture_dropped = sum[STAT_CAPTURE_DROPPED];
+    out->sink_stalls = sum[STAT_SINK_STALLS];
+    memcpy( out->results, &sum[STAT_RESULTS], sizeof( out->results ) );
+    out->in_flight = __atomic_load_n( &ctx->in_flight, __ATOMIC_RELAXED );
+    out->kernel_received = __atomic_load_n( &ctx->kernel_received, __ATOMIC_RELAXED );
+    out->kernel_dropped = __atomic_load_n( &ctx->kernel_dropped, __ATOMIC_RELAXED );
+    out->interface_dropped = __atomic_load_n( &ctx->interface_dropped, __ATOMIC_RELAXED );
+}
+
+int synfrag_profile_report( struct synfrag_ctx *ctx, FILE *out )
+{
+#ifdef SYNFRAG_PROFILE
+    prof_report( &ctx->prof, out );
+    return SYNFRAG_OK;
+#else
+    return set_error( ctx, SYNFRAG_ERR_ARGUMENT, "Built without profiling (make PROFILE=1)" );
+#endif
+}
+
+const char *synfrag_geterr( struct synfrag_ctx *ctx )
+{
+    return ctx->errbuf;
+}
+
+const char *synfrag_strerror( int code )
+{
+    switch ( code ) {
+        case SYNFRAG_OK: return "Success";
+        case SYNFRAG_ERR_ARGUMENT: return "Invalid argument";
+        case SYNFRAG_ERR_SYSTEM: return "System call failed";
+        case SYNFRAG_ERR_PCAP: return "libpcap error";
+        case SYNFRAG_ERR_NOMEM: return "Out of memory";
+        case SYNFRAG_ERR_BUSY: return "Too many probes in flight";
+    }
+    return "Unknown error";
+}
+
+enum TEST_TYPE synfrag_test_by_name( const char *name )
+{
+    unsigned int x;
+
+    for ( x = 0; x < TEST_COUNT; x++ ) {
+        if ( strcmp( name, tests[x].name ) == 0 ) return tests[x].test_type;
+    }
+    return TEST_INVALID;
+}
+
+const char *synfrag_test_name( enum TEST_TYPE test_type )
+{
+    const struct test_desc *test = find_test( test_type );
+
+    return test ? test->name : NULL;
+}
+
+enum TEST_TYPE synfrag_test_by_index( int x )
+{
+    if ( x < 0 || x >= TEST_COUNT ) return TEST_INVALID;
+    return tests[x].test_type;
+}
+
+int synfrag_test_family( enum TEST_TYPE test_type )
+{
+    const struct test_desc *test = find_test( test_type );
+
+    return test ? test->family : AF_UNSPEC;
+}
+
+int synfrag_test_is_tcp( enum TEST_TYPE test_type )
+{
+    const struct test_desc *test = find_test( test_type );
+
+    return test && test->l4 == &l4_tcp;
+}
+
+enum TEST_TYPE synfrag_test_baseline( enum TEST_TYPE test_type )
+{
+    const struct test_desc *test = find_test( test_type );
+
+    if ( !test || test->baseline == test_type ) return TEST_INVALID;
+    return test->baseline;
+}
+
+int synfrag_first_fragment_size( enum TEST_TYPE test_type, unsigned short frag_data, unsigned short frag_options )
+{
+    const struct test_desc *test = find_test( test_type );
+
+    if ( !test ) return -1;
+    return first_fragment_size( test, frag_data ? frag_data : MINIMUM_FRAGMENT_SIZE, frag_options ? frag_options : test->options );
+}
+
+const char *synfrag_result_name( enum TEST_RESULT result )
+{
+    if ( result >= SYNFRAG_RESULT_MAX ) return "unknown";
+    return test_result_names[result];
+}
+
+const char *synfrag_reply_type_name( enum REPLY_TYPE reply_type )
+{
+    if ( reply_type >= SYNFRAG_REPLY_TYPE_MAX ) return "unknown";
+    return reply_type_names[reply_type];
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+struct metrics_thread {
+    struct synfrag_ctx *ctx;
+    int listen_fd;
+    long interval;
+    struct synfrag_stats last;
+    struct timeval last_time;
+};
+
+static unsigned long probes_total( const struct synfrag_stats *stats )
+{
+    unsigned long total = 0;
+    int x;
+
+    for ( x = 0; x < SYNFRAG_TEST_TYPE_MAX; x++ ) {
+        total += stats->probes_sent[x];
+    }
+    return total;
+}
+
+void metrics_write_prometheus( int fd, const struct synfrag_stats *stats )
+{
+    enum TEST_TYPE test_type;
+    int x = 0;
+
+    dprintf( fd, "# TYPE synfrag_probes_sent_total counter\n" );
+    while ( ( test_type = synfrag_test_by_index( x++ ) ) ) {
+        dprintf( fd, "synfrag_probes_sent_total{test=\"%s\"} %lu\n", synfrag_test_name( test_type ), stats->probes_sent[test_type] );
+    }
+    dprintf( fd, "# TYPE synfrag_frames_sent_total counter\nsynfrag_frames_sent_total %lu\n", stats->frames_sent );
+    dprintf( fd, "# TYPE synfrag_bytes_sent_total counter\nsynfrag_bytes_sent_total %lu\n", stats->bytes_sent );
+    dprintf( fd, "# TYPE synfrag_inject_failures_total counter\nsynfrag_inject_failures_total %lu\n", stats->inject_failures );
+    dprintf( fd, "# TYPE synfrag_replies_matched_total counter\nsynfrag_replies_matched_total %lu\n", stats->replies_matched );
+    dprintf( fd, "# TYPE synfrag_replies_unmatched_total counter\nsynfrag_replies_unmatched_total %lu\n", stats->replies_unmatched );
+    dprintf( fd, "# TYPE synfrag_replies_reassembled_total counter\nsynfrag_replies_reassembled_total %lu\n", stats->replies_reassembled );
+    dprintf( fd, "# TYPE synfrag_reassembly_discarded_total counter\nsynfrag_reassembly_discarded_total %lu\n", stats->reassembly_discarded );
+    dprintf( fd, "# TYPE synfrag_probes_paced_total counter\nsynfrag_probes_paced_total %lu\n", stats->probes_paced );
+    dprintf( fd, "# TYPE synfrag_rate_limited_total counter\nsynfrag_rate_limited_total %lu\n", stats->rate_limited );
+    dprintf( fd, "# TYPE synfrag_capture_dropped_total counter\nsynfrag_capture_dropped_total %lu\n", stats->capture_dropped );
+    dprintf( fd, "# TYPE synfrag_sink_stalls_total counter\nsynfrag_sink_stalls_total %lu\n", stats->sink_stalls );
+    dprintf( fd, "# TYPE synfrag_results_total counter\n" );
+    for ( x = TEST_RESULT_SUCCESS; x < SYNFRAG_RESULT_MAX; x++ ) {
+        dprintf( fd, "synfrag_results_total{result=\"%s\"} %lu\n", synfrag_result_name( x ), stats->results[x] );
+    }
+    dprintf( fd, "# TYPE synfrag_in_flight gauge\nsynfrag_in_flight %lu\n", stats->in_flight );
+    dprintf( fd, "# TYPE synfrag_kernel_received_total counter\nsynfrag_kernel_received_total %lu\n", stats->kernel_received );
+    dprintf( fd, "# TYPE synfrag_kernel_dropped_total counter\nsynfrag_kernel_dropped_total %lu\n", stats->kernel_dropped );
+    dprintf( fd, "# TYPE synfrag_interface_dropped_total counter\nsynfrag_interface_dropped_total %lu\n", stats->interface_dropped );
+}
+
+/* Rates are over the time since the previous line. */
+static void print_stats_line( struct metrics_thread *mt )
+{
+    struct synfrag_stats now;
+    struct timeval tv, elapsed;
+    double seconds;
+
+    synfrag_get_stats( mt->ctx, &now );
+    gettimeofday( &tv, NULL );
+    timersub( &tv, &mt->last_time, &elapsed );
+    seconds = elapsed.tv_sec + elapsed.tv_usec / 1000000.0;
+    if ( seconds <= 0 ) seconds = 1;
+
+    fprintf(
+        stderr,
+        "stats: probes %lu (%.0f/s) frames %lu (%.0f pps, %.0f bps) in-flight %lu matched %lu unmatched %lu timeouts %lu inject-failures %lu kernel-drops %lu if-drops %lu\n",
+        probes_total( &now ),
+        ( probes_total( &now ) - probes_total( &mt->last ) ) / seconds,
+        now.frames_sent,
+        ( now.frames_sent - mt->last.frames_sent ) / seconds,
+        ( now.bytes_sent - mt->last.bytes_sent ) * 8 / seconds,
+        now.in_flight,
+        now.replies_matched,
+        now.replies_unmatched,
+        now.results[TEST_RESULT_TIMEOUT],
+        now.inject_failures,
+        now.kernel_dropped,
+        now.interface_dropped
+    );
+
+    mt->last = now;
+    mt->last_time = tv;
+}
+
+static void *metrics_loop( void *arg )
+{
+    struct metrics_thread *mt = arg;
+    struct synfrag_stats stats;
+    struct timeval timeout, now, next;
+    fd_set rfds;
+    int fd, r;
+
+    gettimeofday( &mt->last_time, NULL );
+    next = mt->last_time;
+    next.tv_sec += mt->interval;
+
+    while ( 1 ) {
+        FD_ZERO( &rfds );
+        if ( mt->listen_fd != -1 ) FD_SET( mt->listen_fd, &rfds );
+
+        if ( mt->interval ) {
+            gettimeofday( &now, NULL );
+            if ( !timercmp( &now, &next, < ) ) {
+                print_stats_line( mt );
+                next.tv_sec += mt->interval;
+                continue;
+            }
+            timersub( &next, &now, &timeout );
+            r = select( mt->listen_fd + 1, &rfds, NULL, NULL, &timeout );
+        } else {
+            r = select( mt->listen_fd + 1, &rfds, NULL, NULL, NULL );
+        }
+        if ( r <= 0 ) continue;
+
+        if ( ( fd = accept( mt->listen_fd, NULL, NULL ) ) == -1 ) continue;
+        synfrag_get_stats( mt->ctx, &stats );
+        metrics_write_prometheus( fd, &stats );
+        close( fd );
+    }
+
+    return NULL;
+}
+
+int metrics_start( struct synfrag_ctx *ctx, const char *socket_path, long interval )
+{
+    struct metrics_thread *mt;
+    struct sockaddr_un sun;
+    pthread_t thread;
+    int r;
+
+    if ( !socket_path && !interval ) return 0;
+
+    if ( ( mt = calloc( 1, sizeof( struct metrics_thread ) ) ) == NULL ) return -1;
+    mt->ctx = ctx;
+    mt->interval = interval;
+    mt->listen_fd = -1;
+
+    if ( socket_path ) {
+        if ( strlen( socket_path ) >= sizeof( sun.sun_path ) ) {
+            errno = ENAMETOOLONG;
+            goto fail;
+        }
+        memset( &sun, 0, sizeof( struct sockaddr_un ) );
+        sun.sun_family = AF_UNIX;
+        strcpy( sun.sun_path, socket_path );
+
+        if ( ( mt->listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) == -1 ) goto fail;
+        unlink( socket_path );
+        if ( bind( mt->listen_fd, (struct sockaddr *) &sun, sizeof( struct sockaddr_un ) ) == -1 ) goto fail;
+        if ( listen( mt->listen_fd, 16 ) == -1 ) goto fail;
+    }
+
+    if ( ( r = pthread_create( &thread, NULL, metrics_loop, mt ) ) != 0 ) {
+        errno = r;
+        goto fail;
+    }
+    pthread_detach( thread );
+    return 0;
+
+fail:
+    r = errno;
+    if ( mt->listen_fd != -1 ) close( mt->listen_fd );
+    free( mt );
+    errno = r;
+    return -1;
+}
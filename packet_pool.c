@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "packet_pool.h"
+
+#define HUGEPAGE_SIZE ( 2 * 1024 * 1024 )
+
+static void *map_frames( size_t size, int flags, int *hugepages )
+{
+    void *p;
+    int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_POPULATE
+    /* Take the page faults now rather than on the first send. */
+    mmap_flags |= MAP_POPULATE;
+#endif
+
+#ifdef MAP_HUGETLB
+    if ( ( flags & PACKET_POOL_HUGEPAGES ) && size % HUGEPAGE_SIZE == 0 ) {
+        p = mmap( NULL, size, PROT_READ | PROT_WRITE, mmap_flags | MAP_HUGETLB, -1, 0 );
+        if ( p != MAP_FAILED ) {
+            *hugepages = 1;
+            return p;
+        }
+        /* No hugepages reserved, fall back to normal pages. */
+    }
+#endif
+
+    *hugepages = 0;
+    p = mmap( NULL, size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0 );
+    if ( p == MAP_FAILED ) return NULL;
+    return p;
+}
+
+int packet_pool_init( struct packet_pool *pool, unsigned int frame_count, unsigned int frame_size, int flags )
+{
+    unsigned int x;
+    size_t size;
+
+    if ( frame_count == 0 || frame_size == 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset( pool, 0, sizeof( struct packet_pool ) );
+    /* Keep every frame on its own cache lines. */
+    frame_size = ( frame_size + PACKET_POOL_ALIGN - 1 ) & ~( PACKET_POOL_ALIGN - 1 );
+    size = (size_t) frame_size * frame_count;
+    if ( flags & PACKET_POOL_HUGEPAGES )
+        size = ( size + HUGEPAGE_SIZE - 1 ) & ~( (size_t) HUGEPAGE_SIZE - 1 );
+
+    pool->free_stack = malloc( sizeof( void * ) * frame_count );
+    if ( pool->free_stack == NULL ) return -1;
+
+    pool->base = map_frames( size, flags, &pool->hugepages );
+    if ( pool->base == NULL ) {
+        free( pool->free_stack );
+        pool->free_stack = NULL;
+        return -1;
+    }
+
+    pool->map_size = size;
+    pool->frame_size = frame_size;
+    pool->frame_count = frame_count;
+
+    /* Push in reverse so the first get() hands out the first frame. */
+    for ( x = 0; x < frame_count; x++ ) {
+        pool->free_stack[x] = pool->base + (size_t) ( frame_count - x - 1 ) * frame_size;
+    }
+    pool->free_count = frame_count;
+
+    return 0;
+}
+
+void packet_pool_destroy( struct packet_pool *pool )
+{
+    if ( pool->base ) munmap( pool->base, pool->map_size );
+    free( pool->free_stack );
+    memset( pool, 0, sizeof( struct packet_pool ) );
+}
+
+void *packet_pool_get( struct packet_pool *pool )
+{
+    if ( pool->free_count == 0 ) return NULL;
+    return pool->free_stack[--pool->free_count];
+}
+
+void packet_pool_put( struct packet_pool *pool, void *frame )
+{
+    pool->free_stack[pool->free_count++] = frame;
+}
+
+void packet_pool_put_bulk( struct packet_pool *pool, void **frames, unsigned int count )
+{
+    memcpy( &pool->free_stack[pool->free_count], frames, sizeof( void * ) * count );
+    pool->free_count += count;
+}
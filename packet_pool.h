@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <stddef.h>
+
+/*
+ * A fixed set of equally sized frames carved out of one up-front mapping.
+ * Frames are handed out and returned through a LIFO free stack so the most
+ * recently used (and therefore cache-warm) frame is reused first. A pool has
+ * no locking; each thread that needs frames should own its own pool.
+ */
+
+/* Big enough for BIG_PACKET_SIZE plus an ethernet header, in cache lines. */
+#define PACKET_POOL_FRAME_SIZE 1536
+#define PACKET_POOL_ALIGN 64
+
+/* Flags for packet_pool_init(). */
+#define PACKET_POOL_HUGEPAGES ( 1 << 0 )
+
+struct packet_pool {
+    char *base;
+    size_t map_size;
+    unsigned int frame_size;
+    unsigned int frame_count;
+    unsigned int free_count;
+    int hugepages;
+    void **free_stack;
+};
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int packet_pool_init( struct packet_pool *, unsigned int frame_count, unsigned int frame_size, int flags );
+void packet_pool_destroy( struct packet_pool * );
+
+/* Returns NULL if every frame is in use. */
+void *packet_pool_get( struct packet_pool * );
+void packet_pool_put( struct packet_pool *, void * );
+void packet_pool_put_bulk( struct packet_pool *, void **, unsigned int );
+
+#endif
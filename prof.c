@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifdef SYNFRAG_PROFILE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "prof.h"
+
+static char *prof_stage_names[] = {
+    "build",
+    "checksum",
+    "inject",
+    "receive",
+    "match",
+    "wait"
+};
+
+static double elapsed_usec( struct timespec *start, struct timespec *end )
+{
+    return ( end->tv_sec - start->tv_sec ) * 1000000.0 + ( end->tv_nsec - start->tv_nsec ) / 1000.0;
+}
+
+/* Measure the cycle counter against the monotonic clock for 20ms. */
+void prof_calibrate( struct prof *prof )
+{
+    struct timespec start, end, pause = { 0, 20000000 };
+    uint64_t c1, c2;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    c1 = prof_cycles();
+    nanosleep( &pause, NULL );
+    c2 = prof_cycles();
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    prof->cycles_per_usec = ( c2 - c1 ) / elapsed_usec( &start, &end );
+    if ( prof->cycles_per_usec <= 0 ) prof->cycles_per_usec = 1;
+}
+
+/* Upper bound of the bucket holding the given fraction of samples. */
+static uint64_t percentile( const struct prof_stage *s, double fraction )
+{
+    uint64_t want = s->count * fraction, seen = 0;
+    int x;
+
+    for ( x = 0; x < PROF_HIST_BUCKETS; x++ ) {
+        seen += s->hist[x];
+        if ( seen > want ) break;
+    }
+    if ( x >= PROF_HIST_BUCKETS - 1 || ( (uint64_t) 1 << x ) > s->max ) return s->max;
+    return (uint64_t) 1 << x;
+}
+
+void prof_report( const struct prof *prof, FILE *out )
+{
+    const struct prof_stage *s;
+    uint64_t all = 0;
+    int x, y;
+
+    for ( x = 0; x < PROF_STAGES; x++ ) {
+        all += prof->stage[x].total;
+    }
+    if ( !all ) all = 1;
+
+    fprintf( out, "\nCycles per stage (%.0f cycles/usec):\n\n", prof->cycles_per_usec );
+    fprintf( out, "%-9s %10s %14s %6s %10s %10s %10s %12s %10s\n", "stage", "count", "total", "share", "mean", "min", "p50", "p99", "max" );
+    for ( x = 0; x < PROF_STAGES; x++ ) {
+        s = &prof->stage[x];
+        if ( !s->count ) continue;
+        fprintf(
+            out,
+            "%-9s %10llu %14llu %5.1f%% %10llu %10llu %10llu %12llu %10llu\n",
+            prof_stage_names[x],
+            (unsigned long long) s->count,
+            (unsigned long long) s->total,
+            s->total * 100.0 / all,
+            (unsigned long long) ( s->total / s->count ),
+            (unsigned long long) s->min,
+            (unsigned long long) percentile( s, 0.5 ),
+            (unsigned long long) percentile( s, 0.99 ),
+            (unsigned long long) s->max
+        );
+    }
+
+    fprintf( out, "\nHistograms (samples under N cycles):\n" );
+    for ( x = 0; x < PROF_STAGES; x++ ) {
+        s = &prof->stage[x];
+        if ( !s->count ) continue;
+        fprintf( out, "\n%s:\n", prof_stage_names[x] );
+        for ( y = 0; y < PROF_HIST_BUCKETS; y++ ) {
+            if ( !s->hist[y] ) continue;
+            fprintf( out, "  < %-14llu %llu\n", (unsigned long long) 1 << y, (unsigned long long) s->hist[y] );
+        }
+    }
+}
+
+#endif
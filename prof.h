@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Hot path instrumentation for the engine. Two independent pieces:
+ *
+ * Stage timing, compiled in with -DSYNFRAG_PROFILE (make PROFILE=1). Each
+ * stage is timed with the TSC and every sample goes into a log2 histogram.
+ * Without the define the PROF_* macros are empty and cost nothing.
+ *
+ * USDT probes, compiled in whenever <sys/sdt.h> is available (define
+ * SYNFRAG_NO_SDT to leave them out). They are a nop until perf or bpftrace
+ * attaches, so they stay in production builds.
+ */
+
+enum PROF_STAGE {
+    /* Frame construction, minus the checksum and inject time within it. */
+    PROF_BUILD = 0,
+    PROF_CHECKSUM,
+    PROF_INJECT,
+    /* Taking a frame from the backend, whether or not it had one. */
+    PROF_RECEIVE,
+    /* Finding the probe a reply belongs to and deciding its result. */
+    PROF_MATCH,
+    /* Blocked in select() for replies. */
+    PROF_WAIT,
+    PROF_STAGES
+};
+
+/* Bucket n counts samples of less than 2^n cycles. */
+#define PROF_HIST_BUCKETS 48
+
+struct prof_stage {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t hist[PROF_HIST_BUCKETS];
+};
+
+struct prof {
+    struct prof_stage stage[PROF_STAGES];
+    /* Cycles spent in checksum and inject, so build can subtract them. */
+    uint64_t nested;
+    double cycles_per_usec;
+};
+
+#ifdef SYNFRAG_PROFILE
+
+static inline uint64_t prof_cycles( void )
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ( "rdtsc" : "=a" ( lo ), "=d" ( hi ) );
+    return ( (uint64_t) hi << 32 ) | lo;
+#else
+    struct timespec ts;
+
+    /* No TSC, nanoseconds stand in for cycles. */
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void prof_record( struct prof *prof, int stage, uint64_t cycles )
+{
+    struct prof_stage *s = &prof->stage[stage];
+    int bucket = cycles ? 64 - __builtin_clzll( cycles ) : 0;
+
+    if ( bucket >= PROF_HIST_BUCKETS ) bucket = PROF_HIST_BUCKETS - 1;
+    if ( !s->count || cycles < s->min ) s->min = cycles;
+    if ( cycles > s->max ) s->max = cycles;
+    s->count++;
+    s->total += cycles;
+    s->hist[bucket]++;
+}
+
+#define PROF_DECLARE( var ) uint64_t var
+#define PROF_START( var ) ( var ) = prof_cycles()
+#define PROF_END( prof, stage, var ) prof_record( ( prof ), ( stage ), prof_cycles() - ( var ) )
+/* For stages that run inside PROF_BUILD. */
+#define PROF_END_NESTED( prof, stage, var ) do { \
+    uint64_t prof_elapsed_ = prof_cycles() - ( var ); \
+    prof_record( ( prof ), ( stage ), prof_elapsed_ ); \
+    ( prof )->nested += prof_elapsed_; \
+} while ( 0 )
+
+void prof_calibrate( struct prof *prof );
+void prof_report( const struct prof *prof, FILE *out );
+
+#else
+
+#define PROF_DECLARE( var ) int var __attribute__(( unused ))
+#define PROF_START( var ) do { } while ( 0 )
+#define PROF_END( prof, stage, var ) do { } while ( 0 )
+#define PROF_END_NESTED( prof, stage, var ) do { } while ( 0 )
+
+#endif
+
+#if !defined( SYNFRAG_NO_SDT ) && defined( __has_include )
+#if __has_include( <sys/sdt.h> )
+#include <sys/sdt.h>
+#define SYNFRAG_HAVE_SDT 1
+#endif
+#endif
+
+/*
+ * synfrag:send(test, dstip, dstport)
+ * synfrag:receive(caplen)
+ * synfrag:match(test, dstip, result, rtt_usec)
+ * synfrag:timeout(test, dstip)
+ */
+#ifdef SYNFRAG_HAVE_SDT
+#define USDT_SEND( test, dstip, dstport ) DTRACE_PROBE3( synfrag, send, test, dstip, dstport )
+#define USDT_RECEIVE( caplen ) DTRACE_PROBE1( synfrag, receive, caplen )
+#define USDT_MATCH( test, dstip, result, rtt ) DTRACE_PROBE4( synfrag, match, test, dstip, result, rtt )
+#define USDT_TIMEOUT( test, dstip ) DTRACE_PROBE2( synfrag, timeout, test, dstip )
+#else
+#define USDT_SEND( test, dstip, dstport ) do { } while ( 0 )
+#define USDT_RECEIVE( caplen ) do { } while ( 0 )
+#define USDT_MATCH( test, dstip, result, rtt ) do { } while ( 0 )
+#define USDT_TIMEOUT( test, dstip ) do { } while ( 0 )
+#endif
+
+#endif
@@ -0,0 +1,703 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+
+/*
+ * synfrag-query: reads the files --compare --results writes. Prints the
+ * pairs that pass the filters, counts them per prefix with --by, or with
+ * --diff, prints the pairs whose results differ between two runs. Each
+ * file is read as one sorted stream, merged from its sorted blocks, and
+ * with --prefix only the blocks that can hold it are read at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+
+#include "synfrag.h"
+#include "results.h"
+
+/* What a row must be to be read; -1 for any. */
+struct filter {
+    int prefix;
+    unsigned char low[16];
+    unsigned char high[16];
+    int test_type;
+    int verdict;
+    int reply;
+    /* Only pairs whose verdict isn't agree. */
+    int differ;
+};
+
+/*
+ * One block's rows from some point on. key is the next row's address, port
+ * and test as integers that order the same way, so the heap compares them
+ * cheaply and only rows that come off it are gathered.
+ */
+struct cursor {
+    struct results_columns columns;
+    unsigned int at;
+    uint64_t key[3];
+};
+
+/* A file's rows in order: a heap of its blocks' cursors, by their next row. */
+struct merge {
+    const struct filter *filter;
+    struct cursor *cursors;
+    unsigned int *heap;
+    unsigned int count;
+};
+
+static const char *test_label( unsigned int test_type )
+{
+    const char *name = synfrag_test_name( test_type );
+
+    return name ? name : "unknown";
+}
+
+static const char *reply_label( unsigned int reply_type )
+{
+    return reply_type == REPLY_TYPE_NONE ? "timeout" : synfrag_reply_type_name( reply_type );
+}
+
+static const char *verdict_label( unsigned int verdict )
+{
+    return verdict < VERDICT_MAX ? results_verdict_names[verdict] : "unknown";
+}
+
+/* Keep the top bits of addr and set the rest to fill. */
+static void mask_addr( const unsigned char *addr, unsigned int bits, unsigned char fill, unsigned char *out )
+{
+    unsigned int x;
+
+    for ( x = 0; x < 16; x++ ) {
+        if ( bits >= 8 ) {
+            out[x] = addr[x];
+            bits -= 8;
+        } else {
+            out[x] = ( addr[x] & ( 0xff00 >> bits ) ) | ( fill & ( 0xff >> bits ) );
+            bits = 0;
+        }
+    }
+}
+
+/* Whether addr is IPv4, whose prefix lengths count from bit 96. */
+static int is_mapped( const unsigned char *addr )
+{
+    static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    return memcmp( addr, mapped, sizeof( mapped ) ) == 0;
+}
+
+static void parse_prefix( const char *arg, struct filter *filter )
+{
+    char buf[SYNFRAG_ADDRSTRLEN + 8];
+    unsigned char addr[16];
+    char *slash;
+    int bits = -1, max;
+
+    snprintf( buf, sizeof( buf ), "%s", arg );
+    if ( ( slash = strchr( buf, '/' ) ) ) {
+        *slash = '\0';
+        bits = atoi( slash + 1 );
+    }
+    if ( results_pton( buf, addr ) == -1 ) errx( 1, "Invalid prefix %s", arg );
+    max = is_mapped( addr ) ? 32 : 128;
+    if ( bits == -1 ) bits = max;
+    if ( bits < 0 || bits > max ) errx( 1, "Invalid prefix length in %s", arg );
+    if ( is_mapped( addr ) ) bits += 96;
+    mask_addr( addr, bits, 0, filter->low );
+    mask_addr( addr, bits, 0xff, filter->high );
+    filter->prefix = 1;
+}
+
+/* Whether row x of a block passes the filter, prefix aside. */
+static int filter_row( const struct filter *filter, const struct results_columns *c, unsigned int x )
+{
+    if ( filter->test_type != -1 && c->test_type[x] != filter->test_type ) return 0;
+    if ( filter->verdict != -1 && c->verdict[x] != filter->verdict ) return 0;
+    if ( filter->reply != -1 && c->reply[x] != filter->reply ) return 0;
+    if ( filter->differ && c->verdict[x] == VERDICT_AGREE ) return 0;
+    return 1;
+}
+
+static uint64_t load_be64( const unsigned char *p )
+{
+    uint64_t v = 0;
+    unsigned int x;
+
+    for ( x = 0; x < 8; x++ ) {
+        v = v << 8 | p[x];
+    }
+    return v;
+}
+
+/*
+ * Move the cursor to the next row that passes the filter, and set its key.
+ * Returns 0 if its block has none left in the prefix.
+ */
+static int cursor_load( struct cursor *cursor, const struct filter *filter )
+{
+    const struct results_columns *c = &cursor->columns;
+
+    for ( ; cursor->at < c->rows; cursor->at++ ) {
+        if ( filter->prefix && memcmp( c->addr[cursor->at], filter->high, 16 ) > 0 ) return 0;
+        if ( !filter_row( filter, c, cursor->at ) ) continue;
+        cursor->key[0] = load_be64( c->addr[cursor->at] );
+        cursor->key[1] = load_be64( c->addr[cursor->at] + 8 );
+        cursor->key[2] = (uint64_t) c->port[cursor->at] << 8 | c->test_type[cursor->at];
+        return 1;
+    }
+    return 0;
+}
+
+static int heap_less( const struct merge *m, unsigned int a, unsigned int b )
+{
+    const uint64_t *ka = m->cursors[m->heap[a]].key, *kb = m->cursors[m->heap[b]].key;
+
+    if ( ka[0] != kb[0] ) return ka[0] < kb[0];
+    if ( ka[1] != kb[1] ) return ka[1] < kb[1];
+    return ka[2] < kb[2];
+}
+
+static void sift_down( struct merge *m, unsigned int x )
+{
+    unsigned int child, tmp;
+
+    while ( ( child = x * 2 + 1 ) < m->count ) {
+        if ( child + 1 < m->count && heap_less( m, child + 1, child ) ) child++;
+        if ( !heap_less( m, child, x ) ) break;
+        tmp = m->heap[x];
+        m->heap[x] = m->heap[child];
+        m->heap[child] = tmp;
+        x = child;
+    }
+}
+
+/*
+ * Start reading results in order. With a prefix, blocks that end before it
+ * or start after it are skipped, and the rest are read from its first row
+ * on, found by binary search.
+ */
+static void merge_open( struct merge *m, const struct results *results, const struct filter *filter )
+{
+    struct cursor *cursor;
+    unsigned int low, high, mid;
+    uint64_t n;
+
+    m->filter = filter;
+    m->count = 0;
+    m->cursors = malloc( sizeof( struct cursor ) * ( results->header->blocks + 1 ) );
+    m->heap = malloc( sizeof( unsigned int ) * ( results->header->blocks + 1 ) );
+    if ( !m->cursors || !m->heap ) err( 1, "malloc" );
+    for ( n = 0; n < results->header->blocks; n++ ) {
+        cursor = &m->cursors[m->count];
+        results_block( results, n, &cursor->columns );
+        if ( cursor->columns.rows > results->header->block_rows ) errx( 1, "Block %lu is damaged", (unsigned long) n );
+        cursor->at = 0;
+        if ( filter->prefix ) {
+            if ( memcmp( cursor->columns.last, filter->low, 16 ) < 0 || memcmp( cursor->columns.first, filter->high, 16 ) > 0 ) continue;
+            low = 0;
+            high = cursor->columns.rows;
+            while ( low < high ) {
+                mid = low + ( high - low ) / 2;
+                if ( memcmp( cursor->columns.addr[mid], filter->low, 16 ) < 0 ) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            cursor->at = low;
+        }
+        if ( !cursor_load( cursor, filter ) ) continue;
+        m->heap[m->count] = m->count;
+        m->count++;
+    }
+    for ( n = m->count / 2; n-- > 0; ) {
+        sift_down( m, n );
+    }
+}
+
+/* The next row that passes the filter, in order. Returns 0 past the last. */
+static int merge_next( struct merge *m, struct results_row *row )
+{
+    struct cursor *cursor;
+
+    if ( !m->count ) return 0;
+    cursor = &m->cursors[m->heap[0]];
+    results_row( &cursor->columns, cursor->at++, row );
+    if ( !cursor_load( cursor, m->filter ) ) m->heap[0] = m->heap[--m->count];
+    sift_down( m, 0 );
+    return 1;
+}
+
+static void merge_close( struct merge *m )
+{
+    free( m->cursors );
+    free( m->heap );
+}
+
+static void open_results( struct results *results, const char *path )
+{
+    if ( results_open( results, path ) == -1 ) {
+        if ( errno == EINVAL ) errx( 1, "%s is not a results file", path );
+        err( 1, "Unable to open %s", path );
+    }
+}
+
+/* "<dstip> <dstport>" as --compare prints it, "-" for the port of ICMP tests. */
+static void print_pair( const struct results_row *row )
+{
+    char addr[SYNFRAG_ADDRSTRLEN];
+
+    results_ntop( row->addr, addr, sizeof( addr ) );
+    if ( synfrag_test_is_tcp( row->test_type ) ) {
+        printf( "%s %u", addr, row->port );
+    } else {
+        printf( "%s -", addr );
+    }
+}
+
+static void print_rtt( long rtt_usec )
+{
+    if ( rtt_usec < 0 ) {
+        printf( "-" );
+    } else {
+        printf( "%.1f", rtt_usec / 1000.0 );
+    }
+}
+
+static void print_row( const struct results_row *row )
+{
+    char when[32];
+    time_t t = row->time;
+
+    print_pair( row );
+    printf( " %s=%s %s=%s %s rtt ",
+        test_label( row->test_type ), reply_label( row->reply ),
+        test_label( synfrag_test_baseline( row->test_type ) ), reply_label( row->baseline_reply ),
+        verdict_label( row->verdict ) );
+    print_rtt( row->rtt_usec );
+    printf( "/" );
+    print_rtt( row->baseline_rtt_usec );
+    strftime( when, sizeof( when ), "%Y-%m-%dT%H:%M:%SZ", gmtime( &t ) );
+    printf( " ms %s\n", when );
+}
+
+static unsigned long list_rows( const struct results *results, const struct filter *filter )
+{
+    struct merge m;
+    struct results_row row;
+    unsigned long count = 0;
+
+    merge_open( &m, results, filter );
+    while ( merge_next( &m, &row ) ) {
+        print_row( &row );
+        count++;
+    }
+    merge_close( &m );
+    return count;
+}
+
+/* Prefixes --by counts in memory before it falls back to merging. */
+#define AGGREGATES_MAX ( 1 << 20 )
+
+/* Counts for one prefix. */
+struct aggregate {
+    unsigned char prefix[16];
+    unsigned int bits;
+    unsigned long pairs;
+    unsigned long verdicts[VERDICT_MAX];
+    unsigned long rtt_count;
+    double rtt_sum;
+};
+
+/*
+ * Every prefix's counts, open addressed; a slot is free while its pairs is
+ * 0. At most AGGREGATES_MAX prefixes, so it stays in memory.
+ */
+struct aggregates {
+    struct aggregate *slots;
+    unsigned long size;
+    unsigned long used;
+};
+
+static unsigned long aggregate_slot( const struct aggregates *t, const unsigned char *prefix, unsigned int bits )
+{
+    uint64_t h = 14695981039346656037ULL;
+    unsigned long slot;
+    unsigned int x;
+
+    for ( x = 0; x < 16; x++ ) {
+        h = ( h ^ prefix[x] ) * 1099511628211ULL;
+    }
+    h = ( h ^ bits ) * 1099511628211ULL;
+    for ( slot = h & ( t->size - 1 ); t->slots[slot].pairs; slot = ( slot + 1 ) & ( t->size - 1 ) ) {
+        if ( t->slots[slot].bits == bits && memcmp( t->slots[slot].prefix, prefix, 16 ) == 0 ) break;
+    }
+    return slot;
+}
+
+/*
+ * Add a's counts to its prefix's, growing the table to stay at most half
+ * full. Returns -1 if that would take more than AGGREGATES_MAX prefixes.
+ */
+static int add_aggregate( struct aggregates *t, const struct aggregate *a )
+{
+    struct aggregate *old = t->slots, *slot;
+    unsigned long old_size = t->size, x;
+
+    if ( ( t->used + 1 ) * 2 > t->size ) {
+        if ( t->used == AGGREGATES_MAX ) return -1;
+        t->size = t->size ? t->size * 2 : 1024;
+        if ( ( t->slots = calloc( t->size, sizeof( struct aggregate ) ) ) == NULL ) err( 1, "calloc" );
+        for ( x = 0; x < old_size; x++ ) {
+            if ( old[x].pairs ) t->slots[aggregate_slot( t, old[x].prefix, old[x].bits )] = old[x];
+        }
+        free( old );
+    }
+    slot = &t->slots[aggregate_slot( t, a->prefix, a->bits )];
+    if ( !slot->pairs ) {
+        memcpy( slot->prefix, a->prefix, 16 );
+        slot->bits = a->bits;
+        t->used++;
+    }
+    slot->pairs += a->pairs;
+    for ( x = 0; x < VERDICT_MAX; x++ ) {
+        slot->verdicts[x] += a->verdicts[x];
+    }
+    slot->rtt_count += a->rtt_count;
+    slot->rtt_sum += a->rtt_sum;
+    return 0;
+}
+
+static int compare_aggregates( const void *a, const void *b )
+{
+    const struct aggregate *x = a, *y = b;
+    int r = memcmp( x->prefix, y->prefix, 16 );
+
+    if ( r ) return r;
+    return x->bits < y->bits ? -1 : x->bits > y->bits;
+}
+
+static void print_aggregate( const struct aggregate *a )
+{
+    char addr[SYNFRAG_ADDRSTRLEN];
+    unsigned int x;
+
+    results_ntop( a->prefix, addr, sizeof( addr ) );
+    printf( "%s/%u %lu", addr, is_mapped( a->prefix ) ? a->bits - 96 : a->bits, a->pairs );
+    for ( x = 0; x < VERDICT_MAX; x++ ) {
+        printf( " %lu", a->verdicts[x] );
+    }
+    if ( a->rtt_count ) {
+        printf( " %.1f\n", a->rtt_sum / a->rtt_count / 1000.0 );
+    } else {
+        printf( " -\n" );
+    }
+}
+
+static void print_aggregate_header( void )
+{
+    unsigned int x;
+
+    printf( "prefix pairs" );
+    for ( x = 0; x < VERDICT_MAX; x++ ) {
+        printf( " %s", results_verdict_names[x] );
+    }
+    printf( " rtt-ms\n" );
+}
+
+/* Add row x of a block to a, the counts of the prefix it is in. */
+static void count_row( struct aggregate *a, const struct results_columns *c, unsigned int x )
+{
+    a->pairs++;
+    if ( c->verdict[x] < VERDICT_MAX ) a->verdicts[c->verdict[x]]++;
+    if ( c->rtt_usec[x] >= 0 ) {
+        a->rtt_sum += c->rtt_usec[x];
+        a->rtt_count++;
+    }
+}
+
+/* The prefix row x of a block is in; returns its length, IPv4 counted from bit 96. */
+static unsigned int row_prefix( const struct results_columns *c, unsigned int x, unsigned int bits4, unsigned int bits6, unsigned char *prefix )
+{
+    unsigned int bits = is_mapped( c->addr[x] ) ? bits4 + 96 : bits6;
+
+    mask_addr( c->addr[x], bits, 0, prefix );
+    return bits;
+}
+
+/* Count per prefix over all the blocks merged, printing each as it ends. */
+static unsigned long aggregate_merged( const struct results *results, const struct filter *filter, unsigned int bits4, unsigned int bits6 )
+{
+    struct merge m;
+    struct cursor *cursor;
+    struct aggregate a;
+    unsigned char prefix[16];
+    unsigned long count = 0;
+    unsigned int bits;
+
+    print_aggregate_header();
+    memset( &a, 0, sizeof( struct aggregate ) );
+    merge_open( &m, results, filter );
+    while ( m.count ) {
+        cursor = &m.cursors[m.heap[0]];
+        bits = row_prefix( &cursor->columns, cursor->at, bits4, bits6, prefix );
+        if ( a.pairs && ( bits != a.bits || memcmp( prefix, a.prefix, 16 ) != 0 ) ) {
+            print_aggregate( &a );
+            memset( &a, 0, sizeof( struct aggregate ) );
+            count++;
+        }
+        memcpy( a.prefix, prefix, 16 );
+        a.bits = bits;
+        count_row( &a, &cursor->columns, cursor->at++ );
+        if ( !cursor_load( cursor, filter ) ) m.heap[0] = m.heap[--m.count];
+        sift_down( &m, 0 );
+    }
+    if ( a.pairs ) {
+        print_aggregate( &a );
+        count++;
+    }
+    merge_close( &m );
+    return count;
+}
+
+/*
+ * Count the pairs in every IPv4 /bits4 and IPv6 /bits6 there are rows for.
+ * Order doesn't matter for counting, so this reads each block straight
+ * through instead of merging them: a block is sorted, so its rows come a
+ * prefix at a time, and each run of them is added to a table once. With
+ * more prefixes than the table takes, it falls back to merging.
+ */
+static unsigned long aggregate_rows( const struct results *results, const struct filter *filter, unsigned int bits4, unsigned int bits6 )
+{
+    struct merge m;
+    struct cursor *cursor;
+    struct aggregates table;
+    struct aggregate a;
+    unsigned char prefix[16];
+    unsigned long x, used;
+    unsigned int bits;
+    int full = 0;
+
+    memset( &table, 0, sizeof( struct aggregates ) );
+    merge_open( &m, results, filter );
+    for ( x = 0; x < m.count && !full; x++ ) {
+        cursor = &m.cursors[x];
+        memset( &a, 0, sizeof( struct aggregate ) );
+        do {
+            bits = row_prefix( &cursor->columns, cursor->at, bits4, bits6, prefix );
+            if ( a.pairs && ( bits != a.bits || memcmp( prefix, a.prefix, 16 ) != 0 ) ) {
+                if ( ( full = add_aggregate( &table, &a ) == -1 ) ) break;
+                memset( &a, 0, sizeof( struct aggregate ) );
+            }
+            memcpy( a.prefix, prefix, 16 );
+            a.bits = bits;
+            count_row( &a, &cursor->columns, cursor->at++ );
+        } while ( cursor_load( cursor, filter ) );
+        if ( !full ) full = add_aggregate( &table, &a ) == -1;
+    }
+    merge_close( &m );
+    if ( full ) {
+        free( table.slots );
+        return aggregate_merged( results, filter, bits4, bits6 );
+    }
+
+    for ( x = 0, used = 0; x < table.size; x++ ) {
+        if ( table.slots[x].pairs ) table.slots[used++] = table.slots[x];
+    }
+    qsort( table.slots, used, sizeof( struct aggregate ), compare_aggregates );
+    print_aggregate_header();
+    for ( x = 0; x < used; x++ ) {
+        print_aggregate( &table.slots[x] );
+    }
+    free( table.slots );
+    return used;
+}
+
+static void print_side( const struct results_row *row )
+{
+    printf( "%s (%s/%s)", verdict_label( row->verdict ), reply_label( row->reply ), reply_label( row->baseline_reply ) );
+}
+
+/*
+ * Walk both runs in order side by side and print the pairs that are only in
+ * one of them, or whose verdict or replies aren't the same in both. Returns
+ * 1 if there were any.
+ */
+static int diff_rows( const struct results *before, const struct results *after, const struct filter *filter )
+{
+    struct merge a, b;
+    struct results_row row_a, row_b;
+    unsigned long both = 0, changed = 0, added = 0, gone = 0;
+    int more_a, more_b, order;
+
+    merge_open( &a, before, filter );
+    merge_open( &b, after, filter );
+    more_a = merge_next( &a, &row_a );
+    more_b = merge_next( &b, &row_b );
+    while ( more_a || more_b ) {
+        if ( !more_a ) {
+            order = 1;
+        } else if ( !more_b ) {
+            order = -1;
+        } else {
+            order = results_compare( &row_a, &row_b );
+        }
+        if ( order < 0 ) {
+            print_pair( &row_a );
+            printf( " %s: ", test_label( row_a.test_type ) );
+            print_side( &row_a );
+            printf( " -> gone\n" );
+            gone++;
+            more_a = merge_next( &a, &row_a );
+        } else if ( order > 0 ) {
+            print_pair( &row_b );
+            printf( " %s: new -> ", test_label( row_b.test_type ) );
+            print_side( &row_b );
+            printf( "\n" );
+            added++;
+            more_b = merge_next( &b, &row_b );
+        } else {
+            both++;
+            if ( row_a.verdict != row_b.verdict || row_a.reply != row_b.reply || row_a.baseline_reply != row_b.baseline_reply ) {
+                print_pair( &row_a );
+                printf( " %s: ", test_label( row_a.test_type ) );
+                print_side( &row_a );
+                printf( " -> " );
+                print_side( &row_b );
+                printf( "\n" );
+                changed++;
+            }
+            more_a = merge_next( &a, &row_a );
+            more_b = merge_next( &b, &row_b );
+        }
+    }
+    merge_close( &a );
+    merge_close( &b );
+    printf( "%lu pairs in both, %lu changed, %lu new, %lu gone.\n", both, changed, added, gone );
+    return changed || added || gone;
+}
+
+static void exit_with_usage( void )
+{
+    fprintf( stderr, "synfrag-query [--prefix P] [--test T] [--verdict V] [--reply R] [--differ] RESULTS\n" );
+    fprintf( stderr, "synfrag-query [filters] --by BITS [--by6 BITS] RESULTS\n" );
+    fprintf( stderr, "synfrag-query [filters] --diff BEFORE AFTER\n\n" );
+    fprintf( stderr, "Reads the files synfrag --compare --results writes.\n\n" );
+    fprintf( stderr, "--prefix     Only targets in this prefix, as 10.0.0.0/8 or 2001:db8::/32\n" );
+    fprintf( stderr, "--test       Only pairs of this test\n" );
+    fprintf( stderr, "--verdict    Only pairs with this verdict: agree, fragments-dropped, acl-bypass or mismatch\n" );
+    fprintf( stderr, "--reply      Only pairs whose test got this reply: open, closed, timeout...\n" );
+    fprintf( stderr, "--differ     Only pairs whose verdict isn't agree\n" );
+    fprintf( stderr, "--by         Count pairs by verdict per IPv4 prefix of this length\n" );
+    fprintf( stderr, "--by6        Count pairs by verdict per IPv6 prefix of this length (defaults to 48)\n" );
+    fprintf( stderr, "--diff       Print the pairs whose results changed from BEFORE to AFTER\n" );
+    exit( 2 );
+}
+
+int main( int argc, char **argv )
+{
+    struct filter filter;
+    struct results before, after;
+    unsigned long count;
+    int c, x, option_index = 0, by = 0, diff = 0, r = 0;
+    int bits4 = 24, bits6 = 48;
+    static struct option long_options[] = {
+        {"prefix", required_argument, 0, 0},
+        {"test", required_argument, 0, 0},
+        {"verdict", required_argument, 0, 0},
+        {"reply", required_argument, 0, 0},
+        {"differ", no_argument, 0, 0},
+        {"by", required_argument, 0, 0},
+        {"by6", required_argument, 0, 0},
+        {"diff", no_argument, 0, 0},
+        {0, 0, 0, 0}
+    };
+
+    memset( &filter, 0, sizeof( struct filter ) );
+    filter.test_type = filter.verdict = filter.reply = -1;
+
+    while ( ( c = getopt_long( argc, argv, "", long_options, &option_index ) ) != -1 ) {
+        if ( c != 0 ) exit_with_usage();
+        if ( strcmp( long_options[option_index].name, "prefix" ) == 0 ) {
+            parse_prefix( optarg, &filter );
+
+        } else if ( strcmp( long_options[option_index].name, "test" ) == 0 ) {
+            if ( ( filter.test_type = synfrag_test_by_name( optarg ) ) == TEST_INVALID ) errx( 1, "Unknown test %s", optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "verdict" ) == 0 ) {
+            for ( x = 0; x < VERDICT_MAX && strcmp( optarg, results_verdict_names[x] ) != 0; x++ );
+            if ( x == VERDICT_MAX ) errx( 1, "Unknown verdict %s", optarg );
+            filter.verdict = x;
+
+        } else if ( strcmp( long_options[option_index].name, "reply" ) == 0 ) {
+            for ( x = 0; x < SYNFRAG_REPLY_TYPE_MAX && strcmp( optarg, reply_label( x ) ) != 0; x++ );
+            if ( x == SYNFRAG_REPLY_TYPE_MAX ) errx( 1, "Unknown reply %s", optarg );
+            filter.reply = x;
+
+        } else if ( strcmp( long_options[option_index].name, "differ" ) == 0 ) {
+            filter.differ = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "by" ) == 0 ) {
+            bits4 = atoi( optarg );
+            if ( bits4 < 0 || bits4 > 32 ) errx( 1, "Invalid value for by" );
+            by = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "by6" ) == 0 ) {
+            bits6 = atoi( optarg );
+            if ( bits6 < 0 || bits6 > 128 ) errx( 1, "Invalid value for by6" );
+            by = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "diff" ) == 0 ) {
+            diff = 1;
+        }
+    }
+    if ( argc - optind != ( diff ? 2 : 1 ) ) exit_with_usage();
+    if ( diff && by ) errx( 1, "by and diff don't go together" );
+
+    open_results( &before, argv[optind] );
+    if ( diff ) {
+        open_results( &after, argv[optind + 1] );
+        r = diff_rows( &before, &after, &filter );
+        results_close( &after );
+    } else if ( by ) {
+        count = aggregate_rows( &before, &filter, bits4, bits6 );
+        r = count ? 0 : 1;
+    } else {
+        count = list_rows( &before, &filter );
+        r = count ? 0 : 1;
+    }
+    results_close( &before );
+    return r;
+}
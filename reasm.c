@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "checksums.h"
+#include "decode.h"
+#include "reasm.h"
+
+/* Fragment offsets count in 8 byte blocks; what has arrived is a bitmap of them. */
+#define BLOCK_SIZE 8
+#define BLOCKS ( REASM_DATA_MAX / BLOCK_SIZE )
+/* The furthest a fragment offset and length can reach. */
+#define PAYLOAD_MAX 65535
+
+struct reasm_slot {
+    int in_use;
+    int family;
+    struct in6_addr src;
+    struct in6_addr dst;
+    unsigned int id;
+    int protocol;
+    unsigned int hash;
+    int hash_next;
+    struct timeval deadline;
+    /* 0 until the first fragment, the one with the headers, arrives. */
+    unsigned int head_len;
+    unsigned int ip_offset;
+    /* The payload's length, 0 until the last fragment arrives. */
+    unsigned int total;
+    /* The end of the furthest fragment so far. */
+    unsigned int end;
+    /* Bytes received of the payload's first REASM_DATA_MAX. */
+    unsigned int kept;
+    unsigned char received[BLOCKS / 8];
+    char head[REASM_HEAD_MAX];
+    char data[REASM_DATA_MAX];
+};
+
+static inline void put16( unsigned char *p, unsigned int v )
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+/* Mixed the same way as the probe table's addr_hash(). */
+static unsigned int fragment_hash( const struct decoded_fragment *frag )
+{
+    unsigned int h[8], x;
+    int y;
+
+    memcpy( h, &frag->src, 16 );
+    memcpy( h + 4, &frag->dst, 16 );
+    x = frag->id ^ (unsigned int) frag->protocol << 24;
+    for ( y = 0; y < 8; y++ ) {
+        x ^= h[y];
+    }
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35U;
+    x ^= x >> 16;
+    return x;
+}
+
+static int same_packet( const struct reasm_slot *slot, const struct decoded_fragment *frag )
+{
+    return slot->id == frag->id &&
+        slot->protocol == frag->protocol &&
+        slot->family == frag->family &&
+        !memcmp( &slot->src, &frag->src, sizeof( struct in6_addr ) ) &&
+        !memcmp( &slot->dst, &frag->dst, sizeof( struct in6_addr ) );
+}
+
+static void release_slot( struct reasm *r, int idx )
+{
+    struct reasm_slot *slot = &r->slots[idx];
+    int *link = &r->buckets[slot->hash & r->bucket_mask];
+
+    while ( *link != idx ) link = &r->slots[*link].hash_next;
+    *link = slot->hash_next;
+    slot->in_use = 0;
+}
+
+/*
+ * Start a packet in the first free or expired slot from next on, in the
+ * order slots are taken. Only if every slot holds a live packet is the
+ * oldest, at next, given up on.
+ */
+static int take_slot( struct reasm *r, const struct decoded_fragment *frag, unsigned int hash, const struct timeval *now, long timeout )
+{
+    unsigned int x;
+    int idx = r->next;
+    struct reasm_slot *slot;
+
+    for ( x = 0; x < r->slot_count; x++ ) {
+        slot = &r->slots[( r->next + x ) % r->slot_count];
+        if ( !slot->in_use || !timercmp( now, &slot->deadline, < ) ) {
+            idx = ( r->next + x ) % r->slot_count;
+            break;
+        }
+    }
+    slot = &r->slots[idx];
+    r->next = ( idx + 1 ) % r->slot_count;
+    if ( slot->in_use ) {
+        release_slot( r, idx );
+        r->discarded++;
+    }
+
+    slot->in_use = 1;
+    slot->family = frag->family;
+    slot->src = frag->src;
+    slot->dst = frag->dst;
+    slot->id = frag->id;
+    slot->protocol = frag->protocol;
+    slot->hash = hash;
+    slot->deadline = *now;
+    slot->deadline.tv_sec += timeout;
+    slot->head_len = slot->total = slot->end = slot->kept = 0;
+    memset( slot->received, 0, sizeof( slot->received ) );
+
+    slot->hash_next = r->buckets[hash & r->bucket_mask];
+    r->buckets[hash & r->bucket_mask] = idx;
+    return idx;
+}
+
+/* Mark the blocks of [start, end) as received, or return -1 if any already were. */
+static int receive_blocks( struct reasm_slot *slot, unsigned int start, unsigned int end )
+{
+    unsigned int first = start / BLOCK_SIZE, last, x;
+
+    if ( end > REASM_DATA_MAX ) end = REASM_DATA_MAX;
+    if ( start >= end ) return 0;
+    last = ( end + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    for ( x = first; x < last; x++ ) {
+        if ( slot->received[x / 8] & 1 << x % 8 ) return -1;
+    }
+    for ( x = first; x < last; x++ ) {
+        slot->received[x / 8] |= 1 << x % 8;
+    }
+    return 0;
+}
+
+/* Write out the whole packet as if it had never been fragmented. */
+static unsigned int rebuild( struct reasm *r, const struct reasm_slot *slot )
+{
+    unsigned int kept = slot->total < REASM_DATA_MAX ? slot->total : REASM_DATA_MAX;
+    unsigned int hl = slot->head_len - slot->ip_offset;
+    unsigned char *ip = (unsigned char *) r->frame + slot->ip_offset;
+    unsigned short cksum;
+    int sum;
+
+    memcpy( r->frame, slot->head, slot->head_len );
+    memcpy( r->frame + slot->head_len, slot->data, kept );
+    if ( slot->family == AF_INET ) {
+        /* The real length, even if not all of it was kept. Only DF survives. */
+        put16( ip + 2, hl + slot->total );
+        ip[6] &= 0x40;
+        ip[7] = 0;
+        ip[10] = ip[11] = 0;
+        sum = in_cksum( (unsigned short *) ip, hl );
+        cksum = CKSUM_CARRY( sum );
+        memcpy( ip + 10, &cksum, sizeof( cksum ) );
+    } else {
+        /* The fragment header stays, with offset 0 and no more to come. */
+        put16( ip + 4, hl - 40 + slot->total );
+        ip[hl - 6] = ip[hl - 5] = 0;
+    }
+    return slot->head_len + kept;
+}
+
+int reasm_init( struct reasm *r, unsigned int slot_count )
+{
+    unsigned int buckets_count = 1, x;
+
+    if ( slot_count == 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset( r, 0, sizeof( struct reasm ) );
+    while ( buckets_count < slot_count ) buckets_count <<= 1;
+    r->slots = calloc( slot_count, sizeof( struct reasm_slot ) );
+    r->buckets = malloc( sizeof( int ) * buckets_count );
+    r->frame = malloc( REASM_HEAD_MAX + REASM_DATA_MAX );
+    if ( r->slots == NULL || r->buckets == NULL || r->frame == NULL ) {
+        reasm_destroy( r );
+        errno = ENOMEM;
+        return -1;
+    }
+    for ( x = 0; x < buckets_count; x++ ) {
+        r->buckets[x] = -1;
+    }
+    r->slot_count = slot_count;
+    r->bucket_mask = buckets_count - 1;
+    return 0;
+}
+
+void reasm_destroy( struct reasm *r )
+{
+    free( r->slots );
+    free( r->buckets );
+    free( r->frame );
+    memset( r, 0, sizeof( struct reasm ) );
+}
+
+enum REASM_RESULT reasm_add( struct reasm *r, const char *frame, unsigned int len, const struct timeval *now, long timeout, const char **out, unsigned int *out_len )
+{
+    struct decoded_fragment frag;
+    struct reasm_slot *slot;
+    unsigned int hash, end, kept;
+    int idx;
+
+    r->discarded = 0;
+    if ( !decode_fragment( frame, len, &frag ) ) return REASM_NOT_FRAGMENT;
+
+    /* Every fragment but the last carries a whole number of blocks. */
+    end = frag.offset + frag.data_len;
+    if ( ( frag.more && ( !frag.data_len || frag.data_len % BLOCK_SIZE ) ) || end > PAYLOAD_MAX ||
+        ( frag.offset == 0 && frag.data_offset > REASM_HEAD_MAX ) ) {
+        r->discarded++;
+        return REASM_DROPPED;
+    }
+
+    hash = fragment_hash( &frag );
+    for ( idx = r->buckets[hash & r->bucket_mask]; idx != -1; idx = r->slots[idx].hash_next ) {
+        if ( same_packet( &r->slots[idx], &frag ) ) break;
+    }
+    if ( idx != -1 && !timercmp( now, &r->slots[idx].deadline, < ) ) {
+        release_slot( r, idx );
+        r->discarded++;
+        idx = -1;
+    }
+    if ( idx == -1 ) idx = take_slot( r, &frag, hash, now, timeout );
+    slot = &r->slots[idx];
+
+    /* Anything that disagrees with what arrived before ends the packet. */
+    if ( ( slot->total && ( end > slot->total || ( !frag.more && end != slot->total ) ) ) ||
+        ( !frag.more && slot->end > end ) ||
+        ( frag.offset == 0 && slot->head_len ) ||
+        receive_blocks( slot, frag.offset, end ) == -1 ) {
+        release_slot( r, idx );
+        r->discarded++;
+        return REASM_DROPPED;
+    }
+
+    if ( frag.offset < REASM_DATA_MAX ) {
+        kept = ( end < REASM_DATA_MAX ? end : REASM_DATA_MAX ) - frag.offset;
+        memcpy( slot->data + frag.offset, frame + frag.data_offset, kept );
+        slot->kept += kept;
+    }
+    if ( frag.offset == 0 ) {
+        memcpy( slot->head, frame, frag.data_offset );
+        slot->head_len = frag.data_offset;
+        slot->ip_offset = frag.ip_offset;
+    }
+    if ( !frag.more ) slot->total = end;
+    if ( end > slot->end ) slot->end = end;
+
+    if ( !slot->head_len || !slot->total || slot->kept < ( slot->total < REASM_DATA_MAX ? slot->total : REASM_DATA_MAX ) )
+        return REASM_HELD;
+    *out = r->frame;
+    *out_len = rebuild( r, slot );
+    release_slot( r, idx );
+    return REASM_COMPLETE;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef REASM_H
+#define REASM_H
+
+#include <sys/time.h>
+
+/*
+ * Putting fragmented replies back together, in memory fixed when the table
+ * is set up. Packets being reassembled live in a fixed array of slots found
+ * through a hash on (addresses, id, protocol); a new packet takes a free
+ * slot, or one whose packet has run out of time, and only when there is none
+ * evicts the packet in the slot used longest ago, so a flood of stray
+ * fragments costs old partial packets, never memory. Only the first
+ * REASM_DATA_MAX bytes of a packet's payload are kept, which is far more than
+ * matching a reply needs. Overlapping fragments, never legitimate in a reply,
+ * discard the packet. Like the packet pool, a table has no locking.
+ */
+
+#define REASM_DEFAULT_SLOTS 64
+/* The headers before a fragment's data: Ethernet, VLAN tag and IP. */
+#define REASM_HEAD_MAX 256
+#define REASM_DATA_MAX 2048
+
+/* What reasm_add() did with a frame. */
+enum REASM_RESULT {
+    /* Not a fragment, use the frame as it is. */
+    REASM_NOT_FRAGMENT = 0,
+    /* Kept until the rest of its packet arrives. */
+    REASM_HELD,
+    /* The last missing piece; the whole packet is ready. */
+    REASM_COMPLETE,
+    /* Malformed, too big, or overlapping another: thrown away. */
+    REASM_DROPPED
+};
+
+struct reasm_slot;
+
+struct reasm {
+    struct reasm_slot *slots;
+    int *buckets;
+    unsigned int slot_count;
+    unsigned int bucket_mask;
+    /* Just past the slot taken last: the search for a slot starts here, the oldest. */
+    unsigned int next;
+    /* Where completed packets are written, as a frame. */
+    char *frame;
+    /* Partial packets given up on (evicted, expired or overlapping) by the last reasm_add(). */
+    unsigned int discarded;
+};
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int reasm_init( struct reasm *, unsigned int slot_count );
+void reasm_destroy( struct reasm * );
+
+/*
+ * Add a received frame. Partial packets left alone for timeout seconds are
+ * discarded. On REASM_COMPLETE, *out and *out_len are the reassembled frame,
+ * valid until the next call. It looks as if the packet had never been
+ * fragmented, except that an IPv6 packet keeps its fragment header (as an
+ * atomic fragment) and a packet over REASM_DATA_MAX looks like a capture
+ * that was cut short.
+ */
+enum REASM_RESULT reasm_add( struct reasm *, const char *frame, unsigned int len, const struct timeval *now, long timeout, const char **out, unsigned int *out_len );
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "results.h"
+
+/* Blocks start a page in, and each takes a whole number of pages. */
+#define RESULTS_PAGE 4096
+/* A block's row count, first and last target, then its columns. */
+#define BLOCK_HEADER_SIZE 64
+/* Bytes a row takes across all the columns. */
+#define ROW_SIZE 34
+
+const char *results_verdict_names[VERDICT_MAX] = {
+    "agree",
+    "fragments-dropped",
+    "acl-bypass",
+    "mismatch"
+};
+
+static size_t block_size( unsigned int block_rows )
+{
+    return ( BLOCK_HEADER_SIZE + (size_t) block_rows * ROW_SIZE + RESULTS_PAGE - 1 ) & ~(size_t) ( RESULTS_PAGE - 1 );
+}
+
+/* Point columns at a block laid out for block_rows rows, widest column first. */
+static void block_columns( const unsigned char *block, unsigned int block_rows, struct results_columns *c )
+{
+    const unsigned char *p = block + BLOCK_HEADER_SIZE;
+
+    memcpy( &c->rows, block, sizeof( uint32_t ) );
+    c->first = block + 16;
+    c->last = block + 32;
+    c->addr = (const unsigned char (*)[16]) p;
+    p += 16 * block_rows;
+    c->rtt_usec = (const int32_t *) p;
+    p += 4 * block_rows;
+    c->baseline_rtt_usec = (const int32_t *) p;
+    p += 4 * block_rows;
+    c->time = (const uint32_t *) p;
+    p += 4 * block_rows;
+    c->port = (const uint16_t *) p;
+    p += 2 * block_rows;
+    c->test_type = p;
+    p += block_rows;
+    c->verdict = p;
+    p += block_rows;
+    c->reply = p;
+    p += block_rows;
+    c->baseline_reply = p;
+}
+
+int results_compare( const struct results_row *a, const struct results_row *b )
+{
+    int r;
+
+    if ( ( r = memcmp( a->addr, b->addr, 16 ) ) != 0 ) return r;
+    if ( a->port != b->port ) return a->port < b->port ? -1 : 1;
+    return (int) a->test_type - (int) b->test_type;
+}
+
+static int compare_rows( const void *a, const void *b )
+{
+    return results_compare( a, b );
+}
+
+static int write_header( struct results *r )
+{
+    const struct results_header *header = &r->written;
+    ssize_t n = pwrite( r->fd, header, sizeof( struct results_header ), 0 );
+
+    if ( n != sizeof( struct results_header ) ) {
+        if ( n >= 0 ) errno = ENOSPC;
+        return -1;
+    }
+    return 0;
+}
+
+int results_create( struct results *r, const char *path )
+{
+    char magic[8];
+    int e;
+
+    memset( r, 0, sizeof( struct results ) );
+    if ( ( r->fd = open( path, O_RDWR | O_CREAT, 0644 ) ) == -1 ) return -1;
+    /* Replace old results, but not some other file named by mistake. */
+    if ( pread( r->fd, magic, sizeof( magic ), 0 ) > 0 && memcmp( magic, RESULTS_MAGIC, sizeof( magic ) ) != 0 ) {
+        errno = EEXIST;
+        goto fail;
+    }
+    r->block_size = block_size( RESULTS_BLOCK_ROWS );
+    r->pending = malloc( sizeof( struct results_row ) * RESULTS_BLOCK_ROWS );
+    r->block = calloc( 1, r->block_size );
+    if ( !r->pending || !r->block ) goto fail;
+    memcpy( &r->written, RESULTS_MAGIC, sizeof( r->written.magic ) );
+    r->written.block_rows = RESULTS_BLOCK_ROWS;
+    if ( ftruncate( r->fd, 0 ) == -1 || ftruncate( r->fd, RESULTS_PAGE ) == -1 ) goto fail;
+    if ( write_header( r ) == -1 ) goto fail;
+    return 0;
+
+fail:
+    e = errno;
+    free( r->pending );
+    free( r->block );
+    close( r->fd );
+    memset( r, 0, sizeof( struct results ) );
+    r->fd = -1;
+    errno = e;
+    return -1;
+}
+
+int results_open( struct results *r, const char *path )
+{
+    struct stat st;
+    void *p;
+    int e;
+
+    memset( r, 0, sizeof( struct results ) );
+    if ( ( r->fd = open( path, O_RDONLY ) ) == -1 ) return -1;
+    if ( fstat( r->fd, &st ) == -1 ) goto fail;
+    if ( st.st_size < RESULTS_PAGE ) {
+        errno = EINVAL;
+        goto fail;
+    }
+    if ( ( p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0 ) ) == MAP_FAILED ) goto fail;
+    r->header = p;
+    r->map_size = st.st_size;
+    if ( memcmp( r->header->magic, RESULTS_MAGIC, sizeof( r->header->magic ) ) != 0
+            || r->header->block_rows == 0 || r->header->block_rows % 4
+            || r->header->blocks > ( r->map_size - RESULTS_PAGE ) / block_size( r->header->block_rows ) ) {
+        errno = EINVAL;
+        goto fail;
+    }
+    r->block_size = block_size( r->header->block_rows );
+    /* Queries read the columns front to back, block after block. */
+    madvise( p, r->map_size, MADV_SEQUENTIAL );
+    return 0;
+
+fail:
+    e = errno;
+    results_close( r );
+    errno = e;
+    return -1;
+}
+
+/* Sort the pending rows, lay them out as columns and write the block, then the header. */
+static int write_block( struct results *r )
+{
+    unsigned char *block = r->block;
+    struct results_columns c;
+    struct results_row *row;
+    uint32_t rows = r->pending_count;
+    unsigned int x;
+    ssize_t n;
+
+    qsort( r->pending, rows, sizeof( struct results_row ), compare_rows );
+    if ( rows < RESULTS_BLOCK_ROWS ) memset( block, 0, r->block_size );
+    memcpy( block, &rows, sizeof( rows ) );
+    memcpy( block + 16, r->pending[0].addr, 16 );
+    memcpy( block + 32, r->pending[rows - 1].addr, 16 );
+    block_columns( block, RESULTS_BLOCK_ROWS, &c );
+    for ( x = 0; x < rows; x++ ) {
+        row = &r->pending[x];
+        memcpy( (unsigned char *) c.addr[x], row->addr, 16 );
+        ( (int32_t *) c.rtt_usec )[x] = row->rtt_usec;
+        ( (int32_t *) c.baseline_rtt_usec )[x] = row->baseline_rtt_usec;
+        ( (uint32_t *) c.time )[x] = row->time;
+        ( (uint16_t *) c.port )[x] = row->port;
+        ( (uint8_t *) c.test_type )[x] = row->test_type;
+        ( (uint8_t *) c.verdict )[x] = row->verdict;
+        ( (uint8_t *) c.reply )[x] = row->reply;
+        ( (uint8_t *) c.baseline_reply )[x] = row->baseline_reply;
+    }
+    n = pwrite( r->fd, block, r->block_size, RESULTS_PAGE + r->written.blocks * r->block_size );
+    if ( n != (ssize_t) r->block_size ) {
+        if ( n >= 0 ) errno = ENOSPC;
+        return -1;
+    }
+    r->written.blocks++;
+    r->written.rows += rows;
+    r->pending_count = 0;
+    if ( write_header( r ) == -1 ) return -1;
+    return 0;
+}
+
+int results_add( struct results *r, const struct results_row *row )
+{
+    r->pending[r->pending_count++] = *row;
+    if ( r->pending_count == RESULTS_BLOCK_ROWS ) return write_block( r );
+    return 0;
+}
+
+int results_close( struct results *r )
+{
+    int ret = 0, e = 0;
+
+    if ( r->pending && r->pending_count && write_block( r ) == -1 ) {
+        ret = -1;
+        e = errno;
+    }
+    if ( r->header ) munmap( (void *) r->header, r->map_size );
+    if ( r->fd != -1 && close( r->fd ) == -1 && ret == 0 ) {
+        ret = -1;
+        e = errno;
+    }
+    free( r->pending );
+    free( r->block );
+    memset( r, 0, sizeof( struct results ) );
+    r->fd = -1;
+    errno = e;
+    return ret;
+}
+
+void results_block( const struct results *r, uint64_t n, struct results_columns *c )
+{
+    block_columns( (const unsigned char *) r->header + RESULTS_PAGE + n * r->block_size, r->header->block_rows, c );
+}
+
+void results_row( const struct results_columns *c, unsigned int x, struct results_row *row )
+{
+    memcpy( row->addr, c->addr[x], 16 );
+    row->port = c->port[x];
+    row->test_type = c->test_type[x];
+    row->verdict = c->verdict[x];
+    row->reply = c->reply[x];
+    row->baseline_reply = c->baseline_reply[x];
+    row->rtt_usec = c->rtt_usec[x];
+    row->baseline_rtt_usec = c->baseline_rtt_usec[x];
+    row->time = c->time[x];
+}
+
+int results_pton( const char *dstip, unsigned char *addr )
+{
+    if ( inet_pton( AF_INET6, dstip, addr ) == 1 ) return 0;
+    memset( addr, 0, 10 );
+    addr[10] = addr[11] = 0xff;
+    return inet_pton( AF_INET, dstip, addr + 12 ) == 1 ? 0 : -1;
+}
+
+const char *results_ntop( const unsigned char *addr, char *dst, size_t size )
+{
+    static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    if ( memcmp( addr, mapped, sizeof( mapped ) ) == 0 ) return inet_ntop( AF_INET, addr + 12, dst, size );
+    return inet_ntop( AF_INET6, addr, dst, size );
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * --compare's pairs, written for synfrag-query to read back. The file is a
+ * page sized header and then blocks of up to block_rows rows, one page
+ * aligned block after another, so a reader just maps it. Rows are sorted by
+ * target within a block, and each block starts with its first and last
+ * target: that is the index a prefix is looked up in, and what lets blocks
+ * be merged into one sorted stream for aggregating and diffing. Within a
+ * block every field is a column of its own, so a query only reads the
+ * columns it needs. The header is rewritten after every block, so a run that
+ * dies leaves every block but the one in progress. Integers are in host
+ * byte order.
+ */
+
+#define RESULTS_MAGIC "synfragR"
+#define RESULTS_BLOCK_ROWS 65536
+
+enum COMPARE_VERDICT {
+    VERDICT_AGREE = 0,
+    VERDICT_FRAGMENTS_DROPPED,
+    VERDICT_ACL_BYPASS,
+    VERDICT_MISMATCH,
+    VERDICT_MAX
+};
+
+extern const char *results_verdict_names[VERDICT_MAX];
+
+struct results_header {
+    char magic[8];
+    uint32_t block_rows;
+    uint32_t reserved;
+    uint64_t blocks;
+    uint64_t rows;
+};
+
+/* One pair, as written. */
+struct results_row {
+    /* IPv4 addresses are IPv4-mapped, ::ffff:a.b.c.d. */
+    unsigned char addr[16];
+    uint16_t port;
+    /* enum TEST_TYPE of the test; the baseline is synfrag_test_baseline() of it. */
+    uint8_t test_type;
+    uint8_t verdict;
+    /* enum REPLY_TYPE of each side. */
+    uint8_t reply;
+    uint8_t baseline_reply;
+    /* Microseconds, -1 if no reply or if the pair wasn't probed this run. */
+    int32_t rtt_usec;
+    int32_t baseline_rtt_usec;
+    /* When both replies were in, in seconds since the epoch. */
+    uint32_t time;
+};
+
+/* Where a block's columns are in the mapped file. */
+struct results_columns {
+    unsigned int rows;
+    const unsigned char *first;
+    const unsigned char *last;
+    const unsigned char (*addr)[16];
+    const int32_t *rtt_usec;
+    const int32_t *baseline_rtt_usec;
+    const uint32_t *time;
+    const uint16_t *port;
+    const uint8_t *test_type;
+    const uint8_t *verdict;
+    const uint8_t *reply;
+    const uint8_t *baseline_reply;
+};
+
+struct results {
+    int fd;
+    /* Reading: the whole file. */
+    const struct results_header *header;
+    size_t map_size;
+    /* Writing: the block being filled and the header to rewrite. */
+    struct results_header written;
+    struct results_row *pending;
+    unsigned int pending_count;
+    unsigned char *block;
+    size_t block_size;
+};
+
+/*
+ * Start a new results file at path, replacing any results file there
+ * (EEXIST if there is some other file), or open one to read (EINVAL if it
+ * isn't one). Both return 0, or -1 with errno set.
+ */
+int results_create( struct results *, const char *path );
+int results_open( struct results *, const char *path );
+/* Add a row, writing out the block if it is full. Returns 0, or -1 with errno set. */
+int results_add( struct results *, const struct results_row * );
+/* Write out the last block if writing, and close. Returns 0, or -1 with errno set. */
+int results_close( struct results * );
+
+/* Block n of a file opened to read. */
+void results_block( const struct results *, uint64_t n, struct results_columns * );
+void results_row( const struct results_columns *, unsigned int index, struct results_row * );
+/* Order rows by address, then port, then test. */
+int results_compare( const struct results_row *, const struct results_row * );
+/*
+ * Between dstip and a row's address. results_pton() returns 0, or -1 if
+ * dstip is neither IPv4 nor IPv6.
+ */
+int results_pton( const char *dstip, unsigned char *addr );
+const char *results_ntop( const unsigned char *addr, char *dst, size_t size );
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ring.h"
+
+/* Yields before sleeping, and the longest sleep. */
+#define RING_YIELDS 16
+#define RING_SLEEP_MAX_NSEC 200000
+
+/*
+ * Each cell is its sequence number, then the entry. A cell at position p is
+ * free to fill when its sequence is p, full when it is p + 1, and free again
+ * for the next lap, p + size, once taken.
+ */
+struct ring_cell {
+    unsigned long seq;
+} __attribute__(( aligned( 16 ) ));
+
+static struct ring_cell *cell_at( const struct ring *ring, unsigned long pos )
+{
+    return (struct ring_cell *) ( ring->cells + ( pos & ring->mask ) * ring->cell_size );
+}
+
+int ring_init( struct ring *ring, unsigned long count, size_t entry_size )
+{
+    unsigned long size = 1, x;
+    int r;
+
+    while ( size < count ) size <<= 1;
+    ring->cell_size = ( sizeof( struct ring_cell ) + entry_size + 63 ) & ~(size_t) 63;
+    /* posix_memalign() returns its error rather than setting errno. */
+    if ( ( r = posix_memalign( (void **) &ring->cells, 64, size * ring->cell_size ) ) != 0 ) {
+        errno = r;
+        return -1;
+    }
+    ring->mask = size - 1;
+    ring->head = ring->tail = 0;
+    for ( x = 0; x < size; x++ ) {
+        cell_at( ring, x )->seq = x;
+    }
+    return 0;
+}
+
+void ring_destroy( struct ring *ring )
+{
+    free( ring->cells );
+    ring->cells = NULL;
+}
+
+void *ring_reserve( struct ring *ring )
+{
+    unsigned long pos = __atomic_load_n( &ring->head, __ATOMIC_RELAXED ), seq;
+    struct ring_cell *cell;
+
+    while ( 1 ) {
+        cell = cell_at( ring, pos );
+        seq = __atomic_load_n( &cell->seq, __ATOMIC_ACQUIRE );
+        if ( seq == pos ) {
+            /* On failure pos is reloaded with where head is now. */
+            if ( __atomic_compare_exchange_n( &ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) return cell + 1;
+        } else if ( (long) ( seq - pos ) < 0 ) {
+            /* Not yet taken from the last lap: full. */
+            return NULL;
+        } else {
+            pos = __atomic_load_n( &ring->head, __ATOMIC_RELAXED );
+        }
+    }
+}
+
+void ring_publish( struct ring *ring, void *entry )
+{
+    struct ring_cell *cell = (struct ring_cell *) entry - 1;
+
+    __atomic_store_n( &cell->seq, __atomic_load_n( &cell->seq, __ATOMIC_RELAXED ) + 1, __ATOMIC_RELEASE );
+}
+
+void *ring_peek( struct ring *ring )
+{
+    struct ring_cell *cell = cell_at( ring, ring->tail );
+
+    if ( __atomic_load_n( &cell->seq, __ATOMIC_ACQUIRE ) != ring->tail + 1 ) return NULL;
+    return cell + 1;
+}
+
+void ring_release( struct ring *ring )
+{
+    struct ring_cell *cell = cell_at( ring, ring->tail );
+
+    __atomic_store_n( &cell->seq, ring->tail + ring->mask + 1, __ATOMIC_RELEASE );
+    ring->tail++;
+}
+
+void ring_backoff( unsigned int *tries )
+{
+    struct timespec ts = { 0, 1000 };
+
+    if ( ( *tries )++ < RING_YIELDS ) {
+        sched_yield();
+        return;
+    }
+    /* Doubling from a microsecond up to the longest. */
+    ts.tv_nsec <<= *tries - RING_YIELDS < 8 ? *tries - RING_YIELDS : 8;
+    if ( ts.tv_nsec > RING_SLEEP_MAX_NSEC ) ts.tv_nsec = RING_SLEEP_MAX_NSEC;
+    nanosleep( &ts, NULL );
+}
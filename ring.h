@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+
+/*
+ * A bounded queue of fixed size entries between threads, without locks.
+ * Any number of producers may reserve and publish entries at once; only one
+ * consumer may take them, in the order they were reserved. Each cell carries
+ * a sequence number saying whose turn it is, so producers only contend on
+ * claiming a position and never wait on each other to finish writing one.
+ * A full or empty ring is reported, not waited on; ring_backoff() is how
+ * either side waits.
+ */
+
+struct ring {
+    unsigned char *cells;
+    size_t cell_size;
+    unsigned long mask;
+    /* Next position to claim, by any producer. */
+    unsigned long head __attribute__(( aligned( 64 ) ));
+    /* Next position to take; only the consumer writes it. */
+    unsigned long tail __attribute__(( aligned( 64 ) ));
+};
+
+/* count is rounded up to a power of two. Returns 0, or -1 with errno set. */
+int ring_init( struct ring *, unsigned long count, size_t entry_size );
+void ring_destroy( struct ring * );
+
+/* Producers: an entry to fill in, NULL if the ring is full, then hand it over. */
+void *ring_reserve( struct ring * );
+void ring_publish( struct ring *, void *entry );
+
+/* The consumer: the oldest entry, NULL if there is none yet, then give it back. */
+void *ring_peek( struct ring * );
+void ring_release( struct ring * );
+
+/* Wait a little longer each try, yielding first and then sleeping. Start tries at 0. */
+void ring_backoff( unsigned int *tries );
+
+#endif
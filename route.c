@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#ifdef __linux
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#endif
+#include "route.h"
+
+/* How long a next hop gets to answer ARP or neighbour discovery, and how often we look. */
+#define ROUTE_RESOLVE_MSEC 1000
+#define ROUTE_RESOLVE_POLL_MSEC 50
+/* Where the datagram that gets the kernel to resolve a next hop goes: discard. */
+#define ROUTE_RESOLVE_PORT 9
+/* Room for a batch of a dump's messages, for kernels that can only dump the neighbour table. */
+#define ROUTE_BUFFER_SIZE 32768
+
+#ifdef __linux
+
+struct route_request {
+    struct nlmsghdr nh;
+    union {
+        struct rtmsg rt;
+        struct ndmsg nd;
+    } body;
+    char attrs[64];
+};
+
+/* What take_route() and take_neighbour() are looking for, and what they found. */
+struct route_reply {
+    int family;
+    struct route *route;
+    int found;
+    unsigned char type;
+    int has_src;
+    int has_gateway;
+};
+
+static void add_attr( struct nlmsghdr *nh, unsigned short type, const void *data, unsigned short len )
+{
+    struct rtattr *rta = (struct rtattr *) ( (char *) nh + NLMSG_ALIGN( nh->nlmsg_len ) );
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH( len );
+    memcpy( RTA_DATA( rta ), data, len );
+    nh->nlmsg_len = NLMSG_ALIGN( nh->nlmsg_len ) + RTA_ALIGN( rta->rta_len );
+}
+
+/*
+ * Send req and hand every message answering it to take, until the end of a
+ * dump or the single reply to a plain request. Returns 0, or -1 with errno
+ * set, from the kernel's error if it sent one.
+ */
+static int talk( struct route_socket *rs, struct nlmsghdr *req, void (*take)( struct nlmsghdr *, struct route_reply * ), struct route_reply *reply )
+{
+    struct sockaddr_nl kernel;
+    union {
+        struct nlmsghdr nh;
+        char bytes[ROUTE_BUFFER_SIZE];
+    } buf;
+    struct nlmsghdr *nh;
+    struct nlmsgerr *error;
+    ssize_t len;
+    int done = 0;
+
+    memset( &kernel, 0, sizeof( struct sockaddr_nl ) );
+    kernel.nl_family = AF_NETLINK;
+    req->nlmsg_seq = ++rs->seq;
+    if ( sendto( rs->fd, req, req->nlmsg_len, 0, (struct sockaddr *) &kernel, sizeof( struct sockaddr_nl ) ) == -1 ) return -1;
+
+    while ( !done ) {
+        if ( ( len = recv( rs->fd, &buf, sizeof( buf ), 0 ) ) == -1 ) {
+            if ( errno == EINTR ) continue;
+            return -1;
+        }
+        for ( nh = &buf.nh; NLMSG_OK( nh, len ); nh = NLMSG_NEXT( nh, len ) ) {
+            /* Left over from a lookup that was given up on. */
+            if ( nh->nlmsg_seq != rs->seq ) continue;
+            if ( nh->nlmsg_type == NLMSG_DONE ) {
+                done = 1;
+                break;
+            }
+            if ( nh->nlmsg_type == NLMSG_ERROR ) {
+                error = NLMSG_DATA( nh );
+                if ( error->error ) {
+                    errno = -error->error;
+                    return -1;
+                }
+                done = 1;
+                break;
+            }
+            take( nh, reply );
+            if ( !( nh->nlmsg_flags & NLM_F_MULTI ) ) done = 1;
+        }
+    }
+    return 0;
+}
+
+static void take_route( struct nlmsghdr *nh, struct route_reply *reply )
+{
+    struct rtmsg *rt = NLMSG_DATA( nh );
+    struct rtattr *rta;
+    int len = RTM_PAYLOAD( nh );
+    unsigned int addr_len = reply->family == AF_INET ? 4 : 16;
+
+    if ( nh->nlmsg_type != RTM_NEWROUTE ) return;
+    reply->found = 1;
+    reply->type = rt->rtm_type;
+    for ( rta = RTM_RTA( rt ); RTA_OK( rta, len ); rta = RTA_NEXT( rta, len ) ) {
+        if ( rta->rta_type == RTA_OIF && RTA_PAYLOAD( rta ) == sizeof( int ) ) {
+            memcpy( &reply->route->ifindex, RTA_DATA( rta ), sizeof( int ) );
+        } else if ( rta->rta_type == RTA_PREFSRC && RTA_PAYLOAD( rta ) == addr_len ) {
+            memcpy( &reply->route->src, RTA_DATA( rta ), addr_len );
+            reply->has_src = 1;
+        } else if ( rta->rta_type == RTA_GATEWAY && RTA_PAYLOAD( rta ) == addr_len ) {
+            memcpy( &reply->route->nexthop, RTA_DATA( rta ), addr_len );
+            reply->has_gateway = 1;
+        }
+    }
+}
+
+/* A usable entry for the route's next hop: known, or being confirmed. */
+static void take_neighbour( struct nlmsghdr *nh, struct route_reply *reply )
+{
+    struct ndmsg *nd = NLMSG_DATA( nh );
+    struct rtattr *rta;
+    int len = RTM_PAYLOAD( nh );
+    unsigned int addr_len = reply->family == AF_INET ? 4 : 16;
+    const unsigned char *mac = NULL;
+    int match = 0;
+
+    if ( nh->nlmsg_type != RTM_NEWNEIGH || nd->ndm_family != reply->family || nd->ndm_ifindex != reply->route->ifindex ) return;
+    if ( !( nd->ndm_state & ( NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | NUD_PERMANENT ) ) ) return;
+    for ( rta = RTM_RTA( nd ); RTA_OK( rta, len ); rta = RTA_NEXT( rta, len ) ) {
+        if ( rta->rta_type == NDA_DST && RTA_PAYLOAD( rta ) == addr_len ) {
+            match = memcmp( RTA_DATA( rta ), &reply->route->nexthop, addr_len ) == 0;
+        } else if ( rta->rta_type == NDA_LLADDR && RTA_PAYLOAD( rta ) == 6 ) {
+            mac = RTA_DATA( rta );
+        }
+    }
+    if ( !match || !mac ) return;
+    memcpy( reply->route->mac, mac, 6 );
+    reply->found = 1;
+}
+
+/* The source address the kernel picks for dst, for routes that don't name one. */
+static int pick_source( int family, const void *dst, struct route *route )
+{
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof( ss );
+    int fd, r;
+
+    memset( &ss, 0, sizeof( ss ) );
+    ss.ss_family = family;
+    if ( family == AF_INET ) {
+        memcpy( &( (struct sockaddr_in *) &ss )->sin_addr, dst, 4 );
+        ( (struct sockaddr_in *) &ss )->sin_port = htons( ROUTE_RESOLVE_PORT );
+    } else {
+        memcpy( &( (struct sockaddr_in6 *) &ss )->sin6_addr, dst, 16 );
+        ( (struct sockaddr_in6 *) &ss )->sin6_port = htons( ROUTE_RESOLVE_PORT );
+    }
+    if ( ( fd = socket( family, SOCK_DGRAM, 0 ) ) == -1 ) return -1;
+    setsockopt( fd, SOL_SOCKET, SO_BINDTODEVICE, route->interface, strlen( route->interface ) );
+    r = connect( fd, (struct sockaddr *) &ss, family == AF_INET ? sizeof( struct sockaddr_in ) : sizeof( struct sockaddr_in6 ) );
+    if ( r == 0 ) r = getsockname( fd, (struct sockaddr *) &ss, &len );
+    if ( r == 0 && family == AF_INET ) memcpy( &route->src, &( (struct sockaddr_in *) &ss )->sin_addr, 4 );
+    if ( r == 0 && family == AF_INET6 ) memcpy( &route->src, &( (struct sockaddr_in6 *) &ss )->sin6_addr, 16 );
+    close( fd );
+    return r;
+}
+
+/* Get the kernel to resolve the next hop, by sending it an empty datagram. */
+static void poke_neighbour( int family, const struct route *route )
+{
+    struct sockaddr_storage ss;
+    int fd;
+
+    memset( &ss, 0, sizeof( ss ) );
+    ss.ss_family = family;
+    if ( family == AF_INET ) {
+        memcpy( &( (struct sockaddr_in *) &ss )->sin_addr, &route->nexthop, 4 );
+        ( (struct sockaddr_in *) &ss )->sin_port = htons( ROUTE_RESOLVE_PORT );
+    } else {
+        memcpy( &( (struct sockaddr_in6 *) &ss )->sin6_addr, &route->nexthop, 16 );
+        ( (struct sockaddr_in6 *) &ss )->sin6_port = htons( ROUTE_RESOLVE_PORT );
+        /* Gateways are often link local. */
+        ( (struct sockaddr_in6 *) &ss )->sin6_scope_id = route->ifindex;
+    }
+    if ( ( fd = socket( family, SOCK_DGRAM, 0 ) ) == -1 ) return;
+    setsockopt( fd, SOL_SOCKET, SO_BINDTODEVICE, route->interface, strlen( route->interface ) );
+    sendto( fd, "", 0, 0, (struct sockaddr *) &ss, family == AF_INET ? sizeof( struct sockaddr_in ) : sizeof( struct sockaddr_in6 ) );
+    close( fd );
+}
+
+static struct route_neighbour *cached_neighbour( struct route_socket *rs, const struct in6_addr *addr )
+{
+    unsigned int h[4], x;
+
+    memcpy( h, addr, sizeof( h ) );
+    x = h[0] ^ h[1] ^ h[2] ^ h[3];
+    x = ( x ^ x >> 16 ) * 2654435761U;
+    return &rs->neighbours[( x >> 16 ) % ROUTE_NEIGHBOURS];
+}
+
+/*
+ * Ask the kernel for the route's next hop alone, or the whole table from
+ * kernels too old to look one up (before 5.0). Returns 1 if it is known, 0
+ * if not, or -1 with errno set.
+ */
+static int query_neighbour( struct route_socket *rs, struct route *route )
+{
+    struct route_request req;
+    struct route_reply reply;
+
+    memset( &req, 0, sizeof( struct route_request ) );
+    req.nh.nlmsg_len = NLMSG_LENGTH( sizeof( struct ndmsg ) );
+    req.nh.nlmsg_type = RTM_GETNEIGH;
+    req.nh.nlmsg_flags = NLM_F_REQUEST;
+    req.body.nd.ndm_family = route->family;
+    if ( rs->neighbour_dump ) {
+        req.nh.nlmsg_flags |= NLM_F_DUMP;
+    } else {
+        req.body.nd.ndm_ifindex = route->ifindex;
+        add_attr( &req.nh, NDA_DST, &route->nexthop, route->family == AF_INET ? 4 : 16 );
+    }
+    memset( &reply, 0, sizeof( struct route_reply ) );
+    reply.family = route->family;
+    reply.route = route;
+    if ( talk( rs, &req.nh, take_neighbour, &reply ) == -1 ) {
+        if ( errno == ENOENT ) return 0;
+        if ( errno == EOPNOTSUPP && !rs->neighbour_dump ) {
+            rs->neighbour_dump = 1;
+            return query_neighbour( rs, route );
+        }
+        return -1;
+    }
+    return reply.found;
+}
+
+/* As query_neighbour(), but from the cache if it can be, and into it if not. */
+static int find_neighbour( struct route_socket *rs, struct route *route )
+{
+    struct route_neighbour *cached = cached_neighbour( rs, &route->nexthop );
+    int r;
+
+    if ( cached->used && cached->ifindex == route->ifindex && memcmp( &cached->addr, &route->nexthop, sizeof( struct in6_addr ) ) == 0 ) {
+        memcpy( route->mac, cached->mac, 6 );
+        return 1;
+    }
+    if ( ( r = query_neighbour( rs, route ) ) != 1 ) return r;
+    cached->used = 1;
+    cached->ifindex = route->ifindex;
+    cached->addr = route->nexthop;
+    memcpy( cached->mac, route->mac, 6 );
+    return 1;
+}
+
+int route_open( struct route_socket *rs )
+{
+    struct sockaddr_nl local;
+
+    memset( rs, 0, sizeof( struct route_socket ) );
+    if ( ( rs->fd = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE ) ) == -1 ) return -1;
+    memset( &local, 0, sizeof( struct sockaddr_nl ) );
+    local.nl_family = AF_NETLINK;
+    if ( bind( rs->fd, (struct sockaddr *) &local, sizeof( struct sockaddr_nl ) ) == -1 ) {
+        close( rs->fd );
+        return -1;
+    }
+    return 0;
+}
+
+int route_start( struct route_socket *rs, int family, const void *dst, const char *interface, struct route *out )
+{
+    struct route_request req;
+    struct route_reply reply;
+    unsigned int addr_len = family == AF_INET ? 4 : 16;
+    int oif, r;
+
+    memset( out, 0, sizeof( struct route ) );
+    out->family = family;
+    memset( &req, 0, sizeof( struct route_request ) );
+    req.nh.nlmsg_len = NLMSG_LENGTH( sizeof( struct rtmsg ) );
+    req.nh.nlmsg_type = RTM_GETROUTE;
+    req.nh.nlmsg_flags = NLM_F_REQUEST;
+    req.body.rt.rtm_family = family;
+    req.body.rt.rtm_dst_len = addr_len * 8;
+    add_attr( &req.nh, RTA_DST, dst, addr_len );
+    if ( interface ) {
+        if ( ( oif = if_nametoindex( interface ) ) == 0 ) return -1;
+        add_attr( &req.nh, RTA_OIF, &oif, sizeof( int ) );
+    }
+
+    memset( &reply, 0, sizeof( struct route_reply ) );
+    reply.family = family;
+    reply.route = out;
+    if ( talk( rs, &req.nh, take_route, &reply ) == -1 ) return -1;
+    if ( !reply.found || reply.type != RTN_UNICAST || !out->ifindex ) {
+        errno = ENETUNREACH;
+        return -1;
+    }
+    if ( !if_indextoname( out->ifindex, out->interface ) ) return -1;
+    if ( !reply.has_gateway ) memcpy( &out->nexthop, dst, addr_len );
+    if ( !reply.has_src && pick_source( family, dst, out ) == -1 ) return -1;
+    if ( ( r = find_neighbour( rs, out ) ) == 1 ) return 0;
+    if ( r == 0 ) {
+        poke_neighbour( family, out );
+        errno = EINPROGRESS;
+    }
+    return -1;
+}
+
+void route_resolve( struct route_socket *rs, struct route *routes, int *errors, unsigned int count )
+{
+    struct timespec nap = { 0, ROUTE_RESOLVE_POLL_MSEC * 1000000L };
+    unsigned int waited, pending, x;
+    int r;
+
+    for ( waited = 0; ; waited += ROUTE_RESOLVE_POLL_MSEC ) {
+        pending = 0;
+        for ( x = 0; x < count; x++ ) {
+            if ( errors[x] != EINPROGRESS ) continue;
+            if ( waited && ( r = find_neighbour( rs, &routes[x] ) ) != 0 ) {
+                errors[x] = r == 1 ? 0 : errno;
+            } else {
+                pending++;
+            }
+        }
+        if ( !pending ) return;
+        if ( waited >= ROUTE_RESOLVE_MSEC ) break;
+        nanosleep( &nap, NULL );
+    }
+    for ( x = 0; x < count; x++ ) {
+        if ( errors[x] == EINPROGRESS ) errors[x] = EHOSTUNREACH;
+    }
+}
+
+int route_lookup( struct route_socket *rs, int family, const void *dst, const char *interface, struct route *out )
+{
+    int error = 0;
+
+    if ( route_start( rs, family, dst, interface, out ) == -1 ) {
+        if ( errno != EINPROGRESS ) return -1;
+        error = EINPROGRESS;
+        route_resolve( rs, out, &error, 1 );
+    }
+    errno = error;
+    return error ? -1 : 0;
+}
+
+void route_close( struct route_socket *rs )
+{
+    close( rs->fd );
+}
+
+#else
+
+int route_open( struct route_socket *rs )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int route_lookup( struct route_socket *rs, int family, const void *dst, const char *interface, struct route *out )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int route_start( struct route_socket *rs, int family, const void *dst, const char *interface, struct route *out )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void route_resolve( struct route_socket *rs, struct route *routes, int *errors, unsigned int count )
+{
+    unsigned int x;
+
+    for ( x = 0; x < count; x++ ) {
+        if ( errors[x] == EINPROGRESS ) errors[x] = ENOSYS;
+    }
+}
+
+void route_close( struct route_socket *rs )
+{
+}
+
+#endif
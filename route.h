@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+
+/*
+ * Which way the kernel would send a packet to a target: the egress
+ * interface, the source address it would pick and the next hop's MAC,
+ * looked up over rtnetlink in the kernel's own FIB and neighbour table, so
+ * policy routing and ECMP come out as they would for any other socket.
+ * Linux only; elsewhere route_open() fails with ENOSYS.
+ */
+
+/* Next hops remembered, direct mapped on the address. */
+#define ROUTE_NEIGHBOURS 256
+
+struct route {
+    int family;
+    char interface[IF_NAMESIZE];
+    int ifindex;
+    /* IPv4 addresses use the first 4 bytes. */
+    struct in6_addr src;
+    /* The gateway, or the target itself when it is on link. */
+    struct in6_addr nexthop;
+    unsigned char mac[6];
+};
+
+struct route_neighbour {
+    int used;
+    int ifindex;
+    struct in6_addr addr;
+    unsigned char mac[6];
+};
+
+struct route_socket {
+    int fd;
+    unsigned int seq;
+    /* Set once the kernel turns down looking up a single neighbour. */
+    int neighbour_dump;
+    struct route_neighbour neighbours[ROUTE_NEIGHBOURS];
+};
+
+/* Both return 0, or -1 with errno set. */
+int route_open( struct route_socket * );
+/*
+ * The route to dst (an in_addr or in6_addr of family), only through
+ * interface unless that is NULL. A next hop missing from the neighbour
+ * table is sent an empty UDP datagram so the kernel resolves it, and waited
+ * for up to a second. ENETUNREACH means no route (or only one to this host)
+ * and EHOSTUNREACH a next hop that didn't answer ARP or neighbour discovery.
+ */
+int route_lookup( struct route_socket *, int family, const void *dst, const char *interface, struct route *out );
+/*
+ * route_lookup() without the wait: a next hop missing from the neighbour
+ * table is sent its datagram and left to route_resolve(), failing with
+ * EINPROGRESS, so the next hops of many targets resolve at the same time.
+ */
+int route_start( struct route_socket *, int family, const void *dst, const char *interface, struct route *out );
+/*
+ * Wait, once for all of them, for the next hops of the count routes whose
+ * errors are EINPROGRESS, setting each error to 0 as it resolves or to
+ * EHOSTUNREACH if it hasn't within a second.
+ */
+void route_resolve( struct route_socket *, struct route *routes, int *errors, unsigned int count );
+void route_close( struct route_socket * );
+
+#endif
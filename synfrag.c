@@ -25,1072 +25,1797 @@
  * Author: John Eaglesham
  */
 
-#define __USE_BSD
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
 #include <string.h>
-#include <netdb.h>
-
-#ifdef __FreeBSD__
-#include <netinet/in_systm.h>
-#endif
-
-#ifdef __linux
-#define ETHERTYPE_IPV6 ETH_P_IPV6
-#define __FAVOR_BSD
-#endif
-
-#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/ioctl.h>
-#include <sys/select.h>
 #include <sys/time.h>
-#include <fcntl.h>
-#include <netinet/in.h>
-#include <netinet/ip.h>
-#include <netinet/ip6.h>
-#include <netinet/ip_icmp.h>
-#include <netinet/icmp6.h>
-#include <netinet/tcp.h>
-#include <netinet/if_ether.h>
+#include <sys/un.h>
+#include <time.h>
+#include <arpa/inet.h>
 #include <net/if.h>
-#include <pcap.h>
-#include <signal.h>
-#include <sys/wait.h>
-#include <getopt.h>
-#include "checksums.h"
-#include "flag_names.h"
-
-#define DEFAULT_TIMEOUT_SECONDS 10
-#define IP_FLAGS_OFFSET 13
-#define SOURCE_PORT 44128
-#define BIG_PACKET_SIZE 1500
-#define PCAP_CAPTURE_LEN BIG_PACKET_SIZE
-#define TCP_WINDOW 65535
-/*
- * If this is ever big enough to exceed BIG_PACKET_SIZE when added with the
- * sizes of the other (IPv4/IPv6+destination options+fragmentation+padding)
- * headers, a buffer will overflow. So don't do that. 
- */
-#define FRAGMENT_OFFSET_TO_BYTES 8
-#define MINIMUM_FRAGMENT_SIZE FRAGMENT_OFFSET_TO_BYTES
-#define MINIMUM_PACKET_SIZE 68
-
-/* Save time typing/screen real estate. */
-#define SIZEOF_ICMP6 sizeof( struct icmp6_hdr )
-#define SIZEOF_TCP sizeof( struct tcphdr )
-#define SIZEOF_IPV4 sizeof( struct ip )
-#define SIZEOF_IPV6 sizeof( struct ip6_hdr )
-#define SIZEOF_ETHER sizeof( struct ether_header )
-/* This size is fixed but extends past the standard basic icmp header. */
-#define SIZEOF_PING 8
-
-/*
- * XXX We don't close the pcap device on failure anywhere. The OS will do it
- * for us, but it's impolite.
- */
-
-/*
- * This might turn out to be stupid, but lets try having TCP tests be odd
- * numbered and ICMP even numbered. IPv4 tests will be <= 10 and IPv6 > 10.
- */
-#define IS_TEST_TCP(x) ( x % 2 == 1 )
-#define IS_TEST_ICMP(x) ( x % 2 == 0 )
-#define IS_TEST_IPV4(x) ( x <= 10 )
-#define IS_TEST_IPV6(x) ( x > 10 )
-enum TEST_TYPE {
-    TEST_IPV4_TCP = 1,
-    TEST_FRAG_IPV4_TCP = 3,
-    TEST_FRAG_OPTIONED_IPV4_TCP = 5,
-
-    TEST_FRAG_IPV4_ICMP = 2,
-    TEST_FRAG_OPTIONED_IPV4_ICMP = 4,
-
-    TEST_IPV6_TCP = 11,
-    TEST_FRAG_IPV6_TCP = 13,
-    TEST_FRAG_OPTIONED_IPV6_TCP = 15,
-
-    TEST_FRAG_IPV6_ICMP6 = 12,
-    TEST_FRAG_OPTIONED_IPV6_ICMP6 = 14,
-
-    TEST_INVALID = 0
+#include "synfrag.h"
+#include "metrics.h"
+#include "journal.h"
+#include "results.h"
+#include "targets.h"
+#include "route.h"
+#include "firewall.h"
+
+/* Longest job line accepted by the daemon. */
+#define DAEMON_LINE_MAX 512
+/* Clients the daemon serves at once. */
+#define DAEMON_CLIENTS_MAX 64
+/* How long the daemon waits on the engine before looking for new jobs again. */
+#define DAEMON_POLL_MSEC 10
+/* Pairs of probes handed to synfrag_run() at a time by --compare. */
+#define COMPARE_CHUNK 16384
+/* How long --previous trusts an agreement, and how much of it is checked anyway. */
+#define COMPARE_DEFAULT_FRESH_FOR ( 7 * 24 * 60 * 60 )
+#define COMPARE_DEFAULT_SAMPLE 10
+/* Where a baseline goes out from, so it doesn't collide with its test. */
+#define BASELINE_SOURCE_PORT ( SYNFRAG_SOURCE_PORT + 1 )
+/* Most rates --frag-bench steps through, doubling each time. */
+#define FRAG_BENCH_LEVELS_MAX 32
+#define FRAG_BENCH_DEFAULT_HOLD_MSEC 1000
+/* Most probes --frag-bench keeps in flight. */
+#define FRAG_BENCH_IN_FLIGHT_MAX ( 1 << 20 )
+/* A rate holds up while at least this share of probes fare as at the lowest. */
+#define FRAG_BENCH_HOLDS 0.9
+/* Highest TTL --trace goes to. */
+#define TRACE_HOPS_MAX 255
+/* Room for an IPv6 address and a round trip time. */
+#define TRACE_COLUMN_WIDTH 56
+/* Most interface and source address pairs --compare sends from at once. */
+#define LINKS_MAX 16
+/* Targets routed at a time, their unknown next hops waited for together. */
+#define ROUTES_AHEAD 256
+/* What --frag-search narrows down: layer 4 bytes carried, and size padded out to with options. */
+#define FRAG_SEARCH_DATA 0
+#define FRAG_SEARCH_SIZE 1
+#define FRAG_SEARCH_DIMENSIONS 2
+/* Targets searched at a time. */
+#define FRAG_SEARCH_CHUNK 16384
+/* No first fragment has more options than this: it is IPv6's minimum MTU. */
+#define FRAG_SEARCH_OPTIONS_MAX 1280
+/* "00:11:22:33:44:55" */
+#define MAC_STRLEN 18
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+/* Link functions. */
+
+/* A context sending out of one interface from one source address. */
+struct link {
+    char interface[IF_NAMESIZE];
+    char srcip[SYNFRAG_ADDRSTRLEN];
+    struct synfrag_ctx *ctx;
 };
 
 /*
- * Items and their order in test_indexes needs to match test_names (but not
- * enum TEST_TYPE). 
+ * Where probes go out: the one context the command line describes or, with
+ * routes to look up, one per interface and source address the routes to the
+ * targets take, opened as targets turn up that need them.
  */
-enum TEST_TYPE test_indexes[] = {
-    TEST_IPV4_TCP,
-    TEST_FRAG_IPV4_TCP,
-    TEST_FRAG_IPV4_ICMP,
-    TEST_FRAG_OPTIONED_IPV4_TCP,
-    TEST_FRAG_OPTIONED_IPV4_ICMP,
-
-    TEST_IPV6_TCP,
-    TEST_FRAG_IPV6_TCP,
-    TEST_FRAG_IPV6_ICMP6,
-    TEST_FRAG_OPTIONED_IPV6_TCP,
-    TEST_FRAG_OPTIONED_IPV6_ICMP6,
-
-    0
+struct links {
+    struct link link[LINKS_MAX];
+    unsigned int count;
+    /* NULL without routes to look up. */
+    struct route_socket *routes;
+    /* What every context is opened with (interface, srcip and dstmac as given, if at all) and set to. */
+    struct synfrag_config config;
+    long timeout;
+    double icmp_pace;
+    unsigned int icmp_burst;
+    /* Served for the first context only. */
+    char *metrics_path;
+    long stats_interval;
+    /* Every context's frames go here, NULL without --capture. */
+    struct synfrag_capture *capture;
 };
 
-char *test_names[] = {
-    "v4-tcp",
-    "v4-frag-tcp",
-    "v4-frag-icmp",
-    "v4-frag-optioned-tcp",
-    "v4-frag-optioned-icmp",
-
-    "v6-tcp",
-    "v6-frag-tcp",
-    "v6-frag-icmp6",
-    "v6-frag-optioned-tcp",
-    "v6-frag-optioned-icmp6",
-
-    NULL
-};
-
-pcap_t *pcap;
-pid_t listener_pid;
-int pfd[2];
-
-#ifdef SIOCGIFHWADDR
-void fill_interface_mac( char *dest, char *interface )
+/* Open a context for interface and srcip, sending to dstmac unless told otherwise, or exit. */
+static struct synfrag_ctx *open_link( struct links *links, const char *interface, const char *srcip, const char *dstmac )
 {
-    int fd;
-    struct ifreq ifr;
-
-    fd = socket( AF_INET, SOCK_DGRAM, 0 );
-    if ( fd == -1 )
-        err( 1, "socket failed" );
+    struct synfrag_config config = links->config;
+    struct link *link;
+    char errbuf[SYNFRAG_ERRBUF_SIZE];
+
+    if ( links->count == LINKS_MAX ) errx( 1, "Routes go out of more than %u interfaces and source addresses", LINKS_MAX );
+    link = &links->link[links->count];
+    config.interface = interface;
+    config.srcip = srcip;
+    config.dstmac = dstmac;
+    if ( synfrag_open_config( &link->ctx, &config, errbuf ) != SYNFRAG_OK )
+        errx( 1, "%s", errbuf );
+    if ( !links->count && metrics_start( link->ctx, links->metrics_path, links->stats_interval ) == -1 )
+        err( 1, "Unable to start metrics" );
+    if ( synfrag_set_timeout( link->ctx, links->timeout ) != SYNFRAG_OK ||
+        ( links->icmp_pace && synfrag_set_icmp_pace( link->ctx, links->icmp_pace, links->icmp_burst ) != SYNFRAG_OK ) ||
+        ( links->capture && synfrag_set_capture( link->ctx, links->capture, interface ) != SYNFRAG_OK ) )
+        errx( 1, "%s", synfrag_geterr( link->ctx ) );
+    snprintf( link->interface, IF_NAMESIZE, "%s", interface ? interface : "" );
+    snprintf( link->srcip, SYNFRAG_ADDRSTRLEN, "%s", srcip );
+    links->count++;
+    return link->ctx;
+}
 
-    ifr.ifr_addr.sa_family = AF_INET;
-    strncpy( ifr.ifr_name, interface, IFNAMSIZ - 1 );
+/* What route says: its interface, and the srcip and dstmac given on the command line or else its own. */
+static void describe_route( const struct links *links, const struct route *route, char *interface, char *srcip, char *dstmac )
+{
+    const struct synfrag_config *config = &links->config;
 
-    if ( ioctl( fd, SIOCGIFHWADDR, &ifr ) == -1 ) {
-        close( fd );
-        err( 1, "ioctl failed" );
+    snprintf( interface, IF_NAMESIZE, "%s", route->interface );
+    if ( config->srcip ) {
+        snprintf( srcip, SYNFRAG_ADDRSTRLEN, "%s", config->srcip );
+    } else {
+        inet_ntop( route->family, &route->src, srcip, SYNFRAG_ADDRSTRLEN );
     }
-    close( fd );
-
-    memcpy( dest, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN );
-}
-#elif __FreeBSD__
-#include <ifaddrs.h>
-#include <net/if_dl.h>
-void fill_interface_mac( char *dest, char *interface )
-{
-    struct ifaddrs *ifap;
-
-    if ( getifaddrs( &ifap ) == 0 ) {
-        struct ifaddrs *p;
-        for ( p = ifap; p; p = p->ifa_next ) {
-            if ( ( p->ifa_addr->sa_family == AF_LINK ) && ( strcmp( p->ifa_name, interface ) == 0 ) ) {
-                struct sockaddr_dl* sdp = (struct sockaddr_dl*) p->ifa_addr;
-                memcpy( dest, sdp->sdl_data + sdp->sdl_nlen, 6 );
-                freeifaddrs( ifap );
-                return;
-            }
-        }
-        freeifaddrs(ifap);
+    if ( config->dstmac ) {
+        snprintf( dstmac, MAC_STRLEN, "%s", config->dstmac );
+    } else {
+        snprintf( dstmac, MAC_STRLEN, "%02x:%02x:%02x:%02x:%02x:%02x",
+            route->mac[0], route->mac[1], route->mac[2], route->mac[3], route->mac[4], route->mac[5] );
     }
-    errx( 1, "Failed to get MAC for interface %s", interface );
 }
-#else
-#error Do not know how to get MAC address on this platform.
-#endif
 
-void *malloc_check( int size )
+/*
+ * Which way dstip goes: out of the interface and from the source address
+ * given on the command line if they were, otherwise as routed, to the
+ * given dstmac or the route's next hop. Returns 0, or -1 with errno set.
+ */
+static int route_link( struct links *links, int family, const char *dstip, char *interface, char *srcip, char *dstmac )
 {
-    void *r = malloc( size );
-    if ( r == NULL ) err( 1, "malloc" );
-    return r;
-}
+    struct route route;
+    unsigned char addr[16];
 
-unsigned short fix_up_destination_options_length( unsigned short optlen )
-{
-    /*
-     * Per RFC 2460, a destination options header must have a payload size
-     * that is: ( multiple of 8 ) - 2. We fix that up here by only ever
-     * increasing the size (though the algorithm would be simpler if we were
-     * willing to decrease it. There's no good reason not to decrease it, I
-     * just made a decision.
-     */
-    if ( optlen % 8 != 6 ) {
-        int x = 6 - ( optlen % 8 );
-        if ( x < 0 ) x += 8;
-        optlen += x;
+    if ( inet_pton( family, dstip, addr ) != 1 ) {
+        errno = EINVAL;
+        return -1;
     }
-    return optlen;
+    if ( route_lookup( links->routes, family, addr, links->config.interface, &route ) == -1 ) return -1;
+    describe_route( links, &route, interface, srcip, dstmac );
+    return 0;
 }
 
-void print_ethh( struct ether_header *ethh )
+/* The index of the link route goes out of, opening it if need be, with its next hop in dstmac. */
+static int route_link_index( struct links *links, const struct route *route, char *dstmac )
 {
-    printf( "Ethernet Frame, ethertype 0x%04X (%s)\n",
-        ntohs( ethh->ether_type ),
-        ether_protocol_to_name( ntohs( ethh->ether_type ) )
-    );
-
-    printf( " Src MAC %02X:%02X:%02X:%02X:%02X:%02X\n",
-        ethh->ether_shost[0],
-        ethh->ether_shost[1],
-        ethh->ether_shost[2],
-        ethh->ether_shost[3],
-        ethh->ether_shost[4],
-        ethh->ether_shost[5] );
-
-    printf( " Dest MAC %02X:%02X:%02X:%02X:%02X:%02X\n",
-        ethh->ether_dhost[0],
-        ethh->ether_dhost[1],
-        ethh->ether_dhost[2],
-        ethh->ether_dhost[3],
-        ethh->ether_dhost[4],
-        ethh->ether_dhost[5] );
+    char interface[IF_NAMESIZE];
+    char srcip[SYNFRAG_ADDRSTRLEN];
+    unsigned int x;
 
-    printf( "\n" );
+    describe_route( links, route, interface, srcip, dstmac );
+    for ( x = 0; x < links->count; x++ ) {
+        if ( strcmp( links->link[x].interface, interface ) == 0 && strcmp( links->link[x].srcip, srcip ) == 0 ) return x;
+    }
+    open_link( links, interface, srcip, dstmac );
+    return links->count - 1;
 }
 
-void print_iph( struct ip *iph )
-{
-    char srcbuf[INET_ADDRSTRLEN];
-    char dstbuf[INET_ADDRSTRLEN];
-    char *flag_names = ip_flags_to_names( ntohs( iph->ip_off ) >> IP_FLAGS_OFFSET );
-
-    if ( inet_ntop( AF_INET, &iph->ip_src, (char *) &srcbuf, INET_ADDRSTRLEN ) == NULL ) err( 1, "inet_ntop failed" );
-    if ( inet_ntop( AF_INET, &iph->ip_dst, (char *) &dstbuf, INET_ADDRSTRLEN ) == NULL ) err( 1, "inet_ntop failed" );
-
-    printf( "IPv4 Packet:\n\
- Src IP: %s\n\
- Dst IP: %s\n\
- Protocol: %i (%s)\n\
- Frag Offset: %i (%i bytes)\n\
- Flags: %i (%s)\n\
- Iphl: %i (%i bytes)\n\
-\n",
-        (char *) &srcbuf,
-        (char *) &dstbuf,
-        iph->ip_p,
-        ip_protocol_to_name( iph->ip_p ),
-        ntohs( iph->ip_off ) & 0x1FFF,
-        ( ntohs( iph->ip_off ) & 0x1FFF ) * FRAGMENT_OFFSET_TO_BYTES,
-        ntohs( iph->ip_off ) >> IP_FLAGS_OFFSET,
-        flag_names,
-        iph->ip_hl,
-        iph->ip_hl * 4
-    );
-    free( flag_names );
-}
+/*
+ * A target list read ROUTES_AHEAD targets ahead of where it is probed, so
+ * that with routes to look up, the next hops missing from the neighbour
+ * table are all sent their datagrams before any is waited for.
+ */
+struct routed_targets {
+    struct targets *targets;
+    struct links *links;
+    int family;
+    /* One more, for what the read that ended the list left in its target. */
+    struct target target[ROUTES_AHEAD + 1];
+    struct route route[ROUTES_AHEAD];
+    int error[ROUTES_AHEAD];
+    unsigned int count, next;
+    /* What the last targets_next() returned, with its errno. */
+    int r, r_errno;
+};
 
-void print_ip6h( struct ip6_hdr *ip6h )
+static struct routed_targets *routed_targets_open( struct targets *targets, struct links *links, int family )
 {
-    char srcbuf[INET6_ADDRSTRLEN];
-    char dstbuf[INET6_ADDRSTRLEN];
-
-    if ( inet_ntop( AF_INET6, &ip6h->ip6_src, (char *) &srcbuf, INET6_ADDRSTRLEN ) == NULL ) err( 1, "inet_ntop failed" );
-    if ( inet_ntop( AF_INET6, &ip6h->ip6_dst, (char *) &dstbuf, INET6_ADDRSTRLEN ) == NULL ) err( 1, "inet_ntop failed" );
-
-    printf( "IPv6 Packet:\n\
- Src IP: %s\n\
- Dst IP: %s\n\
- Protocol: %i (%s)\n\
- Payload Len: %i\n\
-\n",
-        (char *) &srcbuf,
-        (char *) &dstbuf,
-        ip6h->ip6_nxt,
-        ip_protocol_to_name( ip6h->ip6_nxt ),
-        ntohs( ip6h->ip6_plen )
-    );
+    struct routed_targets *routed;
+
+    if ( ( routed = malloc( sizeof( struct routed_targets ) ) ) == NULL ) err( 1, "malloc" );
+    routed->targets = targets;
+    routed->links = links;
+    routed->family = family;
+    routed->count = routed->next = 0;
+    routed->r = 1;
+    routed->r_errno = 0;
+    return routed;
 }
 
-void print_icmph( struct icmp *icmph )
+static void routed_targets_fill( struct routed_targets *routed )
 {
-    printf( "ICMP Packet:\n\
- Type: %i (%s)\n\
- Code: %i (%s)\n",
-        icmph->icmp_type,
-        icmp_type_to_name( icmph->icmp_type ),
-        icmph->icmp_code,
-        icmp_code_to_name( icmph->icmp_type, icmph->icmp_code )
-    );
-    if ( ( icmph->icmp_type == ICMP_ECHO || icmph->icmp_type == ICMP_ECHOREPLY ) && ( icmph->icmp_code == 0 ) ) {
-        printf( " Echo id: %i\n", htons( icmph->icmp_id ) );
+    struct target *target;
+    unsigned int x;
+
+    routed->count = routed->next = 0;
+    while ( routed->count < ROUTES_AHEAD && ( routed->r = targets_next( routed->targets, &routed->target[routed->count] ) ) == 1 ) {
+        x = routed->count++;
+        target = &routed->target[x];
+        if ( !routed->links->routes ) continue;
+        routed->error[x] = 0;
+        if ( target->family != routed->family ) {
+            routed->error[x] = EINVAL;
+        } else if ( route_start( routed->links->routes, routed->family, target->addr, routed->links->config.interface, &routed->route[x] ) == -1 ) {
+            routed->error[x] = errno;
+        }
     }
-    printf( "\n" );
+    routed->r_errno = errno;
+    if ( routed->links->routes ) route_resolve( routed->links->routes, routed->route, routed->error, routed->count );
 }
 
-void print_icmp6h( struct icmp6_hdr *icmp6h )
+/*
+ * As targets_next(), with the link the target goes out of in link (left
+ * alone without routes to look up), its next hop in dstmac, and link -1,
+ * with errno set, if there is no way there.
+ */
+static int routed_targets_next( struct routed_targets *routed, struct target *target, int *link, char *dstmac )
 {
-    printf( "ICMPv6 Packet:\n\
- Type: %i (%s)\n\
- Code: %i (%s)\n",
-        icmp6h->icmp6_type,
-        icmp6_type_to_name( icmp6h->icmp6_type ),
-        icmp6h->icmp6_code,
-        icmp6_code_to_name( icmp6h->icmp6_type, icmp6h->icmp6_code )
-    );
-    if ( ( icmp6h->icmp6_type == ICMP6_ECHO_REQUEST || icmp6h->icmp6_type == ICMP6_ECHO_REPLY ) && ( icmp6h->icmp6_code == 0 ) ) {
-        printf( " Echo id: %i\n", htons( icmp6h->icmp6_id ) );
+    unsigned int x;
+
+    if ( routed->next == routed->count ) {
+        if ( routed->r == 1 ) routed_targets_fill( routed );
+        if ( routed->next == routed->count ) {
+            *target = routed->target[routed->count];
+            errno = routed->r_errno;
+            return routed->r;
+        }
     }
-    printf( "\n" );
+    x = routed->next++;
+    *target = routed->target[x];
+    if ( !routed->links->routes ) return 1;
+    if ( routed->error[x] ) {
+        *link = -1;
+        errno = routed->error[x];
+        return 1;
+    }
+    *link = route_link_index( routed->links, &routed->route[x], dstmac );
+    return 1;
 }
 
-void print_tcph( struct tcphdr *tcph )
+static void close_links( struct links *links, int profile )
 {
-    char *tcp_flags = tcp_flags_to_names( tcph->th_flags );
-    printf( "TCP Packet:\n\
- Src Port: %u\n\
- Dst Port: %u\n\
- Seq Num: %u\n\
- Ack Num: %u\n\
- Flags: %i (%s)\n\
-\n",
-        ntohs( tcph->th_sport ),
-        ntohs( tcph->th_dport ),
-        ntohl( tcph->th_seq ),
-        ntohl( tcph->th_ack ),
-        tcph->th_flags,
-        tcp_flags
-    );
-    free( tcp_flags );
+    struct synfrag_stats stats;
+    char errbuf[SYNFRAG_ERRBUF_SIZE];
+    unsigned long dropped = 0;
+    unsigned int x;
+
+    for ( x = 0; x < links->count; x++ ) {
+        if ( profile && synfrag_profile_report( links->link[x].ctx, stderr ) != SYNFRAG_OK )
+            warnx( "%s", synfrag_geterr( links->link[x].ctx ) );
+        synfrag_get_stats( links->link[x].ctx, &stats );
+        dropped += stats.capture_dropped;
+        synfrag_close( links->link[x].ctx );
+    }
+    if ( !links->capture ) return;
+    if ( synfrag_capture_close( links->capture, errbuf ) != SYNFRAG_OK ) warnx( "%s", errbuf );
+    if ( dropped ) warnx( "%lu frames were left out of the capture, it couldn't keep up", dropped );
 }
 
-void build_ethernet( struct ether_header *ethh, char *interface, char *remote_mac, short int ethertype )
-{
-    fill_interface_mac( (char *) &ethh->ether_shost, interface );
+/* Daemon functions. */
 
-    if ( sscanf( remote_mac, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
-            &ethh->ether_dhost[0],
-            &ethh->ether_dhost[1],
-            &ethh->ether_dhost[2],
-            &ethh->ether_dhost[3],
-            &ethh->ether_dhost[4],
-            &ethh->ether_dhost[5] ) != 6 ) {
-        errx( 1, "Unable to parse remote MAC address" );
-    }
+struct daemon_client {
+    /* -1 for a free slot. */
+    int fd;
+    /* Carried by its probes as their user pointer, so a slot used again doesn't get its results. */
+    unsigned long id;
+    char buf[DAEMON_LINE_MAX];
+    size_t len;
+    unsigned int in_flight;
+    /* Hung up: closed once its last result is written. */
+    int eof;
+};
 
-    ethh->ether_type = htons( ethertype );
-    print_ethh( ethh );
-}
+struct daemon {
+    struct synfrag_ctx *ctx;
+    long default_timeout;
+    /* The context's timeout, which only changes while nothing is in flight. */
+    long timeout;
+    struct daemon_client clients[DAEMON_CLIENTS_MAX];
+    unsigned long next_id;
+};
 
-void build_tcp_syn( void *iph, struct tcphdr *tcph, unsigned short srcport, unsigned short dstport )
+/*
+ * A job is one line: "<test> <dstip> [dstport] [timeout]". The answer is one
+ * line: "<test> <dstip> <dstport> <success|failed|timeout|time-exceeded>",
+ * or "error <reason>" if the job was rejected. Returns 0 once the job is
+ * submitted or answered, or -1 if it has to wait for probes in flight: for
+ * room in the context, or to change its timeout.
+ */
+static int run_daemon_job( struct daemon *d, struct daemon_client *client, char *line )
 {
-    tcph->th_sport = htons( srcport );
-    tcph->th_dport = htons( dstport );
-    tcph->th_seq = htonl( rand() );
-    tcph->th_ack = 0;
-    tcph->th_x2 = 0;
-    tcph->th_off = SIZEOF_TCP / 4;
-    tcph->th_flags = TH_SYN;
-    tcph->th_win = TCP_WINDOW;
-    tcph->th_sum = 0;
-    tcph->th_urp = 0;
-    if ( do_checksum( iph, IPPROTO_TCP, SIZEOF_TCP ) != 1 )
-        errx( 1, "Unable to compute checksum (build_tcp_syn)." );
-
-    print_tcph( tcph );
-}
+    char *test, *dstip, *port_str, *timeout_str, *saveptr;
+    struct synfrag_probe probe;
+    int tmpport = 0;
+    long receive_timeout = d->default_timeout;
+    char job[DAEMON_LINE_MAX];
+    int r;
 
-void build_icmp_ping( void *iph, struct icmp *icmph, unsigned short payload_length )
-{
-    icmph->icmp_type = ICMP_ECHO;
-    icmph->icmp_code = 0;
-    icmph->icmp_cksum = 0;
-    icmph->icmp_id = htons( SOURCE_PORT );
-    icmph->icmp_seq = htons( 1 );
-    memset( (char *) icmph + SIZEOF_PING, 0x01, payload_length );
-    if ( do_checksum( iph, IPPROTO_ICMP, SIZEOF_PING + payload_length ) != 1 )
-        errx( 1, "Unable to compute checksum (build_icmp_ping)." );
-
-    print_icmph( icmph );
-}
+    /* strtok_r() cuts the line up, and it may have to wait for another go. */
+    snprintf( job, DAEMON_LINE_MAX, "%s", line );
+    test = strtok_r( job, " \t\r\n", &saveptr );
+    /* Blank line. */
+    if ( !test ) return 0;
+    dstip = strtok_r( NULL, " \t\r\n", &saveptr );
+    port_str = strtok_r( NULL, " \t\r\n", &saveptr );
+    timeout_str = strtok_r( NULL, " \t\r\n", &saveptr );
+
+    if ( ( probe.test_type = synfrag_test_by_name( test ) ) == TEST_INVALID ) {
+        dprintf( client->fd, "error unknown test %s\n", test );
+        return 0;
+    }
+    if ( port_str ) tmpport = atoi( port_str );
+    if ( tmpport > 65535 || tmpport < 0 ) {
+        dprintf( client->fd, "error invalid dstport\n" );
+        return 0;
+    }
+    if ( timeout_str ) receive_timeout = atol( timeout_str );
+    if ( receive_timeout != d->timeout ) {
+        if ( synfrag_in_flight( d->ctx ) ) return -1;
+        if ( synfrag_set_timeout( d->ctx, receive_timeout ) != SYNFRAG_OK ) {
+            dprintf( client->fd, "error %s\n", synfrag_geterr( d->ctx ) );
+            return 0;
+        }
+        d->timeout = receive_timeout;
+    }
 
-void build_icmp6_ping( void *iph, struct icmp6_hdr *icmp6h, unsigned short payload_length )
-{
-    icmp6h->icmp6_type = ICMP6_ECHO_REQUEST;
-    icmp6h->icmp6_code = 0;
-    icmp6h->icmp6_cksum = 0;
-    icmp6h->icmp6_id = htons( SOURCE_PORT );
-    icmp6h->icmp6_seq = htons( 1 );
-    memset( (char *) icmp6h + SIZEOF_ICMP6, 0x01, payload_length );
-    if ( do_checksum( iph, IPPROTO_ICMPV6, SIZEOF_ICMP6 + payload_length ) != 1 )
-        errx( 1, "Unable to compute checksum (build_icmp6_ping)." );
-
-    print_icmp6h( icmp6h );
+    probe.dstip = dstip;
+    probe.dstport = tmpport;
+    probe.srcport = 0;
+    probe.ttl = 0;
+    probe.hold_msec = 0;
+    probe.frag_data = 0;
+    probe.frag_options = 0;
+    probe.dstmac = NULL;
+    probe.user = (void *) client->id;
+
+    /* Late replies to earlier jobs, unless they might be replies to jobs still running. */
+    if ( !synfrag_in_flight( d->ctx ) ) synfrag_flush( d->ctx );
+    if ( ( r = synfrag_submit( d->ctx, &probe ) ) == SYNFRAG_ERR_BUSY ) return -1;
+    if ( r != SYNFRAG_OK ) {
+        dprintf( client->fd, "error %s\n", synfrag_geterr( d->ctx ) );
+        return 0;
+    }
+    client->in_flight++;
+    return 0;
 }
 
-void build_bare_ipv4( struct ip *iph, char *srcip, char *dstip, unsigned char protocol )
+/* Run every whole line client has sent, up to one that has to wait. Returns how many were submitted. */
+static unsigned int run_daemon_jobs( struct daemon *d, struct daemon_client *client )
 {
-    iph->ip_v = 4;
-    iph->ip_hl = 5;
-    iph->ip_tos = 0;
-    iph->ip_len = htons( SIZEOF_IPV4 + SIZEOF_TCP );
-    iph->ip_id = 0;
-    iph->ip_off = 0;
-    iph->ip_ttl = IPDEFTTL;
-    iph->ip_p = protocol;
-    iph->ip_sum = 0;
-    iph->ip_src.s_addr = inet_addr(srcip);
-    iph->ip_dst.s_addr = inet_addr(dstip);
+    unsigned int in_flight = client->in_flight;
+    char *end;
+    size_t used;
+
+    while ( ( end = memchr( client->buf, '\n', client->len ) ) ) {
+        *end = '\0';
+        if ( run_daemon_job( d, client, client->buf ) == -1 ) {
+            *end = '\n';
+            break;
+        }
+        used = end + 1 - client->buf;
+        memmove( client->buf, end + 1, client->len - used );
+        client->len -= used;
+    }
+    if ( client->len == DAEMON_LINE_MAX && !end ) {
+        dprintf( client->fd, "error job longer than %d bytes\n", DAEMON_LINE_MAX - 1 );
+        client->len = 0;
+    }
+    return client->in_flight - in_flight;
 }
 
-void build_ipv4( struct ip *iph, char *srcip, char *dstip, unsigned char protocol )
+static void add_daemon_client( struct daemon *d, int fd )
 {
-    build_bare_ipv4( iph, srcip, dstip, protocol );
-    if ( do_checksum( (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
-        errx( 1, "Unable to compute checksum (build_ipv4)." );
-
-    print_iph( iph );
+    struct daemon_client *client = d->clients;
+
+    /* Only called with a slot free. */
+    while ( client->fd != -1 ) client++;
+    client->fd = fd;
+    client->id = ++d->next_id;
+    client->len = 0;
+    client->in_flight = 0;
+    client->eof = 0;
 }
 
-void build_ipv4_short_frag1( struct ip *iph, char *srcip, char *dstip, unsigned char protocol, unsigned short fragid )
+static struct daemon_client *find_daemon_client( struct daemon *d, unsigned long id )
 {
-    build_bare_ipv4( iph, srcip, dstip, protocol );
-    iph->ip_off = htons( 1 << IP_FLAGS_OFFSET ); /* Set More Fragments (MF) bit */
-    iph->ip_id = htons( fragid );
-    iph->ip_len = htons( SIZEOF_IPV4 + MINIMUM_FRAGMENT_SIZE );
-    if ( do_checksum( (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
-        errx( 1, "Unable to compute checksum (build_ipv4_short_frag1)." );
-
-    print_iph( iph );
-}
+    unsigned int x;
 
-void build_ipv4_frag2( struct ip *iph, char *srcip, char *dstip, unsigned char protocol, unsigned short fragid, unsigned short payload_length )
-{
-    build_bare_ipv4( iph, srcip, dstip, protocol );
-    iph->ip_off = htons( 1 );
-    iph->ip_id = htons( fragid );
-    iph->ip_len = htons( SIZEOF_IPV4 + payload_length );
-    if ( do_checksum( (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
-        errx( 1, "Unable to compute checksum (build_ipv4_frag2)." );
-
-    print_iph( iph );
+    for ( x = 0; x < DAEMON_CLIENTS_MAX; x++ ) {
+        if ( d->clients[x].fd != -1 && d->clients[x].id == id ) return &d->clients[x];
+    }
+    return NULL;
 }
 
-void build_ipv4_optioned_frag1( struct ip *iph, char *srcip, char *dstip, unsigned char protocol, unsigned short fragid, unsigned short optlen )
+/* Read what client has sent, ending a last line it didn't once it hangs up. */
+static void read_daemon_client( struct daemon_client *client )
 {
-    build_bare_ipv4( iph, srcip, dstip, protocol );
-    iph->ip_off = htons( 1 << IP_FLAGS_OFFSET ); /* Set More Fragments (MF) bit */
-    iph->ip_id = htons( fragid );
-    iph->ip_len = htons( SIZEOF_IPV4 + optlen + MINIMUM_FRAGMENT_SIZE );
-
-    if ( optlen % 4 != 0 ) errx( 1, "optlen must be a multiple of 4" );
-    iph->ip_hl = 5 + optlen;
-
-    /* Pad with NOP's and then end-of-padding option. */
-    memset( (char *) iph + SIZEOF_IPV4, 0x01, optlen );
-    *( (char *) iph + SIZEOF_IPV4 + optlen ) = 0;
-    if ( do_checksum( (char *) iph, IPPROTO_IP, iph->ip_hl * 4 ) != 1 )
-        errx( 1, "Unable to compute checksum (build_ipv4_optioned_frag1)." );
+    ssize_t len;
 
-    print_iph( iph );
+    if ( ( len = read( client->fd, client->buf + client->len, DAEMON_LINE_MAX - client->len ) ) > 0 ) {
+        client->len += len;
+        return;
+    }
+    if ( len == -1 && errno == EINTR ) return;
+    client->eof = 1;
+    if ( client->len && client->len < DAEMON_LINE_MAX && client->buf[client->len - 1] != '\n' ) client->buf[client->len++] = '\n';
 }
 
-void build_ipv6( struct ip6_hdr *ip6h, char *srcip, char *dstip, unsigned char protocol, unsigned short payload_length )
+/* Once it has hung up, and every job it sent is answered. */
+static void close_daemon_client( struct daemon_client *client, int force )
 {
-    /* 4 bits version, 8 bits TC, 20 bits flow-ID. We only set the version bits. */
-    ip6h->ip6_flow = htonl( 0x06 << 28 );
-    ip6h->ip6_plen = htons( payload_length );
-    ip6h->ip6_hlim = 64;
-    ip6h->ip6_nxt = protocol;
-    if ( !inet_pton( AF_INET6, srcip, &ip6h->ip6_src ) ) errx( 1, "Invalid source address" );
-    if ( !inet_pton( AF_INET6, dstip, &ip6h->ip6_dst ) ) errx( 1, "Invalid source address" );
-
-    print_ip6h( ip6h );
+    if ( !force && ( !client->eof || client->in_flight || memchr( client->buf, '\n', client->len ) ) ) return;
+    close( client->fd );
+    client->fd = -1;
 }
 
-void build_ipv6_short_frag1( struct ip6_hdr *ip6h, char *srcip, char *dstip, unsigned char protocol, unsigned short fragid )
+/*
+ * Write each result completed by until to the client whose job it was. The
+ * engine failing is reported to every client with jobs in flight, which are
+ * given up on.
+ */
+static void write_daemon_results( struct daemon *d, const struct timeval *until )
 {
-    struct ip6_frag *fragh = (struct ip6_frag *) ( (char *)ip6h + SIZEOF_IPV6 );
-
-    /* 4 bits version, 8 bits TC, 20 bits flow-ID. We only set the version bits. */
-    ip6h->ip6_flow = htonl( 0x06 << 28 );
-    ip6h->ip6_plen = htons( sizeof( struct ip6_frag ) + MINIMUM_FRAGMENT_SIZE );
-    ip6h->ip6_hlim = 64;
-    ip6h->ip6_nxt = IPPROTO_FRAGMENT;
-    if ( !inet_pton( AF_INET6, srcip, &ip6h->ip6_src ) ) errx( 1, "Invalid source address" );
-    if ( !inet_pton( AF_INET6, dstip, &ip6h->ip6_dst ) ) errx( 1, "Invalid source address" );
-
-    fragh->ip6f_reserved = 0;
-    fragh->ip6f_nxt = protocol;
-    fragh->ip6f_ident = htons( fragid );
-    fragh->ip6f_offlg = IP6F_MORE_FRAG;
-
-    print_ip6h( ip6h );
-}
+    struct synfrag_result result;
+    struct daemon_client *client;
+    unsigned int x;
+    int r;
 
-void build_ipv6_optioned_frag1( struct ip6_hdr *ip6h, char *srcip, char *dstip, unsigned char protocol, unsigned short fragid, unsigned short optlen )
-{
-    struct ip6_dest *desth = (struct ip6_dest *) ( (char *)ip6h + SIZEOF_IPV6 );
-    struct ip6_frag *fragh = (struct ip6_frag *) ( (char *)ip6h + SIZEOF_IPV6 + sizeof( struct ip6_dest ) + optlen );
-
-    /* 4 bits version, 8 bits TC, 20 bits flow-ID. We only set the version bits. */
-    ip6h->ip6_flow = htonl( 0x06 << 28 );
-    ip6h->ip6_plen = htons( sizeof( struct ip6_dest ) + optlen + sizeof( struct ip6_frag ) + MINIMUM_FRAGMENT_SIZE );
-    ip6h->ip6_hlim = 64;
-    ip6h->ip6_nxt = IPPROTO_DSTOPTS;
-    if ( !inet_pton( AF_INET6, srcip, &ip6h->ip6_src ) ) errx( 1, "Invalid source address" );
-    if ( !inet_pton( AF_INET6, dstip, &ip6h->ip6_dst ) ) errx( 1, "Invalid source address" );
-
-    if ( optlen == 0 || optlen % 8 != 6 ) errx( 1, "optlen value not supported" );
-    desth->ip6d_nxt = IPPROTO_FRAGMENT;
-    desth->ip6d_len = optlen / 8;
-
-    *( (char *) desth + sizeof( struct ip6_dest ) ) = 1;
-    *( (char *) desth + sizeof( struct ip6_dest ) + 1 ) = optlen - 2;
-    memset( (char *) desth + sizeof( struct ip6_dest ) + 2, 0, optlen - 2 );
-
-    fragh->ip6f_reserved = 0;
-    fragh->ip6f_nxt = protocol;
-    fragh->ip6f_ident = htons( fragid );
-    fragh->ip6f_offlg = IP6F_MORE_FRAG;
-
-    print_ip6h( ip6h );
+    while ( ( r = synfrag_next_result_until( d->ctx, &result, until ) ) == 1 ) {
+        if ( ( client = find_daemon_client( d, (unsigned long) result.user ) ) == NULL ) continue;
+        dprintf( client->fd, "%s %s %i %s\n", synfrag_test_name( result.test_type ), result.dstip, result.dstport, synfrag_result_name( result.result ) );
+        client->in_flight--;
+    }
+    if ( r == 0 ) return;
+    /* One bad job doesn't take the daemon down with it. */
+    for ( x = 0; x < DAEMON_CLIENTS_MAX; x++ ) {
+        client = &d->clients[x];
+        if ( client->fd == -1 || !client->in_flight ) continue;
+        dprintf( client->fd, "error %s\n", synfrag_geterr( d->ctx ) );
+        client->in_flight = 0;
+    }
+    synfrag_abandon( d->ctx );
 }
 
-void build_ipv6_frag2( struct ip6_hdr *ip6h, char *srcip, char *dstip, unsigned char protocol, unsigned short fragid, unsigned short payload_length )
+static void stop_daemon( int sig )
 {
-    struct ip6_frag *fragh = (struct ip6_frag *) ( (char *)ip6h + SIZEOF_IPV6 );
-
-    /* 4 bits version, 8 bits TC, 20 bits flow-ID. We only set the version bits. */
-    ip6h->ip6_flow = htonl( 0x06 << 28 );
-    ip6h->ip6_plen = htons( payload_length + sizeof( struct ip6_frag ) );
-    ip6h->ip6_hlim = 64;
-    ip6h->ip6_nxt = IPPROTO_FRAGMENT;
-    if ( !inet_pton( AF_INET6, srcip, &ip6h->ip6_src ) ) errx( 1, "Invalid source address" );
-    if ( !inet_pton( AF_INET6, dstip, &ip6h->ip6_dst ) ) errx( 1, "Invalid source address" );
-
-    fragh->ip6f_reserved = 0;
-    fragh->ip6f_nxt = protocol;
-    fragh->ip6f_ident = htons( fragid );
-    fragh->ip6f_offlg = htons( 1 << 3 );
-
-    print_ip6h( ip6h );
+    daemon_stop = 1;
 }
 
-/* Returns the layer 4 header if we found one. */
-char *print_a_packet( int len, char *packet_data, unsigned short wanted_type )
+/*
+ * Serve jobs from a unix socket to any number of clients at once, keeping the
+ * backend, its compiled filter and the interface MAC from one job to the
+ * next. Each job is submitted as soon as its line arrives, and each result
+ * written back to its client as soon as it completes, so a client may have
+ * many jobs running and gets their results in the order they finish. A job
+ * whose timeout differs from the one running jobs were given waits for them
+ * to finish, as do the lines after it. Returns on SIGINT or SIGTERM.
+ */
+void run_daemon( char *socket_path, struct synfrag_ctx *ctx, long default_timeout )
 {
-    struct ip *iph;
-    struct ip6_hdr *ip6h;
-    size_t s;
-    struct ether_header *ethh = (struct ether_header *) packet_data;
-    unsigned short found_type;
-    char *found_header;
-
-    if ( ntohs( ethh->ether_type ) == ETHERTYPE_IP ) {
-        iph = (struct ip *) ( packet_data + SIZEOF_ETHER );
-        s = SIZEOF_ETHER + ( iph->ip_hl * 4 );
-        if ( s > len ) errx( 1, "Reply too short (IPv4)" );
-        print_iph( iph );
-        if ( iph->ip_p == IPPROTO_TCP ) {
-            if ( s + SIZEOF_TCP > len ) errx( 1, "Reply too short" );
-            print_tcph( (struct tcphdr *) ( packet_data + s ) );
-            found_type = IPPROTO_TCP;
-            found_header = packet_data + s;
-        } else if ( iph->ip_p == IPPROTO_ICMP ) {
-            if ( s + SIZEOF_PING > len ) errx( 1, "Reply too short" );
-            print_icmph( (struct icmp *) ( packet_data + s ) );
-            found_type = IPPROTO_ICMP;
-            found_header = packet_data + s;
-        } else {
-            errx( 1, "Unknown reply received (ip protocol %i)", iph->ip_p );
+    struct sockaddr_un sun;
+    struct sigaction sa;
+    struct pollfd fds[DAEMON_CLIENTS_MAX + 1];
+    struct daemon_client *slot[DAEMON_CLIENTS_MAX + 1];
+    struct daemon_client *client;
+    struct daemon *d;
+    struct timeval until;
+    unsigned int x, nfds, clients, submitted;
+    int lfd, cfd;
+
+    if ( strlen( socket_path ) >= sizeof( sun.sun_path ) ) errx( 1, "Socket path too long" );
+    memset( &sun, 0, sizeof( struct sockaddr_un ) );
+    sun.sun_family = AF_UNIX;
+    strcpy( sun.sun_path, socket_path );
+
+    if ( ( d = calloc( 1, sizeof( struct daemon ) ) ) == NULL ) err( 1, "calloc" );
+    d->ctx = ctx;
+    d->default_timeout = d->timeout = default_timeout;
+    for ( x = 0; x < DAEMON_CLIENTS_MAX; x++ ) d->clients[x].fd = -1;
+
+    if ( ( lfd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) == -1 ) err( 1, "socket failed" );
+    unlink( socket_path );
+    if ( bind( lfd, (struct sockaddr *) &sun, sizeof( struct sockaddr_un ) ) == -1 ) err( 1, "bind failed" );
+    if ( listen( lfd, 16 ) == -1 ) err( 1, "listen failed" );
+
+    /* A client hanging up early shouldn't take us down with it. */
+    signal( SIGPIPE, SIG_IGN );
+    /* No SA_RESTART, so a blocked poll() gives up on a signal. */
+    memset( &sa, 0, sizeof( struct sigaction ) );
+    sa.sa_handler = stop_daemon;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+    printf( "Waiting for jobs on \"%s\".\n", socket_path );
+    fflush( stdout );
+
+    while ( !daemon_stop ) {
+        /* Jobs that had to wait go first, now that some may have finished. */
+        submitted = 0;
+        for ( x = 0; x < DAEMON_CLIENTS_MAX; x++ ) {
+            client = &d->clients[x];
+            if ( client->fd == -1 ) continue;
+            submitted += run_daemon_jobs( d, client );
+            close_daemon_client( client, 0 );
+        }
+        if ( submitted ) synfrag_transmit( ctx );
+
+        /* The listening socket while there is room, and every client still sending. */
+        nfds = clients = 0;
+        for ( x = 0; x < DAEMON_CLIENTS_MAX; x++ ) {
+            client = &d->clients[x];
+            if ( client->fd == -1 ) continue;
+            clients++;
+            if ( client->eof || client->len == DAEMON_LINE_MAX ) continue;
+            fds[nfds].fd = client->fd;
+            fds[nfds].events = POLLIN;
+            slot[nfds++] = client;
+        }
+        if ( clients < DAEMON_CLIENTS_MAX ) {
+            fds[nfds].fd = lfd;
+            fds[nfds].events = POLLIN;
+            slot[nfds++] = NULL;
+        }
+        /* With jobs running, the engine does the waiting. */
+        if ( poll( fds, nfds, synfrag_in_flight( ctx ) ? 0 : -1 ) == -1 ) {
+            if ( errno == EINTR ) continue;
+            err( 1, "poll failed" );
         }
 
-    } else if ( ntohs( ethh->ether_type ) == ETHERTYPE_IPV6 ) {
-        ip6h = (struct ip6_hdr *) ( packet_data + SIZEOF_ETHER );
-        s = SIZEOF_ETHER + SIZEOF_IPV6;
-        if ( s > len ) errx( 1, "Reply too short (IPv6)" );
-        print_ip6h( ip6h );
-        if ( ip6h->ip6_nxt == IPPROTO_TCP ) {
-            if ( s + SIZEOF_TCP > len ) errx( 1, "Reply too short" );
-            print_tcph( (struct tcphdr *) ( packet_data + s ) );
-            found_type = IPPROTO_TCP;
-            found_header = packet_data + s;
-        } else if ( ip6h->ip6_nxt == IPPROTO_ICMPV6 ) {
-            if ( s + SIZEOF_ICMP6 > len ) errx( 1, "Reply too short" );
-            print_icmp6h( (struct icmp6_hdr *) ( packet_data + s ) );
-            found_type = IPPROTO_ICMPV6;
-            found_header = packet_data + s;
-        } else {
-            errx( 1, "Unknown reply received (ip6 next header %i)", ip6h->ip6_nxt );
+        for ( x = 0; x < nfds; x++ ) {
+            if ( !fds[x].revents ) continue;
+            if ( slot[x] ) {
+                read_daemon_client( slot[x] );
+                continue;
+            }
+            if ( ( cfd = accept( lfd, NULL, NULL ) ) == -1 ) {
+                if ( errno == EINTR || errno == ECONNABORTED ) continue;
+                err( 1, "accept failed" );
+            }
+            add_daemon_client( d, cfd );
         }
 
-    } else {
-        errx( 1, "Unknown reply received (ethertype %i)", ntohs( ethh->ether_type ) );
+        if ( synfrag_in_flight( ctx ) ) {
+            synfrag_now( ctx, &until );
+            until.tv_usec += DAEMON_POLL_MSEC * 1000;
+            if ( until.tv_usec >= 1000000 ) {
+                until.tv_sec++;
+                until.tv_usec -= 1000000;
+            }
+            write_daemon_results( d, &until );
+        }
     }
 
-    if ( wanted_type == found_type ) return found_header;
-    return NULL;
+    for ( x = 0; x < DAEMON_CLIENTS_MAX; x++ ) {
+        if ( d->clients[x].fd != -1 ) close_daemon_client( &d->clients[x], 1 );
+    }
+    synfrag_abandon( ctx );
+    free( d );
+    close( lfd );
+    unlink( socket_path );
 }
 
-int receive_a_packet( char *srcip, char *dstip, unsigned short srcport, unsigned short dstport, enum TEST_TYPE test_type, char **packet_buf, long receive_timeout )
-{
-    struct pcap_pkthdr *received_packet_pcap;
-    struct bpf_program pcap_filter;
-    char *received_packet_data;
-/*
- * My back-of-the-napkin for the maximum length for the ipv6 filter string
- * below + 1 byte for the trailing NULL 
- */
-#define FILTER_STR_LEN 203 
-    char filter_str[FILTER_STR_LEN];
-    int r, fd;
-    fd_set select_me;
-    struct timeval ts;
-
-    /*
-     * Something prior to now should have validated srcip and dstip are valid
-     * IP addresses, we hope. Napkin math says we shouldn't even be close to
-     * overflowing our buffer.
-     */
-    if ( IS_TEST_IPV4( test_type ) ) {
-        r = snprintf(
-            (char *) &filter_str,
-            FILTER_STR_LEN,
-            "src %s and dst %s and (icmp or (tcp and src port %i and dst port %i))",
-            srcip,
-            dstip,
-            srcport,
-            dstport
-        );
-    } else {
-        r = snprintf(
-            (char *) &filter_str,
-            FILTER_STR_LEN,
-            /* Attempt to ignore ICMP6 neighbor solicitation/advertisement */
-            "src %s and dst %s and ((icmp6 and ip6[40] != 135 and ip6[40] != 136) or (tcp and src port %i and dst port %i))",
-            srcip,
-            dstip,
-            srcport,
-            dstport
-        );
-    }
-    if ( r < 0 || r >= FILTER_STR_LEN ) errx( 1, "snprintf for pcap filter failed" );
-    if ( pcap_compile( pcap, &pcap_filter, (char *) &filter_str, 1, 0 ) == -1 )
-        errx( 1, "pcap_compile failed: %s", pcap_geterr( pcap ) );
-    if ( pcap_setfilter( pcap, &pcap_filter ) == -1 )
-        errx( 1, "pcap_setfilter failed: %s", pcap_geterr( pcap ) );
-    pcap_freecode( &pcap_filter );
-
-    if ( ( fd = pcap_fileno( pcap ) ) == -1 )
-        errx( 1, "pcap_fileno failed" );
-
-    FD_ZERO( &select_me );
-    FD_SET( fd, &select_me );
-
-    ts.tv_sec = receive_timeout;
-    ts.tv_usec = 0;
+/* Bench functions. */
 
-    /*
-     * Signal we're ready to go. Still a race condition. I don't see how to
-     * work around this with pcap. 
-     */
-    write( pfd[1], ".", 1 );
-    r = select( fd + 1, &select_me, NULL, NULL, &ts );
-    /* Timed out */
-    if ( r == 0 ) return 0;
-
-    r = pcap_next_ex( pcap, &received_packet_pcap, (const unsigned char **) &received_packet_data );
-
-    /* Error or pcap_next_ex timed out (should never happen) */
-    if ( r < 1 ) return 0;
-    if ( received_packet_pcap->len > received_packet_pcap->caplen ) errx( 1, "pcap didn't capture the whole packet." );
+static void count_bench_result( const struct synfrag_result *result, void *arg )
+{
+    unsigned long *results = arg;
 
-    *packet_buf = (char *) received_packet_data;
-    return received_packet_pcap->len;
+    results[result->result]++;
 }
 
-int check_received_packet( int buf_len, char *packet_buf, enum TEST_TYPE test_type ) {
-    struct ether_header *received_packet_data = (struct ether_header *) packet_buf;
-    struct tcphdr *tcph;
-    struct icmp *icmph;
-    struct icmp6_hdr *icmp6h;
-
-    if ( IS_TEST_IPV4( test_type ) && IS_TEST_ICMP( test_type ) ) {
-        icmph = (struct icmp *) print_a_packet( buf_len, (char *) received_packet_data, IPPROTO_ICMP );
-        if ( !icmph ) return 0;
-        if ( icmph->icmp_type == ICMP_ECHOREPLY && icmph->icmp_id == htons( SOURCE_PORT ) ) return 1;
-    } else if ( IS_TEST_IPV6( test_type ) && IS_TEST_ICMP( test_type ) ) {
-        icmp6h = (struct icmp6_hdr *) print_a_packet( buf_len, (char *) received_packet_data, IPPROTO_ICMPV6 );
-        if ( !icmp6h ) return 0;
-        if ( icmp6h->icmp6_type == ICMP6_ECHO_REPLY && icmp6h->icmp6_id == htons( SOURCE_PORT ) ) return 1;
-    } else { /* Assume pcap picked the right address family for our packet. */
-        tcph = (struct tcphdr *) print_a_packet( buf_len, (char *) received_packet_data, IPPROTO_TCP );
-        if ( !tcph ) return 0;
-        if ( ( tcph->th_flags & ( TH_SYN|TH_ACK ) ) && !( tcph->th_flags & TH_RST ) ) {
-            return 1;
-        }
+/* Where --bench's probes have got to: the next is to base + next. */
+struct bench_gen {
+    enum TEST_TYPE test_type;
+    unsigned short dstport;
+    int family;
+    unsigned int addr_len;
+    unsigned char base[16];
+    unsigned long next;
+    unsigned long count;
+    char dstip[SYNFRAG_ADDRSTRLEN];
+};
+
+static int next_bench_probe( struct synfrag_probe *probe, void *arg )
+{
+    struct bench_gen *gen = arg;
+    unsigned char addr[16];
+    unsigned int carry, y;
+
+    if ( gen->next == gen->count ) return 0;
+    /* base + next, as one big endian number. */
+    memcpy( addr, gen->base, gen->addr_len );
+    carry = 0;
+    for ( y = 0; y < gen->addr_len; y++ ) {
+        carry += addr[gen->addr_len - 1 - y] + ( y < sizeof( unsigned long ) ? ( gen->next >> ( 8 * y ) ) & 0xff : 0 );
+        addr[gen->addr_len - 1 - y] = carry & 0xff;
+        carry >>= 8;
     }
-    printf( "Received reply but it wasn't what we were hoping for.\n" );
-    return 0;
+    inet_ntop( gen->family, addr, gen->dstip, SYNFRAG_ADDRSTRLEN );
+    gen->next++;
+    probe->test_type = gen->test_type;
+    probe->dstip = gen->dstip;
+    probe->dstport = gen->dstport;
+    return 1;
 }
 
-/* IPv4 tests. */
-void do_ipv4_syn( char *interface, char *srcip, char *dstip, char *dstmac, unsigned short dstport )
+/*
+ * Run count probes as fast as the backend takes them, to dstip, dstip + 1
+ * and so on, and report the rate. Meant for the loopback backend, where it
+ * measures the engine alone. Probes are made and results counted on threads
+ * of their own, so the engine never stops for either.
+ */
+void run_bench( struct synfrag_ctx *ctx, enum TEST_TYPE test_type, const char *dstip, unsigned short dstport, unsigned long count )
 {
-    struct ip *iph;
-    struct tcphdr *tcph;
-    struct ether_header *ethh;
-    int packet_size;
-
-    packet_size = SIZEOF_ETHER + SIZEOF_TCP + SIZEOF_IPV4;
+    struct bench_gen gen;
+    struct synfrag_sink *sink;
+    unsigned long results[SYNFRAG_RESULT_MAX] = { 0 };
+    struct synfrag_stats stats;
+    struct timeval start, end, elapsed;
+    char errbuf[SYNFRAG_ERRBUF_SIZE];
+    double seconds;
+
+    memset( &gen, 0, sizeof( struct bench_gen ) );
+    gen.test_type = test_type;
+    gen.dstport = dstport;
+    gen.family = synfrag_test_family( test_type );
+    gen.addr_len = gen.family == AF_INET ? 4 : 16;
+    gen.count = count;
+    if ( inet_pton( gen.family, dstip, gen.base ) != 1 ) errx( 1, "Invalid dstip for this test: %s", dstip );
+    if ( synfrag_sink_open( &sink, count_bench_result, results, errbuf ) != SYNFRAG_OK ) errx( 1, "%s", errbuf );
+
+    gettimeofday( &start, NULL );
+    if ( synfrag_run_pipelined( ctx, next_bench_probe, &gen, sink ) < 0 ) errx( 1, "%s", synfrag_geterr( ctx ) );
+    synfrag_sink_close( sink );
+    gettimeofday( &end, NULL );
+
+    timersub( &end, &start, &elapsed );
+    seconds = elapsed.tv_sec + elapsed.tv_usec / 1000000.0;
+    printf( "%lu probes in %.3f seconds, %.0f probes/second.\n", count, seconds, seconds > 0 ? count / seconds : 0 );
+    printf( "%lu %s, %lu %s, %lu %s.\n",
+        results[TEST_RESULT_SUCCESS], synfrag_result_name( TEST_RESULT_SUCCESS ),
+        results[TEST_RESULT_FAILED], synfrag_result_name( TEST_RESULT_FAILED ),
+        results[TEST_RESULT_TIMEOUT], synfrag_result_name( TEST_RESULT_TIMEOUT ) );
+    synfrag_get_stats( ctx, &stats );
+    if ( stats.probes_paced || stats.rate_limited )
+        printf( "%lu probes paced, %lu timeouts look rate limited.\n", stats.probes_paced, stats.rate_limited );
+}
 
-    ethh = (struct ether_header *) malloc_check( packet_size );
-    iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
-    tcph = (struct tcphdr *) ( (char *) iph + SIZEOF_IPV4 );
+/* Fragment reassembly capacity functions. */
+
+/* What became of a probe whose last fragment was held back. */
+enum FRAG_BENCH_VERDICT {
+    /* Answered once it was whole. */
+    FRAG_BENCH_COMPLETED = 0,
+    /* Answered before it was whole: whatever was in the way let it through unassembled. */
+    FRAG_BENCH_EARLY,
+    /* Answered with an error, or a reply that fails the test. */
+    FRAG_BENCH_REJECTED,
+    /* Not answered: dropped, or its reassembly given up on. */
+    FRAG_BENCH_LOST,
+    FRAG_BENCH_VERDICT_MAX
+};
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IP );
-    build_ipv4( iph, srcip, dstip, IPPROTO_TCP );
-    build_tcp_syn( iph, tcph, SOURCE_PORT, dstport );
+/* Indexed by enum FRAG_BENCH_VERDICT. */
+static const char *frag_bench_verdict_names[] = {
+    "completed",
+    "early",
+    "rejected",
+    "lost"
+};
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+static void count_frag_bench_result( const struct synfrag_result *result, void *arg )
+{
+    unsigned long *verdicts = arg;
+
+    if ( result->result == TEST_RESULT_TIMEOUT ) {
+        verdicts[FRAG_BENCH_LOST]++;
+    } else if ( result->result != TEST_RESULT_SUCCESS ) {
+        verdicts[FRAG_BENCH_REJECTED]++;
+    } else if ( result->early ) {
+        verdicts[FRAG_BENCH_EARLY]++;
+    } else {
+        verdicts[FRAG_BENCH_COMPLETED]++;
+    }
 }
 
-void do_ipv4_short_tcp_frag( char *interface, char *srcip, char *dstip, char *dstmac, unsigned short dstport )
+/* The most common verdict, leaving out but (-1 for none). */
+static enum FRAG_BENCH_VERDICT top_verdict( const unsigned long *verdicts, int but )
 {
-    struct ip *iph;
-    struct tcphdr *tcph;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + MINIMUM_FRAGMENT_SIZE;
+    int v, top = -1;
 
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
-    tcph = (struct tcphdr *) ( (char *) iph + SIZEOF_IPV4 );
-
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IP );
-    build_ipv4_short_frag1( iph, srcip, dstip, IPPROTO_TCP, fragid );
-    build_tcp_syn( iph, tcph, SOURCE_PORT, dstport );
+    for ( v = 0; v < FRAG_BENCH_VERDICT_MAX; v++ ) {
+        if ( v == but ) continue;
+        if ( top == -1 || verdicts[v] > verdicts[top] ) top = v;
+    }
+    return top;
+}
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/*
+ * How many fragmented packets whatever is in front of dstip reassembles at
+ * once. At each rate, first fragments go out steadily while every last
+ * fragment is held back hold_msec, so about rate * hold reassemblies are
+ * open at once, and that goes on for two holds (at least a second) so the
+ * table fills and stays full. The rate doubles up to top_rate, and the
+ * capacity is where probes stop faring as they did at the lowest rate. Each
+ * rate is drained before the next starts.
+ */
+void run_frag_bench( struct synfrag_ctx *ctx, enum TEST_TYPE test_type, const char *dstip, unsigned short dstport, unsigned long top_rate, unsigned int hold_msec, long timeout )
+{
+    unsigned long rates[FRAG_BENCH_LEVELS_MAX];
+    unsigned long verdicts[FRAG_BENCH_LEVELS_MAX][FRAG_BENCH_VERDICT_MAX];
+    unsigned long rate, count, total, held, x, in_flight;
+    unsigned int levels = 0, level, flip;
+    enum FRAG_BENCH_VERDICT usual, other;
+    struct synfrag_probe probe;
+    struct synfrag_result result;
+    struct timeval start, next;
+    double seconds = hold_msec < 500 ? 1 : 2 * hold_msec / 1000.0, at;
+    int r;
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE;
+    if ( synfrag_test_baseline( test_type ) == TEST_INVALID )
+        errx( 1, "%s sends no fragments, pick a fragment test", synfrag_test_name( test_type ) );
+
+    for ( rate = top_rate; rate && levels < FRAG_BENCH_LEVELS_MAX; rate /= 2 ) levels++;
+    for ( level = levels, rate = top_rate; level; rate /= 2 ) rates[--level] = rate;
+    memset( verdicts, 0, sizeof( verdicts ) );
+
+    /* The timeout runs from the first fragment, so it has to cover the hold. */
+    if ( synfrag_set_timeout( ctx, timeout + ( hold_msec + 999 ) / 1000 ) != SYNFRAG_OK )
+        errx( 1, "%s", synfrag_geterr( ctx ) );
+    /* Room for every probe to be lost at the top rate; past that the rate slips. */
+    in_flight = top_rate * ( seconds + hold_msec / 1000.0 + timeout ) + 1;
+    if ( in_flight > FRAG_BENCH_IN_FLIGHT_MAX ) in_flight = FRAG_BENCH_IN_FLIGHT_MAX;
+    if ( synfrag_set_max_in_flight( ctx, in_flight ) != SYNFRAG_OK )
+        errx( 1, "%s", synfrag_geterr( ctx ) );
+
+    probe.test_type = test_type;
+    probe.dstip = dstip;
+    probe.dstport = dstport;
+    probe.srcport = 0;
+    probe.ttl = 0;
+    probe.hold_msec = hold_msec;
+    probe.frag_data = 0;
+    probe.frag_options = 0;
+    probe.dstmac = NULL;
+    probe.user = NULL;
+
+    printf( "%10s %10s %10s %10s %10s %10s %10s\n", "rate/s", "held", "probes",
+        frag_bench_verdict_names[FRAG_BENCH_COMPLETED], frag_bench_verdict_names[FRAG_BENCH_EARLY],
+        frag_bench_verdict_names[FRAG_BENCH_REJECTED], frag_bench_verdict_names[FRAG_BENCH_LOST] );
+    for ( level = 0; level < levels; level++ ) {
+        rate = rates[level];
+        count = rate * seconds;
+        synfrag_now( ctx, &start );
+        for ( x = 0; x < count; x++ ) {
+            /* Wait for this probe's turn, collecting results meanwhile. */
+            at = (double) x / rate;
+            next.tv_sec = start.tv_sec + (long) at;
+            next.tv_usec = start.tv_usec + (long) ( ( at - (long) at ) * 1000000 );
+            if ( next.tv_usec >= 1000000 ) {
+                next.tv_sec++;
+                next.tv_usec -= 1000000;
+            }
+            while ( ( r = synfrag_next_result_until( ctx, &result, &next ) ) == 1 )
+                count_frag_bench_result( &result, verdicts[level] );
+            if ( r < 0 ) errx( 1, "%s", synfrag_geterr( ctx ) );
 
-    build_ipv4_frag2( iph, srcip, dstip, IPPROTO_TCP, fragid, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
-    memmove( tcph, (char *) tcph + MINIMUM_FRAGMENT_SIZE, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
+            while ( ( r = synfrag_submit( ctx, &probe ) ) == SYNFRAG_ERR_BUSY ) {
+                if ( ( r = synfrag_next_result( ctx, &result, 1 ) ) < 0 ) errx( 1, "%s", synfrag_geterr( ctx ) );
+                if ( r == 1 ) count_frag_bench_result( &result, verdicts[level] );
+            }
+            if ( r != SYNFRAG_OK ) errx( 1, "%s", synfrag_geterr( ctx ) );
+        }
+        while ( ( r = synfrag_next_result( ctx, &result, 1 ) ) == 1 )
+            count_frag_bench_result( &result, verdicts[level] );
+        if ( r < 0 ) errx( 1, "%s", synfrag_geterr( ctx ) );
+
+        printf( "%10lu %10lu %10lu %10lu %10lu %10lu %10lu\n", rate, rate * hold_msec / 1000, count,
+            verdicts[level][FRAG_BENCH_COMPLETED], verdicts[level][FRAG_BENCH_EARLY],
+            verdicts[level][FRAG_BENCH_REJECTED], verdicts[level][FRAG_BENCH_LOST] );
+        fflush( stdout );
+    }
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+    usual = top_verdict( verdicts[0], -1 );
+    for ( flip = 0; flip < levels; flip++ ) {
+        for ( total = 0, x = 0; x < FRAG_BENCH_VERDICT_MAX; x++ ) total += verdicts[flip][x];
+        if ( total && verdicts[flip][usual] < total * FRAG_BENCH_HOLDS ) break;
+    }
+    printf( "\n" );
+    if ( flip == levels ) {
+        held = top_rate * hold_msec / 1000;
+        printf( "%s held at %s up to %lu/s, about %lu reassemblies open at once.\n",
+            synfrag_test_name( test_type ), frag_bench_verdict_names[usual], top_rate, held );
+        return;
+    }
+    other = top_verdict( verdicts[flip], usual );
+    printf( "%s flips from %s to %s at %lu/s, about %lu reassemblies open at once (%lu of %lu %s).\n",
+        synfrag_test_name( test_type ), frag_bench_verdict_names[usual], frag_bench_verdict_names[other],
+        rates[flip], rates[flip] * hold_msec / 1000, verdicts[flip][other], total, frag_bench_verdict_names[other] );
 }
 
-void do_ipv4_short_icmp_frag( char *interface, char *srcip, char *dstip, char *dstmac )
+/*
+ * The unfragmented test of the same family and protocol, which a fragment
+ * test is measured against: TEST_INVALID if test_type is one itself. It goes
+ * out alongside the test from its own source port, so to the target the two
+ * are separate connections and it answers both.
+ */
+static enum TEST_TYPE baseline_test( enum TEST_TYPE test_type )
 {
-    struct ip *iph;
-    struct icmp *icmph;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-    unsigned short pinglen = 40;
-
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + MINIMUM_FRAGMENT_SIZE;
-
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
-    icmph = (struct icmp *) ( (char *) iph + SIZEOF_IPV4 );
+    return synfrag_test_baseline( test_type );
+}
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IP );
-    build_ipv4_short_frag1( iph, srcip, dstip, IPPROTO_ICMP, fragid );
-    build_icmp_ping( iph, icmph, pinglen );
+/* Trace functions. */
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/* What came back for one TTL. */
+struct trace_hop {
+    enum TEST_RESULT result;
+    char replier[SYNFRAG_ADDRSTRLEN];
+    long rtt_usec;
+};
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + SIZEOF_PING + pinglen - MINIMUM_FRAGMENT_SIZE;
+static void record_trace_hop( const struct synfrag_result *result, void *arg )
+{
+    struct trace_hop *hop = result->user;
 
-    build_ipv4_frag2( iph, srcip, dstip, IPPROTO_ICMP, fragid, SIZEOF_PING + pinglen - MINIMUM_FRAGMENT_SIZE );
-    memmove( icmph, (char *) icmph + MINIMUM_FRAGMENT_SIZE, SIZEOF_PING + pinglen - MINIMUM_FRAGMENT_SIZE );
+    hop->result = result->result;
+    memcpy( hop->replier, result->replier, SYNFRAG_ADDRSTRLEN );
+    hop->rtt_usec = result->rtt_usec;
+}
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+/*
+ * Send test_type to dstip with every TTL from 1 to max_hops at once, and
+ * collect what comes back into hops, bounded by one timeout.
+ */
+static void trace_pass( struct synfrag_ctx *ctx, enum TEST_TYPE test_type, const char *dstip, unsigned short dstport, unsigned int max_hops, struct trace_hop *hops )
+{
+    struct synfrag_probe probes[TRACE_HOPS_MAX];
+    unsigned int count = 0, x;
+
+    memset( probes, 0, sizeof( probes ) );
+    for ( x = 0; x < max_hops; x++ ) {
+        probes[count].test_type = test_type;
+        probes[count].dstip = dstip;
+        probes[count].dstport = dstport;
+        probes[count].srcport = 0;
+        probes[count].ttl = x + 1;
+        probes[count].hold_msec = 0;
+        probes[count].frag_data = 0;
+        probes[count].frag_options = 0;
+        probes[count].dstmac = NULL;
+        probes[count++].user = &hops[x];
+    }
+    if ( synfrag_run( ctx, probes, count, record_trace_hop, NULL ) < 0 )
+        errx( 1, "%s", synfrag_geterr( ctx ) );
 }
 
-void do_ipv4_optioned_tcp_frag( char *interface, char *srcip, char *dstip, char *dstmac, unsigned short dstport )
+/* Whether a hop's reply came from the target rather than a router. */
+static int trace_reached( const struct trace_hop *hop )
 {
-    struct ip *iph;
-    struct tcphdr *tcph, *tcph_optioned;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-    unsigned short optlen = 40; /* Multiple of 4. */
+    return hop->result == TEST_RESULT_SUCCESS || hop->result == TEST_RESULT_FAILED;
+}
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + optlen + MINIMUM_FRAGMENT_SIZE;
+/* Pads to width, so columns line up. */
+static void print_trace_hop( const struct trace_hop *hop, int width )
+{
+    char buf[SYNFRAG_ADDRSTRLEN + 32];
 
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
-    tcph = (struct tcphdr *) ( (char *) iph + SIZEOF_IPV4 );
-    tcph_optioned = (struct tcphdr *) ( (char *) tcph + optlen );
+    if ( hop->result == TEST_RESULT_TIMEOUT ) {
+        snprintf( buf, sizeof( buf ), "*" );
+    } else {
+        snprintf( buf, sizeof( buf ), "%s  %.1f ms%s", hop->replier, hop->rtt_usec / 1000.0, hop->result == TEST_RESULT_FAILED ? " !" : "" );
+    }
+    printf( "  %-*s", width, buf );
+}
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IP );
-    build_ipv4_optioned_frag1( iph, srcip, dstip, IPPROTO_TCP, fragid, optlen );
-    build_tcp_syn( iph, tcph_optioned, SOURCE_PORT, dstport );
+/*
+ * Find where on the path to dstip the test's frames get dropped, Paris
+ * traceroute style: the test goes out with every TTL at once, and the
+ * routers' time exceeded errors come back in parallel; then the same for its
+ * unfragmented baseline. Frames of both differ only in TTL, IP id and
+ * sequence number, none of which load balancers hash on, so they all take
+ * one path. That is why the baseline gets a pass of its own, from the test's
+ * source port, rather than going out alongside from another. The first hop
+ * the baseline reaches and the test doesn't is just past whatever drops the
+ * test.
+ *
+ * Returns 0 if the test got through to dstip.
+ */
+int run_trace( struct synfrag_ctx *ctx, enum TEST_TYPE test_type, const char *dstip, unsigned short dstport, unsigned int max_hops )
+{
+    enum TEST_TYPE baseline_type = baseline_test( test_type );
+    int with_baseline = baseline_type != TEST_INVALID;
+    struct trace_hop test[TRACE_HOPS_MAX], baseline[TRACE_HOPS_MAX];
+    unsigned int hops, last_test = 0, x;
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+    trace_pass( ctx, test_type, dstip, dstport, max_hops, test );
+    if ( with_baseline ) trace_pass( ctx, baseline_type, dstip, dstport, max_hops, baseline );
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE;
+    /* TTLs past the target only reach it again. */
+    for ( hops = 1; hops < max_hops; hops++ ) {
+        if ( trace_reached( &test[hops - 1] ) || ( with_baseline && trace_reached( &baseline[hops - 1] ) ) ) break;
+    }
 
-    build_ipv4_frag2( iph, srcip, dstip, IPPROTO_TCP, fragid, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
-    memmove( tcph, (char *) tcph_optioned + MINIMUM_FRAGMENT_SIZE, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
+    printf( "hop  %-*s", with_baseline ? TRACE_COLUMN_WIDTH : 0, synfrag_test_name( test_type ) );
+    if ( with_baseline ) printf( "  %s", synfrag_test_name( baseline_type ) );
+    printf( "\n" );
+    for ( x = 0; x < hops; x++ ) {
+        printf( "%3u", x + 1 );
+        print_trace_hop( &test[x], with_baseline ? TRACE_COLUMN_WIDTH : 0 );
+        if ( with_baseline ) print_trace_hop( &baseline[x], 0 );
+        printf( "\n" );
+        if ( test[x].result != TEST_RESULT_TIMEOUT ) last_test = x + 1;
+    }
+    printf( "\n" );
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+    for ( x = 0; x < hops; x++ ) {
+        if ( !trace_reached( &test[x] ) ) continue;
+        printf( "%s reached %s at hop %u: %s.\n", synfrag_test_name( test_type ), dstip, x + 1, synfrag_result_name( test[x].result ) );
+        return test[x].result == TEST_RESULT_SUCCESS ? 0 : 1;
+    }
+    if ( !with_baseline ) {
+        printf( "%s got as far as hop %u.\n", synfrag_test_name( test_type ), last_test );
+        return 1;
+    }
+    for ( x = last_test; x < hops; x++ ) {
+        if ( baseline[x].result == TEST_RESULT_TIMEOUT ) continue;
+        if ( last_test ) {
+            printf( "%s got as far as hop %u (%s) but not hop %u (%s), which %s reached: it is dropped in between.\n",
+                synfrag_test_name( test_type ), last_test, test[last_test - 1].replier,
+                x + 1, baseline[x].replier, synfrag_test_name( baseline_type ) );
+        } else {
+            printf( "%s didn't get as far as hop 1 (%s), which %s reached: it is dropped on the way there.\n",
+                synfrag_test_name( test_type ), baseline[x].replier, synfrag_test_name( baseline_type ) );
+        }
+        return 1;
+    }
+    printf( "%s got as far as hop %u, and %s no further: no hop to blame.\n", synfrag_test_name( test_type ), last_test, synfrag_test_name( baseline_type ) );
+    return 1;
 }
 
-void do_ipv4_optioned_icmp_frag( char *interface, char *srcip, char *dstip, char *dstmac )
-{
-    struct ip *iph;
-    struct icmp *icmph, *icmph_optioned;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-    unsigned short optlen = 40; /* Multiple of 4. */
-    unsigned short pinglen = 40;
-
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + optlen + MINIMUM_FRAGMENT_SIZE;
-
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    iph = (struct ip *) ( (char *) ethh + SIZEOF_ETHER );
-    icmph = (struct icmp *) ( (char *) iph + SIZEOF_IPV4 );
-    icmph_optioned = (struct icmp *) ( (char *) icmph + optlen );
+/* Compare functions. */
+
+/* How --compare keeps its results and what it measures them against. */
+struct compare_options {
+    /* Either may be NULL. */
+    char *journal_path;
+    char *previous_path;
+    /* NULL without --results. */
+    char *results_path;
+    /* NULL without --compile. */
+    char *compile_path;
+    int resume;
+    /* Seconds a previous agreement stays good for. */
+    long fresh_for;
+    /* Percent of good agreements probed again anyway. */
+    int sample;
+};
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IP );
-    build_ipv4_optioned_frag1( iph, srcip, dstip, IPPROTO_ICMP, fragid, optlen );
-    build_icmp_ping( iph, icmph_optioned, pinglen );
+/* One target and port, probed with the test and its baseline. */
+struct compare_pair {
+    char dstip[SYNFRAG_ADDRSTRLEN];
+    unsigned short dstport;
+    enum REPLY_TYPE test;
+    enum REPLY_TYPE baseline;
+    /* -1 for no reply, or for a pair that wasn't probed. */
+    long test_rtt_usec;
+    long baseline_rtt_usec;
+    /* When both replies were in. */
+    time_t verified;
+    /* Replies in so far; 2 if a journal already had both. */
+    int replies;
+    /* Index of its journal record, -1 without a journal. */
+    long record;
+    /* Its record's state in the previous run's journal, 0 if it wasn't there. */
+    unsigned char previous;
+    /* Either side timed out in a way that looks like an ICMP rate limit. */
+    int rate_limited;
+    /* Which of the run's links it goes out of, and to which next hop ("" for the link's own). */
+    unsigned int link;
+    char dstmac[MAC_STRLEN];
+};
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/* Divergence counts, by verdict, and where the replies came from. */
+struct compare_totals {
+    unsigned long pairs;
+    unsigned long verdicts[VERDICT_MAX];
+    unsigned long resumed;
+    /* With a previous run: why pairs were probed, or that they weren't. */
+    unsigned long added;
+    unsigned long diverged;
+    unsigned long stale;
+    unsigned long sampled;
+    unsigned long carried;
+    unsigned long changed;
+    /* Pairs with a side that looks lost to an ICMP rate limit. */
+    unsigned long rate_limited;
+};
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV4 + SIZEOF_PING + pinglen;
+struct compare_run {
+    enum TEST_TYPE test_type;
+    struct links *links;
+    struct compare_pair *pairs;
+    struct synfrag_probe *probes;
+    struct compare_totals totals;
+    /* NULL without --journal. */
+    struct journal *journal;
+    /* NULL without --previous. */
+    struct journal *previous;
+    /* NULL without --results. */
+    struct results *results;
+};
 
-    build_ipv4_frag2( iph, srcip, dstip, IPPROTO_ICMP, fragid, SIZEOF_PING - MINIMUM_FRAGMENT_SIZE + pinglen );
-    memmove( icmph, (char *) icmph_optioned + MINIMUM_FRAGMENT_SIZE, SIZEOF_PING + pinglen - MINIMUM_FRAGMENT_SIZE );
+static void record_compare_result( const struct synfrag_result *result, void *arg )
+{
+    struct compare_pair *pair = result->user;
+    struct compare_run *run = arg;
+    struct journal_record *record;
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+    if ( result->test_type == run->test_type ) {
+        pair->test = result->reply_type;
+        pair->test_rtt_usec = result->rtt_usec;
+    } else {
+        pair->baseline = result->reply_type;
+        pair->baseline_rtt_usec = result->rtt_usec;
+    }
+    if ( result->rate_limited ) pair->rate_limited = 1;
+    if ( ++pair->replies < 2 ) return;
+    pair->verified = time( NULL );
+    if ( pair->record != -1 ) {
+        record = &run->journal->records[pair->record];
+        record->verified = pair->verified;
+        record->state = JOURNAL_DONE | pair->baseline << 3 | pair->test;
+    }
 }
 
-/* IPv6 tests. */
-void do_ipv6_syn( char *interface, char *srcip, char *dstip, char *dstmac, unsigned short dstport )
+/* What a pair is known by in a journal: 64 bit FNV-1a of its address and port. */
+static uint64_t compare_pair_key( const char *dstip, unsigned short dstport )
 {
-    struct ip6_hdr *ip6h;
-    struct tcphdr *tcph;
-    struct ether_header *ethh;
-    int packet_size;
-
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + SIZEOF_TCP;
+    uint64_t h = 14695981039346656037ULL;
 
-    ethh = (struct ether_header *) malloc_check( packet_size );
-    ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
-    tcph = (struct tcphdr *) ( (char *) ip6h + SIZEOF_IPV6 );
-
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IPV6 );
-    build_ipv6( ip6h, srcip, dstip, IPPROTO_TCP, SIZEOF_TCP );
-    build_tcp_syn( ip6h, tcph, SOURCE_PORT, dstport );
+    while ( *dstip ) h = ( h ^ (unsigned char) *dstip++ ) * 1099511628211ULL;
+    h = ( h ^ ( dstport >> 8 ) ) * 1099511628211ULL;
+    return ( h ^ ( dstport & 0xff ) ) * 1099511628211ULL;
+}
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+/* Whether the probe got to the target and was answered by it. */
+static int compare_reached( enum REPLY_TYPE reply_type )
+{
+    return reply_type == REPLY_TYPE_OPEN || reply_type == REPLY_TYPE_CLOSED;
 }
 
-void do_ipv6_short_tcp_frag( char *interface, char *srcip, char *dstip, char *dstmac, unsigned short dstport )
+static const char *compare_label( enum REPLY_TYPE reply_type )
 {
-    struct ip6_hdr *ip6h;
-    struct tcphdr *tcph;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
+    return reply_type == REPLY_TYPE_NONE ? "timeout" : synfrag_reply_type_name( reply_type );
+}
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + MINIMUM_FRAGMENT_SIZE;
+/*
+ * acl-bypass if the test was accepted, or reached the target when the
+ * baseline didn't; fragments-dropped if the baseline reached the target and
+ * the test got a worse answer or none; and mismatch for anything else.
+ */
+static enum COMPARE_VERDICT compare_verdict( enum REPLY_TYPE test, enum REPLY_TYPE baseline )
+{
+    if ( test == baseline ) return VERDICT_AGREE;
+    if ( test == REPLY_TYPE_OPEN || ( compare_reached( test ) && !compare_reached( baseline ) ) ) return VERDICT_ACL_BYPASS;
+    if ( compare_reached( baseline ) ) return VERDICT_FRAGMENTS_DROPPED;
+    return VERDICT_MISMATCH;
+}
 
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
-    tcph = (struct tcphdr *) ( (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_frag ) );
+static enum COMPARE_VERDICT journal_verdict( unsigned char state )
+{
+    return compare_verdict( state & 7, state >> 3 & 7 );
+}
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IPV6 );
-    build_ipv6_short_frag1( ip6h, srcip, dstip, IPPROTO_TCP, fragid );
-    build_tcp_syn( ip6h, tcph, SOURCE_PORT, dstport );
+/*
+ * Whether a pair the previous run found in agreement, and verified less than
+ * fresh_for seconds ago, can keep that result instead of being probed. Only
+ * sample percent of them are probed again; everything else always is, and is
+ * counted by why.
+ */
+static int compare_carry_over( struct compare_run *run, const struct journal_record *previous, const struct compare_options *options, time_t now )
+{
+    if ( !previous || !( previous->state & JOURNAL_DONE ) ) {
+        run->totals.added++;
+    } else if ( journal_verdict( previous->state ) != VERDICT_AGREE ) {
+        run->totals.diverged++;
+    } else if ( now - (time_t) previous->verified >= options->fresh_for ) {
+        run->totals.stale++;
+    } else if ( rand() % 100 < options->sample ) {
+        run->totals.sampled++;
+    } else {
+        run->totals.carried++;
+        return 1;
+    }
+    return 0;
+}
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/* Add a finished pair to the results file, or exit. */
+static void compare_write_result( struct compare_run *run, const struct compare_pair *pair, enum COMPARE_VERDICT verdict )
+{
+    struct results_row row;
+
+    results_pton( pair->dstip, row.addr );
+    row.port = pair->dstport;
+    row.test_type = run->test_type;
+    row.verdict = verdict;
+    row.reply = pair->test;
+    row.baseline_reply = pair->baseline;
+    row.rtt_usec = pair->test_rtt_usec;
+    row.baseline_rtt_usec = pair->baseline_rtt_usec;
+    row.time = pair->verified;
+    if ( results_add( run->results, &row ) == -1 ) err( 1, "Unable to write the results" );
+}
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE;
+/* One link's share of a chunk, run on a thread of its own. */
+struct link_job {
+    struct synfrag_ctx *ctx;
+    struct synfrag_probe *probes;
+    unsigned int count;
+    synfrag_result_cb cb;
+    void *arg;
+    pthread_t thread;
+    int r;
+};
 
-    build_ipv6_frag2( ip6h, srcip, dstip, IPPROTO_TCP, fragid, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
-    memmove( tcph, (char *) tcph + MINIMUM_FRAGMENT_SIZE, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
+static void *run_link_job( void *arg )
+{
+    struct link_job *job = arg;
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+    job->r = synfrag_run( job->ctx, job->probes, job->count, job->cb, job->arg );
+    return NULL;
 }
 
-void do_ipv6_short_icmp_frag( char *interface, char *srcip, char *dstip, char *dstmac )
+/* Run every link's job, on a thread each if more than one has any, or exit. */
+static void run_link_jobs( struct links *links, struct link_job *jobs )
 {
-    struct ip6_hdr *ip6h;
-    struct icmp6_hdr *icmp6h;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-    unsigned short pinglen = 40;
+    unsigned int x, busy = 0;
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + MINIMUM_FRAGMENT_SIZE;
+    for ( x = 0; x < links->count; x++ ) {
+        if ( jobs[x].count ) busy++;
+    }
+    for ( x = 0; x < links->count; x++ ) {
+        if ( !jobs[x].count ) continue;
+        if ( busy == 1 ) {
+            run_link_job( &jobs[x] );
+        } else if ( pthread_create( &jobs[x].thread, NULL, run_link_job, &jobs[x] ) != 0 ) {
+            errx( 1, "Unable to start a thread for interface \"%s\"", links->link[x].interface );
+        }
+    }
+    for ( x = 0; x < links->count; x++ ) {
+        if ( !jobs[x].count ) continue;
+        if ( busy > 1 ) pthread_join( jobs[x].thread, NULL );
+        if ( jobs[x].r < 0 ) errx( 1, "%s", synfrag_geterr( jobs[x].ctx ) );
+    }
+}
 
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
-    icmp6h = (struct icmp6_hdr *) ( (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_frag ) );
+/*
+ * Send the test and its baseline to every pair not already finished, all at
+ * once and back to back so both see the network in the same state, then
+ * print the pairs whose replies differ (see compare_verdict()), in the order
+ * they were read. Against a previous run, print instead the pairs whose
+ * verdict changed, leaving out new ones that agree. Every pair goes in the
+ * results file, if there is one. Pairs going out of different links are sent
+ * by a thread per link, at the same time.
+ */
+static void compare_chunk( struct compare_run *run, unsigned int count )
+{
+    enum TEST_TYPE test_type = run->test_type;
+    enum TEST_TYPE baseline_type = baseline_test( test_type );
+    struct compare_pair *pairs = run->pairs;
+    struct synfrag_probe *probes = run->probes;
+    struct compare_totals *totals = &run->totals;
+    struct links *links = run->links;
+    struct link_job jobs[LINKS_MAX];
+    enum COMPARE_VERDICT verdict;
+    unsigned int offsets[LINKS_MAX];
+    unsigned int x, y;
+
+    /* Each link's probes go together, in the order the pairs were read. */
+    memset( jobs, 0, sizeof( jobs ) );
+    for ( x = 0; x < count; x++ ) {
+        if ( pairs[x].replies != 2 ) jobs[pairs[x].link].count += 2;
+    }
+    for ( x = 0, y = 0; x < links->count; x++ ) {
+        offsets[x] = y;
+        jobs[x].ctx = links->link[x].ctx;
+        jobs[x].probes = &probes[y];
+        jobs[x].cb = record_compare_result;
+        jobs[x].arg = run;
+        y += jobs[x].count;
+    }
+    for ( x = 0; x < count; x++ ) {
+        if ( pairs[x].replies == 2 ) continue;
+        y = offsets[pairs[x].link];
+        offsets[pairs[x].link] += 2;
+        probes[y].test_type = test_type;
+        probes[y].dstip = pairs[x].dstip;
+        probes[y].dstport = pairs[x].dstport;
+        probes[y].srcport = 0;
+        probes[y].ttl = 0;
+        probes[y].hold_msec = 0;
+        probes[y].frag_data = 0;
+        probes[y].frag_options = 0;
+        probes[y].dstmac = pairs[x].dstmac[0] ? pairs[x].dstmac : NULL;
+        probes[y].user = &pairs[x];
+        probes[y + 1] = probes[y];
+        probes[y + 1].test_type = baseline_type;
+        probes[y + 1].srcport = BASELINE_SOURCE_PORT;
+    }
+    run_link_jobs( links, jobs );
+    if ( run->journal ) journal_sync( run->journal );
+
+    for ( x = 0; x < count; x++ ) {
+        totals->pairs++;
+        if ( pairs[x].rate_limited ) totals->rate_limited++;
+        verdict = compare_verdict( pairs[x].test, pairs[x].baseline );
+        totals->verdicts[verdict]++;
+        if ( run->results ) compare_write_result( run, &pairs[x], verdict );
+        if ( run->previous ) {
+            if ( pairs[x].previous & JOURNAL_DONE ) {
+                if ( verdict == journal_verdict( pairs[x].previous ) ) continue;
+            } else if ( verdict == VERDICT_AGREE ) {
+                continue;
+            }
+            totals->changed++;
+        } else if ( verdict == VERDICT_AGREE ) {
+            continue;
+        }
+        if ( synfrag_test_is_tcp( test_type ) ) {
+            printf( "%s %u", pairs[x].dstip, pairs[x].dstport );
+        } else {
+            printf( "%s -", pairs[x].dstip );
+        }
+        printf( " %s=%s %s=%s %s",
+            synfrag_test_name( test_type ), compare_label( pairs[x].test ),
+            synfrag_test_name( baseline_type ), compare_label( pairs[x].baseline ),
+            results_verdict_names[verdict] );
+        if ( pairs[x].rate_limited ) printf( " rate-limited" );
+        if ( run->previous ) {
+            printf( " (was %s)", pairs[x].previous & JOURNAL_DONE ? results_verdict_names[journal_verdict( pairs[x].previous )] : "new" );
+        }
+        printf( "\n" );
+    }
+    fflush( stdout );
+}
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IPV6 );
-    build_ipv6_short_frag1( ip6h, srcip, dstip, IPPROTO_ICMPV6, fragid );
-    build_icmp6_ping( ip6h, icmp6h, pinglen );
+/* Open path as a journal of test_type and dstport, or exit. */
+static void compare_open_journal( struct journal *journal, const char *path, enum TEST_TYPE test_type, unsigned short dstport )
+{
+    if ( journal_open( journal, path ) == -1 ) {
+        if ( errno == EINVAL ) errx( 1, "%s is not a journal", path );
+        err( 1, "Unable to open %s", path );
+    }
+    if ( journal->header->test_type != test_type || journal->header->dstport != dstport )
+        errx( 1, "%s is a journal of %s with dstport %u", path,
+            synfrag_test_name( journal->header->test_type ), journal->header->dstport );
+}
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/*
+ * Run the test and its unfragmented baseline against every target listed in
+ * path ("-" for stdin) in one pass, and report only where they disagree. A
+ * line is "<dstip> [dstport ...]", one pair per port (dstport if none are
+ * given, none at all for ICMP tests); blank lines and ones starting with #
+ * are skipped. path can also be a list run_compile() wrote. With a
+ * journal, progress is kept there; resuming, pairs the journal has finished
+ * are reported from it instead of probed again. Given the journal of a
+ * previous run, pairs it found in agreement recently enough are mostly taken
+ * from it, and only changes are reported. With routes to look up, each
+ * target goes out of the link its route takes, and targets without one are
+ * skipped with a warning. Returns 0 if every pair agreed (or, against a
+ * previous run, nothing changed).
+ */
+int run_compare( struct links *links, enum TEST_TYPE test_type, const char *path, unsigned short dstport, const struct compare_options *options )
+{
+    struct compare_run run;
+    struct compare_pair *pair;
+    struct journal journal, previous;
+    struct results results;
+    struct journal_record *record, *previous_record;
+    struct targets targets;
+    struct routed_targets *routed;
+    struct target target;
+    char dstmac[MAC_STRLEN] = "";
+    unsigned int count = 0, x;
+    int link = 0, r;
+    unsigned long journaled = 0, index = 0;
+    uint64_t key;
+    long found;
+    time_t now = time( NULL );
+    int family = synfrag_test_family( test_type );
+    int tcp = synfrag_test_is_tcp( test_type );
+
+    memset( &run, 0, sizeof( struct compare_run ) );
+    run.test_type = test_type;
+    run.links = links;
+    if ( options->journal_path && options->resume ) {
+        compare_open_journal( &journal, options->journal_path, test_type, dstport );
+        journaled = journal.header->count;
+        run.journal = &journal;
+    } else if ( options->journal_path ) {
+        if ( journal_create( &journal, options->journal_path, test_type, dstport ) == -1 ) {
+            if ( errno == EEXIST ) errx( 1, "%s exists and is not a journal, not overwriting it", options->journal_path );
+            err( 1, "Unable to create %s", options->journal_path );
+        }
+        run.journal = &journal;
+    }
+    if ( options->previous_path ) {
+        compare_open_journal( &previous, options->previous_path, test_type, dstport );
+        if ( journal_index( &previous ) == -1 ) err( 1, "Unable to index %s", options->previous_path );
+        run.previous = &previous;
+        srand( getpid() ^ now );
+    }
+    if ( options->results_path ) {
+        if ( results_create( &results, options->results_path ) == -1 ) {
+            if ( errno == EEXIST ) errx( 1, "%s exists and is not a results file, not overwriting it", options->results_path );
+            err( 1, "Unable to create %s", options->results_path );
+        }
+        run.results = &results;
+    }
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + SIZEOF_PING + pinglen - MINIMUM_FRAGMENT_SIZE;
+    if ( targets_open( &targets, path ) == -1 ) {
+        if ( errno == EINVAL ) errx( 1, "%s is cut short, compile it again", path );
+        err( 1, "Unable to open %s", path );
+    }
+    run.pairs = malloc( sizeof( struct compare_pair ) * COMPARE_CHUNK );
+    run.probes = malloc( sizeof( struct synfrag_probe ) * COMPARE_CHUNK * 2 );
+    if ( !run.pairs || !run.probes ) err( 1, "malloc" );
+
+    routed = routed_targets_open( &targets, links, family );
+    while ( ( r = routed_targets_next( routed, &target, &link, dstmac ) ) == 1 ) {
+        if ( target.family != family ) errx( 1, "%s line %lu: invalid dstip for this test: %s", path, target.line, target.dstip );
+        if ( link == -1 ) {
+            warn( "%s line %lu: no way to %s", path, target.line, target.dstip );
+            continue;
+        }
 
-    build_ipv6_frag2( ip6h, srcip, dstip, IPPROTO_ICMPV6, fragid, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
-    memmove( icmp6h, (char *) icmp6h + MINIMUM_FRAGMENT_SIZE, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
+        /* ICMP tests have no dstport, whatever the line says. */
+        if ( !tcp ) target.port_count = 0;
+        if ( tcp && !target.port_count && !dstport ) errx( 1, "%s line %lu: missing dstport", path, target.line );
+        x = 0;
+        do {
+            if ( count == COMPARE_CHUNK ) {
+                compare_chunk( &run, count );
+                count = 0;
+            }
+            pair = &run.pairs[count++];
+            memcpy( pair->dstip, target.dstip, SYNFRAG_ADDRSTRLEN );
+            pair->dstport = target.port_count ? target.ports[x] : dstport;
+            pair->replies = 0;
+            pair->test_rtt_usec = -1;
+            pair->baseline_rtt_usec = -1;
+            pair->verified = 0;
+            pair->record = -1;
+            pair->previous = 0;
+            pair->rate_limited = 0;
+            pair->link = link;
+            snprintf( pair->dstmac, MAC_STRLEN, "%s", dstmac );
+            key = compare_pair_key( pair->dstip, pair->dstport );
+
+            record = NULL;
+            if ( index < journaled ) {
+                record = &journal.records[index];
+                if ( record->key != key )
+                    errx( 1, "%s line %lu: not the target list %s was written for", path, target.line, options->journal_path );
+                if ( record->state & JOURNAL_DONE ) {
+                    pair->test = record->state & 7;
+                    pair->baseline = record->state >> 3 & 7;
+                    pair->verified = record->verified;
+                    pair->replies = 2;
+                    run.totals.resumed++;
+                }
+                pair->record = index++;
+            } else if ( run.journal ) {
+                if ( ( pair->record = journal_append( &journal, key ) ) == -1 )
+                    err( 1, "Unable to grow %s", options->journal_path );
+                record = &journal.records[pair->record];
+                index++;
+            }
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+            if ( run.previous ) {
+                found = journal_find( &previous, key );
+                previous_record = found == -1 ? NULL : &previous.records[found];
+                if ( previous_record ) pair->previous = previous_record->state;
+                if ( pair->replies != 2 && compare_carry_over( &run, previous_record, options, now ) ) {
+                    pair->test = previous_record->state & 7;
+                    pair->baseline = previous_record->state >> 3 & 7;
+                    pair->verified = previous_record->verified;
+                    pair->replies = 2;
+                    if ( record ) {
+                        record->verified = previous_record->verified;
+                        record->state = previous_record->state;
+                    }
+                }
+            }
+        } while ( ++x < target.port_count );
+    }
+    if ( r == -1 && errno == EINVAL ) errx( 1, "%s line %lu: invalid dstport", path, target.line );
+    if ( r == -1 && errno == E2BIG ) errx( 1, "%s line %lu: more than %u dstports", path, target.line, TARGETS_PORTS_MAX );
+    if ( r == -1 ) err( 1, "Unable to read %s", path );
+    if ( index < journaled ) errx( 1, "%s has fewer pairs than %s", path, options->journal_path );
+    if ( count ) compare_chunk( &run, count );
+    targets_close( &targets );
+    free( routed );
+    if ( run.journal ) journal_close( run.journal );
+    if ( run.previous ) journal_close( run.previous );
+    if ( run.results && results_close( run.results ) == -1 ) err( 1, "Unable to write %s", options->results_path );
+    free( run.pairs );
+    free( run.probes );
+
+    if ( run.totals.resumed ) printf( "%lu pairs taken from %s.\n", run.totals.resumed, options->journal_path );
+    printf( "%lu pairs compared, %lu differ: %lu fragments-dropped, %lu acl-bypass, %lu mismatch.\n",
+        run.totals.pairs, run.totals.pairs - run.totals.verdicts[VERDICT_AGREE],
+        run.totals.verdicts[VERDICT_FRAGMENTS_DROPPED], run.totals.verdicts[VERDICT_ACL_BYPASS],
+        run.totals.verdicts[VERDICT_MISMATCH] );
+    if ( run.totals.rate_limited )
+        printf( "%lu pairs look rate limited; run them again with --icmp-pace, or a slower one.\n", run.totals.rate_limited );
+    if ( run.previous ) {
+        printf( "%lu probed (%lu new, %lu diverged before, %lu stale, %lu sampled), %lu carried over; %lu changed since %s.\n",
+            run.totals.added + run.totals.diverged + run.totals.stale + run.totals.sampled,
+            run.totals.added, run.totals.diverged, run.totals.stale, run.totals.sampled,
+            run.totals.carried, run.totals.changed, options->previous_path );
+        return run.totals.changed ? 1 : 0;
+    }
+    return run.totals.pairs - run.totals.verdicts[VERDICT_AGREE] ? 1 : 0;
 }
 
-void do_ipv6_optioned_icmp_frag( char *interface, char *srcip, char *dstip, char *dstmac )
+/*
+ * Write the target list at path to out_path as a compiled one, checking
+ * every target against the test as run_compare() would, so that later runs
+ * against it have nothing to parse. Returns 0.
+ */
+int run_compile( enum TEST_TYPE test_type, const char *path, const char *out_path )
 {
-    struct ip6_hdr *ip6h;
-    struct icmp6_hdr *icmp6h, *icmp6h_optioned;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-    unsigned short optlen = fix_up_destination_options_length(
-         MINIMUM_PACKET_SIZE - SIZEOF_IPV6 - sizeof( struct ip6_dest ) - sizeof( struct ip6_frag ) - MINIMUM_FRAGMENT_SIZE
-    );
-    /*
-     * pinglen must be > 6 or our first packet will be <= MINIMUM_PACKET_SIZE bytes and
-     * our second packet empty. 
-     */
-    unsigned short pinglen = 40;
-
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_dest ) + optlen + sizeof( struct ip6_frag ) + MINIMUM_FRAGMENT_SIZE;
+    struct targets targets, out;
+    struct target target;
+    unsigned long count;
+    int family = synfrag_test_family( test_type );
+    int r;
 
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
-    icmp6h = (struct icmp6_hdr *) ( (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_frag ) );
-    icmp6h_optioned = (struct icmp6_hdr *) ( (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_dest ) + optlen + sizeof( struct ip6_frag ) );
+    if ( targets_open( &targets, path ) == -1 ) {
+        if ( errno == EINVAL ) errx( 1, "%s is cut short, compile it again", path );
+        err( 1, "Unable to open %s", path );
+    }
+    if ( targets_create( &out, out_path ) == -1 ) {
+        if ( errno == EEXIST ) errx( 1, "%s exists and is not a compiled target list, not overwriting it", out_path );
+        err( 1, "Unable to create %s", out_path );
+    }
+    while ( ( r = targets_next( &targets, &target ) ) == 1 ) {
+        if ( target.family != family ) errx( 1, "%s line %lu: invalid dstip for this test: %s", path, target.line, target.dstip );
+        if ( !synfrag_test_is_tcp( test_type ) ) target.port_count = 0;
+        if ( targets_add( &out, &target ) == -1 ) err( 1, "Unable to write %s", out_path );
+    }
+    if ( r == -1 && errno == EINVAL ) errx( 1, "%s line %lu: invalid dstport", path, target.line );
+    if ( r == -1 && errno == E2BIG ) errx( 1, "%s line %lu: more than %u dstports", path, target.line, TARGETS_PORTS_MAX );
+    if ( r == -1 ) err( 1, "Unable to read %s", path );
+    targets_close( &targets );
+    count = out.count;
+    if ( targets_close( &out ) == -1 ) err( 1, "Unable to write %s", out_path );
+
+    printf( "%lu pairs compiled to %s.\n", count, out_path );
+    return 0;
+}
 
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IPV6 );
-    build_ipv6_optioned_frag1( ip6h, srcip, dstip, IPPROTO_ICMPV6, fragid, optlen );
-    build_icmp6_ping( ip6h, icmp6h_optioned, pinglen );
+/* Fragment search functions. */
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/* A first fragment the search can send: its shape, and how long that makes it. */
+struct frag_shape {
+    unsigned short data;
+    unsigned short options;
+    int size;
+};
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + SIZEOF_PING + pinglen - MINIMUM_FRAGMENT_SIZE;
+/* One target's search along one dimension. */
+struct frag_search_side {
+    /* shapes[lo] didn't get through and shapes[hi] did; -1 and the shape count to start with. */
+    int lo;
+    int hi;
+    int mid;
+    enum REPLY_TYPE reply;
+};
 
-    build_ipv6_frag2( ip6h, srcip, dstip, IPPROTO_ICMPV6, fragid, SIZEOF_ICMP6 + pinglen - MINIMUM_FRAGMENT_SIZE );
-    memmove( icmp6h, (char *) icmp6h_optioned + MINIMUM_FRAGMENT_SIZE, SIZEOF_ICMP6 + pinglen - MINIMUM_FRAGMENT_SIZE );
+/* One target and port, searched along both dimensions at once. */
+struct frag_search_target {
+    char dstip[SYNFRAG_ADDRSTRLEN];
+    unsigned short dstport;
+    struct frag_search_side sides[FRAG_SEARCH_DIMENSIONS];
+    /* Only probed if no shape got through. */
+    enum REPLY_TYPE baseline;
+    unsigned int link;
+    char dstmac[MAC_STRLEN];
+};
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
-}
+struct frag_search_run {
+    enum TEST_TYPE test_type;
+    struct links *links;
+    struct frag_search_target *targets;
+    struct synfrag_probe *probes;
+    /* Each dimension's shapes, smallest first. */
+    struct frag_shape shapes[FRAG_SEARCH_DIMENSIONS][FRAG_SEARCH_OPTIONS_MAX + 1];
+    int shape_count[FRAG_SEARCH_DIMENSIONS];
+    unsigned long rounds;
+    unsigned long searched;
+    unsigned long found;
+    unsigned long none;
+    unsigned long unreachable;
+};
 
-void do_ipv6_optioned_tcp_frag( char *interface, char *srcip, char *dstip, char *dstmac, unsigned short dstport )
+static void record_frag_search_reply( const struct synfrag_result *result, void *arg )
 {
-    struct ip6_hdr *ip6h;
-    struct tcphdr *tcph, *tcph_optioned;
-    struct ether_header *ethh;
-    int packet_size;
-    unsigned short fragid = rand();
-    unsigned short optlen = fix_up_destination_options_length(
-        MINIMUM_PACKET_SIZE - SIZEOF_IPV6 - sizeof( struct ip6_dest ) - sizeof( struct ip6_frag ) - MINIMUM_FRAGMENT_SIZE
-    );
-
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_dest ) + optlen + sizeof( struct ip6_frag ) + MINIMUM_FRAGMENT_SIZE;
+    enum REPLY_TYPE *reply = result->user;
 
-    ethh = (struct ether_header *) malloc_check( BIG_PACKET_SIZE );
-    ip6h = (struct ip6_hdr *) ( (char *) ethh + SIZEOF_ETHER );
-    tcph = (struct tcphdr *) ( (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_frag ) );
-    tcph_optioned = (struct tcphdr *) ( (char *) ip6h + SIZEOF_IPV6 + sizeof( struct ip6_dest ) + optlen + sizeof( struct ip6_frag ) );
-
-    build_ethernet( ethh, interface, dstmac, ETHERTYPE_IPV6 );
-    build_ipv6_optioned_frag1( ip6h, srcip, dstip, IPPROTO_TCP, fragid, optlen );
-    build_tcp_syn( ip6h, tcph_optioned, SOURCE_PORT, dstport );
+    *reply = result->reply_type;
+}
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
+/*
+ * Every shape the test's first fragment takes along one dimension, smallest
+ * first: carrying 8, 16 and on bytes of the layer 4 header behind the test's
+ * own options, or its own 8 behind more and more options, leaving out those
+ * no longer than one before them. Returns how many there are.
+ */
+static int frag_search_shapes( enum TEST_TYPE test_type, int dimension, struct frag_shape *shapes )
+{
+    unsigned short data, options;
+    int count = 0, size, last = 0;
+
+    if ( dimension == FRAG_SEARCH_DATA ) {
+        for ( data = 8; ( size = synfrag_first_fragment_size( test_type, data, 0 ) ) != -1; data += 8 ) {
+            shapes[count].data = data;
+            shapes[count].options = 0;
+            shapes[count++].size = size;
+        }
+        return count;
+    }
+    for ( options = 0; options <= FRAG_SEARCH_OPTIONS_MAX; options++ ) {
+        if ( ( size = synfrag_first_fragment_size( test_type, 0, options ) ) <= last ) continue;
+        shapes[count].data = 0;
+        shapes[count].options = options;
+        shapes[count++].size = last = size;
+    }
+    return count;
+}
 
-    packet_size = SIZEOF_ETHER + SIZEOF_IPV6 + sizeof( struct ip6_frag ) + SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE;
+/* Whether a search has more than one shape left to narrow down. */
+static int frag_search_open( const struct frag_search_side *side )
+{
+    return side->hi - side->lo > 1;
+}
 
-    build_ipv6_frag2( ip6h, srcip, dstip, IPPROTO_TCP, fragid, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
-    memmove( tcph, (char *) tcph_optioned + MINIMUM_FRAGMENT_SIZE, SIZEOF_TCP - MINIMUM_FRAGMENT_SIZE );
+/* Whether every shape the target was sent, along both dimensions, was lost. */
+static int frag_search_missed( const struct frag_search_run *run, const struct frag_search_target *target )
+{
+    int d;
 
-    if ( pcap_inject( pcap, ethh, packet_size ) != packet_size ) errx( 1, "pcap_inject" );
-    free( ethh );
+    for ( d = 0; d < FRAG_SEARCH_DIMENSIONS; d++ ) {
+        if ( target->sides[d].hi < run->shape_count[d] ) return 0;
+    }
+    return 1;
 }
 
-/* Process functions. */
-void fork_pcap_listener( char *dstip, char *srcip, unsigned short dstport, unsigned short srcport, enum TEST_TYPE test_type, long receive_timeout )
+/*
+ * Probe every target in the chunk with the middle shape of what is left of
+ * each of its searches, one probe per dimension from a source port each, and
+ * halve the searches by whether the target answered, until every one is down
+ * to a single shape or none. Targets nothing got through to then get the
+ * baseline, to tell the ones that can't be reached at all, and every target
+ * is printed.
+ */
+static void frag_search_chunk( struct frag_search_run *run, unsigned int count )
 {
-    char *packet_buf;
-    char buf;
-    int r;
-
-    if ( pipe(pfd) == -1 ) err( 1, "Failed to creatre pipe." );
+    enum TEST_TYPE baseline_type = baseline_test( run->test_type );
+    struct frag_search_target *target;
+    struct frag_search_side *side;
+    struct synfrag_probe *probe;
+    struct links *links = run->links;
+    struct link_job jobs[LINKS_MAX];
+    unsigned int offsets[LINKS_MAX];
+    const struct frag_shape *shape;
+    unsigned int x, y, open;
+    int d, baseline_round = 0;
 
-    listener_pid = fork();
-    if ( listener_pid == -1 ) err( 1, "Failed to fork" );
-    if ( listener_pid )  {
-        close( pfd[1] );
-        read( pfd[0], &buf, 1 );
-        return;
+    while ( 1 ) {
+        /* Each link's probes go together, in the order the targets were read. */
+        memset( jobs, 0, sizeof( jobs ) );
+        for ( x = 0; x < count; x++ ) {
+            target = &run->targets[x];
+            if ( baseline_round ) {
+                jobs[target->link].count += frag_search_missed( run, target );
+                continue;
+            }
+            for ( d = 0; d < FRAG_SEARCH_DIMENSIONS; d++ ) jobs[target->link].count += frag_search_open( &target->sides[d] );
+        }
+        for ( x = 0, y = 0; x < links->count; x++ ) {
+            offsets[x] = y;
+            jobs[x].ctx = links->link[x].ctx;
+            jobs[x].probes = &run->probes[y];
+            jobs[x].cb = record_frag_search_reply;
+            jobs[x].arg = NULL;
+            y += jobs[x].count;
+        }
+        if ( !y ) break;
+
+        for ( x = 0; x < count; x++ ) {
+            target = &run->targets[x];
+            for ( d = 0; d < FRAG_SEARCH_DIMENSIONS; d++ ) {
+                side = &target->sides[d];
+                if ( baseline_round ? d || !frag_search_missed( run, target ) : !frag_search_open( side ) ) continue;
+                probe = &run->probes[offsets[target->link]++];
+                probe->dstip = target->dstip;
+                probe->dstport = target->dstport;
+                probe->ttl = 0;
+                probe->hold_msec = 0;
+                probe->dstmac = target->dstmac[0] ? target->dstmac : NULL;
+                if ( baseline_round ) {
+                    target->baseline = REPLY_TYPE_NONE;
+                    probe->test_type = baseline_type;
+                    probe->srcport = 0;
+                    probe->frag_data = 0;
+                    probe->frag_options = 0;
+                    probe->user = &target->baseline;
+                    continue;
+                }
+                side->mid = ( side->lo + side->hi ) / 2;
+                side->reply = REPLY_TYPE_NONE;
+                shape = &run->shapes[d][side->mid];
+                probe->test_type = run->test_type;
+                probe->srcport = d == FRAG_SEARCH_DATA ? 0 : BASELINE_SOURCE_PORT;
+                probe->frag_data = shape->data;
+                probe->frag_options = shape->options;
+                probe->user = &side->reply;
+            }
+        }
+        run_link_jobs( links, jobs );
+        run->rounds++;
+        if ( baseline_round ) break;
+
+        open = 0;
+        for ( x = 0; x < count; x++ ) {
+            for ( d = 0; d < FRAG_SEARCH_DIMENSIONS; d++ ) {
+                side = &run->targets[x].sides[d];
+                if ( !frag_search_open( side ) ) continue;
+                if ( compare_reached( side->reply ) ) {
+                    side->hi = side->mid;
+                } else {
+                    side->lo = side->mid;
+                }
+                open += frag_search_open( side );
+            }
+        }
+        if ( !open ) baseline_round = 1;
     }
-    close( pfd[0] );
-    /*
-     * Due to how pcap works there's still a race between we signal that we are
-     * ready and when we actually call select(). Will this even help with our
-     * race condition if write() doesn't block? The documentation seems unclear
-     * as to the advantages of O_NONBLOCK with a 1 byte write.
-     */
-    fcntl( pfd[1], F_SETFL, O_NONBLOCK );
 
-    pcap_setdirection( pcap, PCAP_D_IN );
-
-    r = receive_a_packet( dstip, srcip, dstport, SOURCE_PORT, test_type, &packet_buf, receive_timeout );
-    if ( r ) {
-        write( pfd[1], &r, sizeof( int ) );
-        write( pfd[1], packet_buf, r );
-    } else {
-        r = 0;
-        write( pfd[1], &r, sizeof( int ) );
+    for ( x = 0; x < count; x++ ) {
+        target = &run->targets[x];
+        run->searched++;
+        if ( synfrag_test_is_tcp( run->test_type ) ) {
+            printf( "%s %u", target->dstip, target->dstport );
+        } else {
+            printf( "%s -", target->dstip );
+        }
+        if ( frag_search_missed( run, target ) ) {
+            if ( compare_reached( target->baseline ) ) {
+                printf( " none\n" );
+                run->none++;
+            } else {
+                printf( " unreachable\n" );
+                run->unreachable++;
+            }
+            continue;
+        }
+        run->found++;
+        side = &target->sides[FRAG_SEARCH_DATA];
+        if ( side->hi < run->shape_count[FRAG_SEARCH_DATA] ) {
+            printf( " data=%u", run->shapes[FRAG_SEARCH_DATA][side->hi].data );
+        } else {
+            printf( " data=none" );
+        }
+        side = &target->sides[FRAG_SEARCH_SIZE];
+        if ( side->hi < run->shape_count[FRAG_SEARCH_SIZE] ) {
+            printf( " size=%d\n", run->shapes[FRAG_SEARCH_SIZE][side->hi].size );
+        } else {
+            printf( " size=none\n" );
+        }
     }
-    close( pfd[1] );
-    exit( 0 );
+    fflush( stdout );
 }
 
-int harvest_pcap_listener( char **packet_buf ) {
-    int packet_buf_size;
-
-    if ( read( pfd[0], &packet_buf_size, sizeof( int ) ) < sizeof( int ) )
-        errx( 1, "Error communicating with child process." );
-    /* No packet received. */
-    if ( packet_buf_size == 0 ) return 0;
-    if ( packet_buf_size > PCAP_CAPTURE_LEN || packet_buf_size < 1 )
-        errx( 1, "Bad data received from child process." );
-    *packet_buf = (char *) malloc_check( packet_buf_size );
-    if ( read( pfd[0], *packet_buf, packet_buf_size ) < packet_buf_size )
-        errx( 1, "Error communicating with child process (2)." );
-    wait( NULL );
-    return packet_buf_size;
+/*
+ * For every target listed in path, as for run_compare(), find the smallest
+ * first fragment of the test that gets through whatever filters it: along
+ * one dimension, the fewest bytes of the layer 4 header it has to carry, and
+ * along the other, the shortest it can be padded out to with options. Each
+ * is a binary search, assuming whatever lets a first fragment through lets
+ * any bigger one through too, so it takes as many rounds as it takes to halve
+ * the shapes down to one, with every target of a chunk probed in each. A
+ * probe lost on the way makes a target's result too big. Returns 0.
+ */
+int run_frag_search( struct links *links, enum TEST_TYPE test_type, const char *path, unsigned short dstport )
+{
+    struct frag_search_run *run;
+    struct frag_search_target *search;
+    struct targets targets;
+    struct routed_targets *routed;
+    struct target target;
+    char dstmac[MAC_STRLEN] = "";
+    unsigned int count = 0, x;
+    int link = 0, d, r;
+    int family = synfrag_test_family( test_type );
+    int tcp = synfrag_test_is_tcp( test_type );
+
+    if ( ( run = calloc( 1, sizeof( struct frag_search_run ) ) ) == NULL ) err( 1, "calloc" );
+    run->test_type = test_type;
+    run->links = links;
+    for ( d = 0; d < FRAG_SEARCH_DIMENSIONS; d++ ) run->shape_count[d] = frag_search_shapes( test_type, d, run->shapes[d] );
+
+    if ( targets_open( &targets, path ) == -1 ) {
+        if ( errno == EINVAL ) errx( 1, "%s is cut short, compile it again", path );
+        err( 1, "Unable to open %s", path );
+    }
+    run->targets = malloc( sizeof( struct frag_search_target ) * FRAG_SEARCH_CHUNK );
+    run->probes = malloc( sizeof( struct synfrag_probe ) * FRAG_SEARCH_CHUNK * FRAG_SEARCH_DIMENSIONS );
+    if ( !run->targets || !run->probes ) err( 1, "malloc" );
+
+    routed = routed_targets_open( &targets, links, family );
+    while ( ( r = routed_targets_next( routed, &target, &link, dstmac ) ) == 1 ) {
+        if ( target.family != family ) errx( 1, "%s line %lu: invalid dstip for this test: %s", path, target.line, target.dstip );
+        if ( link == -1 ) {
+            warn( "%s line %lu: no way to %s", path, target.line, target.dstip );
+            continue;
+        }
+
+        /* ICMP tests have no dstport, whatever the line says. */
+        if ( !tcp ) target.port_count = 0;
+        if ( tcp && !target.port_count && !dstport ) errx( 1, "%s line %lu: missing dstport", path, target.line );
+        x = 0;
+        do {
+            if ( count == FRAG_SEARCH_CHUNK ) {
+                frag_search_chunk( run, count );
+                count = 0;
+            }
+            search = &run->targets[count++];
+            memcpy( search->dstip, target.dstip, SYNFRAG_ADDRSTRLEN );
+            search->dstport = target.port_count ? target.ports[x] : dstport;
+            for ( d = 0; d < FRAG_SEARCH_DIMENSIONS; d++ ) {
+                search->sides[d].lo = -1;
+                search->sides[d].hi = run->shape_count[d];
+            }
+            search->baseline = REPLY_TYPE_NONE;
+            search->link = link;
+            snprintf( search->dstmac, MAC_STRLEN, "%s", dstmac );
+        } while ( ++x < target.port_count );
+    }
+    if ( r == -1 && errno == EINVAL ) errx( 1, "%s line %lu: invalid dstport", path, target.line );
+    if ( r == -1 && errno == E2BIG ) errx( 1, "%s line %lu: more than %u dstports", path, target.line, TARGETS_PORTS_MAX );
+    if ( r == -1 ) err( 1, "Unable to read %s", path );
+    if ( count ) frag_search_chunk( run, count );
+    targets_close( &targets );
+    free( routed );
+
+    printf( "%lu pairs searched in %lu rounds: %lu let a first fragment through, %lu none, %lu unreachable.\n",
+        run->searched, run->rounds, run->found, run->none, run->unreachable );
+    free( run->targets );
+    free( run->probes );
+    free( run );
+    return 0;
 }
 
 void print_test_types( void )
 {
-    char *test;
+    enum TEST_TYPE test_type;
     int x = 0;
 
     fprintf( stderr, "Available test types:\n\n" );
-    while ( ( test = test_names[x++] ) ) {
-        fprintf( stderr, "%s\n", test );
+    while ( ( test_type = synfrag_test_by_index( x++ ) ) ) {
+        fprintf( stderr, "%s\n", synfrag_test_name( test_type ) );
     }
 }
 
@@ -1105,8 +1830,43 @@ void exit_with_usage( void )
     fprintf( stderr, "--dstport    Destination port for TCP tests\n" );
     fprintf( stderr, "--dstmac     Destination MAC address (default gw or target host if on subnet)\n" );
     fprintf( stderr, "--interface  Packet source interface\n" );
+    fprintf( stderr, "             (on Linux, srcip, dstmac and interface default to the route to each target)\n" );
     fprintf( stderr, "--test       Type of test to run\n" );
-    fprintf( stderr, "--timeout    Reply timeout in seconds (defaults to 10)\n\n" );
+    fprintf( stderr, "--timeout    Reply timeout in seconds (defaults to 10)\n" );
+    fprintf( stderr, "--icmp-pace  Send ICMP tests to any one target at most RATE a second after a burst of\n" );
+    fprintf( stderr, "             BURST, as RATE[:BURST] (e.g. 1:6), to stay under its ICMP rate limit\n" );
+    fprintf( stderr, "--daemon     Serve jobs from this unix socket instead of running one test\n" );
+    fprintf( stderr, "--stats-interval  Print a stats line to stderr every this many seconds\n" );
+    fprintf( stderr, "--metrics    Serve counters in Prometheus text format on this unix socket\n" );
+    fprintf( stderr, "--profile    Print cycles spent per stage at exit (needs a PROFILE=1 build)\n" );
+    fprintf( stderr, "--backend    How to send and receive: pcap (default), packet, xdp, loopback, sim or savefile\n" );
+    fprintf( stderr, "--xdp        Use AF_XDP instead of pcap: zerocopy, copy or generic (for veth and such)\n" );
+    fprintf( stderr, "--xdp-queue  Interface queue for --xdp (defaults to 0)\n" );
+    fprintf( stderr, "--qdisc-bypass  Skip the qdisc layer with the packet backend\n" );
+    fprintf( stderr, "--suppress-rst  Keep this host from sending RSTs in answer to replies while running\n" );
+    fprintf( stderr, "--csum-offload  Leave TCP checksums of v4-tcp and v6-tcp to the kernel or NIC (implies --backend packet)\n" );
+    fprintf( stderr, "--savefile   Read replies from this pcap file with the savefile backend\n" );
+    fprintf( stderr, "--dumpfile   Write frames sent to this pcap file with the savefile backend\n" );
+    fprintf( stderr, "--capture    Write every frame sent and received to this pcapng file, noting probes and results\n" );
+    fprintf( stderr, "--sim        Settings for the simulated network, e.g. loss=30%%,rtt=20,10.1.0.0/16=drop-frags\n" );
+    fprintf( stderr, "--bench      Run this many probes to dstip and up and report the rate\n" );
+    fprintf( stderr, "--frag-bench  Find how many reassemblies dstip's firewall holds, stepping the rate of held\n" );
+    fprintf( stderr, "             back fragmented probes up to this many a second\n" );
+    fprintf( stderr, "--hold       Milliseconds --frag-bench holds each last fragment back (defaults to 1000)\n" );
+    fprintf( stderr, "--trace      Find the hop that drops the test, sending it with TTLs 1 up to this at once\n" );
+    fprintf( stderr, "--compare    Run the test and its unfragmented baseline against every target in this file\n" );
+    fprintf( stderr, "             (- for stdin, one \"dstip [dstport ...]\" per line) and print where they differ\n" );
+    fprintf( stderr, "--journal    Keep --compare's progress in this file\n" );
+    fprintf( stderr, "--resume     Continue the --compare run recorded in --journal, reusing its results\n" );
+    fprintf( stderr, "--previous   Journal of an earlier --compare run: mostly reuse its recent agreements and\n" );
+    fprintf( stderr, "             print only what changed since\n" );
+    fprintf( stderr, "--fresh-for  Seconds an agreement from --previous is reused for (defaults to a week)\n" );
+    fprintf( stderr, "--sample     Percent of reusable agreements probed again anyway (defaults to 10)\n" );
+    fprintf( stderr, "--results    Write every --compare pair to this file, for synfrag-query\n" );
+    fprintf( stderr, "--compile    Instead of running, write --compare's target list to this file compiled,\n" );
+    fprintf( stderr, "             for later runs to use in its place without parsing it\n" );
+    fprintf( stderr, "--frag-search  Find the smallest first fragment of the test that gets through to every\n" );
+    fprintf( stderr, "             target in this file (as for --compare), by layer 4 bytes and by size\n\n" );
     print_test_types();
     fprintf( stderr, "\nAll TCP tests send syn packets, all ICMP/6 test send ping.\n" );
     fprintf( stderr, "All \"frag\" tests send fragments that are below the minimum packet size.\n" );
@@ -1116,17 +1876,9 @@ void exit_with_usage( void )
 
 void copy_arg_string( char **dst, char *opt )
 {
-    *dst = malloc( strlen( opt ) );
-    memcpy( *dst, opt, strlen( opt) );
-}
-
-void ip_test_arg( char *opt )
-{
-    struct in6_addr iptest;
-    if (
-        ( !inet_pton( AF_INET, opt, &iptest ) ) &&
-        ( !inet_pton( AF_INET6, opt, &iptest ) )
-    ) errx( 1, "Invalid IP address: %s", opt );
+    *dst = malloc( strlen( opt ) + 1 );
+    if ( *dst == NULL ) err( 1, "malloc" );
+    memcpy( *dst, opt, strlen( opt ) + 1 );
 }
 
 enum TEST_TYPE parse_args(
@@ -1139,13 +1891,29 @@ enum TEST_TYPE parse_args(
     char **dstmac,
     char **interface,
     char **test_name,
-    long *timeout
+    long *timeout,
+    double *icmp_pace,
+    unsigned int *icmp_burst,
+    char **daemon_path,
+    long *stats_interval,
+    char **metrics_path,
+    int *profile,
+    int *suppress_rst,
+    struct synfrag_config *config,
+    unsigned long *bench,
+    unsigned long *frag_bench,
+    unsigned int *hold_msec,
+    unsigned int *trace,
+    char **compare_path,
+    struct compare_options *compare,
+    char **frag_search_path,
+    char **capture_path
 ) {
-    int x = 0;
     int option_index = 0;
     int c, tmpport;
+    int backend_set = 0;
     long tmptime;
-    char *possible_match;
+    char *end;
     enum TEST_TYPE test_type = 0;
     static struct option long_options[] = {
         {"srcip", required_argument, 0, 0},
@@ -1157,12 +1925,40 @@ enum TEST_TYPE parse_args(
         {"test", required_argument, 0, 0},
         {"help", no_argument, 0, 0},
         {"timeout", required_argument, 0, 0},
+        {"icmp-pace", required_argument, 0, 0},
+        {"daemon", required_argument, 0, 0},
+        {"stats-interval", required_argument, 0, 0},
+        {"metrics", required_argument, 0, 0},
+        {"profile", no_argument, 0, 0},
+        {"xdp", required_argument, 0, 0},
+        {"xdp-queue", required_argument, 0, 0},
+        {"backend", required_argument, 0, 0},
+        {"qdisc-bypass", no_argument, 0, 0},
+        {"suppress-rst", no_argument, 0, 0},
+        {"csum-offload", no_argument, 0, 0},
+        {"savefile", required_argument, 0, 0},
+        {"dumpfile", required_argument, 0, 0},
+        {"capture", required_argument, 0, 0},
+        {"sim", required_argument, 0, 0},
+        {"bench", required_argument, 0, 0},
+        {"frag-bench", required_argument, 0, 0},
+        {"hold", required_argument, 0, 0},
+        {"trace", required_argument, 0, 0},
+        {"compare", required_argument, 0, 0},
+        {"journal", required_argument, 0, 0},
+        {"resume", no_argument, 0, 0},
+        {"previous", required_argument, 0, 0},
+        {"fresh-for", required_argument, 0, 0},
+        {"sample", required_argument, 0, 0},
+        {"results", required_argument, 0, 0},
+        {"compile", required_argument, 0, 0},
+        {"frag-search", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
     if ( argc < 2 ) exit_with_usage();
 
-    *srcip = *dstip = *dstmac = *interface = NULL;
+    *srcip = *dstip = *dstmac = *interface = *daemon_path = *metrics_path = *compare_path = *frag_search_path = *capture_path = NULL;
     *srcport = *dstport = 0;
 
     while ( 1 ) {
@@ -1199,31 +1995,179 @@ enum TEST_TYPE parse_args(
             if ( tmptime < 1 ) errx( 1, "Invalid value for timeout" );
             *timeout = tmptime;
 
+        } else if ( strcmp( long_options[option_index].name, "icmp-pace" ) == 0 ) {
+            *icmp_pace = strtod( optarg, &end );
+            *icmp_burst = 1;
+            if ( *end == ':' ) *icmp_burst = strtoul( end + 1, &end, 10 );
+            if ( end == optarg || *end || *icmp_pace <= 0 || *icmp_burst < 1 ) errx( 1, "Invalid value for icmp-pace" );
+
         } else if ( strcmp( long_options[option_index].name, "test" ) == 0 ) {
-            while ( ( possible_match = test_names[x] ) ) {
-                if ( strcmp( optarg, possible_match ) == 0 ) {
-                    test_type = test_indexes[x];
-                    *test_name = test_names[x];
-                    break;
-                }
-                x++;
+            if ( ( test_type = synfrag_test_by_name( optarg ) ) ) *test_name = optarg;
+
+        } else if ( strcmp( long_options[option_index].name, "daemon" ) == 0 ) {
+            copy_arg_string( daemon_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "stats-interval" ) == 0 ) {
+            tmptime = atol( optarg );
+            if ( tmptime < 1 ) errx( 1, "Invalid value for stats-interval" );
+            *stats_interval = tmptime;
+
+        } else if ( strcmp( long_options[option_index].name, "metrics" ) == 0 ) {
+            copy_arg_string( metrics_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "profile" ) == 0 ) {
+            *profile = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "xdp" ) == 0 ) {
+            if ( strcmp( optarg, "zerocopy" ) == 0 ) {
+                config->backend_flags |= SYNFRAG_XDP_ZEROCOPY;
+            } else if ( strcmp( optarg, "copy" ) == 0 ) {
+                config->backend_flags |= SYNFRAG_XDP_COPY;
+            } else if ( strcmp( optarg, "generic" ) == 0 ) {
+                config->backend_flags |= SYNFRAG_XDP_COPY | SYNFRAG_XDP_GENERIC;
+            } else {
+                errx( 1, "Invalid value for xdp" );
             }
+            /* Picking a mode implies the backend. */
+            if ( !backend_set ) config->backend = SYNFRAG_BACKEND_XDP;
+
+        } else if ( strcmp( long_options[option_index].name, "xdp-queue" ) == 0 ) {
+            if ( atoi( optarg ) < 0 ) errx( 1, "Invalid value for xdp-queue" );
+            config->xdp_queue = atoi( optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "backend" ) == 0 ) {
+            if ( strcmp( optarg, "pcap" ) == 0 ) {
+                config->backend = SYNFRAG_BACKEND_PCAP;
+            } else if ( strcmp( optarg, "packet" ) == 0 ) {
+                config->backend = SYNFRAG_BACKEND_PACKET;
+            } else if ( strcmp( optarg, "xdp" ) == 0 ) {
+                config->backend = SYNFRAG_BACKEND_XDP;
+            } else if ( strcmp( optarg, "loopback" ) == 0 ) {
+                config->backend = SYNFRAG_BACKEND_LOOPBACK;
+            } else if ( strcmp( optarg, "sim" ) == 0 ) {
+                config->backend = SYNFRAG_BACKEND_SIM;
+            } else if ( strcmp( optarg, "savefile" ) == 0 ) {
+                config->backend = SYNFRAG_BACKEND_SAVEFILE;
+            } else {
+                errx( 1, "Invalid value for backend" );
+            }
+            backend_set = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "qdisc-bypass" ) == 0 ) {
+            config->backend_flags |= SYNFRAG_PACKET_QDISC_BYPASS;
+
+        } else if ( strcmp( long_options[option_index].name, "suppress-rst" ) == 0 ) {
+            *suppress_rst = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "csum-offload" ) == 0 ) {
+            config->backend_flags |= SYNFRAG_PACKET_CSUM_OFFLOAD;
+            if ( !backend_set ) config->backend = SYNFRAG_BACKEND_PACKET;
+
+        } else if ( strcmp( long_options[option_index].name, "savefile" ) == 0 ) {
+            config->savefile = optarg;
+
+        } else if ( strcmp( long_options[option_index].name, "dumpfile" ) == 0 ) {
+            config->dumpfile = optarg;
+
+        } else if ( strcmp( long_options[option_index].name, "capture" ) == 0 ) {
+            copy_arg_string( capture_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "sim" ) == 0 ) {
+            config->sim = optarg;
+            if ( !backend_set ) config->backend = SYNFRAG_BACKEND_SIM;
+
+        } else if ( strcmp( long_options[option_index].name, "bench" ) == 0 ) {
+            if ( atol( optarg ) < 1 ) errx( 1, "Invalid value for bench" );
+            *bench = atol( optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "frag-bench" ) == 0 ) {
+            if ( atol( optarg ) < 1 ) errx( 1, "Invalid value for frag-bench" );
+            *frag_bench = atol( optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "hold" ) == 0 ) {
+            if ( atoi( optarg ) < 1 ) errx( 1, "Invalid value for hold" );
+            *hold_msec = atoi( optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "trace" ) == 0 ) {
+            if ( atoi( optarg ) < 1 || atoi( optarg ) > TRACE_HOPS_MAX ) errx( 1, "Invalid value for trace" );
+            *trace = atoi( optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "compare" ) == 0 ) {
+            copy_arg_string( compare_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "journal" ) == 0 ) {
+            copy_arg_string( &compare->journal_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "resume" ) == 0 ) {
+            compare->resume = 1;
+
+        } else if ( strcmp( long_options[option_index].name, "previous" ) == 0 ) {
+            copy_arg_string( &compare->previous_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "results" ) == 0 ) {
+            copy_arg_string( &compare->results_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "compile" ) == 0 ) {
+            copy_arg_string( &compare->compile_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "frag-search" ) == 0 ) {
+            copy_arg_string( frag_search_path, optarg );
+
+        } else if ( strcmp( long_options[option_index].name, "fresh-for" ) == 0 ) {
+            tmptime = atol( optarg );
+            if ( tmptime < 0 ) errx( 1, "Invalid value for fresh-for" );
+            compare->fresh_for = tmptime;
+
+        } else if ( strcmp( long_options[option_index].name, "sample" ) == 0 ) {
+            if ( atoi( optarg ) < 0 || atoi( optarg ) > 100 ) errx( 1, "Invalid value for sample" );
+            compare->sample = atoi( optarg );
         }
     }
 
     if ( optind < argc ) exit_with_usage();
 
-    if ( !*srcip ) errx( 1, "Missing srcip" );
-    if ( !*dstip ) errx( 1, "Missing dstip" );
-    if ( !*dstmac ) errx( 1, "Missing dstmac" );
-    if ( !*interface ) errx( 1, "Missing interface" );
+    /*
+     * The loopback, sim and savefile backends have no interface or next hop.
+     * The others look up whatever isn't given in the route to each target,
+     * except in the daemon, whose targets come later.
+     */
+    if ( config->backend == SYNFRAG_BACKEND_PCAP ||
+        config->backend == SYNFRAG_BACKEND_PACKET ||
+        config->backend == SYNFRAG_BACKEND_XDP ) {
+        if ( *daemon_path && !*srcip ) errx( 1, "Missing srcip" );
+        if ( *daemon_path && !*dstmac ) errx( 1, "Missing dstmac" );
+        if ( *daemon_path && !*interface ) errx( 1, "Missing interface" );
+    } else if ( !*srcip ) {
+        errx( 1, "Missing srcip" );
+    } else if ( *suppress_rst ) {
+        errx( 1, "suppress-rst only works with the pcap, packet and xdp backends" );
+    }
+    if ( config->backend == SYNFRAG_BACKEND_SAVEFILE && !config->savefile ) errx( 1, "Missing savefile" );
+    if ( ( compare->journal_path || compare->previous_path || compare->results_path || compare->compile_path ) && !*compare_path )
+        errx( 1, "journal, previous, results and compile only work with compare" );
+    if ( compare->resume && !compare->journal_path ) errx( 1, "Missing journal to resume from" );
+    if ( *compare_path && *frag_search_path ) errx( 1, "compare and frag-search don't go together" );
+    /* Jobs bring their own test, dstip and dstport. */
+    if ( *daemon_path ) return TEST_INVALID;
     if ( !test_type ) {
         fprintf( stderr, "Missing or invalid test type.\n" );
         print_test_types();
         exit( 1 );
     }
+    /* The target list brings dstips, and can bring dstports. */
+    if ( *compare_path ) {
+        if ( baseline_test( test_type ) == TEST_INVALID )
+            errx( 1, "%s has no baseline to compare with, pick a fragment test", synfrag_test_name( test_type ) );
+        return test_type;
+    }
+    if ( *frag_search_path ) {
+        if ( baseline_test( test_type ) == TEST_INVALID )
+            errx( 1, "%s sends no fragments to search with, pick a fragment test", synfrag_test_name( test_type ) );
+        return test_type;
+    }
+    if ( !*dstip ) errx( 1, "Missing dstip" );
 
-    if ( IS_TEST_TCP( test_type ) ) {
+    if ( synfrag_test_is_tcp( test_type ) ) {
         /* Currently not used.
         if ( !*srcport ) errx( 1, "Missing srcport" ); */
         if ( !*dstport ) errx( 1, "Missing dstport" );
@@ -1234,82 +2178,206 @@ enum TEST_TYPE parse_args(
 
 int main( int argc, char **argv )
 {
-    char pcaperr[PCAP_ERRBUF_SIZE];
-    int r;
     enum TEST_TYPE test_type;
+    struct synfrag_ctx *ctx;
+    struct synfrag_probe probe;
+    struct synfrag_result result;
     char *interface;
     char *srcip;
     char *dstip;
     char *dstmac;
     unsigned short dstport;
     unsigned short srcport;
-    char *packet_buf;
     char *test_name;
-    long receive_timeout = DEFAULT_TIMEOUT_SECONDS;
-
-    test_type = parse_args( argc, argv, &srcip, &dstip, &srcport, &dstport, &dstmac, &interface, &test_name, &receive_timeout );
-    srand( getpid() );
-
-    printf( "Starting test \"%s\". Opening interface \"%s\".\n\n", test_name, interface );
-    if ( ( pcap = pcap_open_live( interface, PCAP_CAPTURE_LEN, 0, 1, pcaperr ) ) == NULL )
-        errx( 1, "pcap_open_live failed: %s", pcaperr );
-
-    if ( pcap_datalink( pcap ) != DLT_EN10MB )
-        errx( 1, "non-ethernet interface specified." );
-
-    fork_pcap_listener( dstip, srcip, dstport, SOURCE_PORT, test_type, receive_timeout );
-
-    switch ( test_type ) {
-        case TEST_IPV4_TCP:
-            do_ipv4_syn( interface, srcip, dstip, dstmac, dstport );
-            break;
-        case TEST_FRAG_IPV4_TCP:
-            do_ipv4_short_tcp_frag( interface, srcip, dstip, dstmac, dstport );
-            break;
-        case TEST_FRAG_IPV4_ICMP:
-            do_ipv4_short_icmp_frag( interface, srcip, dstip, dstmac );
-            break;
-        case TEST_FRAG_OPTIONED_IPV4_TCP:
-            do_ipv4_optioned_tcp_frag( interface, srcip, dstip, dstmac, dstport );
-            break;
-        case TEST_FRAG_OPTIONED_IPV4_ICMP:
-            do_ipv4_optioned_icmp_frag( interface, srcip, dstip, dstmac );
-            break;
+    char *daemon_path;
+    char *metrics_path;
+    long receive_timeout = SYNFRAG_DEFAULT_TIMEOUT_SECONDS;
+    long stats_interval = 0;
+    double icmp_pace = 0;
+    unsigned int icmp_burst = 1;
+    int profile = 0;
+    int suppress_rst = 0;
+    int r;
+    unsigned long bench = 0;
+    unsigned long frag_bench = 0;
+    unsigned int hold_msec = FRAG_BENCH_DEFAULT_HOLD_MSEC;
+    unsigned int trace = 0;
+    char *compare_path;
+    char *frag_search_path;
+    char *capture_path;
+    struct compare_options compare;
+    struct synfrag_config config;
+    struct links links;
+    struct route_socket routes;
+    struct firewall firewall;
+    char errbuf[SYNFRAG_ERRBUF_SIZE];
+    char route_interface[IF_NAMESIZE];
+    char route_srcip[SYNFRAG_ADDRSTRLEN];
+    char route_dstmac[MAC_STRLEN];
+    char where[IF_NAMESIZE + 32];
+
+    memset( &config, 0, sizeof( struct synfrag_config ) );
+    memset( &compare, 0, sizeof( struct compare_options ) );
+    compare.fresh_for = COMPARE_DEFAULT_FRESH_FOR;
+    compare.sample = COMPARE_DEFAULT_SAMPLE;
+
+    test_type = parse_args(
+        argc,
+        argv,
+        &srcip,
+        &dstip,
+        &srcport,
+        &dstport,
+        &dstmac,
+        &interface,
+        &test_name,
+        &receive_timeout,
+        &icmp_pace,
+        &icmp_burst,
+        &daemon_path,
+        &stats_interval,
+        &metrics_path,
+        &profile,
+        &suppress_rst,
+        &config,
+        &bench,
+        &frag_bench,
+        &hold_msec,
+        &trace,
+        &compare_path,
+        &compare,
+        &frag_search_path,
+        &capture_path
+    );
+    config.interface = interface;
+    config.srcip = srcip;
+    config.dstmac = dstmac;
+
+    if ( compare.compile_path ) return run_compile( test_type, compare_path, compare.compile_path );
+
+    /* Left in place until synfrag exits, when the kernel removes it with its socket. */
+    if ( suppress_rst && firewall_open( &firewall, SYNFRAG_SOURCE_PORT, SYNFRAG_SOURCE_PORT + SYNFRAG_SOURCE_PORTS - 1 ) == -1 )
+        err( 1, "Unable to add the nftables rule for suppress-rst" );
+
+    memset( &links, 0, sizeof( struct links ) );
+    links.config = config;
+    links.timeout = receive_timeout;
+    links.icmp_pace = icmp_pace;
+    links.icmp_burst = icmp_burst;
+    links.metrics_path = metrics_path;
+    links.stats_interval = stats_interval;
+    if ( capture_path && synfrag_capture_open( &links.capture, capture_path, errbuf ) != SYNFRAG_OK )
+        errx( 1, "%s", errbuf );
+    if ( ( config.backend == SYNFRAG_BACKEND_PCAP ||
+        config.backend == SYNFRAG_BACKEND_PACKET ||
+        config.backend == SYNFRAG_BACKEND_XDP ) &&
+        ( !interface || !srcip || !dstmac ) ) {
+        if ( route_open( &routes ) == -1 ) err( 1, "Unable to open rtnetlink" );
+        links.routes = &routes;
+    }
+    /* One target, one route; --compare and --frag-search look each target's up as they read them. */
+    if ( links.routes && !compare_path && !frag_search_path ) {
+        if ( route_link( &links, synfrag_test_family( test_type ), dstip, route_interface, route_srcip, route_dstmac ) == -1 )
+            err( 1, "No way to %s", dstip );
+        interface = route_interface;
+        srcip = route_srcip;
+        dstmac = route_dstmac;
+        route_close( &routes );
+        links.routes = NULL;
+    }
 
-        case TEST_IPV6_TCP:
-            do_ipv6_syn( interface, srcip, dstip, dstmac, dstport );
-            break;
-        case TEST_FRAG_IPV6_TCP:
-            do_ipv6_short_tcp_frag( interface, srcip, dstip, dstmac, dstport );
-            break;
-        case TEST_FRAG_IPV6_ICMP6:
-            do_ipv6_short_icmp_frag( interface, srcip, dstip, dstmac );
-            break;
-        case TEST_FRAG_OPTIONED_IPV6_TCP:
-            do_ipv6_optioned_tcp_frag( interface, srcip, dstip, dstmac, dstport );
-            break;
-        case TEST_FRAG_OPTIONED_IPV6_ICMP6:
-            do_ipv6_optioned_icmp_frag( interface, srcip, dstip, dstmac );
-            break;
+    if ( links.routes ) {
+        snprintf( where, sizeof( where ), "the interfaces routes to the targets take" );
+    } else if ( config.backend == SYNFRAG_BACKEND_LOOPBACK ) {
+        snprintf( where, sizeof( where ), "the loopback backend" );
+    } else if ( config.backend == SYNFRAG_BACKEND_SIM ) {
+        snprintf( where, sizeof( where ), "a simulated network" );
+    } else if ( config.backend == SYNFRAG_BACKEND_SAVEFILE ) {
+        snprintf( where, sizeof( where ), "the savefile backend" );
+    } else {
+        snprintf( where, sizeof( where ), "interface \"%.*s\"", IF_NAMESIZE, interface );
+    }
+    if ( daemon_path ) {
+        printf( "Starting daemon. Opening %s.\n", where );
+    } else {
+        printf( "Starting test \"%s\". Opening %s.\n\n", test_name, where );
+    }
+    if ( links.routes ) {
+        if ( frag_search_path ) {
+            r = run_frag_search( &links, test_type, frag_search_path, dstport );
+        } else {
+            r = run_compare( &links, test_type, compare_path, dstport, &compare );
+        }
+        close_links( &links, profile );
+        route_close( &routes );
+        return r;
+    }
+    ctx = open_link( &links, interface, srcip, dstmac );
 
-        default:
-            errx( 1, "Unsupported test type!" );
+    if ( daemon_path ) {
+        run_daemon( daemon_path, ctx, receive_timeout );
+        close_links( &links, profile );
+        return 0;
+    }
+    if ( bench ) {
+        run_bench( ctx, test_type, dstip, dstport, bench );
+        close_links( &links, profile );
+        return 0;
+    }
+    if ( frag_bench ) {
+        run_frag_bench( ctx, test_type, dstip, dstport, frag_bench, hold_msec, receive_timeout );
+        close_links( &links, profile );
+        return 0;
+    }
+    if ( compare_path ) {
+        r = run_compare( &links, test_type, compare_path, dstport, &compare );
+        close_links( &links, profile );
+        return r;
+    }
+    if ( frag_search_path ) {
+        r = run_frag_search( &links, test_type, frag_search_path, dstport );
+        close_links( &links, profile );
+        return r;
     }
+    if ( trace ) {
+        r = run_trace( ctx, test_type, dstip, dstport, trace );
+        close_links( &links, profile );
+        return r;
+    }
+
+    synfrag_set_verbose( ctx, 1 );
+
+    probe.test_type = test_type;
+    probe.dstip = dstip;
+    probe.dstport = dstport;
+    probe.srcport = 0;
+    probe.ttl = 0;
+    probe.hold_msec = 0;
+    probe.frag_data = 0;
+    probe.frag_options = 0;
+    probe.dstmac = NULL;
+    probe.user = NULL;
+    if ( synfrag_submit( ctx, &probe ) != SYNFRAG_OK || synfrag_transmit( ctx ) != SYNFRAG_OK )
+        errx( 1, "%s", synfrag_geterr( ctx ) );
 
     printf( "Packet transmission successful, waiting for reply...\n\n" );
 
-    r = harvest_pcap_listener( &packet_buf );
-    if ( !r ) {
+    if ( synfrag_next_result( ctx, &result, 1 ) < 0 )
+        errx( 1, "%s", synfrag_geterr( ctx ) );
+    close_links( &links, profile );
+
+    if ( result.result == TEST_RESULT_TIMEOUT ) {
         fprintf( stderr, "Test failed, no response before time out (%li seconds).\n", receive_timeout );
         return 1;
     }
-    if ( check_received_packet( r, packet_buf, test_type ) ) {
+    if ( result.result == TEST_RESULT_SUCCESS ) {
         printf( "Test was successful.\n" );
-        free( packet_buf );
         return 0;
     }
-    fprintf( stderr, "Test failed.\n" );
-    free( packet_buf );
+    if ( result.result == TEST_RESULT_TIME_EXCEEDED ) {
+        fprintf( stderr, "Test failed, TTL exceeded at %s.\n", result.replier );
+        return 1;
+    }
+    fprintf( stderr, "Test failed, reply was %s.\n", synfrag_reply_type_name( result.reply_type ) );
     return 1;
 }
-
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+#ifndef SYNFRAG_H
+#define SYNFRAG_H
+
+/*
+ * libsynfrag: the probe engine behind synfrag.
+ *
+ * All state lives in a struct synfrag_ctx, so several contexts (on the same
+ * or different interfaces) can be used in one process. A context is not
+ * thread safe; use one per thread. No function in the library exits the
+ * process: failures are reported as a negative enum SYNFRAG_ERROR value, with
+ * details available from synfrag_geterr().
+ *
+ * Frames go out and replies come in through a backend chosen when the
+ * context is opened: libpcap on a live interface or a savefile, AF_PACKET
+ * rings, AF_XDP, an in-memory loopback with a responder function behind it,
+ * or a simulated network in virtual time (neither of which needs an
+ * interface, root or a network).
+ *
+ * Probes are built as soon as they are submitted and handed to the backend
+ * in batches: when a batch fills up, when synfrag_next_result() is about to
+ * wait, or on synfrag_transmit(). Their outcomes are collected with
+ * synfrag_next_result(), or synfrag_run() does both and hands each result to
+ * a callback as it completes. synfrag_run_pipelined() does the same with
+ * probes made, frames received and results taken on threads of their own,
+ * so neither a slow source of targets nor a slow consumer of results holds
+ * up the engine.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#define SYNFRAG_ERRBUF_SIZE 256
+/* Large enough for any IPv4 or IPv6 address string. */
+#define SYNFRAG_ADDRSTRLEN 46
+#define SYNFRAG_SOURCE_PORT 44128
+/*
+ * Replies are captured for TCP source ports SYNFRAG_SOURCE_PORT up to
+ * SYNFRAG_SOURCE_PORT + SYNFRAG_SOURCE_PORTS - 1, so probes to the same
+ * target and port can be in flight at once as separate connections.
+ */
+#define SYNFRAG_SOURCE_PORTS 2
+#define SYNFRAG_DEFAULT_TIMEOUT_SECONDS 10
+#define SYNFRAG_DEFAULT_MAX_IN_FLIGHT 4096
+
+enum SYNFRAG_BACKEND {
+    SYNFRAG_BACKEND_PCAP = 0,
+    /* Replies read from a pcap savefile, frames sent optionally dumped to another. */
+    SYNFRAG_BACKEND_SAVEFILE,
+    /* AF_PACKET with mmap'd rings (Linux only, needs root). */
+    SYNFRAG_BACKEND_PACKET,
+    /*
+     * An AF_XDP socket on one queue of the interface (Linux only, needs
+     * root). An XDP program steers replies to the socket, so the queue must
+     * be the one they arrive on; with several queues, steer them there or
+     * use "ethtool -L <if> combined 1".
+     */
+    SYNFRAG_BACKEND_XDP,
+    /* No network: a responder function answers every frame sent. */
+    SYNFRAG_BACKEND_LOOPBACK,
+    /*
+     * A simulated network of hosts, with loss, latency, ICMP rate limiting
+     * and per-prefix filtering of fragments, running in virtual time: the
+     * clock jumps ahead whenever the engine would wait, so timeouts cost
+     * nothing and a long scan replays in seconds.
+     */
+    SYNFRAG_BACKEND_SIM
+};
+
+/* Flags for synfrag_config.backend_flags, each for one backend. */
+#define SYNFRAG_XDP_ZEROCOPY ( 1 << 0 )
+#define SYNFRAG_XDP_COPY ( 1 << 1 )
+#define SYNFRAG_XDP_GENERIC ( 1 << 2 )
+#define SYNFRAG_PACKET_QDISC_BYPASS ( 1 << 3 )
+/*
+ * The default loopback responder answers the first fragment of a fragmented
+ * probe as if it had been reassembled; with this it answers with an ICMP
+ * reassembly time exceeded error instead, like a host dropping fragments.
+ */
+#define SYNFRAG_LOOPBACK_NO_REASSEMBLY ( 1 << 4 )
+/*
+ * Leave the TCP checksum of unfragmented probes (v4-tcp, v6-tcp) to the
+ * kernel or NIC, through PACKET_VNET_HDR. Fragmented probes are always
+ * checksummed in software, since the checksum spans the fragments.
+ */
+#define SYNFRAG_PACKET_CSUM_OFFLOAD ( 1 << 5 )
+
+/*
+ * The values are fixed (they are recorded in journals and index stats), but
+ * say nothing about a test; ask synfrag_test_family() and friends.
+ */
+enum TEST_TYPE {
+    TEST_IPV4_TCP = 1,
+    TEST_FRAG_IPV4_TCP = 3,
+    TEST_FRAG_OPTIONED_IPV4_TCP = 5,
+
+    TEST_FRAG_IPV4_ICMP = 2,
+    TEST_FRAG_OPTIONED_IPV4_ICMP = 4,
+    TEST_IPV4_ICMP = 6,
+
+    TEST_IPV6_TCP = 11,
+    TEST_FRAG_IPV6_TCP = 13,
+    TEST_FRAG_OPTIONED_IPV6_TCP = 15,
+
+    TEST_FRAG_IPV6_ICMP6 = 12,
+    TEST_FRAG_OPTIONED_IPV6_ICMP6 = 14,
+    TEST_IPV6_ICMP6 = 16,
+
+    TEST_INVALID = 0
+};
+
+enum TEST_RESULT {
+    TEST_RESULT_SUCCESS = 0,
+    TEST_RESULT_FAILED,
+    TEST_RESULT_TIMEOUT,
+    /*
+     * The probe's TTL (hop limit) ran out on the way and a router said so;
+     * synfrag_result.replier is the router.
+     */
+    TEST_RESULT_TIME_EXCEEDED
+};
+
+/* Highest enum TEST_RESULT value plus one. */
+#define SYNFRAG_RESULT_MAX 4
+
+/*
+ * What the reply that decided a result said. Open is a SYN/ACK or echo
+ * reply; closed is a RST, or a port or protocol unreachable error; filtered
+ * is any other destination unreachable error, from the target or a router
+ * on the way. Reassembly timeout means the target got the first fragment
+ * but gave up waiting for the rest. Other ICMP errors (parameter problem,
+ * fragmentation needed and so on) are other.
+ */
+enum REPLY_TYPE {
+    REPLY_TYPE_NONE = 0,
+    REPLY_TYPE_OPEN,
+    REPLY_TYPE_CLOSED,
+    REPLY_TYPE_FILTERED,
+    REPLY_TYPE_REASSEMBLY_TIMEOUT,
+    REPLY_TYPE_TIME_EXCEEDED,
+    REPLY_TYPE_OTHER
+};
+
+/* Highest enum REPLY_TYPE value plus one. */
+#define SYNFRAG_REPLY_TYPE_MAX 7
+
+enum SYNFRAG_ERROR {
+    SYNFRAG_OK = 0,
+    /* A bad address, test type, port or option. */
+    SYNFRAG_ERR_ARGUMENT = -1,
+    /* A system call failed. */
+    SYNFRAG_ERR_SYSTEM = -2,
+    /* libpcap reported an error. */
+    SYNFRAG_ERR_PCAP = -3,
+    SYNFRAG_ERR_NOMEM = -4,
+    /* Too many probes in flight, collect some results and try again. */
+    SYNFRAG_ERR_BUSY = -5
+};
+
+struct synfrag_ctx;
+struct synfrag_capture;
+struct synfrag_sink;
+
+struct synfrag_probe {
+    enum TEST_TYPE test_type;
+    /* Must be the same address family as the context's source address. */
+    const char *dstip;
+    /* Required for TCP tests, ignored otherwise. */
+    unsigned short dstport;
+    /*
+     * TCP source port, 0 for SYNFRAG_SOURCE_PORT. Anything else must be in
+     * the range described at SYNFRAG_SOURCE_PORTS.
+     */
+    unsigned short srcport;
+    /* TTL or hop limit of every frame of the probe, 0 for the default (64). */
+    unsigned char ttl;
+    /*
+     * Next-hop MAC for this probe ("00:11:22:33:44:55"), NULL for the
+     * context's. For targets on different next hops out of one interface.
+     */
+    const char *dstmac;
+    /*
+     * Fragment tests only: hold the last fragment back this many
+     * milliseconds, keeping a reassembly open on the way. Held fragments go
+     * out in submission order, so give probes in flight together the same
+     * hold. The timeout still runs from the first fragment.
+     */
+    unsigned int hold_msec;
+    /*
+     * Fragment tests only: the first fragment's shape, 0 for the test's own.
+     * frag_data is how many bytes of the layer 4 header (and payload) it
+     * carries, a multiple of 8 short of all of them; frag_options is how
+     * many bytes of IPv4 options (a multiple of 4, at most 40) or IPv6
+     * destination options (8n - 2) go in front of them. See
+     * synfrag_first_fragment_size().
+     */
+    unsigned short frag_data;
+    unsigned short frag_options;
+    /* Handed back untouched in the result. */
+    void *user;
+};
+
+struct synfrag_result {
+    /* The probe's number, counting submissions to the context from 1, as in a capture. */
+    unsigned long id;
+    enum TEST_TYPE test_type;
+    enum TEST_RESULT result;
+    /* REPLY_TYPE_NONE for a timeout. */
+    enum REPLY_TYPE reply_type;
+    char dstip[SYNFRAG_ADDRSTRLEN];
+    unsigned short dstport;
+    /* Microseconds from sending the probe to its reply, -1 if none. */
+    long rtt_usec;
+    /* Where the reply came from: dstip, or a router on the way. Empty if none. */
+    char replier[SYNFRAG_ADDRSTRLEN];
+    /* The reply frame, if any. Only valid until the next library call. */
+    const char *reply;
+    int reply_len;
+    /* Completed while its last fragment was still held back. */
+    int early;
+    /*
+     * An ICMP probe that timed out less than a second after an earlier one
+     * to the same target was answered: more likely lost to the target's ICMP
+     * rate limit than filtered.
+     */
+    int rate_limited;
+    void *user;
+};
+
+/* Highest enum TEST_TYPE value plus one. */
+#define SYNFRAG_TEST_TYPE_MAX 17
+
+/*
+ * A snapshot of a context's counters. All of them count from synfrag_open()
+ * and only ever go up, except in_flight. The kernel_* values come from the
+ * backend (pcap_stats() and the like) and are refreshed about once a second
+ * while results are being collected.
+ */
+struct synfrag_stats {
+    unsigned long probes_sent[SYNFRAG_TEST_TYPE_MAX];
+    unsigned long frames_sent;
+    unsigned long bytes_sent;
+    unsigned long inject_failures;
+    /* Replies that completed a probe, and captured frames that didn't. */
+    unsigned long replies_matched;
+    unsigned long replies_unmatched;
+    /*
+     * Fragmented replies put back together (each then counts as one reply),
+     * and fragments or partial replies thrown away: timed out, pushed out of
+     * the fixed size fragment table, overlapping or malformed.
+     */
+    unsigned long replies_reassembled;
+    unsigned long reassembly_discarded;
+    /* ICMP probes that waited for their target's budget, and timeouts that look rate limited. */
+    unsigned long probes_paced;
+    unsigned long rate_limited;
+    /* Frames left out of the capture because its writer fell behind. */
+    unsigned long capture_dropped;
+    /* Results that waited for room in a full sink. */
+    unsigned long sink_stalls;
+    /* Indexed by enum TEST_RESULT, so timeouts are results[TEST_RESULT_TIMEOUT]. */
+    unsigned long results[SYNFRAG_RESULT_MAX];
+    unsigned long in_flight;
+    unsigned long kernel_received;
+    unsigned long kernel_dropped;
+    unsigned long interface_dropped;
+};
+
+typedef void (*synfrag_result_cb)( const struct synfrag_result *, void * );
+/*
+ * Fills in the next probe to send and returns 1, or returns 0 once there are
+ * no more. The probe starts out zeroed, and what it points to only has to
+ * last until the next call.
+ */
+typedef int (*synfrag_probe_gen)( struct synfrag_probe *, void * );
+
+/*
+ * Stands in for the network behind the loopback backend. Given a frame that
+ * was sent, write the frame received in reply into reply and return its
+ * length, or return 0 for no reply.
+ */
+typedef unsigned int (*synfrag_responder)( void *arg, const char *frame, unsigned int len, char *reply, unsigned int reply_size );
+
+struct synfrag_config {
+    enum SYNFRAG_BACKEND backend;
+    /* Required for the pcap, packet and xdp backends. */
+    const char *interface;
+    /* Required. */
+    const char *srcip;
+    /* Next-hop MAC every frame is addressed to; optional without an interface. */
+    const char *dstmac;
+    /* For the savefile backend: where replies come from and sent frames go. */
+    const char *savefile;
+    const char *dumpfile;
+    unsigned int xdp_queue;
+    int backend_flags;
+    /* For the loopback backend; NULL for a host that answers every probe. */
+    synfrag_responder responder;
+    void *responder_arg;
+    /*
+     * For the sim backend, comma separated settings, NULL for defaults:
+     * loss=P (or P%), rtt=MS, jitter=MS, tail=P:MS, icmp-rate=N,
+     * host-icmp-rate=N:B, seed=N, hops=N, reassembly=N and
+     * PREFIX/LEN=pass|no-reassembly|drop-short-frags[:N]|drop-frags|
+     * drop-optioned|drop-all. See io.h for the details.
+     */
+    const char *sim;
+};
+
+/*
+ * Open a context as described by config, which need not outlive the call.
+ * errbuf (SYNFRAG_ERRBUF_SIZE bytes) receives the reason if this fails.
+ */
+int synfrag_open_config( struct synfrag_ctx **, const struct synfrag_config *, char *errbuf );
+/* The same with pcap on interface, sending as srcip to next-hop MAC dstmac. */
+int synfrag_open( struct synfrag_ctx **, const char *interface, const char *srcip, const char *dstmac, char *errbuf );
+void synfrag_close( struct synfrag_ctx * );
+
+/* Print every frame sent and every reply received to stdout. */
+void synfrag_set_verbose( struct synfrag_ctx *, int );
+/* Only while no probes are in flight. */
+int synfrag_set_timeout( struct synfrag_ctx *, long seconds );
+/* Only while no probes are in flight. */
+int synfrag_set_max_in_flight( struct synfrag_ctx *, unsigned int );
+/*
+ * Hosts and routers rate limit the ICMP they send any one peer (Linux: one
+ * error a second after a burst of six), so a quick run of ICMP probes to one
+ * target mostly times out. This spaces ICMP probes to each target at most
+ * rate a second, after a first burst of up to burst at once. A probe over
+ * budget is accepted but waits in the engine, holding its slot, while other
+ * targets' probes go out; its timeout starts when it is sent. Probes with a
+ * ttl aren't paced. Targets that still look limited (see rate_limited) get
+ * half the rate and no burst. 0 turns pacing off, the default. Only while
+ * no probes are in flight.
+ */
+int synfrag_set_icmp_pace( struct synfrag_ctx *, double rate, unsigned int burst );
+
+/*
+ * A pcapng file of every frame sent and received by the contexts given it,
+ * each as an interface of its own called name (the backend's if NULL).
+ * Frames are copied to a ring and written by a thread of the capture's own,
+ * so the engine never waits on the disk; when the ring is full frames are
+ * left out and counted in capture_dropped. Frames sent and replies matched
+ * to a probe carry a comment: "probe 17 v4-frag-tcp" and "probe 17
+ * v4-frag-tcp reply closed, failed" (see synfrag_result.id). A probe with
+ * no commented reply timed out. Close the capture after every context using
+ * it. errbuf is as for synfrag_open_config().
+ */
+int synfrag_capture_open( struct synfrag_capture **, const char *path, char *errbuf );
+int synfrag_set_capture( struct synfrag_ctx *, struct synfrag_capture *, const char *name );
+int synfrag_capture_close( struct synfrag_capture *, char *errbuf );
+
+/* Build a probe and queue it for sending. */
+int synfrag_submit( struct synfrag_ctx *, const struct synfrag_probe * );
+/* Send everything queued now rather than waiting for a full batch. */
+int synfrag_transmit( struct synfrag_ctx * );
+/*
+ * Fill in the next completed result. Returns 1 if a result was returned, 0
+ * if there is nothing in flight (or, when wait is 0, nothing has completed
+ * yet) and a negative SYNFRAG_ERROR on failure.
+ */
+int synfrag_next_result( struct synfrag_ctx *, struct synfrag_result *, int wait );
+/*
+ * As synfrag_next_result() waiting, but returning 0 at until (by
+ * synfrag_now()) if nothing completes first, even with nothing in flight.
+ * For pacing probes.
+ */
+int synfrag_next_result_until( struct synfrag_ctx *, struct synfrag_result *, const struct timeval *until );
+/* The context's clock: the wall clock, or the simulated network's. */
+void synfrag_now( struct synfrag_ctx *, struct timeval * );
+/*
+ * Submit count probes, collecting results to make room as needed, and wait
+ * for all of them. cb is called once per probe.
+ */
+int synfrag_run( struct synfrag_ctx *, const struct synfrag_probe *, unsigned int count, synfrag_result_cb, void * );
+
+/*
+ * Where synfrag_run_pipelined() puts results: a ring any number of contexts
+ * on threads of their own may feed at once, drained by a thread of the
+ * sink's own that hands each result to cb, in the order they went in.
+ * Results are copied in, reply frames included, so cb may take its time;
+ * while the ring is full the engines feeding it wait, and count it in
+ * sink_stalls. Close the sink once every context feeding it is done; that
+ * waits for cb to have seen every result. errbuf is as for
+ * synfrag_open_config().
+ */
+int synfrag_sink_open( struct synfrag_sink **, synfrag_result_cb, void *, char *errbuf );
+void synfrag_sink_close( struct synfrag_sink * );
+/*
+ * synfrag_run() as a pipeline: gen runs on a thread of its own, up to a few
+ * thousand probes ahead through a ring, and results go to sink. On a live
+ * interface another thread drains the backend into a ring of raw frames, so
+ * the calling thread only sends, decodes and matches. Returns once every
+ * probe gen made is done, with the same values as synfrag_run(); replies
+ * still in the frame ring by then are dropped, as by synfrag_flush().
+ */
+int synfrag_run_pipelined( struct synfrag_ctx *, synfrag_probe_gen, void *, struct synfrag_sink * );
+/* Drop anything received before now (late replies to earlier probes). */
+void synfrag_flush( struct synfrag_ctx * );
+/* Forget every probe in flight without a result, after an error say. */
+void synfrag_abandon( struct synfrag_ctx * );
+unsigned int synfrag_in_flight( struct synfrag_ctx * );
+/*
+ * Unlike everything else this may be called from another thread while the
+ * context is in use, e.g. by a metrics exporter.
+ */
+void synfrag_get_stats( struct synfrag_ctx *, struct synfrag_stats * );
+/*
+ * Print the cycles spent per stage (build, checksum, inject, receive, match,
+ * wait). Only available when built with make PROFILE=1.
+ */
+int synfrag_profile_report( struct synfrag_ctx *, FILE * );
+
+const char *synfrag_geterr( struct synfrag_ctx * );
+const char *synfrag_strerror( int );
+
+/* Test names, as accepted on the command line. */
+enum TEST_TYPE synfrag_test_by_name( const char * );
+const char *synfrag_test_name( enum TEST_TYPE );
+/* Iterate over all test types; returns TEST_INVALID past the end. */
+enum TEST_TYPE synfrag_test_by_index( int );
+/* AF_INET or AF_INET6, AF_UNSPEC for an unknown test. */
+int synfrag_test_family( enum TEST_TYPE );
+/* Whether the test sends a SYN (and needs a dstport), rather than an echo request. */
+int synfrag_test_is_tcp( enum TEST_TYPE );
+/*
+ * The unfragmented test of the same family and protocol, which a fragment
+ * test is measured against: TEST_INVALID if test_type is one itself.
+ */
+enum TEST_TYPE synfrag_test_baseline( enum TEST_TYPE );
+/*
+ * How long a fragment test's first fragment is, IP header on, shaped by
+ * frag_data and frag_options as in struct synfrag_probe; -1 if the test
+ * can't take that shape. Never more than IPv6's minimum MTU.
+ */
+int synfrag_first_fragment_size( enum TEST_TYPE, unsigned short frag_data, unsigned short frag_options );
+const char *synfrag_result_name( enum TEST_RESULT );
+const char *synfrag_reply_type_name( enum REPLY_TYPE );
+
+#endif
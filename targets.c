@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "targets.h"
+
+static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+static int is_space( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* One more than each hex digit's value, 0 for anything else. */
+static const unsigned char hex_value[256] = {
+    ['0'] = 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+    ['A'] = 11, 12, 13, 14, 15, 16,
+    ['a'] = 11, 12, 13, 14, 15, 16
+};
+
+int targets_pton4( const char *src, size_t len, unsigned char *dst )
+{
+    const char *end = src + len;
+    unsigned char tmp[4];
+    unsigned int octets = 0, value, digits;
+
+    while ( 1 ) {
+        value = digits = 0;
+        while ( src < end && *src >= '0' && *src <= '9' ) {
+            /* No leading zeros, and nothing past 255. */
+            if ( digits && value == 0 ) return 0;
+            value = value * 10 + ( *src++ - '0' );
+            if ( value > 255 ) return 0;
+            digits++;
+        }
+        if ( !digits ) return 0;
+        tmp[octets++] = value;
+        if ( octets == 4 ) break;
+        if ( src == end || *src++ != '.' ) return 0;
+    }
+    if ( src != end ) return 0;
+    memcpy( dst, tmp, 4 );
+    return 1;
+}
+
+int targets_pton6( const char *src, size_t len, unsigned char *dst )
+{
+    const char *end = src + len, *group;
+    unsigned char tmp[16];
+    unsigned int n = 0, value = 0, digits = 0;
+    int gap = -1, d;
+
+    memset( tmp, 0, sizeof( tmp ) );
+    /* A leading colon only as the start of a ::. */
+    if ( src < end && *src == ':' && ( ++src == end || *src != ':' ) ) return 0;
+    group = src;
+    while ( src < end ) {
+        if ( ( d = hex_value[(unsigned char) *src] ) ) {
+            if ( ++digits > 4 ) return 0;
+            value = value << 4 | ( d - 1 );
+            src++;
+        } else if ( *src == ':' ) {
+            group = ++src;
+            if ( !digits ) {
+                if ( gap != -1 ) return 0;
+                gap = n;
+                continue;
+            }
+            if ( src == end || n == 16 ) return 0;
+            tmp[n++] = value >> 8;
+            tmp[n++] = value;
+            value = digits = 0;
+        } else if ( *src == '.' && n <= 12 && targets_pton4( group, end - group, tmp + n ) ) {
+            /* A trailing dotted quad is the last 32 bits. */
+            n += 4;
+            digits = 0;
+            break;
+        } else {
+            return 0;
+        }
+    }
+    if ( digits ) {
+        if ( n == 16 ) return 0;
+        tmp[n++] = value >> 8;
+        tmp[n++] = value;
+    }
+    if ( gap != -1 ) {
+        /* :: stands for at least one group of zeros. */
+        if ( n == 16 ) return 0;
+        memmove( tmp + 16 - ( n - gap ), tmp + gap, n - gap );
+        memset( tmp + gap, 0, 16 - n );
+        n = 16;
+    }
+    if ( n != 16 ) return 0;
+    memcpy( dst, tmp, 16 );
+    return 1;
+}
+
+static char *put_decimal( char *p, unsigned int value )
+{
+    if ( value >= 100 ) *p++ = '0' + value / 100;
+    if ( value >= 10 ) *p++ = '0' + value / 10 % 10;
+    *p++ = '0' + value % 10;
+    return p;
+}
+
+/* An address as inet_ntop() has it, which is what journal keys are made of. */
+static void format_addr( int family, const unsigned char *addr, char *dst )
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned int words[8], x, best = 0, best_len = 0, run = 0, shift;
+    char *p = dst;
+
+    if ( family == AF_INET6 ) {
+        for ( x = 0; x < 8; x++ ) {
+            words[x] = addr[x * 2] << 8 | addr[x * 2 + 1];
+            run = words[x] ? 0 : run + 1;
+            if ( run > best_len ) {
+                best = x + 1 - run;
+                best_len = run;
+            }
+        }
+        /* Only a run of two or more groups becomes ::. */
+        if ( best_len < 2 ) best_len = 0;
+        for ( x = 0; x < 8; x++ ) {
+            if ( best_len && x == best ) {
+                *p++ = ':';
+                if ( x + best_len == 8 ) *p++ = ':';
+                x += best_len - 1;
+                continue;
+            }
+            if ( x ) *p++ = ':';
+            /* IPv4-compatible and -mapped addresses end in a dotted quad. */
+            if ( x == 6 && best == 0 && ( best_len == 6 || ( best_len == 5 && words[5] == 0xffff ) ) ) {
+                addr += 12;
+                break;
+            }
+            for ( shift = 12; shift && !( words[x] >> shift ); shift -= 4 );
+            for ( ; shift; shift -= 4 ) *p++ = hex[words[x] >> shift & 15];
+            *p++ = hex[words[x] & 15];
+        }
+        if ( x == 8 ) {
+            *p = '\0';
+            return;
+        }
+    }
+    p = put_decimal( p, addr[0] );
+    *p++ = '.';
+    p = put_decimal( p, addr[1] );
+    *p++ = '.';
+    p = put_decimal( p, addr[2] );
+    *p++ = '.';
+    p = put_decimal( p, addr[3] );
+    *p = '\0';
+}
+
+/* Split a line of a text list into a target. Returns 1, 0 if there is none on it, or -1 with errno set. */
+static int parse_line( const char *p, const char *end, struct target *target )
+{
+    const char *token;
+    unsigned int value;
+    size_t len;
+
+    while ( p < end && is_space( *p ) ) p++;
+    if ( p == end || *p == '#' ) return 0;
+    token = p;
+    while ( p < end && !is_space( *p ) ) p++;
+    len = p - token;
+    target->family = 0;
+    if ( memchr( token, ':', len ) ) {
+        if ( targets_pton6( token, len, target->addr ) ) target->family = AF_INET6;
+    } else if ( targets_pton4( token, len, target->addr ) ) {
+        target->family = AF_INET;
+    }
+    if ( target->family ) {
+        format_addr( target->family, target->addr, target->dstip );
+    } else {
+        if ( len >= INET6_ADDRSTRLEN ) len = INET6_ADDRSTRLEN - 1;
+        memcpy( target->dstip, token, len );
+        target->dstip[len] = '\0';
+    }
+
+    target->port_count = 0;
+    while ( 1 ) {
+        while ( p < end && is_space( *p ) ) p++;
+        if ( p == end ) return 1;
+        if ( target->port_count == TARGETS_PORTS_MAX ) {
+            errno = E2BIG;
+            return -1;
+        }
+        token = p;
+        value = 0;
+        while ( p < end && *p >= '0' && *p <= '9' && value <= 65535 ) value = value * 10 + ( *p++ - '0' );
+        if ( p == token || value == 0 || value > 65535 || ( p < end && !is_space( *p ) ) ) {
+            errno = EINVAL;
+            return -1;
+        }
+        target->ports[target->port_count++] = value;
+    }
+}
+
+/*
+ * The next target of a compiled list. A target's records are one after
+ * another, one per dstport, or a single one with port 0 if it had none.
+ */
+static int next_record( struct targets *t, struct target *target )
+{
+    const struct targets_record *record;
+
+    if ( t->next == t->count ) return 0;
+    record = &t->records[t->next++];
+    if ( record->family == AF_INET || ( !record->family && memcmp( record->addr, mapped, sizeof( mapped ) ) == 0 ) ) {
+        target->family = AF_INET;
+        memcpy( target->addr, record->addr + 12, 4 );
+    } else {
+        target->family = AF_INET6;
+        memcpy( target->addr, record->addr, 16 );
+    }
+    format_addr( target->family, target->addr, target->dstip );
+    target->line = ++t->line_number;
+    target->port_count = 0;
+    if ( !record->port ) return 1;
+    target->ports[target->port_count++] = record->port;
+    while ( t->next < t->count && target->port_count < TARGETS_PORTS_MAX && t->records[t->next].port &&
+        t->records[t->next].family == record->family && memcmp( t->records[t->next].addr, record->addr, 16 ) == 0 ) {
+        target->ports[target->port_count++] = t->records[t->next++].port;
+    }
+    return 1;
+}
+
+int targets_open( struct targets *t, const char *path )
+{
+    struct stat st;
+    void *p;
+    int e;
+
+    memset( t, 0, sizeof( struct targets ) );
+    t->fd = -1;
+    if ( strcmp( path, "-" ) == 0 ) {
+        t->in = stdin;
+        return 0;
+    }
+    if ( ( t->fd = open( path, O_RDONLY ) ) == -1 ) return -1;
+    if ( fstat( t->fd, &st ) == -1 ) goto fail;
+    /* Pipes and the like can't be mapped, so are read as they come. */
+    if ( !S_ISREG( st.st_mode ) ) {
+        if ( ( t->in = fdopen( t->fd, "r" ) ) == NULL ) goto fail;
+        t->fd = -1;
+        return 0;
+    }
+    if ( st.st_size == 0 ) return 0;
+    if ( ( p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, t->fd, 0 ) ) == MAP_FAILED ) goto fail;
+    t->map = p;
+    t->map_size = st.st_size;
+    madvise( p, t->map_size, MADV_SEQUENTIAL );
+    if ( t->map_size >= sizeof( struct targets_header ) && memcmp( t->map, TARGETS_MAGIC, 8 ) == 0 ) {
+        t->count = ( (const struct targets_header *) t->map )->count;
+        if ( t->count != ( t->map_size - sizeof( struct targets_header ) ) / sizeof( struct targets_record ) ||
+            ( t->map_size - sizeof( struct targets_header ) ) % sizeof( struct targets_record ) ) {
+            errno = EINVAL;
+            goto fail;
+        }
+        t->records = (const struct targets_record *) ( t->map + sizeof( struct targets_header ) );
+    }
+    return 0;
+
+fail:
+    e = errno;
+    targets_close( t );
+    errno = e;
+    return -1;
+}
+
+int targets_create( struct targets *t, const char *path )
+{
+    struct targets_header header;
+    char magic[8];
+    int e;
+
+    memset( t, 0, sizeof( struct targets ) );
+    if ( ( t->fd = open( path, O_RDWR | O_CREAT, 0644 ) ) == -1 ) return -1;
+    /* Replace an old compiled list, but not some other file named by mistake. */
+    if ( pread( t->fd, magic, sizeof( magic ), 0 ) > 0 && memcmp( magic, TARGETS_MAGIC, sizeof( magic ) ) != 0 ) {
+        errno = EEXIST;
+        goto fail;
+    }
+    if ( ftruncate( t->fd, 0 ) == -1 ) goto fail;
+    if ( ( t->out = fdopen( t->fd, "w" ) ) == NULL ) goto fail;
+    /* Counted once finished, so one cut short doesn't read as a list. */
+    memcpy( header.magic, TARGETS_MAGIC, sizeof( header.magic ) );
+    header.count = UINT64_MAX;
+    if ( fwrite( &header, sizeof( header ), 1, t->out ) != 1 ) goto fail;
+    return 0;
+
+fail:
+    e = errno;
+    if ( t->out ) {
+        fclose( t->out );
+    } else {
+        close( t->fd );
+    }
+    memset( t, 0, sizeof( struct targets ) );
+    t->fd = -1;
+    errno = e;
+    return -1;
+}
+
+int targets_next( struct targets *t, struct target *target )
+{
+    const char *line, *end;
+    ssize_t len;
+    int r;
+
+    if ( t->records ) return next_record( t, target );
+    do {
+        if ( t->in ) {
+            if ( ( len = getline( &t->line, &t->line_size, t->in ) ) == -1 ) return ferror( t->in ) ? -1 : 0;
+            line = t->line;
+            end = line + len;
+        } else {
+            if ( t->offset == t->map_size ) return 0;
+            line = t->map + t->offset;
+            if ( ( end = memchr( line, '\n', t->map_size - t->offset ) ) == NULL ) end = t->map + t->map_size;
+            t->offset = end - t->map;
+            if ( t->offset < t->map_size ) t->offset++;
+        }
+        target->line = ++t->line_number;
+        r = parse_line( line, end, target );
+    } while ( r == 0 );
+    return r;
+}
+
+int targets_add( struct targets *t, const struct target *target )
+{
+    struct targets_record record;
+    unsigned int x = 0;
+
+    memset( &record, 0, sizeof( record ) );
+    record.family = target->family;
+    if ( target->family == AF_INET ) {
+        memcpy( record.addr, mapped, sizeof( mapped ) );
+        memcpy( record.addr + 12, target->addr, 4 );
+    } else {
+        memcpy( record.addr, target->addr, 16 );
+    }
+    do {
+        record.port = target->port_count ? target->ports[x] : 0;
+        if ( fwrite( &record, sizeof( record ), 1, t->out ) != 1 ) return -1;
+        t->count++;
+    } while ( ++x < target->port_count );
+    return 0;
+}
+
+int targets_close( struct targets *t )
+{
+    int ret = 0, e = 0;
+
+    if ( t->out ) {
+        if ( fflush( t->out ) == EOF ||
+            pwrite( t->fd, &t->count, sizeof( t->count ), offsetof( struct targets_header, count ) ) != sizeof( t->count ) ) {
+            ret = -1;
+            e = errno;
+        }
+        if ( fclose( t->out ) == EOF && ret == 0 ) {
+            ret = -1;
+            e = errno;
+        }
+    } else {
+        if ( t->map ) munmap( (void *) t->map, t->map_size );
+        if ( t->fd != -1 ) close( t->fd );
+        if ( t->in && t->in != stdin ) fclose( t->in );
+    }
+    free( t->line );
+    memset( t, 0, sizeof( struct targets ) );
+    t->fd = -1;
+    errno = e;
+    return ret;
+}
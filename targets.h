@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2012, Yahoo! Inc All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.  Redistributions
+ *     in binary form must reproduce the above copyright notice, this list
+ *     of conditions and the following disclaimer in the documentation and/or
+ *     other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author: John Eaglesham
+ */
+
+
+
+#ifndef TARGETS_H
+#define TARGETS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+ * --compare's target lists. A text list that is a file is mapped whole and
+ * parsed where it lies, one pass over each line and no inet_pton(); one on a
+ * pipe is read a line at a time. A compiled list is a header and then a
+ * record per pair, ready to use as mapped: the same targets, with nothing
+ * left to parse. Records are in host byte order.
+ */
+
+#define TARGETS_MAGIC "synfragT"
+/* Most dstports one line can list. */
+#define TARGETS_PORTS_MAX 1024
+
+struct targets_header {
+    char magic[8];
+    uint64_t count;
+};
+
+struct targets_record {
+    /* IPv4 addresses are IPv4-mapped, ::ffff:a.b.c.d. */
+    unsigned char addr[16];
+    /* 0 if the line listed none. */
+    uint16_t port;
+    /* AF_INET or AF_INET6, telling a.b.c.d from ::ffff:a.b.c.d; 0 in lists from before it was kept. */
+    uint16_t family;
+};
+
+/* A line of a list: a target and the dstports given with it. */
+struct target {
+    /* AF_INET or AF_INET6, or 0 if dstip isn't an address. */
+    int family;
+    /* As inet_pton() would have it for family. */
+    unsigned char addr[16];
+    /*
+     * As inet_ntop() has it, however it was written, so journal keys match
+     * between a text list and its compiled one. As written if it isn't an
+     * address.
+     */
+    char dstip[INET6_ADDRSTRLEN];
+    unsigned short ports[TARGETS_PORTS_MAX];
+    unsigned int port_count;
+    /* Line of a text list, or target of a compiled one, from 1. */
+    unsigned long line;
+};
+
+struct targets {
+    /* Reading a pipe: a line at a time into line. */
+    FILE *in;
+    char *line;
+    size_t line_size;
+    /* Reading a file: the whole of it, and how far in we are. */
+    int fd;
+    const char *map;
+    size_t map_size;
+    size_t offset;
+    /* Reading a compiled list: its records; writing one: the records written. */
+    const struct targets_record *records;
+    uint64_t count;
+    uint64_t next;
+    FILE *out;
+    unsigned long line_number;
+};
+
+/*
+ * Open the list at path ("-" for stdin) to read, text or compiled, or start
+ * a compiled one to write. Both return 0, or -1 with errno set.
+ */
+int targets_open( struct targets *, const char *path );
+int targets_create( struct targets *, const char *path );
+/*
+ * Read the next target, skipping blank lines and ones starting with #.
+ * Returns 1, 0 at the end of the list, or -1 with errno set: EINVAL if a
+ * dstport isn't one, E2BIG if there are too many, where line says.
+ */
+int targets_next( struct targets *, struct target * );
+/* Write a record for each of a target's dstports. Returns 0, or -1 with errno set. */
+int targets_add( struct targets *, const struct target * );
+/* Finish a compiled list being written, and close. Returns 0, or -1 with errno set. */
+int targets_close( struct targets * );
+
+/*
+ * Parse len characters of text as an address, as inet_pton() would but
+ * without needing them terminated. Return 1 if they are one, 0 if not.
+ */
+int targets_pton4( const char *src, size_t len, unsigned char *dst );
+int targets_pton6( const char *src, size_t len, unsigned char *dst );
+
+#endif